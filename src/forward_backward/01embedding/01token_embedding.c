@@ -1,13 +1,12 @@
 #include "01token_embedding.h"
 #include "lookup.h"
-#include "model_config.h"
 #include <stdio.h>
 #include <stdlib.h>
 
 // 创建Token嵌入结构
-// embedding_matrix tensor shape: [batch_size, vocab_size, embedding_dim], embedding_dim is the same as encoding_dim, d_model
+// embedding_matrix tensor shape: [vocab_size, embedding_dim], embedding_dim is the same as encoding_dim, d_model
 TokenEmbedding* token_embedding_create(int vocab_size, int embedding_dim) {
-    TokenEmbedding* token_emb = (TokenEmbedding*)malloc(sizeof(TokenEmbedding));
+    TokenEmbedding* token_emb = (TokenEmbedding*)calloc(1, sizeof(TokenEmbedding));
     if (!token_emb) {
         fprintf(stderr, "Failed to allocate memory for token embedding\n");
         return NULL;
@@ -16,13 +15,11 @@ TokenEmbedding* token_embedding_create(int vocab_size, int embedding_dim) {
     // 初始化基本参数
     token_emb->vocab_size = vocab_size;
     token_emb->embedding_dim = embedding_dim;
+    token_emb->scale = 1.0f;
 
-    // 获取batch_size
-    const int batch_size = g_model_config.batch_size;
-
-    // 创建嵌入矩阵张量 [batch_size, vocab_size, embedding_dim]
-    int shape[] = {batch_size, vocab_size, embedding_dim};
-    token_emb->embedding_matrix = tensor_create(shape, 3);
+    // 创建嵌入矩阵张量 [vocab_size, embedding_dim], 与batch_size无关
+    int shape[] = {vocab_size, embedding_dim};
+    token_emb->embedding_matrix = tensor_create(shape, 2);
     if (!token_emb->embedding_matrix) {
         free(token_emb);
         return NULL;
@@ -31,9 +28,10 @@ TokenEmbedding* token_embedding_create(int vocab_size, int embedding_dim) {
     return token_emb;
 }
 
-void free_token_embedding(TokenEmbedding* token_emb) {
+void token_embedding_free(TokenEmbedding* token_emb) {
     if (token_emb) {
         tensor_free(token_emb->embedding_matrix);
+        tensor_free(token_emb->grad_embedding);
         free(token_emb);
     }
 }
@@ -62,7 +60,8 @@ bool token_embedding_forward(const TokenEmbedding* embedding, const Tensor* toke
         return false;
     }
 
-    return perform_embedding_lookup(embedding->embedding_matrix, tokens, output, batch_size, seq_length, embedding_dim);
+    return perform_embedding_lookup(embedding->embedding_matrix, tokens, (long)batch_size * seq_length,
+                                    embedding->scale, NULL, output);
 }
 
 
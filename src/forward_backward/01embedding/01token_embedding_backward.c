@@ -1,4 +1,5 @@
 #include "01token_embedding_backward.h"
+#include <stdio.h>
 
 bool token_embedding_backward(
     TokenEmbedding* embedding,
@@ -22,10 +23,10 @@ bool token_embedding_backward(
         return false;
     }
 
-    // 创建梯度累积张量（如果还没有）
+    // 创建梯度累积张量（如果还没有）, 与嵌入矩阵同形状 [vocab_size, embedding_dim]
     if (!embedding->grad_embedding) {
-        int shape[] = {batch_size, embedding->vocab_size, embedding_dim};
-        embedding->grad_embedding = tensor_create(shape, 3);
+        int shape[] = {embedding->vocab_size, embedding_dim};
+        embedding->grad_embedding = tensor_create(shape, 2);
         if (!embedding->grad_embedding) {
             return false;
         }
@@ -44,14 +45,11 @@ bool token_embedding_backward(
                 return false;
             }
 
-            // 累积梯度到对应的embedding向量
+            // 累积梯度到对应的embedding向量, 所有batch共用同一行; 前向乘过scale, 梯度也乘scale
+            const float* grad = grad_output->data + ((long)b * seq_length + s) * embedding_dim;
+            float* dst = embedding->grad_embedding->data + (long)token_id * embedding_dim;
             for (int d = 0; d < embedding_dim; d++) {
-                int grad_idx = (b * seq_length * embedding_dim) + 
-                             (s * embedding_dim) + d;
-                int emb_idx = (b * embedding->vocab_size * embedding_dim) + 
-                             (token_id * embedding_dim) + d;
-                
-                embedding->grad_embedding->data[emb_idx] += grad_output->data[grad_idx];
+                dst[d] += embedding->scale * grad[d];
             }
         }
     }
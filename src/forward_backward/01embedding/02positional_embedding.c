@@ -1,8 +1,8 @@
 #include "02positional_embedding.h"
 #include "position_lookup.h"
-#include "tensor_add.h"
-#include "model_config.h"
+#include "cpu_dispatch.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 
 // 创建位置编码结构
@@ -17,18 +17,17 @@ PositionalEncoding* positional_encoding_create(int max_seq_length, int encoding_
     // 初始化基本参数
     pos_enc->max_seq_length = max_seq_length;
     pos_enc->encoding_dim = encoding_dim;
-    const int batch_size = g_model_config.batch_size;
 
-    // 创建位置编码张量 [batch_size, max_seq_length, encoding_dim]
-    int shape[] = {batch_size, max_seq_length, encoding_dim};
-    pos_enc->encodings = tensor_create(shape, 3);
+    // 创建位置编码张量 [max_seq_length, encoding_dim], 所有batch共用
+    int shape[] = {max_seq_length, encoding_dim};
+    pos_enc->encodings = tensor_create(shape, 2);
     if (!pos_enc->encodings) {
         free(pos_enc);
         return NULL;
     }
 
     // 计算位置编码
-    if (!compute_positional_encodings(pos_enc->encodings, batch_size, max_seq_length, encoding_dim)) {
+    if (!compute_positional_encodings(pos_enc->encodings, max_seq_length, encoding_dim)) {
         tensor_free(pos_enc->encodings);
         free(pos_enc);
         return NULL;
@@ -62,11 +61,42 @@ bool positional_encoding_forward(const PositionalEncoding* pos_enc, Tensor* inpu
         return false;
     }
 
-    // 确保序列长度不超过最大长度
     if (seq_length > pos_enc->max_seq_length) {
-        seq_length = pos_enc->max_seq_length;
+        fprintf(stderr, "Sequence length %d exceeds the positional encoding table (%d)\n",
+                seq_length, pos_enc->max_seq_length);
+        return false;
+    }
+
+    // 表的前seq_length行是连续的, 每个batch一次加完
+    const SimdKernels* kernels = simd_kernels();
+    long rows_size = (long)seq_length * encoding_dim;
+    for (int b = 0; b < batch_size; b++) {
+        float* rows = input->data + b * rows_size;
+        kernels->add(rows, pos_enc->encodings->data, rows, rows_size);
+    }
+    return true;
+}
+
+// 打包变长batch的位置编码: input是各序列首尾相接的[1, total_tokens, encoding_dim],
+// 每个序列的位置都从0开始
+bool positional_encoding_forward_ragged(const PositionalEncoding* pos_enc, Tensor* input,
+                                        const RaggedBatch* batch) {
+    if (input->num_dims != 3 || input->shape[0] != 1 || input->shape[1] != batch->total_tokens ||
+        input->shape[2] != pos_enc->encoding_dim || !tensor_is_contiguous(input)) {
+        fprintf(stderr, "Packed input must be [1, total_tokens, encoding_dim]\n");
+        return false;
+    }
+    if (batch->max_seq_len > pos_enc->max_seq_length) {
+        fprintf(stderr, "Sequence longer than the positional encoding table\n");
+        return false;
     }
 
-    // 使用tensor_add直接进行张量加法
-    return tensor_add(input, pos_enc->encodings, input);
+    int dim = pos_enc->encoding_dim;
+    const SimdKernels* kernels = simd_kernels();
+    for (int i = 0; i < batch->num_seqs; i++) {
+        int len = ragged_batch_seq_len(batch, i);
+        float* rows = input->data + (size_t)batch->cu_seqlens[i] * dim;
+        kernels->add(rows, pos_enc->encodings->data, rows, (size_t)len * dim);
+    }
+    return true;
 }
\ No newline at end of file
@@ -2,13 +2,16 @@
 // first by implementing the token embedding layer, then the positional encoding layer, 
 // and finally the transformer embedding layer by adding their outputs together
 #include "03transformer_embedding.h"
-#include "model_config.h"
+#include "lookup.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 
 TransformerEmbedding* transformer_embedding_create(
     int vocab_size, 
     int embedding_dim, 
-    int max_seq_length
+    int max_seq_length,
+    bool scale_embeddings
 ) {
     TransformerEmbedding* trans_emb = (TransformerEmbedding*)malloc(sizeof(TransformerEmbedding));
     if (!trans_emb) {
@@ -21,11 +24,14 @@ TransformerEmbedding* transformer_embedding_create(
         free(trans_emb);
         return NULL;
     }
+    if (scale_embeddings) {
+        trans_emb->token_embedding->scale = sqrtf((float)embedding_dim);
+    }
 
     // 创建位置编码
     trans_emb->positional_encoding = positional_encoding_create(max_seq_length, embedding_dim);
     if (!trans_emb->positional_encoding) {
-        free_token_embedding(trans_emb->token_embedding);
+        token_embedding_free(trans_emb->token_embedding);
         free(trans_emb);
         return NULL;
     }
@@ -35,13 +41,13 @@ TransformerEmbedding* transformer_embedding_create(
 
 void free_transformer_embedding(TransformerEmbedding* trans_emb) {
     if (trans_emb) {
-        free_token_embedding(trans_emb->token_embedding);
+        token_embedding_free(trans_emb->token_embedding);
         free_positional_encoding(trans_emb->positional_encoding);
         free(trans_emb);
     }
 }
 
-// transformer_embedding forward pass
+// transformer_embedding forward pass, 查表、缩放和位置编码一次写出
 // input tokens shape: [batch_size, seq_length]
 // output tensor shape: [batch_size, seq_length, embedding_dim]
 bool transformer_embedding_forward(
@@ -49,17 +55,45 @@ bool transformer_embedding_forward(
     const Tensor* tokens,
     Tensor* output
 ) {
-    // 执行token嵌入
-    if (!token_embedding_forward(trans_emb->token_embedding, tokens, output)) {
+    const TokenEmbedding* token_emb = trans_emb->token_embedding;
+    if (tokens->num_dims != 2 || output->num_dims != 3 ||
+        output->shape[0] != tokens->shape[0] || output->shape[1] != tokens->shape[1] ||
+        output->shape[2] != token_emb->embedding_dim) {
+        fprintf(stderr, "Tokens must be [batch_size, seq_length] and output [batch_size, seq_length, %d]\n",
+                token_emb->embedding_dim);
         return false;
     }
-    
-    // 添加位置编码
-    if (!positional_encoding_forward(trans_emb->positional_encoding, output)) {
+
+    EmbeddingPositions positions = {
+        .table = trans_emb->positional_encoding->encodings,
+        .seq_length = tokens->shape[1],
+    };
+    return perform_embedding_lookup(token_emb->embedding_matrix, tokens,
+                                    (long)tokens->shape[0] * tokens->shape[1],
+                                    token_emb->scale, &positions, output);
+}
+
+// 打包变长batch: tokens为[1, total_tokens], 嵌入逐token查表, 位置编码按序列从0开始
+bool transformer_embedding_forward_ragged(
+    const TransformerEmbedding* trans_emb,
+    const Tensor* tokens,
+    const RaggedBatch* batch,
+    Tensor* output
+) {
+    const TokenEmbedding* token_emb = trans_emb->token_embedding;
+    if (tokens->num_dims != 2 || tokens->shape[0] != 1 || tokens->shape[1] != batch->total_tokens ||
+        output->num_dims != 3 || output->shape[0] != 1 || output->shape[1] != batch->total_tokens ||
+        output->shape[2] != token_emb->embedding_dim || !tensor_is_contiguous(output)) {
+        fprintf(stderr, "Packed tokens must be [1, total_tokens] and output [1, total_tokens, %d]\n",
+                token_emb->embedding_dim);
         return false;
     }
 
-    // dropout for training
-    
-    return true;
-}
\ No newline at end of file
+    EmbeddingPositions positions = {
+        .table = trans_emb->positional_encoding->encodings,
+        .cu_seqlens = batch->cu_seqlens,
+        .num_seqs = batch->num_seqs,
+    };
+    return perform_embedding_lookup(token_emb->embedding_matrix, tokens, batch->total_tokens,
+                                    token_emb->scale, &positions, output);
+}
@@ -0,0 +1,313 @@
+#include "04vocab_head.h"
+#include "tensor_gemm.h"
+#include "tensor_arena.h"
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+VocabHead* vocab_head_create(int vocab_size, int model_dim) {
+    if (vocab_size <= 0 || model_dim <= 0) {
+        fprintf(stderr, "Invalid dimensions for vocabulary head\n");
+        return NULL;
+    }
+    VocabHead* head = (VocabHead*)malloc(sizeof(VocabHead));
+    if (!head) return NULL;
+
+    int shape[] = {vocab_size, model_dim};
+    head->weight = tensor_create(shape, 2);
+    if (!head->weight) {
+        free(head);
+        return NULL;
+    }
+    head->vocab_size = vocab_size;
+    head->model_dim = model_dim;
+    head->tied = false;
+    return head;
+}
+
+VocabHead* vocab_head_create_tied(TokenEmbedding* embedding) {
+    if (!embedding || !embedding->embedding_matrix) return NULL;
+    VocabHead* head = (VocabHead*)malloc(sizeof(VocabHead));
+    if (!head) return NULL;
+
+    head->weight = embedding->embedding_matrix;
+    head->vocab_size = embedding->vocab_size;
+    head->model_dim = embedding->embedding_dim;
+    head->tied = true;
+    return head;
+}
+
+// rows行隐藏状态(行步长lda)乘以W^T, 写入rows行连续的logits
+// B按[N, K]存储, 分块GEMM打包B时完成转置
+static void vocab_head_project(const VocabHead* head, const float* hidden, int rows, int lda, float* logits) {
+    gemm_f32(false, true, rows, head->vocab_size, head->model_dim, 1.0f,
+             hidden, lda, head->weight->data, head->model_dim,
+             0.0f, logits, head->vocab_size);
+}
+
+static bool vocab_head_check_hidden(const VocabHead* head, const Tensor* hidden) {
+    if (hidden->num_dims != 3 || hidden->shape[2] != head->model_dim || !tensor_is_contiguous(hidden)) {
+        fprintf(stderr, "Vocabulary head input must be contiguous [batch_size, seq_len, %d]\n", head->model_dim);
+        return false;
+    }
+    return true;
+}
+
+bool vocab_head_forward(const VocabHead* head, const Tensor* hidden, Tensor* logits) {
+    if (!head || !hidden || !logits || !vocab_head_check_hidden(head, hidden)) {
+        return false;
+    }
+    if (logits->num_dims != 3 || logits->shape[0] != hidden->shape[0] ||
+        logits->shape[1] != hidden->shape[1] || logits->shape[2] != head->vocab_size) {
+        fprintf(stderr, "Logits must be [batch_size, seq_len, %d]\n", head->vocab_size);
+        return false;
+    }
+    vocab_head_project(head, hidden->data, hidden->shape[0] * hidden->shape[1], head->model_dim, logits->data);
+    return true;
+}
+
+bool vocab_head_forward_last(const VocabHead* head, const Tensor* hidden, Tensor* logits) {
+    if (!head || !hidden || !logits || !vocab_head_check_hidden(head, hidden)) {
+        return false;
+    }
+    int batch_size = hidden->shape[0];
+    int seq_len = hidden->shape[1];
+    if (logits->num_dims != 2 || logits->shape[0] != batch_size || logits->shape[1] != head->vocab_size) {
+        fprintf(stderr, "Logits must be [batch_size, %d]\n", head->vocab_size);
+        return false;
+    }
+    if (seq_len == 0) {
+        fprintf(stderr, "Cannot take the last position of an empty sequence\n");
+        return false;
+    }
+
+    // 第b个序列的最后一行在(b * seq_len + seq_len - 1) * model_dim, 行步长seq_len * model_dim
+    const float* last = hidden->data + (long)(seq_len - 1) * head->model_dim;
+    vocab_head_project(head, last, batch_size, seq_len * head->model_dim, logits->data);
+    return true;
+}
+
+bool vocab_head_forward_ragged_last(const VocabHead* head, const Tensor* hidden,
+                                    const RaggedBatch* batch, Tensor* logits) {
+    if (!head || !hidden || !batch || !logits || !vocab_head_check_hidden(head, hidden)) {
+        return false;
+    }
+    int num_seqs = batch->num_seqs;
+    int dim = head->model_dim;
+    if (hidden->shape[0] != 1 || hidden->shape[1] != batch->total_tokens ||
+        logits->num_dims != 2 || logits->shape[0] != num_seqs || logits->shape[1] != head->vocab_size) {
+        fprintf(stderr, "Packed hidden must be [1, total_tokens, %d] and logits [num_seqs, %d]\n",
+                dim, head->vocab_size);
+        return false;
+    }
+
+    // 各序列最后一行的间隔不固定, 先收集到连续的临时张量
+    TensorArena* arena = tensor_arena_active();
+    size_t mark = tensor_arena_mark(arena);
+    int shape[] = {num_seqs, dim};
+    Tensor* last = tensor_create_scratch_uninit(shape, 2);
+    bool success = false;
+    if (!last) goto cleanup;
+    for (int i = 0; i < num_seqs; i++) {
+        if (ragged_batch_seq_len(batch, i) == 0) {
+            fprintf(stderr, "Cannot take the last position of empty sequence %d\n", i);
+            goto cleanup;
+        }
+        memcpy(last->data + (long)i * dim, hidden->data + (long)(batch->cu_seqlens[i + 1] - 1) * dim,
+               dim * sizeof(float));
+    }
+    vocab_head_project(head, last->data, num_seqs, dim, logits->data);
+    success = true;
+
+cleanup:
+    tensor_free(last);
+    tensor_arena_release(arena, mark);
+    return success;
+}
+
+// 一块logits [rows, cols]上逐行的交叉熵计算, 第一列是词表中的第col0个token
+typedef struct {
+    const SimdKernels* kernels;
+    float* logits;          // [rows, cols], 原地计算
+    int cols;
+    int col0;
+    const float* targets;   // [rows]
+    float* row_max;         // 在线log-sum-exp的状态
+    float* row_sum;
+    float* target_logit;
+    const float* lse;       // 第二遍使用, 每行最终的log-sum-exp
+    float grad_scale;       // 1 / 有效token数
+} VocabCrossEntropyCtx;
+
+// 第一遍: 合并本块的最大值和指数和, 记下落在本块中的目标logit
+static void vocab_ce_lse_range(void* arg, long begin, long end) {
+    const VocabCrossEntropyCtx* ctx = (const VocabCrossEntropyCtx*)arg;
+    for (long r = begin; r < end; r++) {
+        float* row = ctx->logits + r * ctx->cols;
+        int target = (int)ctx->targets[r] - ctx->col0;
+        if (target >= 0 && target < ctx->cols) {
+            ctx->target_logit[r] = row[target];
+        }
+        float block_max = ctx->kernels->scale_mask_max_row(row, row, ctx->cols, 1.0f, NULL, 0.0f);
+        float new_max = block_max > ctx->row_max[r] ? block_max : ctx->row_max[r];
+        float sum = ctx->kernels->exp_sum_row(row, ctx->cols, new_max);
+        ctx->row_sum[r] = ctx->row_sum[r] * expf(ctx->row_max[r] - new_max) + sum;
+        ctx->row_max[r] = new_max;
+    }
+}
+
+// 第二遍: logits原地变为d loss / d logits = (softmax - onehot) / 有效token数, padding行为0
+static void vocab_ce_grad_range(void* arg, long begin, long end) {
+    const VocabCrossEntropyCtx* ctx = (const VocabCrossEntropyCtx*)arg;
+    for (long r = begin; r < end; r++) {
+        float* row = ctx->logits + r * ctx->cols;
+        if (ctx->targets[r] < 0.0f) {
+            memset(row, 0, ctx->cols * sizeof(float));
+            continue;
+        }
+        ctx->kernels->exp_sum_row(row, ctx->cols, ctx->lse[r]);
+        ctx->kernels->scale(row, row, ctx->grad_scale, ctx->cols);
+        int target = (int)ctx->targets[r] - ctx->col0;
+        if (target >= 0 && target < ctx->cols) {
+            row[target] -= ctx->grad_scale;
+        }
+    }
+}
+
+bool vocab_head_cross_entropy(const VocabHead* head, const Tensor* hidden, const Tensor* targets,
+                              float* loss, Tensor* grad_hidden, Tensor* grad_weight) {
+    if (!head || !hidden || !targets || !loss || !vocab_head_check_hidden(head, hidden)) {
+        return false;
+    }
+    int vocab_size = head->vocab_size;
+    int dim = head->model_dim;
+    long tokens = (long)hidden->shape[0] * hidden->shape[1];
+    if (targets->num_dims != 2 || targets->shape[0] != hidden->shape[0] || targets->shape[1] != hidden->shape[1]) {
+        fprintf(stderr, "Targets must be [batch_size, seq_len]\n");
+        return false;
+    }
+    if (grad_hidden && (grad_hidden->num_dims != 3 || grad_hidden->shape[0] != hidden->shape[0] ||
+                        grad_hidden->shape[1] != hidden->shape[1] || grad_hidden->shape[2] != dim ||
+                        !tensor_is_contiguous(grad_hidden))) {
+        fprintf(stderr, "grad_hidden must match hidden\n");
+        return false;
+    }
+    if (grad_weight && (grad_weight->num_dims != 2 || grad_weight->shape[0] != vocab_size ||
+                        grad_weight->shape[1] != dim || !tensor_is_contiguous(grad_weight))) {
+        fprintf(stderr, "grad_weight must be a contiguous [%d, %d] tensor\n", vocab_size, dim);
+        return false;
+    }
+
+    // 有效token数决定损失和梯度的缩放, 先检查所有目标
+    long valid = 0;
+    for (long i = 0; i < tokens; i++) {
+        int target = (int)targets->data[i];
+        if (targets->data[i] < 0.0f) continue;
+        if (target >= vocab_size) {
+            fprintf(stderr, "Target id %d exceeds vocabulary size %d\n", target, vocab_size);
+            return false;
+        }
+        valid++;
+    }
+    *loss = 0.0f;
+    if (grad_hidden) {
+        memset(grad_hidden->data, 0, tokens * dim * sizeof(float));
+    }
+    if (valid == 0) return true;
+
+    TensorArena* arena = tensor_arena_active();
+    size_t mark = tensor_arena_mark(arena);
+    // 短序列或小词表只分配实际用到的行列
+    int max_rows = tokens < VOCAB_CE_ROWS ? (int)tokens : VOCAB_CE_ROWS;
+    int max_cols = vocab_size < VOCAB_CE_CHUNK ? vocab_size : VOCAB_CE_CHUNK;
+    int logits_shape[] = {max_rows, max_cols};
+    int state_shape[] = {4, max_rows};
+    Tensor* logits = tensor_create_scratch_uninit(logits_shape, 2);
+    Tensor* state = tensor_create_scratch_uninit(state_shape, 2);
+    bool success = false;
+    if (!logits || !state) goto cleanup;
+
+    float* row_max = state->data;
+    float* row_sum = row_max + max_rows;
+    float* target_logit = row_sum + max_rows;
+    float* lse = target_logit + max_rows;
+    const float* weight = head->weight->data;
+    bool need_grad = grad_hidden || grad_weight;
+    double loss_sum = 0.0;
+
+    VocabCrossEntropyCtx ctx = {
+        .kernels = simd_kernels(),
+        .logits = logits->data,
+        .row_max = row_max,
+        .row_sum = row_sum,
+        .target_logit = target_logit,
+        .lse = lse,
+        .grad_scale = 1.0f / valid,
+    };
+
+    for (long r0 = 0; r0 < tokens; r0 += VOCAB_CE_ROWS) {
+        int rows = (tokens - r0 < VOCAB_CE_ROWS) ? (int)(tokens - r0) : VOCAB_CE_ROWS;
+        const float* h = hidden->data + r0 * dim;
+        ctx.targets = targets->data + r0;
+        for (int r = 0; r < rows; r++) {
+            row_max[r] = -INFINITY;
+            row_sum[r] = 0.0f;
+        }
+
+        // 第一遍: 逐块logits = h * W_chunk^T, 在线合并log-sum-exp
+        for (int c0 = 0; c0 < vocab_size; c0 += VOCAB_CE_CHUNK) {
+            int cols = (vocab_size - c0 < VOCAB_CE_CHUNK) ? vocab_size - c0 : VOCAB_CE_CHUNK;
+            gemm_f32(false, true, rows, cols, dim, 1.0f, h, dim, weight + (long)c0 * dim, dim,
+                     0.0f, logits->data, cols);
+            ctx.cols = cols;
+            ctx.col0 = c0;
+            parallel_for(rows, 16, vocab_ce_lse_range, &ctx);
+        }
+        for (int r = 0; r < rows; r++) {
+            lse[r] = row_max[r] + logf(row_sum[r]);
+            if (ctx.targets[r] >= 0.0f) {
+                loss_sum += lse[r] - target_logit[r];
+            }
+        }
+        if (!need_grad) continue;
+
+        // 第二遍: 重新计算每块logits, 转为梯度后马上乘回
+        // grad_hidden += G * W_chunk, grad_weight[chunk] += G^T * h
+        for (int c0 = 0; c0 < vocab_size; c0 += VOCAB_CE_CHUNK) {
+            int cols = (vocab_size - c0 < VOCAB_CE_CHUNK) ? vocab_size - c0 : VOCAB_CE_CHUNK;
+            gemm_f32(false, true, rows, cols, dim, 1.0f, h, dim, weight + (long)c0 * dim, dim,
+                     0.0f, logits->data, cols);
+            ctx.cols = cols;
+            ctx.col0 = c0;
+            parallel_for(rows, 16, vocab_ce_grad_range, &ctx);
+            if (grad_hidden) {
+                gemm_f32(false, false, rows, dim, cols, 1.0f, logits->data, cols, weight + (long)c0 * dim, dim,
+                         1.0f, grad_hidden->data + r0 * dim, dim);
+            }
+            if (grad_weight) {
+                gemm_f32(true, false, cols, dim, rows, 1.0f, logits->data, cols, h, dim,
+                         1.0f, grad_weight->data + (long)c0 * dim, dim);
+            }
+        }
+    }
+    *loss = (float)(loss_sum / valid);
+    success = true;
+
+cleanup:
+    tensor_free(logits);
+    tensor_free(state);
+    tensor_arena_release(arena, mark);
+    return success;
+}
+
+void vocab_head_free(VocabHead* head) {
+    if (head) {
+        if (!head->tied) {
+            tensor_free(head->weight);
+        }
+        free(head);
+    }
+}
@@ -7,9 +7,11 @@ typedef struct TokenEmbedding TokenEmbedding;
 
 // Token嵌入结构
 struct TokenEmbedding {
-    Tensor* embedding_matrix;    // 嵌入矩阵 [batch_size, vocab_size, embedding_dim]
+    Tensor* embedding_matrix;    // 嵌入矩阵 [vocab_size, embedding_dim], 所有batch共用
+    Tensor* grad_embedding;      // 嵌入矩阵的梯度 [vocab_size, embedding_dim], 第一次反向传播时创建
     int vocab_size;             // 词汇表大小, number of unique tokens in the vocabulary dictionary
     int embedding_dim;          // 嵌入维度, d_model, number of features to represent a token, same as encoding_dim
+    float scale;                // 查到的嵌入向量乘以scale, 默认1, 可以设为sqrt(embedding_dim)
     // no need to store requires_grad, because token embedding need to be trained
 };
 
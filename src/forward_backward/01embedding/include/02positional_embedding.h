@@ -2,13 +2,14 @@
 #define POSITIONAL_ENCODING_H
 
 #include "tensor_type.h"
+#include "ragged_batch.h"
 #include <stdbool.h>
 
 typedef struct PositionalEncoding PositionalEncoding;
 
 // 位置编码结构
 struct PositionalEncoding {
-    Tensor* encodings;          // 位置编码矩阵 [batch_size, max_seq_length, encoding_dim]
+    Tensor* encodings;          // 位置编码矩阵 [max_seq_length, encoding_dim], 所有batch共用
     int max_seq_length;         // 最大序列长度, for sentence
     int encoding_dim;           // 编码维度, d_model, number of features to represent a position, same as embedding_dim
     // no need to store requires_grad, because it's a fixed value
@@ -17,6 +18,11 @@ struct PositionalEncoding {
 PositionalEncoding* positional_encoding_create(int max_seq_length, int encoding_dim);
 void free_positional_encoding(PositionalEncoding* pos_enc);
 
+// input: [batch_size, seq_length, encoding_dim], 原地加上前seq_length个位置的编码
 bool positional_encoding_forward(const PositionalEncoding* pos_enc, Tensor* input);
 
+// 打包变长batch: input为[1, total_tokens, encoding_dim], 每个序列的位置从0开始
+bool positional_encoding_forward_ragged(const PositionalEncoding* pos_enc, Tensor* input,
+                                        const RaggedBatch* batch);
+
 #endif // POSITIONAL_ENCODING_H
\ No newline at end of file
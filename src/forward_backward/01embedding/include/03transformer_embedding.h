@@ -13,9 +13,17 @@ struct TransformerEmbedding {
     PositionalEncoding* positional_encoding;  // 位置编码层
 };
 
-TransformerEmbedding* transformer_embedding_create(int vocab_size, int embedding_dim, int max_seq_length);
+// scale_embeddings为true时嵌入向量乘以sqrt(embedding_dim)之后再加位置编码
+TransformerEmbedding* transformer_embedding_create(int vocab_size, int embedding_dim, int max_seq_length,
+                                                   bool scale_embeddings);
 void free_transformer_embedding(TransformerEmbedding* transformer_embedding);
 
+// tokens: [batch_size, seq_length], output: [batch_size, seq_length, embedding_dim]
+// 一次并行遍历完成查表、缩放和位置编码
 bool transformer_embedding_forward(const TransformerEmbedding* trans_emb, const Tensor* tokens, Tensor* output);
 
+// 打包变长batch: tokens为[1, total_tokens], output为[1, total_tokens, embedding_dim]
+bool transformer_embedding_forward_ragged(const TransformerEmbedding* trans_emb, const Tensor* tokens,
+                                          const RaggedBatch* batch, Tensor* output);
+
 #endif // TRANSFORMER_EMBEDDING_H
\ No newline at end of file
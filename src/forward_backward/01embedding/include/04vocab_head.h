@@ -0,0 +1,58 @@
+#ifndef VOCAB_HEAD_H
+#define VOCAB_HEAD_H
+
+#include "01token_embedding.h"
+#include "ragged_batch.h"
+#include "tensor_type.h"
+#include <stdbool.h>
+
+typedef struct VocabHead VocabHead;
+
+// 融合交叉熵的分块大小: 每次处理VOCAB_CE_ROWS个token, 每块logits为[VOCAB_CE_ROWS, VOCAB_CE_CHUNK]
+#define VOCAB_CE_ROWS 1024
+#define VOCAB_CE_CHUNK 2048
+
+// 词表投影: logits = hidden * W^T, W按嵌入矩阵的布局[vocab_size, model_dim]存储
+// 与token嵌入共享权重时直接使用嵌入矩阵, GEMM按转置读取, 不复制也不另外分配
+struct VocabHead {
+    Tensor* weight;     // [vocab_size, model_dim], 共享时就是token嵌入的embedding_matrix
+    int vocab_size;
+    int model_dim;
+    bool tied;          // 权重属于token嵌入, vocab_head_free不释放它
+};
+
+// 独立权重的词表投影
+VocabHead* vocab_head_create(int vocab_size, int model_dim);
+
+// 与token嵌入共享权重, embedding必须比词表投影活得久
+VocabHead* vocab_head_create_tied(TokenEmbedding* embedding);
+
+// 所有位置的logits
+// hidden: [batch_size, seq_len, model_dim], logits: [batch_size, seq_len, vocab_size]
+bool vocab_head_forward(const VocabHead* head, const Tensor* hidden, Tensor* logits);
+
+// 只计算每个序列最后一个位置的logits, 直接按行步长读取hidden, 不复制
+// hidden: [batch_size, seq_len, model_dim], logits: [batch_size, vocab_size]
+// 增量解码时seq_len为1, 就是这一步的全部输出
+bool vocab_head_forward_last(const VocabHead* head, const Tensor* hidden, Tensor* logits);
+
+// 打包变长batch上每个序列最后一个位置的logits, 序列不能为空
+// hidden: [1, total_tokens, model_dim], logits: [num_seqs, vocab_size]
+bool vocab_head_forward_ragged_last(const VocabHead* head, const Tensor* hidden,
+                                    const RaggedBatch* batch, Tensor* logits);
+
+// 词表投影与交叉熵融合, 不生成完整的[tokens, vocab_size] logits
+// 按词表分块计算logits, 在线维护每个token的log-sum-exp; 需要梯度时逐块重新计算logits,
+// 得到(softmax - onehot) / 有效token数后立即乘回hidden和权重, 临时内存只有一块logits
+// hidden: [batch_size, seq_len, model_dim]
+// targets: [batch_size, seq_len], 目标token id, 小于0的位置(padding)不计入损失
+// loss: 有效位置的平均交叉熵
+// grad_hidden: 与hidden同形状或NULL, 写入d loss / d hidden
+// grad_weight: [vocab_size, model_dim]或NULL, d loss / d W累加到其中;
+// 共享权重时传入token嵌入的grad_embedding, 嵌入和投影两部分梯度直接相加
+bool vocab_head_cross_entropy(const VocabHead* head, const Tensor* hidden, const Tensor* targets,
+                              float* loss, Tensor* grad_hidden, Tensor* grad_weight);
+
+void vocab_head_free(VocabHead* head);
+
+#endif // VOCAB_HEAD_H
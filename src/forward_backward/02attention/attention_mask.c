@@ -1,40 +1,43 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include "01attention_mask.h"
+#include <string.h>
+#include "attention_mask.h"
 #include "tensor_logic.h"
-#include "tensor_trio.h"
+
+// 除seq_length外全部清零的掩码
+static AttentionMask* mask_alloc(int seq_length) {
+    AttentionMask* mask = (AttentionMask*)calloc(1, sizeof(AttentionMask));
+    if (!mask) {
+        fprintf(stderr, "Failed to allocate memory for attention mask\n");
+        return NULL;
+    }
+    mask->seq_length = seq_length;
+    return mask;
+}
 
 // 创建注意力掩码, used when in Q@K in multiattention
+// 原来是[batch_size, num_heads, q_seq_len, k_seq_len]的浮点张量, 每个head和每个查询都重复一份;
+// padding只取决于k, 改为每个batch一行位图
 AttentionMask* pad_mask_create(Tensor* q, Tensor* k, int num_heads, int pad_token_id) {
+    (void)num_heads;
     if (!q || !k) {
         fprintf(stderr, "Input tensors Q and K cannot be NULL\n");
         return NULL;
     }
 
-    int batch_size = q->shape[0];
-    int q_seq_len = q->shape[1];
+    int batch_size = k->shape[0];
     int k_seq_len = k->shape[1];
-
-    AttentionMask* mask = (AttentionMask*)malloc(sizeof(AttentionMask));
-    if (!mask) {
-        fprintf(stderr, "Failed to allocate memory for attention mask\n");
-        return NULL;
-    }
-
-    mask->seq_length = k_seq_len;
-    
-    // 创建4D掩码张量 [batch_size, num_heads, q_seq_len, k_seq_len]
-    int mask_shape[] = {batch_size, num_heads, q_seq_len, k_seq_len}; 
-    mask->mask = tensor_create(mask_shape, 4);
-    if (!mask->mask) {
-        fprintf(stderr, "Failed to allocate memory for mask tensor\n");
-        free(mask);
-        return NULL;
+    AttentionMask* mask = attention_mask_bits_create(batch_size, 1, k_seq_len);
+    if (!mask) return NULL;
+
+    // 如果k中的token是padding token,则屏蔽,否则允许
+    for (int b = 0; b < batch_size; b++) {
+        for (int j = 0; j < k_seq_len; j++) {
+            if (k->data[b * k_seq_len + j] != pad_token_id) {
+                attention_mask_bits_set(mask, b, 0, j, true);
+            }
+        }
     }
-
-    // 初始化掩码
-    tensor_create_pad_mask(mask->mask, batch_size, q_seq_len, k, pad_token_id);
-
     return mask;
 }
 
@@ -46,75 +49,105 @@ AttentionMask* create_causal_mask(int* shape, int num_dims) {
         return NULL;
     }
 
-    AttentionMask* mask = (AttentionMask*)malloc(sizeof(AttentionMask));
-    if (!mask) {
-        fprintf(stderr, "为因果掩码分配内存失败\n");
-        return NULL;
-    }
-
-    mask->seq_length = shape[1]; // seq_len
-    mask->mask = tensor_create(shape, num_dims);
-    if (!mask->mask) {
-        fprintf(stderr, "为掩码张量分配内存失败\n");
-        free(mask);
-        return NULL;
-    }
-
-    // 创建下三角矩阵掩码
-    if (!tensor_create_causal_mask(mask->mask)) {
-        tensor_free(mask->mask);
-        free(mask);
-        return NULL;
-    }
-
+    // 下三角由注意力内核按下标判断, 不再分配[seq_len, seq_len]的张量
+    AttentionMask* mask = mask_alloc(shape[1]);
+    if (!mask) return NULL;
+    mask->causal = true;
     return mask;
 }
 
 // 创建目标掩码 - 用于decoder的自注意力掩码,考虑padding
+// 这里拿不到目标token, padding部分需要时用attention_mask_key_padding另建掩码, 或者改用打包的变长batch
 AttentionMask* create_trg_mask(int* shape, int num_dims) {
-    // 创建因果掩码
-    AttentionMask* causal_mask = create_causal_mask(shape, num_dims);
-    if (!causal_mask) return NULL;
-
-    // 创建padding掩码
-    Tensor* padding_mask = tensor_create(shape, num_dims);
-    if (!padding_mask) {
-        attention_mask_free(causal_mask);
-        return NULL;
-    }
+    return create_causal_mask(shape, num_dims);
+}
+
+AttentionMask* attention_mask_key_padding(const int* lengths, int batch_size) {
+    if (!lengths || batch_size <= 0) return NULL;
 
-    // 初始化padding掩码
-    if (!tensor_create_pad_mask(padding_mask, shape[0], shape[1], NULL, 0)) {
-        tensor_free(padding_mask);
-        attention_mask_free(causal_mask);
+    int max_len = 0;
+    for (int b = 0; b < batch_size; b++) {
+        if (lengths[b] > max_len) max_len = lengths[b];
+    }
+    AttentionMask* mask = mask_alloc(max_len);
+    if (!mask) return NULL;
+    mask->key_lengths = (int*)malloc(batch_size * sizeof(int));
+    if (!mask->key_lengths) {
+        attention_mask_free(mask);
         return NULL;
     }
+    memcpy(mask->key_lengths, lengths, batch_size * sizeof(int));
+    mask->num_lengths = batch_size;
+    return mask;
+}
 
-    // 将padding mask与因果掩码结合
-    bool success = tensor_and(causal_mask->mask, padding_mask, causal_mask->mask);
-    if (!success) {
-        tensor_free(padding_mask);
-        attention_mask_free(causal_mask);
+AttentionMask* attention_mask_bits_create(int batch_size, int rows, int seq_len_k) {
+    if (batch_size <= 0 || rows <= 0 || seq_len_k <= 0) return NULL;
+
+    AttentionMask* mask = mask_alloc(seq_len_k);
+    if (!mask) return NULL;
+    mask->bits_batch = batch_size;
+    mask->bits_rows = rows;
+    mask->bits_words = (seq_len_k + 63) / 64;
+    mask->bits = (uint64_t*)calloc((size_t)batch_size * rows * mask->bits_words, sizeof(uint64_t));
+    if (!mask->bits) {
+        attention_mask_free(mask);
         return NULL;
     }
+    return mask;
+}
 
-    tensor_free(padding_mask);
-    return causal_mask;
+void attention_mask_bits_set(AttentionMask* mask, int b, int row, int col, bool allowed) {
+    uint64_t* word = mask->bits + ((long)b * mask->bits_rows + row) * mask->bits_words + (col >> 6);
+    uint64_t bit = (uint64_t)1 << (col & 63);
+    *word = allowed ? (*word | bit) : (*word & ~bit);
 }
 
+bool attention_mask_allows(const AttentionMask* mask, int b, int row, int col,
+                           int seq_len_q, int seq_len_k) {
+    if (mask->causal && col > row + seq_len_k - seq_len_q) {
+        return false;
+    }
+    if (mask->key_lengths && col >= mask->key_lengths[b]) {
+        return false;
+    }
+    if (mask->bits) {
+        int bits_b = mask->bits_batch == 1 ? 0 : b;
+        int bits_row = mask->bits_rows == 1 ? 0 : row;
+        const uint64_t* words = mask->bits + ((long)bits_b * mask->bits_rows + bits_row) * mask->bits_words;
+        if (!((words[col >> 6] >> (col & 63)) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
 
+void attention_mask_spec(const AttentionMask* mask, FlashMask* spec) {
+    memset(spec, 0, sizeof(FlashMask));
+    if (!mask) return;
+    spec->dense = mask->mask;
+    spec->causal = mask->causal;
+    spec->key_lengths = mask->key_lengths;
+    spec->num_lengths = mask->num_lengths;
+    spec->bits = mask->bits;
+    spec->bits_batch = mask->bits_batch;
+    spec->bits_rows = mask->bits_rows;
+    spec->bits_words = mask->bits_words;
+}
 
 // 释放注意力掩码
 void attention_mask_free(AttentionMask* mask) {
     if (!mask) return;
     tensor_free(mask->mask);
+    free(mask->key_lengths);
+    free(mask->bits);
     free(mask);
 } 
 
 // 应用注意力掩码到注意力分数上
 bool apply_attention_mask(
     const Tensor* scores,  // [batch_size, num_heads, seq_len_q, seq_len_k]
-    const AttentionMask* mask,  // [batch_size, num_heads, seq_len_q, seq_len_k]
+    const AttentionMask* mask,  // 稠密部分为[seq_len_q, seq_len_k]
     Tensor* output  // [batch_size, num_heads, seq_len_q, seq_len_k]
 ) {
     if (!scores || !mask || !output) {
@@ -128,16 +161,39 @@ bool apply_attention_mask(
         return false;
     }
 
-    // 检查形状匹配
-    if (scores->shape[2] != mask->mask->shape[0] || 
-        scores->shape[3] != mask->mask->shape[1]) {
-        fprintf(stderr, "scores和mask的序列长度不匹配\n");
+    const float MASKING_VALUE = -1e9f;
+    int batch_size = scores->shape[0];
+    int num_heads = scores->shape[1];
+    int seq_len_q = scores->shape[2];
+    int seq_len_k = scores->shape[3];
+
+    if (mask->mask) {
+        // 检查形状匹配
+        if (seq_len_q != mask->mask->shape[0] || seq_len_k != mask->mask->shape[1]) {
+            fprintf(stderr, "scores和mask的序列长度不匹配\n");
+            return false;
+        }
+        if (!tensor_apply_mask(scores, mask->mask, output, MASKING_VALUE)) {
+            return false;
+        }
+    } else if (!tensor_copy(output, scores)) {
         return false;
     }
 
-    // 应用掩码
-    const float MASKING_VALUE = -1e9f;
-    bool success = tensor_apply_mask(scores, mask->mask, output, MASKING_VALUE);
-
-    return success;
-}
\ No newline at end of file
+    // 隐式条件逐元素判断
+    if (mask->causal || mask->key_lengths || mask->bits) {
+        for (int b = 0; b < batch_size; b++) {
+            for (int h = 0; h < num_heads; h++) {
+                for (int i = 0; i < seq_len_q; i++) {
+                    float* row = output->data + (((long)b * num_heads + h) * seq_len_q + i) * seq_len_k;
+                    for (int j = 0; j < seq_len_k; j++) {
+                        if (!attention_mask_allows(mask, b, i, j, seq_len_q, seq_len_k)) {
+                            row[j] = MASKING_VALUE;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
@@ -2,25 +2,55 @@
 #define ATTENTION_MASK_H
 
 #include "tensor_type.h"
+#include "tensor_attention.h"
+#include <stdint.h>
 
 typedef struct AttentionMask AttentionMask;
 
 // 注意力掩码结构
+// 可以是稠密的浮点掩码, 也可以是隐式条件(因果、每个batch的键长度)或不带head维的位图,
+// 给出的各项同时生效, 由注意力内核在计算分数时直接判断
 struct AttentionMask {
     int seq_length;
     Tensor* mask;  // [seq_length, seq_length] 二维张量，用于存储注意力掩码
-                   // 1.0表示允许注意力，0.0表示屏蔽注意力
+                   // 1.0表示允许注意力，0.0表示屏蔽注意力; 只用隐式条件时为NULL
+
+    bool causal;            // 按下标因果屏蔽, 不需要掩码张量
+    int* key_lengths;       // [num_lengths], 第b个batch只看前key_lengths[b]个键; 或 NULL
+    int num_lengths;
+    uint64_t* bits;         // [bits_batch, bits_rows, bits_words]位图, 1表示允许; 或 NULL
+    int bits_batch;
+    int bits_rows;          // 1表示所有查询共用一行
+    int bits_words;
 };
 
 // 创建注意力掩码,用于处理padding token
+// 只记录k中哪些位置是padding: 每个batch一行位图, 所有head和查询共用
 AttentionMask* pad_mask_create(Tensor* q, Tensor* k, int num_heads, int pad_token_id);
 
-// 创建因果掩码,用于decoder的自注意力
+// 创建因果掩码,用于decoder的自注意力, 按下标判断, 不分配掩码张量
 AttentionMask* create_causal_mask(int* shape, int num_dims);
 
 // 创建目标掩码,用于decoder的自注意力,考虑padding
 AttentionMask* create_trg_mask(int* shape, int num_dims);
 
+// 键padding掩码: 第b个batch的前lengths[b]个键有效(padding在末尾), 只保存长度
+AttentionMask* attention_mask_key_padding(const int* lengths, int batch_size);
+
+// 位图掩码, 初始全部屏蔽; rows为1时所有查询共用一行
+AttentionMask* attention_mask_bits_create(int batch_size, int rows, int seq_len_k);
+
+// 设置位图中第b个batch第row行第col个键是否允许
+void attention_mask_bits_set(AttentionMask* mask, int b, int row, int col, bool allowed);
+
+// 隐式条件和位图下第b个batch的第row个查询能否看到第col个键(不检查稠密掩码)
+// seq_len_q/seq_len_k用于因果条件的对齐
+bool attention_mask_allows(const AttentionMask* mask, int b, int row, int col,
+                           int seq_len_q, int seq_len_k);
+
+// 转换成注意力内核使用的屏蔽条件
+void attention_mask_spec(const AttentionMask* mask, FlashMask* spec);
+
 // 释放注意力掩码
 void attention_mask_free(AttentionMask* mask);
 
@@ -0,0 +1,39 @@
+#ifndef KV_CACHE_H
+#define KV_CACHE_H
+
+#include "tensor_type.h"
+
+typedef struct KVCache KVCache;
+
+// 自注意力的K/V缓存, 按最大序列长度预先分配, 只追加
+// 增量解码时每一步只投影最新位置的K/V并写入缓存, 注意力在整个缓存上计算
+struct KVCache {
+    int batch_size;
+    int num_heads;
+    int head_dim;
+    int max_seq_len;
+    int length;     // 已缓存的位置数
+    Tensor* k;      // [batch_size, num_heads, max_seq_len, head_dim]
+    Tensor* v;      // [batch_size, num_heads, max_seq_len, head_dim]
+};
+
+KVCache* kv_cache_create(int batch_size, int num_heads, int head_dim, int max_seq_len);
+void kv_cache_free(KVCache* cache);
+
+// 清空缓存, 开始新的序列, 不释放内存
+void kv_cache_reset(KVCache* cache);
+
+// 缓存中[start, start + length)位置的视图: [batch_size, num_heads, length, head_dim]
+// 用于把新位置的投影直接写入缓存, 或在已缓存的前缀上计算注意力
+Tensor* kv_cache_view_k(const KVCache* cache, int start, int length);
+Tensor* kv_cache_view_v(const KVCache* cache, int start, int length);
+
+// 缓存中第[start, start + rows)个batch的视图, 写入调用者提供的view(不能对它调用kv_cache_free)
+// view->k/v是视图, 头部来自活动arena, 用完后tensor_free; length与原缓存相同
+// 用于让一批请求各自占用缓存中的若干行, 例如调度器只为新到达的请求预先投影交叉注意力K/V
+bool kv_cache_view_batch(const KVCache* cache, int start, int rows, KVCache* view);
+
+// 把第src个batch的全部缓存内容复制到第dst个batch, 调度器压缩batch时使用
+bool kv_cache_copy_batch(KVCache* cache, int dst, int src);
+
+#endif // KV_CACHE_H
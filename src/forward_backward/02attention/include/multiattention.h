@@ -3,6 +3,9 @@
 
 #include "tensor_type.h"
 #include "attention_mask.h"
+#include "kv_cache.h"
+#include "paged_kv_cache.h"
+#include "ragged_batch.h"
 
 typedef struct MultiHeadAttention MultiHeadAttention;
 
@@ -11,13 +14,20 @@ struct MultiHeadAttention {
     int model_dim;  // 模型维度, d_model, not splited by num_heads
     int head_dim;   // 注意力头维度, d_model / num_heads
     
-    // QKV投影权重和偏置
+    // 拼接的QKV投影: 列[0, d)为Q, [d, 2d)为K, [2d, 3d)为V
+    // 自注意力只做一次GEMM, 交叉注意力的K/V也合并为一次GEMM
+    Tensor* W_qkv;  // [model_dim, 3 * model_dim]
+    Tensor* b_qkv;  // [3 * model_dim]
+
+    // QKV投影权重和偏置, 都是W_qkv的列切片视图
     Tensor* W_q;    // [model_dim, model_dim]
     Tensor* W_k;    // [model_dim, model_dim]
     Tensor* W_v;    // [model_dim, model_dim]
     Tensor* b_q;    // [model_dim]
     Tensor* b_k;    // [model_dim]
     Tensor* b_v;    // [model_dim]
+    Tensor* W_kv;   // [model_dim, 2 * model_dim], W_qkv的K/V部分, 用于交叉注意力
+    Tensor* b_kv;   // [2 * model_dim]
     
     // 输出投影
     Tensor* W_o;    // [model_dim, model_dim], 用于将多头注意力结果合并成一个向量
@@ -35,27 +45,69 @@ bool multihead_attention_forward(
 
 bool cross_attention_forward(
     MultiHeadAttention* mha,
-    Tensor* input_q,        // [batch_size, seq_len, model_dim]
-    Tensor* input_k,        // [batch_size, seq_len, model_dim]
-    Tensor* input_v,        // [batch_size, seq_len, model_dim]
-    Tensor* output,       // [batch_size, seq_len, model_dim]
-    AttentionMask* mask         // [batch_size, num_heads, seq_len, seq_len]
-);
-
-bool project_qkv(
-    const Tensor* input_q,      // [batch_size, seq_len, model_dim]
-    const Tensor* input_k,      // [batch_size, seq_len, model_dim]
-    const Tensor* input_v,      // [batch_size, seq_len, model_dim]
-    const Tensor* weight_q,   // [model_dim, model_dim]  
-    const Tensor* weight_k,   // [model_dim, model_dim]
-    const Tensor* weight_v,   // [model_dim, model_dim]
-    const Tensor* weight_combine, // [model_dim, model_dim]
-    const Tensor* bias_q,     // [model_dim]
-    const Tensor* bias_k,     // [model_dim] 
-    const Tensor* bias_v,     // [model_dim]
-    const Tensor* bias_combine, // [model_dim]
-    const AttentionMask* mask,
-    Tensor* output           // [batch_size, num_heads, seq_len, head_dim]
+    Tensor* input_q,        // [batch_size, seq_len_q, model_dim]
+    Tensor* input_k,        // [batch_size, seq_len_k, model_dim]
+    Tensor* input_v,        // [batch_size, seq_len_k, model_dim]
+    Tensor* output,       // [batch_size, seq_len_q, model_dim]
+    AttentionMask* mask         // [batch_size, num_heads, seq_len_q, seq_len_k]
+);
+
+// 打包变长batch上的自注意力: input是各序列首尾相接的[1, total_tokens, model_dim],
+// 投影是total_tokens行的一次GEMM, 注意力按序列分别计算, 不需要padding掩码; causal为true时做因果屏蔽
+bool multihead_attention_forward_ragged(
+    MultiHeadAttention* mha,
+    const Tensor* input,        // [1, total_tokens, model_dim]
+    const RaggedBatch* batch,
+    bool causal,
+    Tensor* output              // [1, total_tokens, model_dim]
+);
+
+// 打包变长batch上的交叉注意力: 第i个查询序列只看第i个键序列, 两边的序列数必须相同
+bool cross_attention_forward_ragged(
+    MultiHeadAttention* mha,
+    const Tensor* input_q,          // [1, q_batch->total_tokens, model_dim]
+    const RaggedBatch* q_batch,
+    const Tensor* input_kv,         // [1, kv_batch->total_tokens, model_dim]
+    const RaggedBatch* kv_batch,
+    Tensor* output                  // [1, q_batch->total_tokens, model_dim]
+);
+
+// 增量解码的一步自注意力: 只投影最新位置的Q/K/V, K/V追加到缓存,
+// Q在缓存中所有已有位置(包括自己)上计算注意力, 天然满足因果约束
+bool multihead_attention_step(
+    MultiHeadAttention* mha,
+    const Tensor* input,    // [batch_size, 1, model_dim], 最新位置的输入
+    KVCache* cache,         // 本层的自注意力缓存, 调用后length加1
+    Tensor* output          // [batch_size, 1, model_dim]
+);
+
+// 分页缓存上的一步自注意力: 每个batch对应一个序列, 序列长度可以各不相同
+// 调用前每个序列都已paged_sequence_append, 新位置的K/V写入第length - 1个槽位
+bool multihead_attention_step_paged(
+    MultiHeadAttention* mha,
+    const Tensor* input,            // [batch_size, 1, model_dim]
+    PagedKVCache* cache,
+    int layer,                      // 本注意力层在cache中的层号
+    PagedSequence* const* seqs,     // batch_size个序列
+    Tensor* output                  // [batch_size, 1, model_dim]
+);
+
+// 交叉注意力的K/V只依赖编码器输出, 一次生成内不变
+// 预先把encoder_output投影到cache中(一次K/V融合GEMM), 之后每一步只需投影Q
+bool cross_attention_precompute(
+    MultiHeadAttention* mha,
+    const Tensor* encoder_output,   // [src_batch, enc_seq_len, model_dim]
+    KVCache* cache                  // batch_size = src_batch, max_seq_len >= enc_seq_len
+);
+
+// 使用预先计算的K/V做交叉注意力
+// input_q的batch可以是src_batch的整数倍, 连续的beam_width个查询batch共享同一个源序列的K/V
+bool cross_attention_cached(
+    MultiHeadAttention* mha,
+    const Tensor* input_q,      // [batch_size, seq_len_q, model_dim]
+    const KVCache* cache,       // cross_attention_precompute的结果
+    const AttentionMask* mask,  // [batch_size或src_batch, seq_len_q, enc_seq_len] 或 NULL
+    Tensor* output              // [batch_size, seq_len_q, model_dim]
 );
 
 #endif // MULTIATTENTION_H
\ No newline at end of file
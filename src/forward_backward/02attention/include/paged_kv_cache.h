@@ -0,0 +1,70 @@
+#ifndef PAGED_KV_CACHE_H
+#define PAGED_KV_CACHE_H
+
+#include "tensor_type.h"
+#include <stddef.h>
+
+typedef struct PagedKVCache PagedKVCache;
+typedef struct PagedSequence PagedSequence;
+
+// 分页K/V缓存: 所有序列共用一个固定大小的块池, 每块保存block_size个位置
+// 块号在所有层之间共用, 第l层的块b存放在k[l]/v[l]的第b个块中
+// 序列通过块表记录自己按顺序使用的块, 长度不同的序列只占用实际需要的块
+// 共同前缀的块可以被多个序列引用(引用计数), 写入共享块时先复制(copy-on-write)
+struct PagedKVCache {
+    int num_layers;
+    int num_blocks;
+    int block_size;     // 每块的位置数
+    int num_heads;
+    int head_dim;
+    Tensor** k;         // 每层一个[num_blocks, num_heads, block_size, head_dim]
+    Tensor** v;
+    int* ref_counts;    // 每块被多少个序列引用, 0表示空闲
+    int* free_blocks;   // 空闲块栈
+    int num_free;
+};
+
+struct PagedSequence {
+    int length;         // 已写入的位置数
+    int num_blocks;     // 块表中的块数
+    int capacity;       // 块表容量
+    int* block_table;   // 按位置顺序使用的块号
+};
+
+PagedKVCache* paged_kv_cache_create(int num_layers, int num_blocks, int block_size,
+                                    int num_heads, int head_dim);
+void paged_kv_cache_free(PagedKVCache* cache);
+
+// 在budget_bytes的K/V内存预算内最多能放多少块
+int paged_kv_cache_blocks_for_budget(size_t budget_bytes, int num_layers, int block_size,
+                                     int num_heads, int head_dim);
+
+// 当前空闲块数, 调度器据此决定能否接纳新的序列
+int paged_kv_cache_num_free(const PagedKVCache* cache);
+
+PagedSequence* paged_sequence_create(void);
+
+// 归还序列占用的块并释放序列
+void paged_sequence_free(PagedKVCache* cache, PagedSequence* seq);
+
+// 归还序列占用的块, 长度清零, 序列对象可以继续使用
+void paged_sequence_reset(PagedKVCache* cache, PagedSequence* seq);
+
+// 复制一个序列: 新序列与parent共享所有块(例如beam分叉或共享的提示前缀), 不复制数据
+PagedSequence* paged_sequence_fork(PagedKVCache* cache, const PagedSequence* parent);
+
+// 为下一个位置准备可写的槽位并把长度加1
+// 需要新块时从池中分配; 最后一块被共享时先复制一份(copy-on-write)
+// 块池用尽时返回false, 序列保持不变
+bool paged_sequence_append(PagedKVCache* cache, PagedSequence* seq);
+
+// 把序列截短到length个位置, 归还不再需要的块; length不小于当前长度时不做任何事
+// 用于撤销失败的解码步: 追加时复制出的私有块保留, 其中length之前的数据与原共享块相同
+void paged_sequence_truncate(PagedKVCache* cache, PagedSequence* seq, int length);
+
+// 把一个位置的K/V写入第layer层的块中
+// k/v: num_heads个head_dim向量, 相邻两个头之间相隔head_stride个元素
+void paged_kv_cache_store(PagedKVCache* cache, int layer, const PagedSequence* seq, int position,
+                          const float* k, const float* v, long head_stride);
+
+#endif // PAGED_KV_CACHE_H
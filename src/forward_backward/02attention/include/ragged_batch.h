@@ -0,0 +1,30 @@
+#ifndef RAGGED_BATCH_H
+#define RAGGED_BATCH_H
+
+#include "tensor_type.h"
+#include <stdbool.h>
+
+typedef struct RaggedBatch RaggedBatch;
+
+// 打包的变长batch: 各序列的token首尾相接成一个[1, total_tokens, model_dim]张量, 不补齐
+// 线性层、前馈网络、层归一化和嵌入都是逐token计算, 直接把它当作total_tokens行处理;
+// 注意力按cu_seqlens分序列计算, 每个序列只看到自己的键
+struct RaggedBatch {
+    int num_seqs;
+    int total_tokens;
+    int max_seq_len;
+    int* cu_seqlens;    // [num_seqs + 1], 第i个序列占[cu_seqlens[i], cu_seqlens[i + 1])行
+};
+
+RaggedBatch* ragged_batch_create(const int* seq_lens, int num_seqs);
+void ragged_batch_free(RaggedBatch* batch);
+
+// 第i个序列的长度
+int ragged_batch_seq_len(const RaggedBatch* batch, int i);
+
+// 补齐的[num_seqs, max_len, model_dim](max_len >= max_seq_len)与打包的[1, total_tokens, model_dim]互相转换
+// unpack时补齐位置填0
+bool ragged_batch_pack(const RaggedBatch* batch, const Tensor* padded, Tensor* packed);
+bool ragged_batch_unpack(const RaggedBatch* batch, const Tensor* packed, Tensor* padded);
+
+#endif // RAGGED_BATCH_H
@@ -0,0 +1,92 @@
+#include "kv_cache.h"
+#include "tensor_reshape.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+KVCache* kv_cache_create(int batch_size, int num_heads, int head_dim, int max_seq_len) {
+    if (batch_size <= 0 || num_heads <= 0 || head_dim <= 0 || max_seq_len <= 0) {
+        fprintf(stderr, "Invalid KV cache dimensions\n");
+        return NULL;
+    }
+
+    KVCache* cache = (KVCache*)calloc(1, sizeof(KVCache));
+    if (!cache) return NULL;
+
+    cache->batch_size = batch_size;
+    cache->num_heads = num_heads;
+    cache->head_dim = head_dim;
+    cache->max_seq_len = max_seq_len;
+    cache->length = 0;
+
+    int shape[] = {batch_size, num_heads, max_seq_len, head_dim};
+    cache->k = tensor_create(shape, 4);
+    cache->v = tensor_create(shape, 4);
+    if (!cache->k || !cache->v) {
+        fprintf(stderr, "Failed to allocate KV cache\n");
+        kv_cache_free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void kv_cache_free(KVCache* cache) {
+    if (cache) {
+        tensor_free(cache->k);
+        tensor_free(cache->v);
+        free(cache);
+    }
+}
+
+void kv_cache_reset(KVCache* cache) {
+    if (cache) {
+        cache->length = 0;
+    }
+}
+
+static Tensor* cache_view(const KVCache* cache, const Tensor* storage, int start, int length) {
+    if (!cache || start < 0 || length <= 0 || start + length > cache->max_seq_len) {
+        fprintf(stderr, "KV cache range [%d, %d) out of bounds\n", start, start + length);
+        return NULL;
+    }
+    // 沿序列维切片, 视图头部来自活动arena
+    return tensor_view_slice(storage, 2, start, length);
+}
+
+Tensor* kv_cache_view_k(const KVCache* cache, int start, int length) {
+    return cache ? cache_view(cache, cache->k, start, length) : NULL;
+}
+
+Tensor* kv_cache_view_v(const KVCache* cache, int start, int length) {
+    return cache ? cache_view(cache, cache->v, start, length) : NULL;
+}
+
+bool kv_cache_view_batch(const KVCache* cache, int start, int rows, KVCache* view) {
+    if (!cache || !view || start < 0 || rows <= 0 || start + rows > cache->batch_size) {
+        fprintf(stderr, "KV cache batch range out of bounds\n");
+        return false;
+    }
+    *view = *cache;
+    view->batch_size = rows;
+    view->k = tensor_view_slice(cache->k, 0, start, rows);
+    view->v = tensor_view_slice(cache->v, 0, start, rows);
+    if (!view->k || !view->v) {
+        tensor_free(view->k);
+        tensor_free(view->v);
+        return false;
+    }
+    return true;
+}
+
+bool kv_cache_copy_batch(KVCache* cache, int dst, int src) {
+    if (!cache || dst < 0 || src < 0 || dst >= cache->batch_size || src >= cache->batch_size) {
+        return false;
+    }
+    if (dst != src) {
+        // 缓存张量是连续的, 每个batch占[num_heads, max_seq_len, head_dim]
+        size_t row = (size_t)cache->num_heads * cache->max_seq_len * cache->head_dim;
+        memcpy(cache->k->data + dst * row, cache->k->data + src * row, row * sizeof(float));
+        memcpy(cache->v->data + dst * row, cache->v->data + src * row, row * sizeof(float));
+    }
+    return true;
+}
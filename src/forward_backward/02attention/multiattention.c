@@ -1,85 +1,190 @@
-#include "02multiattention.h"
-#include "model_config.h"
+#include "multiattention.h"
 #include "tensor_mul.h"
 #include "tensor_add.h"
 #include "tensor_reshape.h"
-#include "softmax.h"
+#include "tensor_attention.h"
+#include "tensor_arena.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 
 MultiHeadAttention* multihead_attention_create(int num_heads, int model_dim) {
-    MultiHeadAttention* mha = (MultiHeadAttention*)malloc(sizeof(MultiHeadAttention));
+    MultiHeadAttention* mha = (MultiHeadAttention*)calloc(1, sizeof(MultiHeadAttention));
     if (!mha) return NULL;
 
     mha->num_heads = num_heads;
     mha->model_dim = model_dim;
     mha->head_dim = model_dim / num_heads;
 
-    // 初始化QKV投影权重和偏置
-    // 注意：权重维度现在是 [model_dim, head_dim]
-    int qkv_weight_shape[] = {model_dim, mha->head_dim};
-    int qkv_bias_shape[] = {mha->head_dim};
-    
-    mha->W_q = tensor_create(qkv_weight_shape, 2);
-    mha->W_k = tensor_create(qkv_weight_shape, 2);
-    mha->W_v = tensor_create(qkv_weight_shape, 2);
-    mha->b_q = tensor_create(qkv_bias_shape, 1);
-    mha->b_k = tensor_create(qkv_bias_shape, 1);
-    mha->b_v = tensor_create(qkv_bias_shape, 1);
-    
-    // 初始化输出投影
-    mha->W_o = tensor_create(qkv_weight_shape, 2);
-    mha->b_o = tensor_create(qkv_bias_shape, 1);
+    // QKV投影权重按列拼接成一个矩阵, 一次GEMM完成三个投影
+    // W_q/W_k/W_v和W_kv都是它的列切片视图, 共享同一块存储
+    int qkv_weight_shape[] = {model_dim, 3 * model_dim};
+    int qkv_bias_shape[] = {3 * model_dim};
+    int weight_shape[] = {model_dim, model_dim};
+    int bias_shape[] = {model_dim};
+
+    mha->W_qkv = tensor_create(qkv_weight_shape, 2);
+    mha->b_qkv = tensor_create(qkv_bias_shape, 1);
+    if (!mha->W_qkv || !mha->b_qkv) {
+        multihead_attention_free(mha);
+        return NULL;
+    }
 
+    // 视图不能放进arena, 创建期间临时关闭活动arena
+    TensorArena* previous = tensor_arena_set_active(NULL);
+    mha->W_q = tensor_view_slice(mha->W_qkv, 1, 0, model_dim);
+    mha->W_k = tensor_view_slice(mha->W_qkv, 1, model_dim, model_dim);
+    mha->W_v = tensor_view_slice(mha->W_qkv, 1, 2 * model_dim, model_dim);
+    mha->W_kv = tensor_view_slice(mha->W_qkv, 1, model_dim, 2 * model_dim);
+    mha->b_q = tensor_view_slice(mha->b_qkv, 0, 0, model_dim);
+    mha->b_k = tensor_view_slice(mha->b_qkv, 0, model_dim, model_dim);
+    mha->b_v = tensor_view_slice(mha->b_qkv, 0, 2 * model_dim, model_dim);
+    mha->b_kv = tensor_view_slice(mha->b_qkv, 0, model_dim, 2 * model_dim);
+    tensor_arena_set_active(previous);
 
+    // 初始化输出投影
+    mha->W_o = tensor_create(weight_shape, 2);
+    mha->b_o = tensor_create(bias_shape, 1);
+
+    if (!mha->W_q || !mha->W_k || !mha->W_v || !mha->W_kv ||
+        !mha->b_q || !mha->b_k || !mha->b_v || !mha->b_kv ||
+        !mha->W_o || !mha->b_o) {
+        multihead_attention_free(mha);
+        return NULL;
+    }
     return mha;
 }
 
 void multihead_attention_free(MultiHeadAttention* mha) {
     if (!mha) return;
-    
+
+    // 先释放切片视图, 再释放拼接的权重
     tensor_free(mha->W_q);
     tensor_free(mha->W_k);
     tensor_free(mha->W_v);
+    tensor_free(mha->W_kv);
     tensor_free(mha->b_q);
     tensor_free(mha->b_k);
     tensor_free(mha->b_v);
+    tensor_free(mha->b_kv);
+    tensor_free(mha->W_qkv);
+    tensor_free(mha->b_qkv);
     tensor_free(mha->W_o);
     tensor_free(mha->b_o);
-    
+
     free(mha);
 }
 
+static bool attend_heads(
+    const Tensor* q_heads, const Tensor* k_heads, const Tensor* v_heads,
+    const AttentionMask* mask, Tensor* context_heads
+);
+
+// 打包变长batch的注意力: 查询和键各自的序列划分, 自注意力时两者相同
+typedef struct {
+    const RaggedBatch* q;
+    const RaggedBatch* k;
+    bool causal;
+} RaggedAttention;
+
+// 融合投影的注意力: Q/K/V由一次(交叉注意力为两次)GEMM直接写成[batch_size, num_heads, seq_len, head_dim]
+// K和V的输入不同时分别投影, 共三次GEMM
+// 偏置在GEMM写回时加上, 不再单独遍历投影结果
+// ragged非NULL时输入是打包的[1, total_tokens, model_dim], 注意力按序列分别计算
+static bool fused_attention(
+    MultiHeadAttention* mha,
+    const Tensor* input_q,      // [batch_size, seq_len_q, model_dim]
+    const Tensor* input_k,      // [batch_size, seq_len_k, model_dim], 自注意力时与input_q相同
+    const Tensor* input_v,      // [batch_size, seq_len_k, model_dim], 通常与input_k相同
+    const AttentionMask* mask,
+    const RaggedAttention* ragged,
+    Tensor* output              // [batch_size, seq_len_q, model_dim]
+) {
+    int batch_size = input_q->shape[0];
+    int seq_len_q = input_q->shape[1];
+    int seq_len_k = input_k->shape[1];
+    int num_heads = mha->num_heads;
+    int head_dim = mha->head_dim;
+    bool success = false;
+
+    TensorArena* arena = tensor_arena_active();
+    size_t mark = tensor_arena_mark(arena);
+
+    int q_shape[] = {batch_size, num_heads, seq_len_q, head_dim};
+    int kv_shape[] = {batch_size, num_heads, seq_len_k, head_dim};
+    int context_shape[] = {batch_size, seq_len_q, mha->model_dim};
+    Tensor* q_heads = tensor_create_scratch_uninit(q_shape, 4);
+    Tensor* k_heads = tensor_create_scratch_uninit(kv_shape, 4);
+    Tensor* v_heads = tensor_create_scratch_uninit(kv_shape, 4);
+    Tensor* context = tensor_create_scratch_uninit(context_shape, 3);
+    Tensor* context_heads = NULL;
+    if (!q_heads || !k_heads || !v_heads || !context) {
+        goto cleanup;
+    }
+
+    if (input_q == input_k && input_k == input_v) {
+        Tensor* qkv[] = {q_heads, k_heads, v_heads};
+        if (!tensor_linear_split_heads(input_q, mha->W_qkv, mha->b_qkv, qkv, 3)) {
+            goto cleanup;
+        }
+    } else if (input_k == input_v) {
+        Tensor* kv[] = {k_heads, v_heads};
+        if (!tensor_linear_split_heads(input_q, mha->W_q, mha->b_q, &q_heads, 1) ||
+            !tensor_linear_split_heads(input_k, mha->W_kv, mha->b_kv, kv, 2)) {
+            goto cleanup;
+        }
+    } else if (!tensor_linear_split_heads(input_q, mha->W_q, mha->b_q, &q_heads, 1) ||
+               !tensor_linear_split_heads(input_k, mha->W_k, mha->b_k, &k_heads, 1) ||
+               !tensor_linear_split_heads(input_v, mha->W_v, mha->b_v, &v_heads, 1)) {
+        goto cleanup;
+    }
+
+    // 注意力结果直接写入context的头视图, context本身就是合并后的布局
+    context_heads = tensor_view_split_heads(context, num_heads);
+    if (!context_heads) {
+        goto cleanup;
+    }
+    bool attended;
+    if (ragged) {
+        attended = tensor_varlen_attention(q_heads, k_heads, v_heads,
+                                           ragged->q->cu_seqlens, ragged->k->cu_seqlens,
+                                           ragged->q->num_seqs, ragged->causal,
+                                           1.0f / sqrtf((float)head_dim), context_heads);
+    } else {
+        attended = attend_heads(q_heads, k_heads, v_heads, mask, context_heads);
+    }
+    if (!attended) {
+        goto cleanup;
+    }
+
+    if (!tensor_linear_3d(context, mha->W_o, mha->b_o, output)) {
+        goto cleanup;
+    }
+    success = true;
+
+cleanup:
+    tensor_free(context_heads);
+    tensor_free(q_heads);
+    tensor_free(k_heads);
+    tensor_free(v_heads);
+    tensor_free(context);
+    tensor_arena_release(arena, mark);
+    return success;
+}
+
 bool multihead_attention_forward(
     MultiHeadAttention* mha,
     Tensor* input,        // [batch_size, seq_len, model_dim]
     Tensor* output,       // [batch_size, seq_len, model_dim]
     AttentionMask* mask         // [batch_size, num_heads, seq_len, seq_len]
 ) {
-    int batch_size = input->shape[0];
-    int seq_len = input->shape[1];
-    int model_dim = input->shape[2];
-    
-    // 执行多头注意力计算
-    bool success = project_qkv(
-        input,          // 输入
-        input,          // 输入
-        input,          // 输入
-        mha->W_q,      // Q权重
-        mha->W_k,      // K权重
-        mha->W_v,      // V权重
-        mha->W_o,      // 输出权重
-        mha->b_q,      // Q偏置
-        mha->b_k,      // K偏置
-        mha->b_v,      // V偏置
-        mha->b_o,      // 输出偏置
-        (AttentionMask*)mask,  // 注意力掩码
-        output         // 输出
-    );
+    bool success = fused_attention(mha, input, input, input, mask, NULL, output);
 
     if (!success) {
         fprintf(stderr, "多头注意力计算失败\n");
-        return;
+        return false;
     }
+    return true;
 }
 
 bool cross_attention_forward(
@@ -90,147 +195,286 @@ bool cross_attention_forward(
     Tensor* output,       // [batch_size, seq_len, model_dim]
     AttentionMask* mask         // [batch_size, num_heads, seq_len, seq_len]
 ) {
-    int batch_size = input_q->shape[0];
-    int seq_len = input_q->shape[1];
-    int model_dim = input_q->shape[2];
-    
-    // 执行多头注意力计算
-    bool success = project_qkv(
-        input_q,          // 输入
-        input_k,          // 输入
-        input_v,          // 输入
-        mha->W_q,      // Q权重
-        mha->W_k,      // K权重
-        mha->W_v,      // V权重
-        mha->W_o,      // 输出权重
-        mha->b_q,      // Q偏置
-        mha->b_k,      // K偏置
-        mha->b_v,      // V偏置
-        mha->b_o,      // 输出偏置
-        (AttentionMask*)mask,  // 注意力掩码
-        output         // 输出
-    );
+    // K和V来自同一个编码器输出时合并为一次GEMM
+    bool success = fused_attention(mha, input_q, input_k, input_v, mask, NULL, output);
 
     if (!success) {
         fprintf(stderr, "多头注意力计算失败\n");
-        return;
+        return false;
     }
+    return true;
 }
 
+bool multihead_attention_forward_ragged(
+    MultiHeadAttention* mha,
+    const Tensor* input,
+    const RaggedBatch* batch,
+    bool causal,
+    Tensor* output
+) {
+    if (!mha || !input || !batch || !output ||
+        input->num_dims != 3 || input->shape[0] != 1 || input->shape[1] != batch->total_tokens) {
+        fprintf(stderr, "Packed input does not match the ragged batch\n");
+        return false;
+    }
+    RaggedAttention ragged = {batch, batch, causal};
+    return fused_attention(mha, input, input, input, NULL, &ragged, output);
+}
 
-// 辅助函数：将3D输入与2D权重相乘并重塑为4D输出
-// input: [batch_size, seq_len, model_dim]
-// weight: [model_dim, model_dim]
-// bias: [model_dim]
-// output: [batch_size, num_heads, seq_len, head_dim]
-bool project_qkv(
-    const Tensor* input_q,      // [batch_size, seq_len, model_dim]
-    const Tensor* input_k,      // [batch_size, seq_len, model_dim]
-    const Tensor* input_v,      // [batch_size, seq_len, model_dim]
-    const Tensor* weight_q,   // [model_dim, model_dim]
-    const Tensor* weight_k,   // [model_dim, model_dim]
-    const Tensor* weight_v,   // [model_dim, model_dim]
-    const Tensor* weight_combine, // [model_dim, model_dim]
-    const Tensor* bias_q,     // [model_dim]
-    const Tensor* bias_k,     // [model_dim]
-    const Tensor* bias_v,     // [model_dim]
-    const Tensor* bias_combine, // [model_dim]
-    const AttentionMask* mask,    // [batch_size, num_heads, seq_len, seq_len]
-    Tensor* output           // [batch_size, num_heads, seq_len, head_dim]
+bool cross_attention_forward_ragged(
+    MultiHeadAttention* mha,
+    const Tensor* input_q,
+    const RaggedBatch* q_batch,
+    const Tensor* input_kv,
+    const RaggedBatch* kv_batch,
+    Tensor* output
 ) {
-    int batch_size = input_q->shape[0];
-    int seq_len = input_q->shape[1];
-    int model_dim = input_q->shape[2];
-    int num_heads = g_model_config.num_heads;
-    int head_dim = model_dim / num_heads;
-
-    // 1. 首先进行批量矩阵乘法: [batch_size, seq_len, model_dim] @ [model_dim, model_dim]
-    int temp_shape[] = {batch_size, seq_len, model_dim};
-    Tensor* temp_q = tensor_create(temp_shape, 3);
-    Tensor* temp_k = tensor_create(temp_shape, 3);
-    Tensor* temp_v = tensor_create(temp_shape, 3);
-
-    // 执行3D矩阵乘法
-    if (!tensor_mul_3_2(input_q, weight_q, temp_q) ||
-        !tensor_mul_3_2(input_k, weight_k, temp_k) ||
-        !tensor_mul_3_2(input_v, weight_v, temp_v)) {
-        tensor_free(temp_q);
-        tensor_free(temp_k);
-        tensor_free(temp_v);
+    if (!mha || !input_q || !q_batch || !input_kv || !kv_batch || !output || !mha->W_kv ||
+        q_batch->num_seqs != kv_batch->num_seqs ||
+        input_q->num_dims != 3 || input_q->shape[0] != 1 || input_q->shape[1] != q_batch->total_tokens ||
+        input_kv->num_dims != 3 || input_kv->shape[0] != 1 || input_kv->shape[1] != kv_batch->total_tokens) {
+        fprintf(stderr, "Packed inputs do not match the ragged batches\n");
         return false;
     }
+    RaggedAttention ragged = {q_batch, kv_batch, false};
+    return fused_attention(mha, input_q, input_kv, input_kv, NULL, &ragged, output);
+}
 
-    // 添加偏置
-    if (!tensor_add_bias_3d(temp_q, bias_q, temp_q) ||
-        !tensor_add_bias_3d(temp_k, bias_k, temp_k) ||
-        !tensor_add_bias_3d(temp_v, bias_v, temp_v)) {
-        tensor_free(temp_q);
-        tensor_free(temp_k);
-        tensor_free(temp_v);
+bool multihead_attention_step(
+    MultiHeadAttention* mha,
+    const Tensor* input,
+    KVCache* cache,
+    Tensor* output
+) {
+    if (!mha || !input || !cache || !output) {
         return false;
     }
-    
-    // 2. 重塑结果为4D: [batch_size, num_heads, seq_len, head_dim]
-    int new_shape[] = {batch_size, num_heads, seq_len, head_dim};
-    
-    Tensor* reshaped_q = tensor_create(new_shape, 4);
-    Tensor* reshaped_k = tensor_create(new_shape, 4);
-    Tensor* reshaped_v = tensor_create(new_shape, 4);
-    
-    if (!tensor_reshape_3d_to_4d(temp_q, num_heads, reshaped_q) ||
-        !tensor_reshape_3d_to_4d(temp_k, num_heads, reshaped_k) ||
-        !tensor_reshape_3d_to_4d(temp_v, num_heads, reshaped_v)) {
+    int batch_size = input->shape[0];
+    if (input->num_dims != 3 || input->shape[1] != 1 || input->shape[2] != mha->model_dim ||
+        cache->batch_size != batch_size || cache->num_heads != mha->num_heads ||
+        cache->head_dim != mha->head_dim) {
+        fprintf(stderr, "Decode step expects [batch_size, 1, model_dim] input matching the cache\n");
         return false;
     }
-    // 计算注意力分数: Q * K^T / sqrt(head_dim)
-    float scale = 1.0f / sqrt(head_dim);
-    
-    // 调用4D张量乘法函数,K的最后两个维度需要转置
-    if (!tensor_mul_4d_transpose(reshaped_q, reshaped_k, scale, output)) {
+    if (cache->length >= cache->max_seq_len) {
+        fprintf(stderr, "KV cache is full (%d positions)\n", cache->max_seq_len);
         return false;
     }
 
-    // 应用注意力掩码
-    if (mask) {
-        if (!apply_attention_mask(output, mask, output)) {
-            return false;
-        }
+    int position = cache->length;
+    bool success = false;
+    TensorArena* arena = tensor_arena_active();
+    size_t mark = tensor_arena_mark(arena);
+
+    int q_shape[] = {batch_size, mha->num_heads, 1, mha->head_dim};
+    int context_shape[] = {batch_size, 1, mha->model_dim};
+    Tensor* q_heads = tensor_create_scratch_uninit(q_shape, 4);
+    Tensor* context = tensor_create_scratch_uninit(context_shape, 3);
+    Tensor* k_new = kv_cache_view_k(cache, position, 1);
+    Tensor* v_new = kv_cache_view_v(cache, position, 1);
+    Tensor* k_all = kv_cache_view_k(cache, 0, position + 1);
+    Tensor* v_all = kv_cache_view_v(cache, 0, position + 1);
+    Tensor* context_heads = NULL;
+    if (!q_heads || !context || !k_new || !v_new || !k_all || !v_all) {
+        goto cleanup;
+    }
+
+    // 新位置的K/V由GEMM写回阶段直接写进缓存
+    Tensor* qkv[] = {q_heads, k_new, v_new};
+    if (!tensor_linear_split_heads(input, mha->W_qkv, mha->b_qkv, qkv, 3)) {
+        goto cleanup;
+    }
+    cache->length = position + 1;
+
+    context_heads = tensor_view_split_heads(context, mha->num_heads);
+    if (!context_heads || !attend_heads(q_heads, k_all, v_all, NULL, context_heads)) {
+        goto cleanup;
     }
+    if (!tensor_linear_3d(context, mha->W_o, mha->b_o, output)) {
+        goto cleanup;
+    }
+    success = true;
+
+cleanup:
+    tensor_free(context_heads);
+    tensor_free(k_new);
+    tensor_free(v_new);
+    tensor_free(k_all);
+    tensor_free(v_all);
+    tensor_free(q_heads);
+    tensor_free(context);
+    tensor_arena_release(arena, mark);
+    return success;
+}
 
-    // 应用softmax
-    if (!attention_scores_softmax(output, output)) {
+bool multihead_attention_step_paged(
+    MultiHeadAttention* mha,
+    const Tensor* input,
+    PagedKVCache* cache,
+    int layer,
+    PagedSequence* const* seqs,
+    Tensor* output
+) {
+    if (!mha || !input || !cache || !seqs || !output) {
         return false;
     }
-    // 将softmax后的注意力分数与V相乘
-    // output: [batch_size, num_heads, seq_len, seq_len]
-    // reshaped_v: [batch_size, num_heads, seq_len, head_dim]
-    // 结果仍存在output中: [batch_size, num_heads, seq_len, head_dim]
-    if (!tensor_matmul_4d(output, reshaped_v, output)) {
+    int batch_size = input->shape[0];
+    int num_heads = mha->num_heads;
+    int head_dim = mha->head_dim;
+    if (input->num_dims != 3 || input->shape[1] != 1 || input->shape[2] != mha->model_dim ||
+        layer < 0 || layer >= cache->num_layers ||
+        cache->num_heads != num_heads || cache->head_dim != head_dim) {
+        fprintf(stderr, "Paged decode step expects [batch_size, 1, model_dim] input matching the cache\n");
         return false;
     }
 
-    // 4. 将4D张量重塑为3D张量
-    if (!tensor_reshape_4d_to_3d(output, output)) {
-        return false;
+    bool success = false;
+    TensorArena* arena = tensor_arena_active();
+    size_t mark = tensor_arena_mark(arena);
+
+    int head_shape[] = {batch_size, num_heads, 1, head_dim};
+    int context_shape[] = {batch_size, 1, mha->model_dim};
+    Tensor* q_heads = tensor_create_scratch_uninit(head_shape, 4);
+    Tensor* k_new = tensor_create_scratch_uninit(head_shape, 4);
+    Tensor* v_new = tensor_create_scratch_uninit(head_shape, 4);
+    Tensor* context = tensor_create_scratch_uninit(context_shape, 3);
+    Tensor* context_heads = NULL;
+
+    // 块表和长度数组, 有活动arena时放在arena中
+    size_t table_bytes = batch_size * (sizeof(const int*) + sizeof(int));
+    char* tables = arena ? (char*)tensor_arena_alloc(arena, table_bytes) : (char*)malloc(table_bytes);
+    const int** block_tables = (const int**)tables;
+    int* seq_lens = tables ? (int*)(tables + batch_size * sizeof(const int*)) : NULL;
+    if (!q_heads || !k_new || !v_new || !context || !tables) {
+        goto cleanup;
+    }
+
+    Tensor* qkv[] = {q_heads, k_new, v_new};
+    if (!tensor_linear_split_heads(input, mha->W_qkv, mha->b_qkv, qkv, 3)) {
+        goto cleanup;
+    }
+
+    // 新位置的K/V写入各自序列的块, 然后按块表在块池上计算注意力
+    for (int b = 0; b < batch_size; b++) {
+        const PagedSequence* seq = seqs[b];
+        if (seq->length <= 0) {
+            fprintf(stderr, "Sequence %d has no slot for the new position\n", b);
+            goto cleanup;
+        }
+        long offset = (long)b * num_heads * head_dim;
+        paged_kv_cache_store(cache, layer, seq, seq->length - 1,
+                             k_new->data + offset, v_new->data + offset, head_dim);
+        block_tables[b] = seq->block_table;
+        seq_lens[b] = seq->length;
+    }
+
+    context_heads = tensor_view_split_heads(context, num_heads);
+    if (!context_heads ||
+        !tensor_paged_attention(q_heads, cache->k[layer], cache->v[layer], block_tables, seq_lens,
+                                1.0f / sqrtf((float)head_dim), context_heads)) {
+        goto cleanup;
+    }
+    if (!tensor_linear_3d(context, mha->W_o, mha->b_o, output)) {
+        goto cleanup;
     }
+    success = true;
 
-    // 计算最终的多头注意力输出: [batch_size, seq_len, model_dim]
-    if (!tensor_mul_3_2(output, weight_combine, output)) {
+cleanup:
+    if (!arena) free(tables);
+    tensor_free(context_heads);
+    tensor_free(q_heads);
+    tensor_free(k_new);
+    tensor_free(v_new);
+    tensor_free(context);
+    tensor_arena_release(arena, mark);
+    return success;
+}
+
+bool cross_attention_precompute(
+    MultiHeadAttention* mha,
+    const Tensor* encoder_output,
+    KVCache* cache
+) {
+    if (!mha || !encoder_output || !cache) {
+        return false;
+    }
+    int enc_len = encoder_output->shape[1];
+    if (encoder_output->num_dims != 3 || encoder_output->shape[2] != mha->model_dim ||
+        cache->batch_size != encoder_output->shape[0] || cache->num_heads != mha->num_heads ||
+        cache->head_dim != mha->head_dim || cache->max_seq_len < enc_len) {
+        fprintf(stderr, "Cross-attention cache does not match encoder output\n");
         return false;
     }
 
-    // 添加输出偏置
-    if (!tensor_add_bias_3d(output, bias_combine, output)) {
+    Tensor* kv[] = {kv_cache_view_k(cache, 0, enc_len), kv_cache_view_v(cache, 0, enc_len)};
+    bool success = kv[0] && kv[1] &&
+                   tensor_linear_split_heads(encoder_output, mha->W_kv, mha->b_kv, kv, 2);
+    cache->length = success ? enc_len : 0;
+    tensor_free(kv[0]);
+    tensor_free(kv[1]);
+    return success;
+}
+
+bool cross_attention_cached(
+    MultiHeadAttention* mha,
+    const Tensor* input_q,
+    const KVCache* cache,
+    const AttentionMask* mask,
+    Tensor* output
+) {
+    if (!mha || !input_q || !cache || !output || cache->length <= 0) {
+        fprintf(stderr, "Cross-attention cache is empty\n");
         return false;
     }
+    int batch_size = input_q->shape[0];
+    int seq_len_q = input_q->shape[1];
+    bool success = false;
+    TensorArena* arena = tensor_arena_active();
+    size_t mark = tensor_arena_mark(arena);
+
+    int q_shape[] = {batch_size, mha->num_heads, seq_len_q, mha->head_dim};
+    int context_shape[] = {batch_size, seq_len_q, mha->model_dim};
+    Tensor* q_heads = tensor_create_scratch_uninit(q_shape, 4);
+    Tensor* context = tensor_create_scratch_uninit(context_shape, 3);
+    Tensor* k_heads = kv_cache_view_k(cache, 0, cache->length);
+    Tensor* v_heads = kv_cache_view_v(cache, 0, cache->length);
+    Tensor* context_heads = NULL;
+    if (!q_heads || !context || !k_heads || !v_heads) {
+        goto cleanup;
+    }
 
-    // 5. 释放临时张量
-    tensor_free(reshaped_q);
-    tensor_free(reshaped_k); 
-    tensor_free(reshaped_v);
-    
-    tensor_free(temp_q);
-    tensor_free(temp_k);
-    tensor_free(temp_v);
-    return true;
-}
\ No newline at end of file
+    // 只投影Q, K/V直接取缓存; 多个beam共享K/V时由注意力内核按batch分组广播
+    if (!tensor_linear_split_heads(input_q, mha->W_q, mha->b_q, &q_heads, 1)) {
+        goto cleanup;
+    }
+    context_heads = tensor_view_split_heads(context, mha->num_heads);
+    if (!context_heads || !attend_heads(q_heads, k_heads, v_heads, mask, context_heads)) {
+        goto cleanup;
+    }
+    if (!tensor_linear_3d(context, mha->W_o, mha->b_o, output)) {
+        goto cleanup;
+    }
+    success = true;
+
+cleanup:
+    tensor_free(context_heads);
+    tensor_free(k_heads);
+    tensor_free(v_heads);
+    tensor_free(q_heads);
+    tensor_free(context);
+    tensor_arena_release(arena, mark);
+    return success;
+}
+
+// 按头计算注意力: softmax(Q * K^T / sqrt(head_dim) + mask) * V, 结果写入context_heads
+// 分块计算, 不生成[seq_len_q, seq_len_k]的分数矩阵
+static bool attend_heads(
+    const Tensor* q_heads, const Tensor* k_heads, const Tensor* v_heads,
+    const AttentionMask* mask, Tensor* context_heads
+) {
+    float scale = 1.0f / sqrtf((float)q_heads->shape[3]);
+    FlashMask spec;
+    attention_mask_spec(mask, &spec);
+    return tensor_flash_attention_masked(q_heads, k_heads, v_heads, mask ? &spec : NULL,
+                                         scale, context_heads);
+}
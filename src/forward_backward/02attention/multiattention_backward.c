@@ -1,4 +1,5 @@
 #include "03multiattention_backward.h"
+#include "tensor_arena.h"
 
 bool multihead_attention_backward(
     MultiHeadAttention* mha,
@@ -12,15 +13,15 @@ bool multihead_attention_backward(
     }
 
     // 创建临时张量
-    Tensor* grad_q = tensor_create(input->shape, input->num_dims);
-    Tensor* grad_k = tensor_create(input->shape, input->num_dims);
-    Tensor* grad_v = tensor_create(input->shape, input->num_dims);
+    Tensor* grad_q = tensor_create_scratch(input->shape, input->num_dims);
+    Tensor* grad_k = tensor_create_scratch(input->shape, input->num_dims);
+    Tensor* grad_v = tensor_create_scratch(input->shape, input->num_dims);
     if (!grad_q || !grad_k || !grad_v) {
         goto cleanup;
     }
 
     // 1. 输出投影的反向传播
-    Tensor* grad_multihead = tensor_create(grad_output->shape, grad_output->num_dims);
+    Tensor* grad_multihead = tensor_create_scratch(grad_output->shape, grad_output->num_dims);
     if (!linear_backward(mha->output_proj, grad_output, grad_multihead)) {
         goto cleanup;
     }
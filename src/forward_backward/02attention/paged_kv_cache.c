@@ -0,0 +1,208 @@
+#include "paged_kv_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+PagedKVCache* paged_kv_cache_create(int num_layers, int num_blocks, int block_size,
+                                    int num_heads, int head_dim) {
+    if (num_layers <= 0 || num_blocks <= 0 || block_size <= 0 || num_heads <= 0 || head_dim <= 0) {
+        fprintf(stderr, "Invalid paged KV cache dimensions\n");
+        return NULL;
+    }
+
+    PagedKVCache* cache = (PagedKVCache*)calloc(1, sizeof(PagedKVCache));
+    if (!cache) return NULL;
+
+    cache->num_layers = num_layers;
+    cache->num_blocks = num_blocks;
+    cache->block_size = block_size;
+    cache->num_heads = num_heads;
+    cache->head_dim = head_dim;
+    cache->k = (Tensor**)calloc(num_layers, sizeof(Tensor*));
+    cache->v = (Tensor**)calloc(num_layers, sizeof(Tensor*));
+    cache->ref_counts = (int*)calloc(num_blocks, sizeof(int));
+    cache->free_blocks = (int*)malloc(num_blocks * sizeof(int));
+    if (!cache->k || !cache->v || !cache->ref_counts || !cache->free_blocks) {
+        fprintf(stderr, "Failed to allocate paged KV cache\n");
+        paged_kv_cache_free(cache);
+        return NULL;
+    }
+
+    int shape[] = {num_blocks, num_heads, block_size, head_dim};
+    for (int l = 0; l < num_layers; l++) {
+        cache->k[l] = tensor_create(shape, 4);
+        cache->v[l] = tensor_create(shape, 4);
+        if (!cache->k[l] || !cache->v[l]) {
+            fprintf(stderr, "Failed to allocate KV block pool\n");
+            paged_kv_cache_free(cache);
+            return NULL;
+        }
+    }
+
+    // 小块号在栈顶, 先分配
+    for (int i = 0; i < num_blocks; i++) {
+        cache->free_blocks[i] = num_blocks - 1 - i;
+    }
+    cache->num_free = num_blocks;
+    return cache;
+}
+
+void paged_kv_cache_free(PagedKVCache* cache) {
+    if (!cache) return;
+    for (int l = 0; l < cache->num_layers; l++) {
+        if (cache->k) tensor_free(cache->k[l]);
+        if (cache->v) tensor_free(cache->v[l]);
+    }
+    free(cache->k);
+    free(cache->v);
+    free(cache->ref_counts);
+    free(cache->free_blocks);
+    free(cache);
+}
+
+int paged_kv_cache_blocks_for_budget(size_t budget_bytes, int num_layers, int block_size,
+                                     int num_heads, int head_dim) {
+    size_t block_bytes = 2 * (size_t)num_layers * num_heads * block_size * head_dim * sizeof(float);
+    return block_bytes > 0 ? (int)(budget_bytes / block_bytes) : 0;
+}
+
+int paged_kv_cache_num_free(const PagedKVCache* cache) {
+    return cache ? cache->num_free : 0;
+}
+
+static int block_alloc(PagedKVCache* cache) {
+    if (cache->num_free == 0) {
+        return -1;
+    }
+    int block = cache->free_blocks[--cache->num_free];
+    cache->ref_counts[block] = 1;
+    return block;
+}
+
+static void block_release(PagedKVCache* cache, int block) {
+    if (--cache->ref_counts[block] == 0) {
+        cache->free_blocks[cache->num_free++] = block;
+    }
+}
+
+// 一层中一个块的数据: [num_heads, block_size, head_dim], 在池中连续存放
+static size_t block_floats(const PagedKVCache* cache) {
+    return (size_t)cache->num_heads * cache->block_size * cache->head_dim;
+}
+
+static void block_copy(PagedKVCache* cache, int dst, int src) {
+    size_t n = block_floats(cache);
+    for (int l = 0; l < cache->num_layers; l++) {
+        memcpy(cache->k[l]->data + dst * n, cache->k[l]->data + src * n, n * sizeof(float));
+        memcpy(cache->v[l]->data + dst * n, cache->v[l]->data + src * n, n * sizeof(float));
+    }
+}
+
+static bool table_reserve(PagedSequence* seq, int num_blocks) {
+    if (num_blocks <= seq->capacity) {
+        return true;
+    }
+    int capacity = seq->capacity ? seq->capacity * 2 : 8;
+    while (capacity < num_blocks) capacity *= 2;
+    int* table = (int*)realloc(seq->block_table, capacity * sizeof(int));
+    if (!table) {
+        fprintf(stderr, "Failed to grow block table\n");
+        return false;
+    }
+    seq->block_table = table;
+    seq->capacity = capacity;
+    return true;
+}
+
+PagedSequence* paged_sequence_create(void) {
+    PagedSequence* seq = (PagedSequence*)calloc(1, sizeof(PagedSequence));
+    if (!seq) {
+        fprintf(stderr, "Failed to allocate paged sequence\n");
+    }
+    return seq;
+}
+
+void paged_sequence_reset(PagedKVCache* cache, PagedSequence* seq) {
+    if (!cache || !seq) return;
+    for (int i = 0; i < seq->num_blocks; i++) {
+        block_release(cache, seq->block_table[i]);
+    }
+    seq->num_blocks = 0;
+    seq->length = 0;
+}
+
+void paged_sequence_free(PagedKVCache* cache, PagedSequence* seq) {
+    if (!seq) return;
+    paged_sequence_reset(cache, seq);
+    free(seq->block_table);
+    free(seq);
+}
+
+PagedSequence* paged_sequence_fork(PagedKVCache* cache, const PagedSequence* parent) {
+    if (!cache || !parent) return NULL;
+
+    PagedSequence* seq = paged_sequence_create();
+    if (!seq || !table_reserve(seq, parent->num_blocks)) {
+        paged_sequence_free(cache, seq);
+        return NULL;
+    }
+    for (int i = 0; i < parent->num_blocks; i++) {
+        seq->block_table[i] = parent->block_table[i];
+        cache->ref_counts[parent->block_table[i]]++;
+    }
+    seq->num_blocks = parent->num_blocks;
+    seq->length = parent->length;
+    return seq;
+}
+
+bool paged_sequence_append(PagedKVCache* cache, PagedSequence* seq) {
+    if (!cache || !seq) return false;
+
+    int position = seq->length;
+    int index = position / cache->block_size;
+
+    if (index == seq->num_blocks) {
+        // 上一块已满, 取一个新块
+        if (!table_reserve(seq, index + 1)) return false;
+        int block = block_alloc(cache);
+        if (block < 0) return false;
+        seq->block_table[seq->num_blocks++] = block;
+    } else {
+        // 写入共享块之前先复制, 其他序列继续使用原来的块
+        int shared = seq->block_table[index];
+        if (cache->ref_counts[shared] > 1) {
+            int block = block_alloc(cache);
+            if (block < 0) return false;
+            block_copy(cache, block, shared);
+            block_release(cache, shared);
+            seq->block_table[index] = block;
+        }
+    }
+
+    seq->length = position + 1;
+    return true;
+}
+
+void paged_sequence_truncate(PagedKVCache* cache, PagedSequence* seq, int length) {
+    if (!cache || !seq || length < 0 || length >= seq->length) return;
+
+    int needed = (length + cache->block_size - 1) / cache->block_size;
+    while (seq->num_blocks > needed) {
+        block_release(cache, seq->block_table[--seq->num_blocks]);
+    }
+    seq->length = length;
+}
+
+void paged_kv_cache_store(PagedKVCache* cache, int layer, const PagedSequence* seq, int position,
+                          const float* k, const float* v, long head_stride) {
+    int block = seq->block_table[position / cache->block_size];
+    int offset = position % cache->block_size;
+    size_t head_floats = (size_t)cache->block_size * cache->head_dim;
+    float* k_dst = cache->k[layer]->data + block * block_floats(cache) + (size_t)offset * cache->head_dim;
+    float* v_dst = cache->v[layer]->data + block * block_floats(cache) + (size_t)offset * cache->head_dim;
+
+    for (int h = 0; h < cache->num_heads; h++) {
+        memcpy(k_dst + h * head_floats, k + h * head_stride, cache->head_dim * sizeof(float));
+        memcpy(v_dst + h * head_floats, v + h * head_stride, cache->head_dim * sizeof(float));
+    }
+}
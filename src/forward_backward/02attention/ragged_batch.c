@@ -0,0 +1,84 @@
+#include "ragged_batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+RaggedBatch* ragged_batch_create(const int* seq_lens, int num_seqs) {
+    if (!seq_lens || num_seqs <= 0) {
+        return NULL;
+    }
+
+    RaggedBatch* batch = (RaggedBatch*)malloc(sizeof(RaggedBatch));
+    if (!batch) return NULL;
+    batch->cu_seqlens = (int*)malloc((num_seqs + 1) * sizeof(int));
+    if (!batch->cu_seqlens) {
+        free(batch);
+        return NULL;
+    }
+
+    batch->num_seqs = num_seqs;
+    batch->max_seq_len = 0;
+    batch->cu_seqlens[0] = 0;
+    for (int i = 0; i < num_seqs; i++) {
+        if (seq_lens[i] < 0) {
+            fprintf(stderr, "Negative sequence length\n");
+            ragged_batch_free(batch);
+            return NULL;
+        }
+        batch->cu_seqlens[i + 1] = batch->cu_seqlens[i] + seq_lens[i];
+        if (seq_lens[i] > batch->max_seq_len) {
+            batch->max_seq_len = seq_lens[i];
+        }
+    }
+    batch->total_tokens = batch->cu_seqlens[num_seqs];
+    return batch;
+}
+
+void ragged_batch_free(RaggedBatch* batch) {
+    if (batch) {
+        free(batch->cu_seqlens);
+        free(batch);
+    }
+}
+
+int ragged_batch_seq_len(const RaggedBatch* batch, int i) {
+    return batch->cu_seqlens[i + 1] - batch->cu_seqlens[i];
+}
+
+static bool check_layout(const RaggedBatch* batch, const Tensor* padded, const Tensor* packed) {
+    if (!batch || !padded || !packed || padded->num_dims != 3 || packed->num_dims != 3 ||
+        padded->shape[0] != batch->num_seqs || padded->shape[1] < batch->max_seq_len ||
+        packed->shape[0] != 1 || packed->shape[1] != batch->total_tokens ||
+        packed->shape[2] != padded->shape[2] ||
+        !tensor_is_contiguous(padded) || !tensor_is_contiguous(packed)) {
+        fprintf(stderr, "Padded and packed tensors do not match the ragged batch\n");
+        return false;
+    }
+    return true;
+}
+
+bool ragged_batch_pack(const RaggedBatch* batch, const Tensor* padded, Tensor* packed) {
+    if (!check_layout(batch, padded, packed)) return false;
+
+    int dim = padded->shape[2];
+    size_t seq_stride = (size_t)padded->shape[1] * dim;
+    for (int i = 0; i < batch->num_seqs; i++) {
+        memcpy(packed->data + (size_t)batch->cu_seqlens[i] * dim, padded->data + i * seq_stride,
+               (size_t)ragged_batch_seq_len(batch, i) * dim * sizeof(float));
+    }
+    return true;
+}
+
+bool ragged_batch_unpack(const RaggedBatch* batch, const Tensor* packed, Tensor* padded) {
+    if (!check_layout(batch, padded, packed)) return false;
+
+    int dim = padded->shape[2];
+    size_t seq_stride = (size_t)padded->shape[1] * dim;
+    for (int i = 0; i < batch->num_seqs; i++) {
+        size_t len = (size_t)ragged_batch_seq_len(batch, i) * dim;
+        float* dst = padded->data + i * seq_stride;
+        memcpy(dst, packed->data + (size_t)batch->cu_seqlens[i] * dim, len * sizeof(float));
+        memset(dst + len, 0, (seq_stride - len) * sizeof(float));
+    }
+    return true;
+}
@@ -2,19 +2,36 @@
 #define LAYER_NORM_H
 
 #include "tensor_type.h"
+#include "model_config.h"
 
+// 归一化层, LayerNorm或RMSNorm
 typedef struct LayerNorm {
     float eps;          // 用于数值稳定性的小值
+    NormType type;
     Tensor* gamma;      // 缩放参数
-    Tensor* beta;       // 偏移参数
+    Tensor* beta;       // 偏移参数, RMSNorm为NULL
     int normalized_dim; // 需要归一化的维度
+
+    // 最近一次前向计算每行的均值和1 / sqrt(var + eps), 供反向传播使用
+    // RMSNorm只记录1 / sqrt(mean(x^2) + eps), 不写均值
+    float* mean_cache;
+    float* rstd_cache;
+    int cache_rows;     // 最近一次前向的行数
+    int cache_capacity;
 } LayerNorm;
 
 // 创建和释放函数
 LayerNorm* layer_norm_create(int normalized_shape, float eps);
+LayerNorm* rms_norm_create(int normalized_shape, float eps);
+LayerNorm* layer_norm_create_typed(int normalized_shape, float eps, NormType type);
 void layer_norm_free(LayerNorm* ln);
 
 // 前向计算函数
 bool layer_norm_forward(LayerNorm* ln, Tensor* input, Tensor* output);
 
+// 残差连接与层归一化融合: output = LayerNorm(input + residual)
+// sum非NULL时同时写出input + residual; input、sum和output可以是同一个张量
+bool layer_norm_forward_residual(LayerNorm* ln, const Tensor* input, const Tensor* residual,
+                                 Tensor* sum, Tensor* output);
+
 #endif
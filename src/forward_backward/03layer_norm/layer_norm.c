@@ -2,26 +2,40 @@
 #include "tensor_std.h"
 #include <stdlib.h>
 #include <math.h>
+#include <stdio.h>
 
 LayerNorm* layer_norm_create(int normalized_shape, float eps) {
+    return layer_norm_create_typed(normalized_shape, eps, NORM_LAYER_NORM);
+}
+
+LayerNorm* rms_norm_create(int normalized_shape, float eps) {
+    return layer_norm_create_typed(normalized_shape, eps, NORM_RMS_NORM);
+}
+
+LayerNorm* layer_norm_create_typed(int normalized_shape, float eps, NormType type) {
     LayerNorm* ln = (LayerNorm*)malloc(sizeof(LayerNorm));
+    if (!ln) return NULL;
     ln->eps = eps;
-    
-    // 创建gamma和beta参数，初始化gamma为1，beta为0
+    ln->type = type;
+    ln->normalized_dim = normalized_shape;
+    ln->mean_cache = NULL;
+    ln->rstd_cache = NULL;
+    ln->cache_rows = 0;
+    ln->cache_capacity = 0;
+
+    // 创建gamma和beta参数，初始化gamma为1，beta为0; RMSNorm没有beta
     int shape[] = {normalized_shape};
     ln->gamma = tensor_create(shape, 1);
-    ln->beta = tensor_create(shape, 1);
+    ln->beta = type == NORM_LAYER_NORM ? tensor_create(shape, 1) : NULL;
+    if (!ln->gamma || (type == NORM_LAYER_NORM && !ln->beta)) {
+        layer_norm_free(ln);
+        return NULL;
+    }
     
-    // 初始化gamma为1
+    // 初始化gamma为1, beta由tensor_create置0
     for (int i = 0; i < normalized_shape; i++) {
         ln->gamma->data[i] = 1.0f;
     }
-    // 初始化beta为0
-    for (int i = 0; i < normalized_shape; i++) {
-        ln->beta->data[i] = 0.0f;
-    }
-    
-    ln->normalized_dim = normalized_shape;
     return ln;
 }
 
@@ -29,20 +43,55 @@ void layer_norm_free(LayerNorm* ln) {
     if (ln) {
         tensor_free(ln->gamma);
         tensor_free(ln->beta);
+        free(ln->mean_cache);
+        free(ln->rstd_cache);
         free(ln);
     }
 }
 
+// 按行数扩大均值/rstd缓存
+static bool layer_norm_reserve_cache(LayerNorm* ln, int rows) {
+    if (rows > ln->cache_capacity) {
+        float* mean = (float*)realloc(ln->mean_cache, sizeof(float) * rows);
+        if (mean) ln->mean_cache = mean;
+        float* rstd = (float*)realloc(ln->rstd_cache, sizeof(float) * rows);
+        if (rstd) ln->rstd_cache = rstd;
+        if (!mean || !rstd) {
+            fprintf(stderr, "Failed to allocate layer norm statistics\n");
+            return false;
+        }
+        ln->cache_capacity = rows;
+    }
+    ln->cache_rows = rows;
+    return true;
+}
+
 bool layer_norm_forward(LayerNorm* ln, Tensor* input, Tensor* output) {
+    return layer_norm_forward_residual(ln, input, NULL, NULL, output);
+}
+
+bool layer_norm_forward_residual(LayerNorm* ln, const Tensor* input, const Tensor* residual,
+                                 Tensor* sum, Tensor* output) {
     if (!input || !output || !ln) {
         return false;
     }
+    if (!layer_norm_reserve_cache(ln, input->shape[0] * input->shape[1])) {
+        return false;
+    }
 
-    return layer_norm_forward_3d(
+    if (ln->type == NORM_RMS_NORM) {
+        return residual_rms_norm_forward_3d(input, residual, sum, output,
+                                            ln->gamma, ln->eps, ln->rstd_cache);
+    }
+    return residual_layer_norm_forward_3d(
         input,
-        output, 
+        residual,
+        sum,
+        output,
         ln->gamma,
         ln->beta,
-        ln->eps
+        ln->eps,
+        ln->mean_cache,
+        ln->rstd_cache
     );
 }
@@ -12,7 +12,6 @@ bool layer_norm_backward(
     int batch_size = grad_output->shape[0];
     int seq_len = grad_output->shape[1];
     int model_dim = grad_output->shape[2];
-    float eps = 1e-5f;
 
     // 创建临时张量
     Tensor* grad_gamma = tensor_create_1d(model_dim);
@@ -25,10 +24,11 @@ bool layer_norm_backward(
 
     for (int b = 0; b < batch_size; b++) {
         for (int s = 0; s < seq_len; s++) {
-            float mean = ln->mean_cache[b * seq_len + s];
-            float var = ln->var_cache[b * seq_len + s];
-            float std = sqrtf(var + eps);
-            float inv_std = 1.0f / std;
+            // 前向计算缓存的均值和1 / sqrt(var + eps)
+            // RMSNorm不减均值, 相当于均值为0且没有均值的梯度项
+            bool rms = ln->type == NORM_RMS_NORM;
+            float mean = rms ? 0.0f : ln->mean_cache[b * seq_len + s];
+            float inv_std = ln->rstd_cache[b * seq_len + s];
 
             // 计算中间值
             float sum_grad = 0.0f;
@@ -50,13 +50,13 @@ bool layer_norm_backward(
                 float grad = grad_output->data[idx];
                 
                 grad_input->data[idx] = ln->gamma->data[h] * inv_std * (
-                    grad - (sum_grad / model_dim) - 
-                    ((x - mean) * sum_grad_x) / (model_dim * var)
+                    grad - (rms ? 0.0f : sum_grad / model_dim) - 
+                    ((x - mean) * sum_grad_x) * inv_std * inv_std / model_dim
                 );
 
                 // 累积gamma和beta的梯度
                 grad_gamma->data[h] += grad * (x - mean) * inv_std;
-                grad_beta->data[h] += grad;
+                if (!rms) grad_beta->data[h] += grad;
             }
         }
     }
@@ -1,17 +1,33 @@
 #include "feed_forward.h"
-#include "relu.h"
 #include "tensor_mul.h"
-#include "tensor_add.h"
+#include "tensor_logic.h"
+#include "tensor_arena.h"
 #include <stdlib.h>
+#include <stdio.h>
 
-FeedForward* feed_forward_create(int input_dim, int hidden_dim) {
+static bool feed_forward_gated(const FeedForward* ff) {
+    return ff->activation == FFN_ACT_SWIGLU || ff->activation == FFN_ACT_GEGLU;
+}
+
+GemmActivation feed_forward_gemm_activation(FfnActivation activation) {
+    switch (activation) {
+        case FFN_ACT_GELU:   return GEMM_ACT_GELU;
+        case FFN_ACT_SWIGLU: return GEMM_ACT_SWIGLU;
+        case FFN_ACT_GEGLU:  return GEMM_ACT_GEGLU;
+        default:             return GEMM_ACT_RELU;
+    }
+}
+
+FeedForward* feed_forward_create(int input_dim, int hidden_dim, FfnActivation activation) {
     FeedForward* ff = (FeedForward*)malloc(sizeof(FeedForward));
     if (!ff) return NULL;
+    ff->activation = activation;
 
-    // 创建权重矩阵
-    int w1_shape[] = {input_dim, hidden_dim};  // [input_dim, hidden_dim]
+    // 创建权重矩阵, 门控变体的gate和up拼接在w1中, 一次GEMM算出
+    int w1_cols = feed_forward_gated(ff) ? 2 * hidden_dim : hidden_dim;
+    int w1_shape[] = {input_dim, w1_cols};     // [input_dim, hidden_dim]或[input_dim, 2 * hidden_dim]
     int w2_shape[] = {hidden_dim, input_dim};  // [hidden_dim, input_dim]
-    int b1_shape[] = {hidden_dim};             // [hidden_dim]
+    int b1_shape[] = {w1_cols};
     int b2_shape[] = {input_dim};              // [input_dim]
 
     ff->w1 = tensor_create(w1_shape, 2);
@@ -22,24 +38,72 @@ FeedForward* feed_forward_create(int input_dim, int hidden_dim) {
     return ff;
 }
 
+bool feed_forward_load_gated(FeedForward* ff, const Tensor* gate_w, const Tensor* up_w,
+                             const Tensor* gate_b, const Tensor* up_b) {
+    if (!ff || !gate_w || !up_w || !feed_forward_gated(ff)) {
+        return false;
+    }
+    int input_dim = ff->w1->shape[0];
+    int hidden_dim = ff->w2->shape[0];
+    if (gate_w->num_dims != 2 || up_w->num_dims != 2 ||
+        gate_w->shape[0] != input_dim || gate_w->shape[1] != hidden_dim ||
+        up_w->shape[0] != input_dim || up_w->shape[1] != hidden_dim ||
+        (gate_b && gate_b->shape[0] != hidden_dim) || (up_b && up_b->shape[0] != hidden_dim)) {
+        fprintf(stderr, "Gated feed-forward weights must be [%d, %d]\n", input_dim, hidden_dim);
+        return false;
+    }
+
+    int cols = 2 * hidden_dim;
+    for (int j = 0; j < hidden_dim; j++) {
+        int g = gemm_gated_column(hidden_dim, j, false);
+        int u = gemm_gated_column(hidden_dim, j, true);
+        for (int i = 0; i < input_dim; i++) {
+            ff->w1->data[(long)i * cols + g] = gate_w->data[(long)i * hidden_dim + j];
+            ff->w1->data[(long)i * cols + u] = up_w->data[(long)i * hidden_dim + j];
+        }
+        ff->b1->data[g] = gate_b ? gate_b->data[j] : 0.0f;
+        ff->b1->data[u] = up_b ? up_b->data[j] : 0.0f;
+    }
+    return true;
+}
+
 bool feed_forward_forward(FeedForward* ff, const Tensor* input, Tensor* output) {
-    // input shape: [batch_size, input_dim]
-    int batch_size = input->shape[0];
-    int input_dim = input->shape[1];
-    int hidden_dim = ff->w1->shape[0];
+    return feed_forward_forward_residual(ff, input, NULL, 0.0f, NULL, output);
+}
 
-    // 第一个线性变换: intermediate = x * W1 + b1 (注意这里是x乘以W1,而不是W1乘以x)
-    if (!tensor_matmul_2d(input, ff->w1, output)) return false;
-    if (!tensor_add(output, ff->b1, output)) return false;
+bool feed_forward_forward_residual(FeedForward* ff, const Tensor* input, const Tensor* residual,
+                                   float dropout_prob, DropoutMask* dropout_mask, Tensor* output) {
+    // input shape: [batch_size, seq_len, input_dim]
+    int hidden_dim = ff->w2->shape[0];
+    int hidden_shape[] = {input->shape[0], input->shape[1], hidden_dim};
 
-    // ReLU激活
-    relu_forward(output, output);
+    // 中间层完全由GEMM写入, 不需要清零
+    Tensor* hidden = tensor_create_scratch_uninit(hidden_shape, 3);
+    if (!hidden) return false;
 
-    // 第二个线性变换: output = relu_output * W2 + b2
-    if (!tensor_matmul_2d(output, ff->w2, output)) return false;
-    if (!tensor_add(output, ff->b2, output)) return false;
+    // 第一个线性变换: hidden = act(x * W1 + b1), 偏置和激活在写回时完成
+    // 门控变体: 同一个微块里有配对的gate和up, 写回act(gate) * up, 不写出[tokens, 2 * hidden_dim]
+    GemmEpilogue first = {
+        .activation = feed_forward_gemm_activation(ff->activation),
+    };
 
-    return true;
+    // 第二个线性变换: output = dropout(hidden * W2 + b2) + residual
+    GemmEpilogue second = {
+        .dropout_prob = dropout_prob,
+        .dropout_seed = dropout_prob > 0.0f ? dropout_next_seed() : 0,
+    };
+
+    bool success = tensor_linear_3d_ex(input, ff->w1, ff->b1, NULL, &first, hidden) &&
+                   tensor_linear_3d_ex(hidden, ff->w2, ff->b2, residual, &second, output);
+
+    // 写回时的dropout与dropout_forward是同一个计数器随机数序列, 按种子重新生成掩码
+    if (success && dropout_mask) {
+        long n = (long)calculate_total_size(output->shape, output->num_dims);
+        success = dropout_mask_generate(dropout_mask, n, dropout_prob, second.dropout_seed);
+    }
+
+    tensor_free(hidden);
+    return success;
 }
 
 void feed_forward_free(FeedForward* ff) {
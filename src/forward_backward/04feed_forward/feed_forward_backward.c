@@ -1,4 +1,5 @@
 #include "feed_forward_backward.h"
+#include "tensor_arena.h"
 #include "relu_backward.h"
 #include "linear_backward.h"
 
@@ -13,7 +14,7 @@ bool feed_forward_backward(
     }
 
     // 创建临时张量存储中间梯度
-    Tensor* hidden_grad = tensor_create(ff->hidden->shape, ff->hidden->num_dims);
+    Tensor* hidden_grad = tensor_create_scratch(ff->hidden->shape, ff->hidden->num_dims);
     if (!hidden_grad) return false;
 
     // 1. 输出层的反向传播
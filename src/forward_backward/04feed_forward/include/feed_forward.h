@@ -2,22 +2,42 @@
 #define FEED_FORWARD_H
 
 #include "tensor_type.h"
+#include "model_config.h"
+#include "tensor_gemm.h"
+#include "tensor_logic.h"
 
 typedef struct FeedForward FeedForward;
 
 struct FeedForward {
-    Tensor* w1;  // 第一个线性变换的权重
-    Tensor* b1;  // 第一个线性变换的偏置
+    Tensor* w1;  // 第一个线性变换的权重, 门控变体是[input_dim, 2 * hidden_dim]的gate/up交错拼接
+    Tensor* b1;  // 第一个线性变换的偏置, 门控变体同样交错拼接
     Tensor* w2;  // 第二个线性变换的权重
     Tensor* b2;  // 第二个线性变换的偏置
+    FfnActivation activation;
 };
 
 // 创建前馈层
-FeedForward* feed_forward_create(int input_dim, int hidden_dim);
+FeedForward* feed_forward_create(int input_dim, int hidden_dim, FfnActivation activation);
 
-// 前向传播
+// 门控变体写入分开的gate/up参数, 按GEMM需要的列顺序拼接到w1/b1
+// gate_w/up_w: [input_dim, hidden_dim]; gate_b/up_b: [hidden_dim] 或 NULL(偏置为0)
+bool feed_forward_load_gated(FeedForward* ff, const Tensor* gate_w, const Tensor* up_w,
+                             const Tensor* gate_b, const Tensor* up_b);
+
+// 前向传播, input/output: [batch_size, seq_len, input_dim]
+// 中间层从活动arena分配
 bool feed_forward_forward(FeedForward* ff, const Tensor* input, Tensor* output);
 
+// 前向传播并融合之后的dropout和残差连接: output = dropout(FFN(input)) + residual
+// 偏置、激活、dropout和残差都在GEMM写回时完成, 不再单独遍历中间层和输出
+// residual: [batch_size, seq_len, input_dim] 或 NULL, 可以与output相同(此时dropout_prob必须为0)
+// dropout_mask非NULL时记录dropout的保留掩码, 供反向传播使用
+bool feed_forward_forward_residual(FeedForward* ff, const Tensor* input, const Tensor* residual,
+                                   float dropout_prob, DropoutMask* dropout_mask, Tensor* output);
+
+// 第一个线性变换写回时使用的GEMM激活
+GemmActivation feed_forward_gemm_activation(FfnActivation activation);
+
 // 释放资源
 void feed_forward_free(FeedForward* ff);
 
@@ -0,0 +1,45 @@
+#ifndef MOE_H
+#define MOE_H
+
+#include "tensor_type.h"
+#include "model_config.h"
+#include "feed_forward.h"
+#include "linear.h"
+
+typedef struct MoEFeedForward MoEFeedForward;
+
+// 混合专家前馈层: 路由器为每个token选出top_k个专家, 输出是这些专家FFN输出的加权和
+// 权重是所选专家的路由logits做softmax(只在top_k个之间归一化)
+struct MoEFeedForward {
+    int num_experts;
+    int top_k;
+    float capacity_factor;      // 每个专家最多处理ceil(capacity_factor * tokens * top_k / num_experts)个token, <= 0时不限制
+    Linear* router;             // [input_dim, num_experts]
+    FeedForward** experts;      // num_experts个结构相同的前馈层
+
+    // 负载统计, 每次前向累加, moe_reset_stats清零
+    long* expert_load;          // [num_experts] 各专家实际处理的token数
+    long routed_tokens;         // 路由过的token数
+    long dropped;               // 因专家超出容量而丢弃的(token, 专家)分配数
+};
+
+// 创建混合专家层, 各专家的结构与feed_forward_create相同
+MoEFeedForward* moe_create(int input_dim, int hidden_dim, FfnActivation activation,
+                           int num_experts, int top_k, float capacity_factor);
+
+// 前向传播: output = dropout(MoE(input)) + residual
+// 同一专家的token先收集成连续的行, 所有专家的两个线性变换各用一次分组GEMM完成
+// 超出容量的分配被丢弃, 其余专家的权重不重新归一化; 所有分配都被丢弃的token输出为0(只剩残差)
+// input/output: [batch_size, seq_len, input_dim]
+// residual: 同形状或NULL, 可以与output相同(此时dropout_prob必须为0)
+// dropout_mask非NULL时记录dropout的保留掩码
+bool moe_forward_residual(MoEFeedForward* moe, const Tensor* input, const Tensor* residual,
+                          float dropout_prob, DropoutMask* dropout_mask, Tensor* output);
+
+// 负载统计清零
+void moe_reset_stats(MoEFeedForward* moe);
+
+// 释放资源
+void moe_free(MoEFeedForward* moe);
+
+#endif
@@ -0,0 +1,318 @@
+#include "moe.h"
+#include "tensor_mul.h"
+#include "tensor_add.h"
+#include "tensor_logic.h"
+#include "tensor_arena.h"
+#include "thread_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+MoEFeedForward* moe_create(int input_dim, int hidden_dim, FfnActivation activation,
+                           int num_experts, int top_k, float capacity_factor) {
+    if (num_experts <= 0 || top_k <= 0 || top_k > num_experts) {
+        fprintf(stderr, "Invalid MoE configuration: %d experts, top-%d\n", num_experts, top_k);
+        return NULL;
+    }
+    // 分组GEMM中门控激活的K不分块
+    if ((activation == FFN_ACT_SWIGLU || activation == FFN_ACT_GEGLU) && input_dim > GEMM_GATED_MAX_K) {
+        fprintf(stderr, "Gated MoE experts support input_dim up to %d\n", GEMM_GATED_MAX_K);
+        return NULL;
+    }
+
+    MoEFeedForward* moe = (MoEFeedForward*)calloc(1, sizeof(MoEFeedForward));
+    if (!moe) return NULL;
+    moe->num_experts = num_experts;
+    moe->top_k = top_k;
+    moe->capacity_factor = capacity_factor;
+
+    moe->router = linear_create(input_dim, num_experts);
+    moe->experts = (FeedForward**)calloc(num_experts, sizeof(FeedForward*));
+    moe->expert_load = (long*)calloc(num_experts, sizeof(long));
+    if (!moe->router || !moe->experts || !moe->expert_load) {
+        moe_free(moe);
+        return NULL;
+    }
+    for (int e = 0; e < num_experts; e++) {
+        moe->experts[e] = feed_forward_create(input_dim, hidden_dim, activation);
+        if (!moe->experts[e]) {
+            moe_free(moe);
+            return NULL;
+        }
+    }
+    return moe;
+}
+
+void moe_reset_stats(MoEFeedForward* moe) {
+    if (!moe) return;
+    memset(moe->expert_load, 0, moe->num_experts * sizeof(long));
+    moe->routed_tokens = 0;
+    moe->dropped = 0;
+}
+
+// 每个token的top-k专家和权重
+typedef struct {
+    const float* logits;    // [tokens, num_experts]
+    int num_experts;
+    int top_k;
+    int* expert;            // [tokens, top_k] 按logit从大到小
+    float* weight;          // [tokens, top_k]
+} MoETopKCtx;
+
+static void moe_topk_range(void* arg, long begin, long end) {
+    const MoETopKCtx* ctx = (const MoETopKCtx*)arg;
+    int k = ctx->top_k;
+    for (long t = begin; t < end; t++) {
+        const float* row = ctx->logits + t * ctx->num_experts;
+        int* ids = ctx->expert + t * k;
+        float* w = ctx->weight + t * k;
+
+        // 插入排序维护当前最大的k个, logit相同时序号小的优先
+        int n = 0;
+        for (int e = 0; e < ctx->num_experts; e++) {
+            float v = row[e];
+            if (n == k && !(v > row[ids[k - 1]])) continue;
+            int i = n < k ? n++ : k - 1;
+            while (i > 0 && row[ids[i - 1]] < v) {
+                ids[i] = ids[i - 1];
+                i--;
+            }
+            ids[i] = e;
+        }
+
+        // 只在所选专家之间做softmax
+        float max = row[ids[0]];
+        float sum = 0.0f;
+        for (int j = 0; j < k; j++) {
+            w[j] = expf(row[ids[j]] - max);
+            sum += w[j];
+        }
+        for (int j = 0; j < k; j++) {
+            w[j] /= sum;
+        }
+    }
+}
+
+// 把每个分配对应的token行复制到该专家的连续区域
+typedef struct {
+    const float* input;     // [tokens, dim]
+    float* gathered;        // [max_rows, dim], 只用前面实际分到专家的行
+    const int* slot;        // [tokens * top_k], -1表示被丢弃
+    int top_k;
+    int dim;
+} MoEGatherCtx;
+
+static void moe_gather_range(void* arg, long begin, long end) {
+    const MoEGatherCtx* ctx = (const MoEGatherCtx*)arg;
+    for (long a = begin; a < end; a++) {
+        int slot = ctx->slot[a];
+        if (slot < 0) continue;
+        memcpy(ctx->gathered + (long)slot * ctx->dim, ctx->input + (a / ctx->top_k) * ctx->dim,
+               ctx->dim * sizeof(float));
+    }
+}
+
+// 按token把各专家的输出加权求和写回原来的位置
+typedef struct {
+    const float* expert_out;    // [max_rows, dim], 只用前面实际分到专家的行
+    const float* residual;      // [tokens, dim] 或 NULL, 可以就是output
+    float* output;
+    const int* slot;
+    const float* weight;
+    int top_k;
+    int dim;
+} MoECombineCtx;
+
+static void moe_combine_range(void* arg, long begin, long end) {
+    const MoECombineCtx* ctx = (const MoECombineCtx*)arg;
+    int dim = ctx->dim;
+    for (long t = begin; t < end; t++) {
+        float* out = ctx->output + t * dim;
+        if (!ctx->residual) {
+            memset(out, 0, dim * sizeof(float));
+        } else if (ctx->residual != ctx->output) {
+            memcpy(out, ctx->residual + t * dim, dim * sizeof(float));
+        }
+        for (int j = 0; j < ctx->top_k; j++) {
+            int slot = ctx->slot[t * ctx->top_k + j];
+            if (slot < 0) continue;
+            float w = ctx->weight[t * ctx->top_k + j];
+            const float* y = ctx->expert_out + (long)slot * dim;
+            for (int d = 0; d < dim; d++) {
+                out[d] += w * y[d];
+            }
+        }
+    }
+}
+
+static void* moe_scratch(TensorArena* arena, size_t bytes) {
+    return arena ? tensor_arena_alloc(arena, bytes) : malloc(bytes);
+}
+
+bool moe_forward_residual(MoEFeedForward* moe, const Tensor* input, const Tensor* residual,
+                          float dropout_prob, DropoutMask* dropout_mask, Tensor* output) {
+    if (!moe || !input || !output || input->num_dims != 3) {
+        return false;
+    }
+    if (residual == output && dropout_prob > 0.0f) {
+        fprintf(stderr, "MoE dropout cannot be applied in place on the residual\n");
+        return false;
+    }
+
+    int num_experts = moe->num_experts;
+    int k = moe->top_k;
+    int dim = input->shape[2];
+    int hidden_dim = moe->experts[0]->w2->shape[0];
+    int w1_cols = moe->experts[0]->w1->shape[1];
+    long tokens = (long)input->shape[0] * input->shape[1];
+    long assignments = tokens * k;
+    if (tokens == 0) return true;
+
+    long capacity = tokens;
+    if (moe->capacity_factor > 0.0f) {
+        capacity = (long)ceil((double)moe->capacity_factor * assignments / num_experts);
+        if (capacity > tokens) capacity = tokens;
+    }
+    // 实际分到专家的行数取决于路由结果, 中间结果按上界分配,
+    // 每次前向的分配序列只与形状有关, 内存规划不会失效; GEMM只计算前面实际分到的行
+    long max_rows = capacity * num_experts < assignments ? capacity * num_experts : assignments;
+
+    // 路由索引和分组参数有活动arena时放在arena中, 结束时整体回退
+    TensorArena* arena = tensor_arena_active();
+    size_t mark = tensor_arena_mark(arena);
+    bool success = false;
+    int* expert = (int*)moe_scratch(arena, assignments * sizeof(int));
+    int* slot = (int*)moe_scratch(arena, assignments * sizeof(int));
+    float* weight = (float*)moe_scratch(arena, assignments * sizeof(float));
+    int* offset = (int*)moe_scratch(arena, (num_experts + 1) * sizeof(int));
+    GemmGroup* groups = (GemmGroup*)moe_scratch(arena, num_experts * sizeof(GemmGroup));
+    GemmEpilogue* epilogues = (GemmEpilogue*)moe_scratch(arena, num_experts * sizeof(GemmEpilogue));
+    int logits_shape[] = {input->shape[0], input->shape[1], num_experts};
+    Tensor* logits = tensor_create_scratch_uninit(logits_shape, 3);
+    Tensor* gathered = NULL;
+    Tensor* hidden = NULL;
+    Tensor* expert_out = NULL;
+    if (!expert || !slot || !weight || !offset || !groups || !epilogues || !logits) goto cleanup;
+    memset(offset, 0, (num_experts + 1) * sizeof(int));
+
+    // 1. 路由: logits = x * W_router + b, 每个token选出top_k个专家
+    if (!tensor_linear_3d(input, moe->router->weight, moe->router->bias, logits)) goto cleanup;
+    MoETopKCtx topk = {logits->data, num_experts, k, expert, weight};
+    parallel_for(tokens, 64, moe_topk_range, &topk);
+
+    // 2. 按token顺序分配容量, 记下每个分配在专家内的序号; 超出容量的丢弃
+    int* count = offset + 1;
+    long dropped = 0;
+    for (long a = 0; a < assignments; a++) {
+        int e = expert[a];
+        if (count[e] < capacity) {
+            slot[a] = count[e]++;
+        } else {
+            slot[a] = -1;
+            dropped++;
+        }
+    }
+    moe->routed_tokens += tokens;
+    moe->dropped += dropped;
+    for (int e = 0; e < num_experts; e++) {
+        moe->expert_load[e] += count[e];
+    }
+
+    // 前缀和得到各专家的起始行, 序号转换为全局行号
+    for (int e = 0; e < num_experts; e++) {
+        offset[e + 1] += offset[e];
+    }
+    for (long a = 0; a < assignments; a++) {
+        if (slot[a] >= 0) slot[a] += offset[expert[a]];
+    }
+
+    int gathered_shape[] = {(int)max_rows, dim};
+    int hidden_shape[] = {(int)max_rows, hidden_dim};
+    gathered = tensor_create_scratch_uninit(gathered_shape, 2);
+    hidden = tensor_create_scratch_uninit(hidden_shape, 2);
+    expert_out = tensor_create_scratch_uninit(gathered_shape, 2);
+    if (!gathered || !hidden || !expert_out) goto cleanup;
+
+    // 3. 收集: 同一专家的token成为连续的行
+    MoEGatherCtx gather = {input->data, gathered->data, slot, k, dim};
+    parallel_for(assignments, 64, moe_gather_range, &gather);
+
+    // 4. 两个线性变换各一次分组GEMM, 偏置和激活在写回时完成
+    // 门控专家的w1有2 * hidden_dim列, 写回act(gate) * up后只剩hidden_dim列
+    for (int e = 0; e < num_experts; e++) {
+        const FeedForward* ff = moe->experts[e];
+        int rows = offset[e + 1] - offset[e];
+        epilogues[e] = (GemmEpilogue){
+            .bias = ff->b1->data,
+            .activation = feed_forward_gemm_activation(ff->activation),
+        };
+        groups[e] = (GemmGroup){
+            rows, w1_cols, dim,
+            gathered->data + (long)offset[e] * dim, dim,
+            ff->w1->data, w1_cols,
+            hidden->data + (long)offset[e] * hidden_dim, hidden_dim,
+            &epilogues[e],
+        };
+    }
+    if (!gemm_f32_grouped(num_experts, groups)) goto cleanup;
+
+    for (int e = 0; e < num_experts; e++) {
+        const FeedForward* ff = moe->experts[e];
+        int rows = offset[e + 1] - offset[e];
+        epilogues[e] = (GemmEpilogue){.bias = ff->b2->data};
+        groups[e] = (GemmGroup){
+            rows, dim, hidden_dim,
+            hidden->data + (long)offset[e] * hidden_dim, hidden_dim,
+            ff->w2->data, dim,
+            expert_out->data + (long)offset[e] * dim, dim,
+            &epilogues[e],
+        };
+    }
+    if (!gemm_f32_grouped(num_experts, groups)) goto cleanup;
+
+    // 5. 加权合并回原来的token位置; 有dropout时残差在dropout之后再加
+    bool late_residual = residual && dropout_prob > 0.0f;
+    MoECombineCtx combine = {
+        expert_out->data, late_residual || !residual ? NULL : residual->data, output->data,
+        slot, weight, k, dim,
+    };
+    parallel_for(tokens, 32, moe_combine_range, &combine);
+    if ((dropout_prob > 0.0f || dropout_mask) &&
+        !dropout_forward_masked(output, output, dropout_prob, dropout_mask)) goto cleanup;
+    if (late_residual && !tensor_add(output, residual, output)) goto cleanup;
+    success = true;
+
+cleanup:
+    tensor_free(logits);
+    tensor_free(gathered);
+    tensor_free(hidden);
+    tensor_free(expert_out);
+    if (arena) {
+        tensor_arena_release(arena, mark);
+    } else {
+        free(expert);
+        free(slot);
+        free(weight);
+        free(offset);
+        free(groups);
+        free(epilogues);
+    }
+    return success;
+}
+
+void moe_free(MoEFeedForward* moe) {
+    if (moe) {
+        if (moe->experts) {
+            for (int e = 0; e < moe->num_experts; e++) {
+                feed_forward_free(moe->experts[e]);
+            }
+            free(moe->experts);
+        }
+        if (moe->router) {
+            linear_free(moe->router);
+        }
+        free(moe->expert_load);
+        free(moe);
+    }
+}
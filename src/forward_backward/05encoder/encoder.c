@@ -2,25 +2,45 @@
 #include <stdlib.h>
 
 Encoder* encoder_create(int num_layers, int num_heads, int model_dim, 
-                       int ff_dim, float dropout_prob) {
+                       int ff_dim, float dropout_prob, const LayerOptions* options) {
     Encoder* encoder = (Encoder*)malloc(sizeof(Encoder));
     if (!encoder) return NULL;
+    if (!options) options = &LAYER_OPTIONS_DEFAULT;
 
     encoder->num_layers = num_layers;
-    encoder->layers = (EncoderLayer**)malloc(sizeof(EncoderLayer*) * num_layers);
+    encoder->final_norm = NULL;
+    encoder->layers = (EncoderLayer**)calloc(num_layers, sizeof(EncoderLayer*));
+    if (!encoder->layers) {
+        free(encoder);
+        return NULL;
+    }
     
     for (int i = 0; i < num_layers; i++) {
         encoder->layers[i] = encoder_layer_create(num_heads, model_dim, 
-                                                ff_dim, dropout_prob);
+                                                ff_dim, dropout_prob, options);
         if (!encoder->layers[i]) {
             encoder_free(encoder);
             return NULL;
         }
     }
+
+    // pre-norm的残差流没有归一化, 输出前再归一化一次
+    if (options->pre_norm) {
+        encoder->final_norm = layer_norm_create_typed(model_dim, 1e-5, options->norm_type);
+        if (!encoder->final_norm) {
+            encoder_free(encoder);
+            return NULL;
+        }
+    }
     
     return encoder;
 }
 
+// pre-norm时对最后一层的输出做最后的归一化, 原地进行
+static bool encoder_final_norm(Encoder* encoder, Tensor* output) {
+    return !encoder->final_norm || layer_norm_forward(encoder->final_norm, output, output);
+}
+
 bool encoder_forward(Encoder* encoder, Tensor* input, Tensor* output, 
                     AttentionMask* mask) {
     // 第一层使用input作为输入
@@ -35,7 +55,19 @@ bool encoder_forward(Encoder* encoder, Tensor* input, Tensor* output,
         }
     }
     
-    return true;
+    return encoder_final_norm(encoder, output);
+}
+
+bool encoder_forward_ragged(Encoder* encoder, Tensor* input, Tensor* output,
+                            const RaggedBatch* batch) {
+    Tensor* layer_input = input;
+    for (int i = 0; i < encoder->num_layers; i++) {
+        if (!encoder_layer_forward_ragged(encoder->layers[i], layer_input, output, batch)) {
+            return false;
+        }
+        layer_input = output;
+    }
+    return encoder_final_norm(encoder, output);
 }
 
 void encoder_free(Encoder* encoder) {
@@ -44,6 +76,7 @@ void encoder_free(Encoder* encoder) {
             encoder_layer_free(encoder->layers[i]);
         }
         free(encoder->layers);
+        layer_norm_free(encoder->final_norm);
         free(encoder);
     }
 }
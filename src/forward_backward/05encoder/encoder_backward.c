@@ -1,4 +1,5 @@
 #include "encoder_backward.h"
+#include "tensor_arena.h"
 
 bool encoder_backward(
     Encoder* encoder,
@@ -11,7 +12,7 @@ bool encoder_backward(
     }
 
     // 创建临时张量存储每层的梯度
-    Tensor* layer_grad = tensor_create(grad_output->shape, grad_output->num_dims);
+    Tensor* layer_grad = tensor_create_scratch(grad_output->shape, grad_output->num_dims);
     if (!layer_grad) return false;
 
     // 从最后一层开始反向传播
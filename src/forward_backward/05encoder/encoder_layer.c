@@ -1,68 +1,124 @@
 #include "encoder_layer.h"
 #include "layer_norm.h"
-#include "tensor_add.h"
 #include "tensor_logic.h"
+#include "tensor_arena.h"
 #include <stdlib.h>
 
-EncoderLayer* encoder_layer_create(int num_heads, int model_dim, int ff_dim, float dropout_prob) {
-    EncoderLayer* layer = (EncoderLayer*)malloc(sizeof(EncoderLayer));
+EncoderLayer* encoder_layer_create(int num_heads, int model_dim, int ff_dim, float dropout_prob,
+                                   const LayerOptions* options) {
+    EncoderLayer* layer = (EncoderLayer*)calloc(1, sizeof(EncoderLayer));
     if (!layer) return NULL;
+    if (!options) options = &LAYER_OPTIONS_DEFAULT;
 
     layer->self_attn = multihead_attention_create(num_heads, model_dim);
-    layer->norm1 = layer_norm_create(model_dim, 1e-5);
-    layer->ff = feed_forward_create(model_dim, ff_dim);
-    layer->norm2 = layer_norm_create(model_dim, 1e-5);
+    layer->norm1 = layer_norm_create_typed(model_dim, 1e-5, options->norm_type);
+    if (options->num_experts > 0) {
+        layer->moe = moe_create(model_dim, ff_dim, options->ffn_activation, options->num_experts,
+                                options->moe_top_k, options->moe_capacity_factor);
+    } else {
+        layer->ff = feed_forward_create(model_dim, ff_dim, options->ffn_activation);
+    }
+    layer->norm2 = layer_norm_create_typed(model_dim, 1e-5, options->norm_type);
     layer->dropout_prob = dropout_prob;
+    layer->pre_norm = options->pre_norm;
 
     return layer;
 }
 
-bool encoder_layer_forward(EncoderLayer* layer, Tensor* input, Tensor* output, 
-                         AttentionMask* mask) {
-    // 1. 自注意力子层
-    if (!multihead_attention_forward(layer->self_attn, input, output, mask)) {
-        return false;
-    }
-    
-    // Dropout
-    if (!dropout_forward(output, output, layer->dropout_prob)) {
-        return false;
+// 前馈网络子层: output = dropout(FFN(input)) + residual, 稠密前馈网络或混合专家
+static bool encoder_layer_feed_forward(EncoderLayer* layer, const Tensor* input, const Tensor* residual,
+                                       float dropout_prob, Tensor* output) {
+    if (layer->moe) {
+        return moe_forward_residual(layer->moe, input, residual, dropout_prob, &layer->ff_dropout, output);
     }
-    
-    // 残差连接和层归一化
-    if (!tensor_add(output, input, output)) {  // 残差连接
-        return false;
+    return feed_forward_forward_residual(layer->ff, input, residual, dropout_prob, &layer->ff_dropout, output);
+}
+
+// 补齐的batch和打包的变长batch共用的层计算, ragged非NULL时input是[1, total_tokens, model_dim]
+// post-norm: x = Norm(x + Sublayer(x)); pre-norm: x = x + Sublayer(Norm(x)),
+// pre-norm时自注意力的残差加法和前馈网络之前的归一化一次完成
+static bool encoder_layer_run(EncoderLayer* layer, Tensor* input, Tensor* output,
+                              AttentionMask* mask, const RaggedBatch* ragged) {
+    // 中间结果从活动arena分配, 本层结束后回退, 下一层复用同一块内存
+    // 残差需要原始输入, 所以子层结果不直接写进output(output可能就是input)
+    TensorArena* arena = tensor_arena_active();
+    size_t mark = tensor_arena_mark(arena);
+    bool success = false;
+
+    // 推理时不做dropout, 也不生成随机数
+    float dropout_prob = g_model_config.is_training ? layer->dropout_prob : 0.0f;
+
+    Tensor* attn_output = tensor_create_scratch_uninit(input->shape, input->num_dims);
+    Tensor* ff_output = NULL;
+    Tensor* normed = NULL;
+    if (layer->pre_norm) {
+        normed = tensor_create_scratch_uninit(input->shape, input->num_dims);
+    } else {
+        ff_output = tensor_create_scratch_uninit(input->shape, input->num_dims);
     }
-    if (!layer_norm_forward(layer->norm1, output, output)) {
-        return false;
+    if (!attn_output || (!normed && !ff_output)) goto cleanup;
+
+    // 1. 自注意力子层
+    Tensor* attn_input = input;
+    if (layer->pre_norm) {
+        if (!layer_norm_forward(layer->norm1, input, normed)) {
+            goto cleanup;
+        }
+        attn_input = normed;
     }
-    
-    // 2. 前馈网络子层
-    Tensor* ff_output = tensor_create(output->shape, output->num_dims);
-    if (!ff_output) return false;
-    if (!feed_forward_forward(layer->ff, output, ff_output)) {
-        tensor_free(ff_output);
-        return false;
+    bool attended = ragged ?
+        multihead_attention_forward_ragged(layer->self_attn, attn_input, ragged, false, attn_output) :
+        multihead_attention_forward(layer->self_attn, attn_input, attn_output, mask);
+    if (!attended) {
+        goto cleanup;
     }
     
     // Dropout
-    if (!dropout_forward(ff_output, ff_output, layer->dropout_prob)) {
-        tensor_free(ff_output);
-        return false;
+    if (!dropout_forward_masked(attn_output, attn_output, dropout_prob, &layer->attn_dropout)) {
+        goto cleanup;
     }
     
-    // 残差连接和层归一化
-    if (!tensor_add(ff_output, output, output)) {
-        tensor_free(ff_output);
-        return false;
-    }
-    if (!layer_norm_forward(layer->norm2, output, output)) {
-        tensor_free(ff_output);
-        return false;
+    // 残差连接和层归一化, 一次遍历完成; 之后attn_output是前馈网络的残差
+    // pre-norm时attn_output保存残差和, 归一化结果写入normed作为前馈网络的输入
+    Tensor* ff_input = attn_output;
+    if (layer->pre_norm) {
+        if (!layer_norm_forward_residual(layer->norm2, attn_output, input, attn_output, normed)) {
+            goto cleanup;
+        }
+        ff_input = normed;
+    } else if (!layer_norm_forward_residual(layer->norm1, attn_output, input, NULL, attn_output)) {
+        goto cleanup;
     }
     
+    // 2. 前馈网络子层, dropout在第二个GEMM写回时完成
+    // pre-norm时残差连接也在写回时完成, 结果直接写入output
+    if (layer->pre_norm) {
+        if (!encoder_layer_feed_forward(layer, ff_input, attn_output, dropout_prob, output)) {
+            goto cleanup;
+        }
+    } else if (!encoder_layer_feed_forward(layer, ff_input, NULL, dropout_prob, ff_output) ||
+               !layer_norm_forward_residual(layer->norm2, ff_output, attn_output, NULL, output)) {
+        goto cleanup;
+    }
+    success = true;
+
+cleanup:
+    tensor_free(attn_output);
     tensor_free(ff_output);
-    return true;
+    tensor_free(normed);
+    tensor_arena_release(arena, mark);
+    return success;
+}
+
+bool encoder_layer_forward(EncoderLayer* layer, Tensor* input, Tensor* output,
+                         AttentionMask* mask) {
+    return encoder_layer_run(layer, input, output, mask, NULL);
+}
+
+bool encoder_layer_forward_ragged(EncoderLayer* layer, Tensor* input, Tensor* output,
+                                  const RaggedBatch* batch) {
+    if (!batch) return false;
+    return encoder_layer_run(layer, input, output, NULL, batch);
 }
 
 void encoder_layer_free(EncoderLayer* layer) {
@@ -70,7 +126,10 @@ void encoder_layer_free(EncoderLayer* layer) {
         multihead_attention_free(layer->self_attn);
         layer_norm_free(layer->norm1);
         feed_forward_free(layer->ff);
+        moe_free(layer->moe);
         layer_norm_free(layer->norm2);
+        dropout_mask_release(&layer->attn_dropout);
+        dropout_mask_release(&layer->ff_dropout);
         free(layer);
     }
 }
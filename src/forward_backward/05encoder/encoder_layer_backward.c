@@ -1,4 +1,5 @@
 #include "encoder_layer_backward.h"
+#include "tensor_arena.h"
 
 bool encoder_layer_backward(
     EncoderLayer* layer,
@@ -12,8 +13,8 @@ bool encoder_layer_backward(
     }
 
     // 创建临时张量
-    Tensor* temp_grad = tensor_create(grad_output->shape, grad_output->num_dims);
-    Tensor* residual_grad = tensor_create(grad_output->shape, grad_output->num_dims);
+    Tensor* temp_grad = tensor_create_scratch(grad_output->shape, grad_output->num_dims);
+    Tensor* residual_grad = tensor_create_scratch(grad_output->shape, grad_output->num_dims);
     if (!temp_grad || !residual_grad) {
         tensor_free(temp_grad);
         tensor_free(residual_grad);
@@ -31,7 +32,7 @@ bool encoder_layer_backward(
         goto cleanup;
     }
 
-    if (!dropout_backward(temp_grad, temp_grad, layer->dropout_prob)) {
+    if (!dropout_backward(temp_grad, temp_grad, &layer->ff_dropout)) {
         goto cleanup;
     }
 
@@ -55,7 +56,7 @@ bool encoder_layer_backward(
         goto cleanup;
     }
 
-    if (!dropout_backward(grad_input, grad_input, layer->dropout_prob)) {
+    if (!dropout_backward(grad_input, grad_input, &layer->attn_dropout)) {
         goto cleanup;
     }
 
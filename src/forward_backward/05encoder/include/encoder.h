@@ -6,6 +6,7 @@
 typedef struct Encoder {
     int num_layers;           // 编码器层数量
     EncoderLayer** layers;    // 编码器层数组
+    LayerNorm* final_norm;    // pre-norm时最后一层之后的归一化, post-norm为NULL
 } Encoder;
 
 // 创建编码器
@@ -14,7 +15,8 @@ Encoder* encoder_create(
     int num_heads,
     int model_dim,
     int ff_dim,
-    float dropout_prob
+    float dropout_prob,
+    const LayerOptions* options     // 层结构, NULL表示LAYER_OPTIONS_DEFAULT
 );
 
 // 前向传播
@@ -25,6 +27,14 @@ bool encoder_forward(
     AttentionMask* mask     // 注意力掩码
 );
 
+// 打包变长batch上的前向传播: 线性层、前馈网络和层归一化处理total_tokens行, 注意力按序列计算
+bool encoder_forward_ragged(
+    Encoder* encoder,
+    Tensor* input,              // [1, total_tokens, model_dim]
+    Tensor* output,             // [1, total_tokens, model_dim]
+    const RaggedBatch* batch
+);
+
 // 释放资源
 void encoder_free(Encoder* encoder);
 
@@ -5,13 +5,19 @@
 #include "multiattention.h"
 #include "layer_norm.h"
 #include "feed_forward.h"
+#include "moe.h"
+#include "tensor_logic.h"
 
 typedef struct EncoderLayer {
     MultiHeadAttention* self_attn;  // 自注意力层
     LayerNorm* norm1;               // 第一个层归一化
-    FeedForward* ff;                // 前馈网络
+    FeedForward* ff;                // 前馈网络, 使用混合专家时为NULL
+    MoEFeedForward* moe;            // 混合专家前馈层, 稠密前馈网络时为NULL
     LayerNorm* norm2;               // 第二个层归一化
-    float dropout_prob;             // dropout概率
+    float dropout_prob;             // dropout概率, 只在训练时(g_model_config.is_training)使用
+    bool pre_norm;                  // 归一化放在子层之前(pre-norm)还是残差连接之后(post-norm)
+    DropoutMask attn_dropout;       // 最近一次前向中两个子层的dropout掩码, 供反向传播使用
+    DropoutMask ff_dropout;
 } EncoderLayer;
 
 // 创建编码器层
@@ -19,7 +25,8 @@ EncoderLayer* encoder_layer_create(
     int num_heads,
     int model_dim,
     int ff_dim,
-    float dropout_prob
+    float dropout_prob,
+    const LayerOptions* options     // 层结构, NULL表示LAYER_OPTIONS_DEFAULT
 );
 
 // 前向传播
@@ -30,6 +37,14 @@ bool encoder_layer_forward(
     AttentionMask* mask     // 注意力掩码
 );
 
+// 打包变长batch上的前向传播, 各序列首尾相接, 不需要padding掩码
+bool encoder_layer_forward_ragged(
+    EncoderLayer* layer,
+    Tensor* input,              // [1, total_tokens, model_dim]
+    Tensor* output,             // [1, total_tokens, model_dim]
+    const RaggedBatch* batch
+);
+
 // 释放资源
 void encoder_layer_free(EncoderLayer* layer);
 
@@ -1,14 +1,18 @@
 #include "decoder.h"
+#include "tensor_arena.h"
 #include <stdlib.h>
 #include <stdio.h>
 
 Decoder* decoder_create(int num_layers, int num_heads, int model_dim, 
-                       int ff_dim, float dropout_prob) {
+                       int ff_dim, float dropout_prob, const LayerOptions* options) {
     Decoder* decoder = (Decoder*)malloc(sizeof(Decoder));
     if (!decoder) return NULL;
+    if (!options) options = &LAYER_OPTIONS_DEFAULT;
 
     decoder->num_layers = num_layers;
-    decoder->layers = (DecoderLayer**)malloc(sizeof(DecoderLayer*) * num_layers);
+    decoder->final_norm = NULL;
+    decoder->output_linear = NULL;
+    decoder->layers = (DecoderLayer**)calloc(num_layers, sizeof(DecoderLayer*));
     if (!decoder->layers) {
         free(decoder);
         return NULL;
@@ -17,13 +21,22 @@ Decoder* decoder_create(int num_layers, int num_heads, int model_dim,
     // 创建每一层解码器
     for (int i = 0; i < num_layers; i++) {
         decoder->layers[i] = decoder_layer_create(num_heads, model_dim, 
-                                                ff_dim, dropout_prob);
+                                                ff_dim, dropout_prob, options);
         if (!decoder->layers[i]) {
             decoder_free(decoder);
             return NULL;
         }
     }
 
+    // pre-norm的残差流没有归一化, 最后的线性层之前再归一化一次
+    if (options->pre_norm) {
+        decoder->final_norm = layer_norm_create_typed(model_dim, 1e-5, options->norm_type);
+        if (!decoder->final_norm) {
+            decoder_free(decoder);
+            return NULL;
+        }
+    }
+
     // 添加最后的线性层
     decoder->output_linear = linear_create(model_dim, model_dim);
     if (!decoder->output_linear) {
@@ -34,6 +47,21 @@ Decoder* decoder_create(int num_layers, int num_heads, int model_dim,
     return decoder;
 }
 
+// 通过最后的线性层, GEMM的输入输出不能是同一块内存, 先把最后一层结果放到临时张量
+// pre-norm时最后的归一化直接写入这个临时张量, 代替复制
+static bool decoder_output_projection(Decoder* decoder, Tensor* output) {
+    TensorArena* arena = tensor_arena_active();
+    size_t mark = tensor_arena_mark(arena);
+    Tensor* hidden = tensor_create_scratch_uninit(output->shape, output->num_dims);
+    bool success = hidden &&
+                   (decoder->final_norm ? layer_norm_forward(decoder->final_norm, output, hidden) :
+                                          tensor_copy(hidden, output)) &&
+                   linear_forward(decoder->output_linear, hidden, output);
+    tensor_free(hidden);
+    tensor_arena_release(arena, mark);
+    return success;
+}
+
 bool decoder_forward(
     Decoder* decoder,
     Tensor* input,           // [batch_size, seq_len, model_dim] 解码器输入
@@ -60,14 +88,140 @@ bool decoder_forward(
         }
     }
 
-    // 通过最后的线性层
-    if (!linear_forward(decoder->output_linear, output, output)) {
+    return decoder_output_projection(decoder, output);
+}
+
+bool decoder_forward_loss(
+    Decoder* decoder,
+    const VocabHead* head,
+    Tensor* input,
+    Tensor* encoder_output,
+    const Tensor* targets,
+    AttentionMask* self_mask,
+    AttentionMask* cross_mask,
+    Tensor* hidden,
+    float* loss,
+    Tensor* grad_hidden,
+    Tensor* grad_weight
+) {
+    if (!head || !targets || !hidden || !loss) {
         return false;
     }
+    return decoder_forward(decoder, input, encoder_output, hidden, self_mask, cross_mask) &&
+           vocab_head_cross_entropy(head, hidden, targets, loss, grad_hidden, grad_weight);
+}
+
+bool decoder_forward_ragged(Decoder* decoder, Tensor* input, Tensor* encoder_output, Tensor* output,
+                            const RaggedBatch* tgt_batch, const RaggedBatch* src_batch) {
+    if (!decoder || !input || !encoder_output || !output) {
+        return false;
+    }
+
+    Tensor* layer_input = input;
+    for (int i = 0; i < decoder->num_layers; i++) {
+        if (!decoder_layer_forward_ragged(decoder->layers[i], layer_input, encoder_output,
+                                          output, tgt_batch, src_batch)) {
+            return false;
+        }
+        layer_input = output;
+    }
+    return decoder_output_projection(decoder, output);
+}
+
+bool decoder_init_cache(Decoder* decoder, int batch_size, int max_seq_len) {
+    if (!decoder) return false;
+    for (int i = 0; i < decoder->num_layers; i++) {
+        if (!decoder_layer_init_cache(decoder->layers[i], batch_size, max_seq_len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void decoder_reset_cache(Decoder* decoder) {
+    if (!decoder) return;
+    for (int i = 0; i < decoder->num_layers; i++) {
+        kv_cache_reset(decoder->layers[i]->self_cache);
+    }
+}
 
+bool decoder_precompute_cross(Decoder* decoder, const Tensor* encoder_output) {
+    if (!decoder || !encoder_output) return false;
+    for (int i = 0; i < decoder->num_layers; i++) {
+        if (!decoder_layer_precompute_cross(decoder->layers[i], encoder_output)) {
+            return false;
+        }
+    }
     return true;
 }
 
+bool decoder_step(
+    Decoder* decoder,
+    Tensor* input,           // [batch_size, 1, model_dim] 最新位置的输入
+    Tensor* encoder_output,  // [batch_size, enc_seq_len, model_dim] 编码器输出, 已预先投影时可以为NULL
+    Tensor* output,          // [batch_size, 1, model_dim] 最新位置的输出
+    AttentionMask* cross_mask
+) {
+    if (!decoder || !input || !output) {
+        return false;
+    }
+
+    Tensor* layer_input = input;
+    for (int i = 0; i < decoder->num_layers; i++) {
+        if (!decoder_layer_step(decoder->layers[i], layer_input, encoder_output,
+                                output, cross_mask)) {
+            return false;
+        }
+        layer_input = output;
+    }
+    return decoder_output_projection(decoder, output);
+}
+
+bool decoder_step_paged(
+    Decoder* decoder,
+    Tensor* input,
+    PagedKVCache* cache,
+    PagedSequence* const* seqs,
+    Tensor* encoder_output,
+    const KVCache* const* cross_caches,
+    Tensor* output,
+    AttentionMask* cross_mask
+) {
+    if (!decoder || !input || !cache || !seqs || !output || cache->num_layers < decoder->num_layers) {
+        return false;
+    }
+
+    // 所有层共用同一个位置, 先为每个序列追加槽位
+    // 任何一步失败都撤销已追加的槽位, 序列回到调用前的长度, 新取的块归还到池中
+    int batch_size = input->shape[0];
+    int appended = 0;
+    for (; appended < batch_size; appended++) {
+        if (!paged_sequence_append(cache, seqs[appended])) {
+            fprintf(stderr, "KV block pool exhausted\n");
+            goto rollback;
+        }
+    }
+
+    Tensor* layer_input = input;
+    for (int i = 0; i < decoder->num_layers; i++) {
+        const KVCache* cross_cache = cross_caches ? cross_caches[i] : NULL;
+        if (!decoder_layer_step_paged(decoder->layers[i], layer_input, encoder_output, cross_cache,
+                                      output, cross_mask, cache, i, seqs)) {
+            goto rollback;
+        }
+        layer_input = output;
+    }
+    if (decoder_output_projection(decoder, output)) {
+        return true;
+    }
+
+rollback:
+    for (int b = 0; b < appended; b++) {
+        paged_sequence_truncate(cache, seqs[b], seqs[b]->length - 1);
+    }
+    return false;
+}
+
 void decoder_free(Decoder* decoder) {
     if (decoder) {
         if (decoder->layers) {
@@ -79,6 +233,7 @@ void decoder_free(Decoder* decoder) {
         if (decoder->output_linear) {
             linear_free(decoder->output_linear);
         }
+        layer_norm_free(decoder->final_norm);
         free(decoder);
     }
 }
\ No newline at end of file
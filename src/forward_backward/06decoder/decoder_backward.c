@@ -1,4 +1,5 @@
 #include "decoder_backward.h"
+#include "tensor_arena.h"
 
 bool decoder_backward(
     Decoder* decoder,
@@ -15,7 +16,7 @@ bool decoder_backward(
     }
 
     // 创建临时张量存储每层的梯度
-    Tensor* layer_grad = tensor_create(grad_output->shape, grad_output->num_dims);
+    Tensor* layer_grad = tensor_create_scratch(grad_output->shape, grad_output->num_dims);
     if (!layer_grad) return false;
 
     // 初始化编码器输出的梯度为0
@@ -26,7 +27,7 @@ bool decoder_backward(
     
     // 从最后一层向第一层反向传播
     for (int i = decoder->num_layers - 1; i >= 0; i--) {
-        Tensor* temp_grad_encoder = tensor_create(grad_encoder_output->shape, 
+        Tensor* temp_grad_encoder = tensor_create_scratch(grad_encoder_output->shape, 
                                                 grad_encoder_output->num_dims);
         if (!temp_grad_encoder) {
             tensor_free(layer_grad);
@@ -1,21 +1,30 @@
 #include "decoder_layer.h"
 #include "tensor_logic.h"
-#include "tensor_add.h"
+#include "tensor_arena.h"
 #include <stdlib.h>
+#include <stdio.h>
 
 DecoderLayer* decoder_layer_create(int num_heads, int model_dim, 
-                                 int ff_dim, float dropout_prob) {
-    DecoderLayer* layer = (DecoderLayer*)malloc(sizeof(DecoderLayer));
+                                 int ff_dim, float dropout_prob,
+                                 const LayerOptions* options) {
+    DecoderLayer* layer = (DecoderLayer*)calloc(1, sizeof(DecoderLayer));
     if (!layer) return NULL;
+    if (!options) options = &LAYER_OPTIONS_DEFAULT;
 
     // 创建各个子层
     layer->self_attn = multihead_attention_create(num_heads, model_dim);
     layer->cross_attn = multihead_attention_create(num_heads, model_dim);
-    layer->norm1 = layer_norm_create(model_dim, 1e-5);
-    layer->norm2 = layer_norm_create(model_dim, 1e-5);
-    layer->norm3 = layer_norm_create(model_dim, 1e-5);
-    layer->ff = feed_forward_create(model_dim, ff_dim);
+    layer->norm1 = layer_norm_create_typed(model_dim, 1e-5, options->norm_type);
+    layer->norm2 = layer_norm_create_typed(model_dim, 1e-5, options->norm_type);
+    layer->norm3 = layer_norm_create_typed(model_dim, 1e-5, options->norm_type);
+    if (options->num_experts > 0) {
+        layer->moe = moe_create(model_dim, ff_dim, options->ffn_activation, options->num_experts,
+                                options->moe_top_k, options->moe_capacity_factor);
+    } else {
+        layer->ff = feed_forward_create(model_dim, ff_dim, options->ffn_activation);
+    }
     layer->dropout_prob = dropout_prob;
+    layer->pre_norm = options->pre_norm;
 
     return layer;
 }
@@ -28,80 +37,233 @@ void decoder_layer_free(DecoderLayer* layer) {
         layer_norm_free(layer->norm2);
         layer_norm_free(layer->norm3);
         feed_forward_free(layer->ff);
+        moe_free(layer->moe);
+        kv_cache_free(layer->self_cache);
+        kv_cache_free(layer->cross_cache);
+        dropout_mask_release(&layer->self_dropout);
+        dropout_mask_release(&layer->cross_dropout);
+        dropout_mask_release(&layer->ff_dropout);
         free(layer);
     }
 }
 
-bool decoder_layer_forward(DecoderLayer* layer, Tensor* input, 
-                         Tensor* encoder_output, Tensor* output,
-                         AttentionMask* self_mask, AttentionMask* cross_mask) {
+bool decoder_layer_init_cache(DecoderLayer* layer, int batch_size, int max_seq_len) {
+    if (!layer) return false;
+
+    KVCache* cache = layer->self_cache;
+    MultiHeadAttention* attn = layer->self_attn;
+    if (cache && cache->batch_size == batch_size && cache->max_seq_len >= max_seq_len) {
+        kv_cache_reset(cache);
+        return true;
+    }
+
+    kv_cache_free(cache);
+    layer->self_cache = kv_cache_create(batch_size, attn->num_heads, attn->head_dim, max_seq_len);
+    return layer->self_cache != NULL;
+}
+
+bool decoder_layer_precompute_cross(DecoderLayer* layer, const Tensor* encoder_output) {
+    if (!layer || !encoder_output || encoder_output->num_dims != 3) return false;
+
+    int src_batch = encoder_output->shape[0];
+    int enc_len = encoder_output->shape[1];
+    KVCache* cache = layer->cross_cache;
+    MultiHeadAttention* attn = layer->cross_attn;
+    if (!cache || cache->batch_size != src_batch || cache->max_seq_len < enc_len) {
+        kv_cache_free(cache);
+        layer->cross_cache = kv_cache_create(src_batch, attn->num_heads, attn->head_dim, enc_len);
+        if (!layer->cross_cache) return false;
+    }
+    return cross_attention_precompute(attn, encoder_output, layer->cross_cache);
+}
+
+// 增量解码时自注意力使用的缓存: 连续缓存, 或分页缓存中第layer层的一组序列
+typedef struct {
+    KVCache* contiguous;
+    PagedKVCache* paged;
+    int layer;
+    PagedSequence* const* seqs;
+    const KVCache* cross;   // 交叉注意力K/V, NULL时使用层自己的cross_cache
+} StepCache;
+
+// 打包变长batch: 目标序列和源序列各自的划分
+typedef struct {
+    const RaggedBatch* tgt;
+    const RaggedBatch* src;
+} RaggedInputs;
+
+// 子层之后的残差连接和归一化, sublayer_output与residual相加, 返回下一子层的输入
+// post-norm: post_norm(和)原地写回sublayer_output, 下一子层的输入和残差都是它
+// pre-norm: 和保留在sublayer_output作为之后的残差, next_norm(和)写入normed作为下一子层的输入
+static Tensor* decoder_layer_residual(DecoderLayer* layer, LayerNorm* post_norm, LayerNorm* next_norm,
+                                      Tensor* sublayer_output, Tensor* residual, Tensor* normed) {
+    if (layer->pre_norm) {
+        return layer_norm_forward_residual(next_norm, sublayer_output, residual,
+                                           sublayer_output, normed) ? normed : NULL;
+    }
+    return layer_norm_forward_residual(post_norm, sublayer_output, residual,
+                                       NULL, sublayer_output) ? sublayer_output : NULL;
+}
+
+// 前馈网络子层: output = dropout(FFN(input)) + residual, 稠密前馈网络或混合专家
+static bool decoder_layer_feed_forward(DecoderLayer* layer, const Tensor* input, const Tensor* residual,
+                                       float dropout_prob, Tensor* output) {
+    if (layer->moe) {
+        return moe_forward_residual(layer->moe, input, residual, dropout_prob, &layer->ff_dropout, output);
+    }
+    return feed_forward_forward_residual(layer->ff, input, residual, dropout_prob, &layer->ff_dropout, output);
+}
+
+// 完整序列和增量解码共用的层计算, cache非NULL时自注意力只处理最新位置
+// post-norm: x = Norm(x + Sublayer(x)); pre-norm: x = x + Sublayer(Norm(x))
+// ragged非NULL时input/encoder_output是打包的[1, total_tokens, model_dim], 自注意力按序列做因果屏蔽
+static bool decoder_layer_run(DecoderLayer* layer, Tensor* input,
+                              Tensor* encoder_output, Tensor* output,
+                              AttentionMask* self_mask, AttentionMask* cross_mask,
+                              const StepCache* cache, const RaggedInputs* ragged) {
+    // 中间结果从活动arena分配, 本层结束后回退
+    // output可能就是input, 残差连接都使用临时张量中的子层输入
+    TensorArena* arena = tensor_arena_active();
+    size_t mark = tensor_arena_mark(arena);
+    bool success = false;
+
+    // 推理和增量解码时不做dropout, 也不生成随机数
+    float dropout_prob = (g_model_config.is_training && !cache) ? layer->dropout_prob : 0.0f;
+
+    Tensor* self_output = tensor_create_scratch_uninit(input->shape, input->num_dims);
+    Tensor* cross_output = tensor_create_scratch_uninit(input->shape, input->num_dims);
+    Tensor* ff_output = NULL;
+    Tensor* normed = NULL;
+    if (layer->pre_norm) {
+        normed = tensor_create_scratch_uninit(input->shape, input->num_dims);
+    } else {
+        ff_output = tensor_create_scratch_uninit(input->shape, input->num_dims);
+    }
+    if (!self_output || !cross_output || (!normed && !ff_output)) goto cleanup;
+
     // 1. 自注意力子层
-    if (!multihead_attention_forward(layer->self_attn, input, output, self_mask)) {
-        return false;
+    Tensor* self_input = input;
+    if (layer->pre_norm) {
+        if (!layer_norm_forward(layer->norm1, input, normed)) {
+            goto cleanup;
+        }
+        self_input = normed;
+    }
+    bool attended;
+    if (ragged) {
+        attended = multihead_attention_forward_ragged(layer->self_attn, self_input, ragged->tgt,
+                                                      true, self_output);
+    } else if (!cache) {
+        attended = multihead_attention_forward(layer->self_attn, self_input, self_output, self_mask);
+    } else if (cache->paged) {
+        attended = multihead_attention_step_paged(layer->self_attn, self_input, cache->paged,
+                                                  cache->layer, cache->seqs, self_output);
+    } else {
+        attended = multihead_attention_step(layer->self_attn, self_input, cache->contiguous, self_output);
+    }
+    if (!attended) {
+        goto cleanup;
     }
     
     // Dropout
-    if (!dropout_forward(output, output, layer->dropout_prob)) {
-        return false;
+    if (!dropout_forward_masked(self_output, self_output, dropout_prob, &layer->self_dropout)) {
+        goto cleanup;
     }
     
-    // 残差连接和层归一化
-    if (!tensor_add(output, input, output)) {  // 残差连接
-        return false;
-    }
-    if (!layer_norm_forward(layer->norm1, output, output)) {
-        return false;
+    // 残差连接和层归一化, 一次遍历完成
+    Tensor* cross_input = decoder_layer_residual(layer, layer->norm1, layer->norm2,
+                                                 self_output, input, normed);
+    if (!cross_input) {
+        goto cleanup;
     }
     
-    // 2. 交叉注意力子层
-    Tensor* temp = tensor_create(input->shape, input->num_dims);
-    if (!temp) return false;
-
-    
-    if (!cross_attention_forward(layer->cross_attn, output, encoder_output, encoder_output, temp, cross_mask)) {
-        tensor_free(temp);
-        return false;
+    // 2. 交叉注意力子层, 增量解码时使用预先投影的K/V
+    const KVCache* cross_cache = NULL;
+    if (cache) {
+        cross_cache = cache->cross ? cache->cross : layer->cross_cache;
+    }
+    if (ragged) {
+        if (!cross_attention_forward_ragged(layer->cross_attn, cross_input, ragged->tgt,
+                                            encoder_output, ragged->src, cross_output)) {
+            goto cleanup;
+        }
+    } else if (cross_cache && cross_cache->length > 0) {
+        if (!cross_attention_cached(layer->cross_attn, cross_input, cross_cache,
+                                    cross_mask, cross_output)) {
+            goto cleanup;
+        }
+    } else if (!encoder_output ||
+               !cross_attention_forward(layer->cross_attn, cross_input, encoder_output, encoder_output,
+                                        cross_output, cross_mask)) {
+        goto cleanup;
     }
     
-    if (!dropout_forward(temp, temp, layer->dropout_prob)) {
-        tensor_free(temp);
-        return false;
+    if (!dropout_forward_masked(cross_output, cross_output, dropout_prob, &layer->cross_dropout)) {
+        goto cleanup;
     }
     
-    if (!tensor_add(output, temp, temp)) {  // 残差连接
-        tensor_free(temp);
-        return false;
+    Tensor* ff_input = decoder_layer_residual(layer, layer->norm2, layer->norm3,
+                                              cross_output, self_output, normed);  // 残差连接和层归一化
+    if (!ff_input) {
+        goto cleanup;
     }
-    if (!layer_norm_forward(layer->norm2, temp, temp)) {
-        tensor_free(temp);
-        return false;
+
+    // 3. 前馈网络子层, dropout在第二个GEMM写回时完成
+    // cross_output保存前两个子层之后的残差流, pre-norm时残差连接也在写回时完成
+    if (layer->pre_norm) {
+        if (!decoder_layer_feed_forward(layer, ff_input, cross_output, dropout_prob, output)) {
+            goto cleanup;
+        }
+    } else if (!decoder_layer_feed_forward(layer, ff_input, NULL, dropout_prob, ff_output) ||
+               !layer_norm_forward_residual(layer->norm3, ff_output, cross_output, NULL, output)) {
+        goto cleanup;
     }
-    
+    success = true;
 
-    // 3. 前馈网络子层
+cleanup:
+    tensor_free(self_output);
+    tensor_free(cross_output);
+    tensor_free(ff_output);
+    tensor_free(normed);
+    tensor_arena_release(arena, mark);
+    return success;
+}
 
-    tensor_copy(output, temp);
-    if (!feed_forward_forward(layer->ff, output, output)) {
-        tensor_free(temp);
-        return false;
-    }
-    
-    if (!dropout_forward(output, output, layer->dropout_prob)) {
-        tensor_free(temp);
+bool decoder_layer_forward(DecoderLayer* layer, Tensor* input,
+                         Tensor* encoder_output, Tensor* output,
+                         AttentionMask* self_mask, AttentionMask* cross_mask) {
+    return decoder_layer_run(layer, input, encoder_output, output, self_mask, cross_mask, NULL, NULL);
+}
+
+bool decoder_layer_step(DecoderLayer* layer, Tensor* input,
+                        Tensor* encoder_output, Tensor* output,
+                        AttentionMask* cross_mask) {
+    if (!layer || !layer->self_cache) {
+        fprintf(stderr, "Decoder layer cache is not initialized\n");
         return false;
     }
-    
-    if (!tensor_add(output, temp, output)) {  // 残差连接
-        tensor_free(temp);
+    StepCache cache = {.contiguous = layer->self_cache};
+    return decoder_layer_run(layer, input, encoder_output, output, NULL, cross_mask, &cache, NULL);
+}
+
+bool decoder_layer_step_paged(DecoderLayer* layer, Tensor* input,
+                              Tensor* encoder_output, const KVCache* cross_cache,
+                              Tensor* output, AttentionMask* cross_mask,
+                              PagedKVCache* cache, int layer_index,
+                              PagedSequence* const* seqs) {
+    if (!layer || !cache || !seqs) {
         return false;
     }
-    if (!layer_norm_forward(layer->norm3, output, output)) {
-        tensor_free(temp);
+    StepCache step = {.paged = cache, .layer = layer_index, .seqs = seqs, .cross = cross_cache};
+    return decoder_layer_run(layer, input, encoder_output, output, NULL, cross_mask, &step, NULL);
+}
+
+bool decoder_layer_forward_ragged(DecoderLayer* layer, Tensor* input,
+                                  Tensor* encoder_output, Tensor* output,
+                                  const RaggedBatch* tgt_batch, const RaggedBatch* src_batch) {
+    if (!layer || !encoder_output || !tgt_batch || !src_batch) {
         return false;
     }
-    
-    tensor_free(temp);
-    return true;
+    RaggedInputs ragged = {tgt_batch, src_batch};
+    return decoder_layer_run(layer, input, encoder_output, output, NULL, NULL, NULL, &ragged);
 }
-
-
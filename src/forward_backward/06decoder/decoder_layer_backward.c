@@ -1,4 +1,5 @@
 #include "decoder_layer_backward.h"
+#include "tensor_arena.h"
 #include "layer_norm_backward.h"
 #include "multiattention_backward.h"
 #include "cross_attention_backward.h"
@@ -21,8 +22,8 @@ bool decoder_layer_backward(
     }
 
     // 为中间梯度创建临时张量
-    Tensor* temp_grad = tensor_create(grad_output->shape, grad_output->num_dims);
-    Tensor* residual_grad = tensor_create(grad_output->shape, grad_output->num_dims);
+    Tensor* temp_grad = tensor_create_scratch(grad_output->shape, grad_output->num_dims);
+    Tensor* residual_grad = tensor_create_scratch(grad_output->shape, grad_output->num_dims);
     if (!temp_grad || !residual_grad) {
         tensor_free(temp_grad);
         tensor_free(residual_grad);
@@ -30,8 +31,8 @@ bool decoder_layer_backward(
     }
 
     // 保存前向传播的中间结果
-    Tensor* self_attn_output = tensor_create(input->shape, input->num_dims);
-    Tensor* cross_attn_output = tensor_create(input->shape, input->num_dims);
+    Tensor* self_attn_output = tensor_create_scratch(input->shape, input->num_dims);
+    Tensor* cross_attn_output = tensor_create_scratch(input->shape, input->num_dims);
     if (!self_attn_output || !cross_attn_output) {
         tensor_free(temp_grad);
         tensor_free(residual_grad);
@@ -55,7 +56,7 @@ bool decoder_layer_backward(
     }
 
     // 应用dropout的反向传播
-    if (!dropout_backward(temp_grad, temp_grad, layer->dropout_prob)) {
+    if (!dropout_backward(temp_grad, temp_grad, &layer->ff_dropout)) {
         goto cleanup;
     }
 
@@ -83,7 +84,7 @@ bool decoder_layer_backward(
         goto cleanup;
     }
 
-    if (!dropout_backward(temp_grad, temp_grad, layer->dropout_prob)) {
+    if (!dropout_backward(temp_grad, temp_grad, &layer->cross_dropout)) {
         goto cleanup;
     }
 
@@ -109,7 +110,7 @@ bool decoder_layer_backward(
         goto cleanup;
     }
 
-    if (!dropout_backward(grad_input, grad_input, layer->dropout_prob)) {
+    if (!dropout_backward(grad_input, grad_input, &layer->self_dropout)) {
         goto cleanup;
     }
 
@@ -3,10 +3,12 @@
 
 #include "decoder_layer.h"
 #include "linear.h"
+#include "04vocab_head.h"
 
 typedef struct Decoder {
     int num_layers;           // 解码器层数量
     DecoderLayer** layers;    // 解码器层数组
+    LayerNorm* final_norm;    // pre-norm时输出线性层之前的归一化, post-norm为NULL
     Linear* output_linear;    // 输出线性层
 } Decoder;
 
@@ -16,7 +18,8 @@ Decoder* decoder_create(
     int num_heads,
     int model_dim,
     int ff_dim,
-    float dropout_prob
+    float dropout_prob,
+    const LayerOptions* options     // 层结构, NULL表示LAYER_OPTIONS_DEFAULT
 );
 
 // 前向传播
@@ -29,6 +32,68 @@ bool decoder_forward(
     AttentionMask* cross_mask  // 交叉注意力掩码
 );
 
+// 训练时的前向传播和损失: 解码器输出直接进入融合的词表投影交叉熵, 不生成完整的logits
+// hidden保存解码器输出, 之后沿解码器反向传播时需要它; grad_hidden/grad_weight见vocab_head_cross_entropy
+bool decoder_forward_loss(
+    Decoder* decoder,
+    const VocabHead* head,
+    Tensor* input,              // [batch_size, seq_len, model_dim]
+    Tensor* encoder_output,     // [batch_size, enc_seq_len, model_dim]
+    const Tensor* targets,      // [batch_size, seq_len] 目标token id, 小于0的位置不计入
+    AttentionMask* self_mask,
+    AttentionMask* cross_mask,
+    Tensor* hidden,             // [batch_size, seq_len, model_dim] 解码器输出
+    float* loss,                // 有效位置的平均交叉熵
+    Tensor* grad_hidden,        // 与hidden同形状 或 NULL
+    Tensor* grad_weight         // [vocab_size, model_dim] 累加 或 NULL
+);
+
+// 打包变长batch上的前向传播, 自注意力按目标序列做因果屏蔽, 不需要掩码张量
+bool decoder_forward_ragged(
+    Decoder* decoder,
+    Tensor* input,              // [1, tgt_batch->total_tokens, model_dim]
+    Tensor* encoder_output,     // [1, src_batch->total_tokens, model_dim]
+    Tensor* output,             // [1, tgt_batch->total_tokens, model_dim]
+    const RaggedBatch* tgt_batch,
+    const RaggedBatch* src_batch
+);
+
+// 增量解码: 为每一层分配max_seq_len长的自注意力缓存, 开始新的序列时调用
+bool decoder_init_cache(Decoder* decoder, int batch_size, int max_seq_len);
+
+// 清空所有层的缓存, 保留已分配的内存
+void decoder_reset_cache(Decoder* decoder);
+
+// 编码器输出在整个生成过程中不变: encoder_forward之后调用一次, 为每层预先投影交叉注意力的K/V
+// encoder_output的batch是源序列数, decoder_step的batch可以是它的整数倍(每个源序列的多个beam)
+bool decoder_precompute_cross(Decoder* decoder, const Tensor* encoder_output);
+
+// 解码一个新位置: input只包含最新token的嵌入, 自注意力使用各层缓存中的前缀
+// 调用过decoder_precompute_cross时交叉注意力使用缓存的K/V, encoder_output可以为NULL
+bool decoder_step(
+    Decoder* decoder,
+    Tensor* input,              // [batch_size, 1, model_dim]
+    Tensor* encoder_output,     // [batch_size, enc_seq_len, model_dim] 或 NULL
+    Tensor* output,             // [batch_size, 1, model_dim]
+    AttentionMask* cross_mask   // 交叉注意力掩码
+);
+
+// 分页缓存上解码一个新位置, batch中每一行对应seqs中的一个序列, 各序列长度可以不同
+// 先为每个序列追加一个槽位, 再逐层计算; 任何一步失败都返回false, 各序列的长度和块恢复原状
+// cache需要至少num_layers层, 与解码器的注意力头数和头维度一致
+// cross_caches非NULL时第i层交叉注意力使用cross_caches[i]而不是该层自己的缓存,
+// 调度器用它让每个batch行读取各自请求的编码器K/V
+bool decoder_step_paged(
+    Decoder* decoder,
+    Tensor* input,              // [batch_size, 1, model_dim]
+    PagedKVCache* cache,
+    PagedSequence* const* seqs, // batch_size个序列
+    Tensor* encoder_output,     // [batch_size, enc_seq_len, model_dim], 已预先投影时可以为NULL
+    const KVCache* const* cross_caches, // num_layers个交叉注意力缓存 或 NULL
+    Tensor* output,             // [batch_size, 1, model_dim]
+    AttentionMask* cross_mask
+);
+
 // 释放资源
 void decoder_free(Decoder* decoder);
 
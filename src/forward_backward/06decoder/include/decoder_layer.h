@@ -4,6 +4,8 @@
 #include "tensor_type.h"
 #include "multiattention.h"
 #include "feed_forward.h"
+#include "moe.h"
+#include "tensor_logic.h"
 #include "layer_norm.h"
 
 typedef struct DecoderLayer {
@@ -12,8 +14,15 @@ typedef struct DecoderLayer {
     LayerNorm* norm1;                 // 第一个层归一化
     LayerNorm* norm2;                 // 第二个层归一化
     LayerNorm* norm3;                 // 第三个层归一化
-    FeedForward* ff;                  // 前馈网络
-    float dropout_prob;                // dropout概率
+    FeedForward* ff;                  // 前馈网络, 使用混合专家时为NULL
+    MoEFeedForward* moe;              // 混合专家前馈层, 稠密前馈网络时为NULL
+    float dropout_prob;                // dropout概率, 只在训练时(g_model_config.is_training)的完整序列前向中使用
+    bool pre_norm;                    // 归一化放在子层之前(pre-norm)还是残差连接之后(post-norm)
+    DropoutMask self_dropout;         // 最近一次前向中三个子层的dropout掩码, 供反向传播使用
+    DropoutMask cross_dropout;
+    DropoutMask ff_dropout;
+    KVCache* self_cache;              // 增量解码的自注意力K/V缓存, decoder_layer_init_cache之前为NULL
+    KVCache* cross_cache;             // 预先投影的编码器输出K/V, 一次生成内所有步和beam共用
 } DecoderLayer;
 
 // 创建解码器层
@@ -21,7 +30,8 @@ DecoderLayer* decoder_layer_create(
     int num_heads,
     int model_dim,
     int ff_dim,
-    float dropout_prob
+    float dropout_prob,
+    const LayerOptions* options         // 层结构, NULL表示LAYER_OPTIONS_DEFAULT
 );
 
 // 前向传播
@@ -34,6 +44,46 @@ bool decoder_layer_forward(
     AttentionMask* cross_mask  // 交叉注意力掩码
 );
 
+// 为增量解码分配(或复用)自注意力缓存, 并清空已缓存的位置
+bool decoder_layer_init_cache(DecoderLayer* layer, int batch_size, int max_seq_len);
+
+// 把编码器输出投影成交叉注意力的K/V并缓存, 每次encoder_forward之后调用一次
+bool decoder_layer_precompute_cross(DecoderLayer* layer, const Tensor* encoder_output);
+
+// 增量解码一步: 只处理最新位置, 自注意力在缓存上计算
+// 已调用decoder_layer_precompute_cross时交叉注意力使用缓存的K/V, encoder_output可以为NULL
+bool decoder_layer_step(
+    DecoderLayer* layer,
+    Tensor* input,              // [batch_size, 1, model_dim]
+    Tensor* encoder_output,     // [batch_size, enc_seq_len, model_dim] 或 NULL
+    Tensor* output,             // [batch_size, 1, model_dim]
+    AttentionMask* cross_mask   // 交叉注意力掩码
+);
+
+// 分页缓存上的增量解码一步, seqs中每个序列已为当前位置调用过paged_sequence_append
+bool decoder_layer_step_paged(
+    DecoderLayer* layer,
+    Tensor* input,              // [batch_size, 1, model_dim]
+    Tensor* encoder_output,     // [batch_size, enc_seq_len, model_dim] 或 NULL
+    const KVCache* cross_cache, // 预先投影的交叉注意力K/V, NULL时使用本层的cross_cache
+    Tensor* output,             // [batch_size, 1, model_dim]
+    AttentionMask* cross_mask,
+    PagedKVCache* cache,
+    int layer_index,            // 本层在cache中的层号
+    PagedSequence* const* seqs  // batch_size个序列
+);
+
+// 打包变长batch上的前向传播: 自注意力在每个目标序列内做因果屏蔽,
+// 交叉注意力中第i个目标序列只看第i个源序列
+bool decoder_layer_forward_ragged(
+    DecoderLayer* layer,
+    Tensor* input,              // [1, tgt_batch->total_tokens, model_dim]
+    Tensor* encoder_output,     // [1, src_batch->total_tokens, model_dim]
+    Tensor* output,             // [1, tgt_batch->total_tokens, model_dim]
+    const RaggedBatch* tgt_batch,
+    const RaggedBatch* src_batch
+);
+
 // 释放资源
 void decoder_layer_free(DecoderLayer* layer);
 
@@ -5,6 +5,19 @@
 #include "decoder.h"
 #include "tensor_type.h"
 #include "attention_mask.h"
+#include "tensor_arena.h"
+
+// 内存规划按形状分桶缓存, 序列长度向上取整到桶边界
+#define TRANSFORMER_MAX_PLANS 8
+#define TRANSFORMER_PLAN_BUCKET 32
+
+typedef struct {
+    int batch_size;     // 分桶后的形状
+    int enc_len;
+    int dec_len;
+    MemoryPlan* plan;
+    unsigned long last_used;
+} TransformerPlanEntry;
 
 typedef struct Transformer {
     Encoder* encoder;
@@ -14,6 +27,11 @@ typedef struct Transformer {
     int num_layers;
     int ff_dim;
     float dropout_prob;
+    LayerOptions layer_options; // 层结构: 归一化类型和位置
+    TensorArena* arena;     // 前向/反向中间结果, 每次前向开始时重置
+    TransformerPlanEntry plans[TRANSFORMER_MAX_PLANS];
+    int num_plans;
+    unsigned long plan_clock;
 } Transformer;
 
 // 创建transformer
@@ -22,7 +40,8 @@ Transformer* transformer_create(
     int num_heads,
     int model_dim,
     int ff_dim,
-    float dropout_prob
+    float dropout_prob,
+    const LayerOptions* options    // 层结构, NULL表示LAYER_OPTIONS_DEFAULT(post-norm LayerNorm)
 );
 
 // 前向传播
@@ -36,6 +55,38 @@ bool transformer_forward(
     AttentionMask* cross_mask  // decoder的交叉注意力掩码
 );
 
+// 打包变长batch上的前向传播: 源序列和目标序列各自首尾相接, 不补齐也不需要padding掩码
+// 线性层、前馈网络和层归一化直接处理total_tokens行, 注意力按序列计算, 解码器自注意力按序列做因果屏蔽
+// 形状随batch的组成变化, 不使用按形状分桶的内存规划
+bool transformer_forward_ragged(
+    Transformer* transformer,
+    Tensor* encoder_input,          // [1, src_batch->total_tokens, model_dim]
+    const RaggedBatch* src_batch,
+    Tensor* decoder_input,          // [1, tgt_batch->total_tokens, model_dim]
+    const RaggedBatch* tgt_batch,
+    Tensor* output                  // [1, tgt_batch->total_tokens, model_dim]
+);
+
+// 为给定形状所在的桶规划前向的中间结果内存
+// 用桶内最大形状的输入跑一次前向并追踪每个中间结果的生命周期,
+// 然后按生命周期为它们在arena中分配可复用的偏移; 结果按桶缓存, 重复调用直接返回
+// transformer_forward遇到新的桶时会自动调用, 新的桶规划完成时打印规划摘要; 返回的规划中peak_bytes即所需的激活内存
+const MemoryPlan* transformer_plan_memory(
+    Transformer* transformer,
+    int batch_size,
+    int enc_len,
+    int dec_len
+);
+
+// 给定形状一次前向所需的激活内存(字节), 即所在桶的规划峰值; 还没有规划时先规划
+// 可以据此确定容器内存或在同样的内存中选择更大的batch; 规划失败时返回0
+size_t transformer_activation_bytes(
+    Transformer* transformer,
+    int batch_size,
+    int enc_len,
+    int dec_len
+);
+
 // 释放资源
 void transformer_free(Transformer* transformer);
 
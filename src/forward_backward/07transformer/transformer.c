@@ -1,8 +1,10 @@
 #include "transformer.h"
+#include "tensor_arena.h"
 #include <stdlib.h>
+#include <stdio.h>
 
 Transformer* transformer_create(int num_layers, int num_heads, int model_dim,
-                              int ff_dim, float dropout_prob) {
+                              int ff_dim, float dropout_prob, const LayerOptions* options) {
     Transformer* transformer = (Transformer*)malloc(sizeof(Transformer));
     if (!transformer) return NULL;
     
@@ -12,10 +14,22 @@ Transformer* transformer_create(int num_layers, int num_heads, int model_dim,
     transformer->num_layers = num_layers;
     transformer->ff_dim = ff_dim;
     transformer->dropout_prob = dropout_prob;
+    transformer->layer_options = options ? *options : LAYER_OPTIONS_DEFAULT;
+    transformer->encoder = NULL;
+    transformer->decoder = NULL;
+    transformer->num_plans = 0;
+    transformer->plan_clock = 0;
+
+    // 中间结果用的arena, 第一次前向时学习所需大小
+    transformer->arena = tensor_arena_create(0);
+    if (!transformer->arena) {
+        transformer_free(transformer);
+        return NULL;
+    }
     
     // 创建编码器
     transformer->encoder = encoder_create(num_layers, num_heads, model_dim,
-                                       ff_dim, dropout_prob);
+                                       ff_dim, dropout_prob, &transformer->layer_options);
     if (!transformer->encoder) {
         transformer_free(transformer);
         return NULL;
@@ -23,7 +37,7 @@ Transformer* transformer_create(int num_layers, int num_heads, int model_dim,
     
     // 创建解码器
     transformer->decoder = decoder_create(num_layers, num_heads, model_dim,
-                                       ff_dim, dropout_prob);
+                                       ff_dim, dropout_prob, &transformer->layer_options);
     if (!transformer->decoder) {
         transformer_free(transformer);
         return NULL;
@@ -32,40 +46,188 @@ Transformer* transformer_create(int num_layers, int num_heads, int model_dim,
     return transformer;
 }
 
-bool transformer_forward(Transformer* transformer,
-                       Tensor* encoder_input, Tensor* decoder_input,
-                       Tensor* output,
-                       AttentionMask* enc_mask, AttentionMask* dec_mask,
-                       AttentionMask* cross_mask) {
-    if (!transformer || !encoder_input || !decoder_input || !output) {
-        return false;
-    }
-    
+// 编码器 + 解码器, 调用者负责设置活动arena
+static bool transformer_run(Transformer* transformer,
+                            Tensor* encoder_input, Tensor* decoder_input,
+                            Tensor* output,
+                            AttentionMask* enc_mask, AttentionMask* dec_mask,
+                            AttentionMask* cross_mask) {
+    bool success = false;
+
     // 创建一个临时张量存储编码器输出
-    Tensor* encoder_output = tensor_create(encoder_input->shape, encoder_input->num_dims);
-    if (!encoder_output) return false;
+    Tensor* encoder_output = tensor_create_scratch_uninit(encoder_input->shape, encoder_input->num_dims);
+    if (!encoder_output) goto cleanup;
     
     // 编码器前向传播
     if (!encoder_forward(transformer->encoder, encoder_input, encoder_output, enc_mask)) {
-        tensor_free(encoder_output);
-        return false;
+        goto cleanup;
     }
     
     // 解码器前向传播
     if (!decoder_forward(transformer->decoder, decoder_input, encoder_output,
                         output, dec_mask, cross_mask)) {
-        tensor_free(encoder_output);
+        goto cleanup;
+    }
+    success = true;
+
+cleanup:
+    tensor_free(encoder_output);
+    return success;
+}
+
+static int plan_bucket(int len) {
+    return (len + TRANSFORMER_PLAN_BUCKET - 1) / TRANSFORMER_PLAN_BUCKET * TRANSFORMER_PLAN_BUCKET;
+}
+
+// 缓存满时替换最久未使用的规划
+static TransformerPlanEntry* plan_slot(Transformer* transformer) {
+    if (transformer->num_plans < TRANSFORMER_MAX_PLANS) {
+        return &transformer->plans[transformer->num_plans++];
+    }
+    TransformerPlanEntry* oldest = &transformer->plans[0];
+    for (int i = 1; i < transformer->num_plans; i++) {
+        if (transformer->plans[i].last_used < oldest->last_used) {
+            oldest = &transformer->plans[i];
+        }
+    }
+    if (transformer->arena->plan == oldest->plan) {
+        tensor_arena_use_plan(transformer->arena, NULL);
+    }
+    memory_plan_free(oldest->plan);
+    oldest->plan = NULL;
+    return oldest;
+}
+
+const MemoryPlan* transformer_plan_memory(Transformer* transformer,
+                                          int batch_size, int enc_len, int dec_len) {
+    if (!transformer || batch_size <= 0 || enc_len <= 0 || dec_len <= 0) {
+        return NULL;
+    }
+
+    enc_len = plan_bucket(enc_len);
+    dec_len = plan_bucket(dec_len);
+    transformer->plan_clock++;
+
+    for (int i = 0; i < transformer->num_plans; i++) {
+        TransformerPlanEntry* entry = &transformer->plans[i];
+        if (entry->batch_size == batch_size && entry->enc_len == enc_len && entry->dec_len == dec_len) {
+            entry->last_used = transformer->plan_clock;
+            return entry->plan;
+        }
+    }
+
+    // 用桶内最大的形状跑一次前向, 追踪中间结果的分配和释放
+    int enc_shape[] = {batch_size, enc_len, transformer->model_dim};
+    int dec_shape[] = {batch_size, dec_len, transformer->model_dim};
+    Tensor* encoder_input = tensor_create(enc_shape, 3);
+    Tensor* decoder_input = tensor_create(dec_shape, 3);
+    Tensor* output = tensor_create(dec_shape, 3);
+    MemoryPlan* plan = NULL;
+
+    if (encoder_input && decoder_input && output) {
+        TensorArena* previous = tensor_arena_set_active(transformer->arena);
+        tensor_arena_use_plan(transformer->arena, NULL);
+        tensor_arena_reset(transformer->arena);
+        tensor_arena_begin_trace(transformer->arena);
+        bool success = transformer_run(transformer, encoder_input, decoder_input, output,
+                                       NULL, NULL, NULL);
+        plan = tensor_arena_end_trace(transformer->arena);
+        tensor_arena_set_active(previous);
+        if (!success) {
+            memory_plan_free(plan);
+            plan = NULL;
+        }
+    }
+
+    tensor_free(encoder_input);
+    tensor_free(decoder_input);
+    tensor_free(output);
+    if (!plan) {
+        fprintf(stderr, "Failed to plan activation memory\n");
+        return NULL;
+    }
+
+    // 每个新桶报告一次激活内存的峰值, 与不复用和栈式分配比较
+    char name[64];
+    snprintf(name, sizeof(name), "batch %d, enc %d, dec %d", batch_size, enc_len, dec_len);
+    memory_plan_print(plan, name);
+
+    TransformerPlanEntry* entry = plan_slot(transformer);
+    entry->batch_size = batch_size;
+    entry->enc_len = enc_len;
+    entry->dec_len = dec_len;
+    entry->plan = plan;
+    entry->last_used = transformer->plan_clock;
+    return plan;
+}
+
+size_t transformer_activation_bytes(Transformer* transformer, int batch_size, int enc_len, int dec_len) {
+    const MemoryPlan* plan = transformer_plan_memory(transformer, batch_size, enc_len, dec_len);
+    return plan ? plan->peak_bytes : 0;
+}
+
+bool transformer_forward(Transformer* transformer,
+                       Tensor* encoder_input, Tensor* decoder_input,
+                       Tensor* output,
+                       AttentionMask* enc_mask, AttentionMask* dec_mask,
+                       AttentionMask* cross_mask) {
+    if (!transformer || !encoder_input || !decoder_input || !output) {
         return false;
     }
-    
+
+    // 按形状桶取内存规划, 第一次遇到的桶会先规划一次
+    const MemoryPlan* plan = transformer_plan_memory(transformer,
+                                                     encoder_input->shape[0],
+                                                     encoder_input->shape[1],
+                                                     decoder_input->shape[1]);
+
+    // 每次前向开始时回收上一次的中间结果, 然后按规划放置本次的中间结果
+    TensorArena* previous = tensor_arena_set_active(transformer->arena);
+    tensor_arena_reset(transformer->arena);
+    tensor_arena_use_plan(transformer->arena, plan);
+
+    bool success = transformer_run(transformer, encoder_input, decoder_input, output,
+                                   enc_mask, dec_mask, cross_mask);
+
+    tensor_arena_set_active(previous);
+    return success;
+}
+
+bool transformer_forward_ragged(Transformer* transformer,
+                                Tensor* encoder_input, const RaggedBatch* src_batch,
+                                Tensor* decoder_input, const RaggedBatch* tgt_batch,
+                                Tensor* output) {
+    if (!transformer || !encoder_input || !src_batch || !decoder_input || !tgt_batch || !output ||
+        src_batch->num_seqs != tgt_batch->num_seqs) {
+        return false;
+    }
+
+    TensorArena* previous = tensor_arena_set_active(transformer->arena);
+    tensor_arena_reset(transformer->arena);
+    tensor_arena_use_plan(transformer->arena, NULL);
+
+    bool success = false;
+    Tensor* encoder_output = tensor_create_scratch_uninit(encoder_input->shape, encoder_input->num_dims);
+    if (encoder_output &&
+        encoder_forward_ragged(transformer->encoder, encoder_input, encoder_output, src_batch) &&
+        decoder_forward_ragged(transformer->decoder, decoder_input, encoder_output, output,
+                               tgt_batch, src_batch)) {
+        success = true;
+    }
     tensor_free(encoder_output);
-    return true;
+
+    tensor_arena_set_active(previous);
+    return success;
 }
 
 void transformer_free(Transformer* transformer) {
     if (transformer) {
         encoder_free(transformer->encoder);
         decoder_free(transformer->decoder);
+        for (int i = 0; i < transformer->num_plans; i++) {
+            memory_plan_free(transformer->plans[i].plan);
+        }
+        tensor_arena_free(transformer->arena);
         free(transformer);
     }
 }
\ No newline at end of file
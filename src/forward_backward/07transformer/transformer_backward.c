@@ -1,4 +1,5 @@
 #include "transformer_backward.h"
+#include "tensor_arena.h"
 
 bool transformer_backward(
     Transformer* transformer,
@@ -13,24 +14,31 @@ bool transformer_backward(
         return false;
     }
 
+    // 反向的中间梯度接在前向结果之后分配, 结束时回退, 不影响前向保存的中间结果
+    TensorArena* previous = tensor_arena_set_active(transformer->arena);
+    size_t mark = tensor_arena_mark(transformer->arena);
+    bool success = false;
+
     // 创建临时张量存储编码器输出的梯度
-    Tensor* grad_encoder_output = tensor_create(grad_encoder_input->shape, grad_encoder_input->num_dims);
-    if (!grad_encoder_output) return false;
+    Tensor* grad_encoder_output = tensor_create_scratch(grad_encoder_input->shape, grad_encoder_input->num_dims);
+    if (!grad_encoder_output) goto cleanup;
 
     // 解码器反向传播
     if (!decoder_backward(transformer->decoder, grad_output, grad_encoder_output,
                          grad_decoder_input, dec_mask, cross_mask)) {
-        tensor_free(grad_encoder_output);
-        return false;
+        goto cleanup;
     }
 
     // 编码器反向传播
     if (!encoder_backward(transformer->encoder, grad_encoder_output,
                          grad_encoder_input, enc_mask)) {
-        tensor_free(grad_encoder_output);
-        return false;
+        goto cleanup;
     }
+    success = true;
 
+cleanup:
     tensor_free(grad_encoder_output);
-    return true;
+    tensor_arena_release(transformer->arena, mark);
+    tensor_arena_set_active(previous);
+    return success;
 }
\ No newline at end of file
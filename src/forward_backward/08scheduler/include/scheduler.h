@@ -0,0 +1,133 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "transformer.h"
+#include "kv_cache.h"
+#include "paged_kv_cache.h"
+#include "04vocab_head.h"
+#include <stdbool.h>
+
+// 连续批处理推理调度器
+// 请求按token粒度进出正在运行的解码batch: 每一步先为新到达的请求跑编码器并预先投影交叉注意力K/V,
+// 再让batch中所有请求各解码一个位置, 已完成的请求立即退出, 空出的位置下一步就能接纳新请求
+// 自注意力K/V放在分页缓存中, 各请求长度互不影响; 交叉注意力K/V每个batch位置占一行
+
+typedef enum {
+    REQUEST_QUEUED,     // 等待进入batch
+    REQUEST_RUNNING,    // 正在解码
+    REQUEST_FINISHED,   // 正常结束(回调要求停止或达到max_new_tokens)
+    REQUEST_FAILED      // 无法调度(编码器输入过长或所需KV块超过整个块池)或编码失败
+} RequestState;
+
+typedef struct InferenceRequest InferenceRequest;
+
+// 一个推理请求, 由调用者创建和释放, 调度器只持有指针
+struct InferenceRequest {
+    int id;                     // 提交时分配的序号
+    Tensor* encoder_input;      // [1, enc_len, model_dim], 请求自己的副本
+    int enc_len;
+    float* next_input;          // [model_dim], 下一步解码器的输入, 初始为起始token的嵌入
+    int max_new_tokens;
+    int generated;              // 已解码的位置数
+    RequestState state;
+    void* user_data;
+
+    // 延迟统计(秒, 单调时钟)
+    double submit_time;
+    double start_time;          // 进入batch的时刻
+    double first_token_time;
+    double finish_time;
+
+    // 调度器内部状态
+    PagedSequence* seq;
+    int reserved_blocks;        // 最坏情况下需要的KV块数, 接纳时预留
+};
+
+// 每解码一个位置调用一次: output是该请求本步的解码器输出[model_dim],
+// 设置了词表投影时output是这一位置的logits[vocab_size];
+// 回调把下一步的输入嵌入写入next_input[model_dim], 返回false表示请求结束(例如生成了EOS)
+typedef bool (*SchedulerTokenFn)(void* user_data, InferenceRequest* request,
+                                 const float* output, float* next_input);
+
+typedef struct {
+    int queue_depth;                // 当前等待中的请求数
+    int max_queue_depth;            // 历史最大等待数
+    int active;                     // 当前batch中的请求数
+    int max_batch;
+    long steps;                     // 解码步数
+    long tokens;                    // 解码的位置总数
+    long admitted;
+    long finished;
+    long failed;
+    double occupancy;               // 平均batch占用率: tokens / (steps * max_batch)
+    double mean_queue_latency;      // 已完成请求从提交到进入batch的平均时间
+    double mean_first_token_latency;// 从提交到第一个输出的平均时间
+    double mean_latency;            // 从提交到完成的平均时间
+} SchedulerStats;
+
+typedef struct InferenceScheduler {
+    Transformer* transformer;
+    int max_batch;
+    int max_enc_len;
+    SchedulerTokenFn on_token;
+    void* user_data;
+    const VocabHead* vocab_head;    // 非NULL时每步只为batch中各请求的最新位置计算logits
+
+    PagedKVCache* kv;               // 解码器各层的自注意力K/V
+    KVCache** cross;                // 每层一个[max_batch, H, max_enc_len, Dh]交叉注意力缓存
+
+    // 等待队列(环形缓冲区)
+    InferenceRequest** queue;
+    int queue_head;
+    int queue_count;
+    int queue_capacity;
+
+    // 运行中的请求, 始终紧凑地占据[0, active)
+    InferenceRequest** running;
+    PagedSequence** seqs;
+    int active;
+
+    int next_id;
+    SchedulerStats stats;
+    double queue_latency_sum;
+    double first_token_latency_sum;
+    double latency_sum;
+} InferenceScheduler;
+
+// 复制encoder_input([enc_len, model_dim]或[1, enc_len, model_dim])和起始输入start_input[model_dim]
+InferenceRequest* inference_request_create(const Tensor* encoder_input, const float* start_input,
+                                           int max_new_tokens, void* user_data);
+void inference_request_free(InferenceRequest* request);
+
+// 创建调度器
+InferenceScheduler* scheduler_create(
+    Transformer* transformer,
+    int max_batch,              // batch中同时解码的最大请求数
+    int max_enc_len,            // 编码器输入的最大长度
+    int num_blocks,             // 自注意力KV块池的块数, 可用paged_kv_cache_blocks_for_budget估算
+    int block_size,             // 每块的位置数
+    SchedulerTokenFn on_token,
+    void* user_data             // 传给on_token
+);
+
+void scheduler_free(InferenceScheduler* scheduler);
+
+// 设置词表投影, 之后回调收到logits而不是解码器输出; head由调用者持有, NULL恢复原来的行为
+bool scheduler_set_vocab_head(InferenceScheduler* scheduler, const VocabHead* head);
+
+// 提交请求, 进入等待队列
+bool scheduler_submit(InferenceScheduler* scheduler, InferenceRequest* request);
+
+// 调度一步: 接纳新请求并运行编码器, batch中所有请求解码一个位置, 退出已完成的请求
+// 没有任何请求时直接返回true; 编码失败时本步接纳的请求标记为REQUEST_FAILED, 归还KV块后返回false
+bool scheduler_step(InferenceScheduler* scheduler);
+
+// 反复调度直到队列和batch都为空
+bool scheduler_run(InferenceScheduler* scheduler);
+
+// 是否还有未完成的请求
+bool scheduler_has_work(const InferenceScheduler* scheduler);
+
+void scheduler_get_stats(const InferenceScheduler* scheduler, SchedulerStats* stats);
+
+#endif // SCHEDULER_H
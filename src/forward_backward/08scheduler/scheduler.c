@@ -0,0 +1,481 @@
+#include "scheduler.h"
+#include "tensor_arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+InferenceRequest* inference_request_create(const Tensor* encoder_input, const float* start_input,
+                                           int max_new_tokens, void* user_data) {
+    if (!encoder_input || !start_input || max_new_tokens <= 0 ||
+        encoder_input->num_dims < 2 || encoder_input->num_dims > 3 ||
+        (encoder_input->num_dims == 3 && encoder_input->shape[0] != 1)) {
+        fprintf(stderr, "Invalid inference request\n");
+        return NULL;
+    }
+
+    int n = encoder_input->num_dims;
+    int enc_len = encoder_input->shape[n - 2];
+    int model_dim = encoder_input->shape[n - 1];
+    InferenceRequest* request = (InferenceRequest*)calloc(1, sizeof(InferenceRequest));
+    if (!request) return NULL;
+
+    int shape[] = {1, enc_len, model_dim};
+    request->encoder_input = tensor_create(shape, 3);
+    request->next_input = (float*)malloc(model_dim * sizeof(float));
+    if (!request->encoder_input || !request->next_input ||
+        !tensor_copy(request->encoder_input, encoder_input)) {
+        inference_request_free(request);
+        return NULL;
+    }
+    memcpy(request->next_input, start_input, model_dim * sizeof(float));
+    request->enc_len = enc_len;
+    request->max_new_tokens = max_new_tokens;
+    request->state = REQUEST_QUEUED;
+    request->user_data = user_data;
+    return request;
+}
+
+void inference_request_free(InferenceRequest* request) {
+    if (request) {
+        tensor_free(request->encoder_input);
+        free(request->next_input);
+        free(request);
+    }
+}
+
+InferenceScheduler* scheduler_create(Transformer* transformer, int max_batch, int max_enc_len,
+                                     int num_blocks, int block_size,
+                                     SchedulerTokenFn on_token, void* user_data) {
+    if (!transformer || !on_token || max_batch <= 0 || max_enc_len <= 0) {
+        return NULL;
+    }
+    InferenceScheduler* scheduler = (InferenceScheduler*)calloc(1, sizeof(InferenceScheduler));
+    if (!scheduler) return NULL;
+
+    Decoder* decoder = transformer->decoder;
+    MultiHeadAttention* attn = decoder->layers[0]->self_attn;
+    scheduler->transformer = transformer;
+    scheduler->max_batch = max_batch;
+    scheduler->max_enc_len = max_enc_len;
+    scheduler->on_token = on_token;
+    scheduler->user_data = user_data;
+    scheduler->stats.max_batch = max_batch;
+
+    scheduler->kv = paged_kv_cache_create(decoder->num_layers, num_blocks, block_size,
+                                          attn->num_heads, attn->head_dim);
+    scheduler->cross = (KVCache**)calloc(decoder->num_layers, sizeof(KVCache*));
+    scheduler->running = (InferenceRequest**)calloc(max_batch, sizeof(InferenceRequest*));
+    scheduler->seqs = (PagedSequence**)calloc(max_batch, sizeof(PagedSequence*));
+    if (!scheduler->kv || !scheduler->cross || !scheduler->running || !scheduler->seqs) {
+        scheduler_free(scheduler);
+        return NULL;
+    }
+    for (int i = 0; i < decoder->num_layers; i++) {
+        scheduler->cross[i] = kv_cache_create(max_batch, attn->num_heads, attn->head_dim, max_enc_len);
+        if (!scheduler->cross[i]) {
+            scheduler_free(scheduler);
+            return NULL;
+        }
+    }
+    return scheduler;
+}
+
+void scheduler_free(InferenceScheduler* scheduler) {
+    if (scheduler) {
+        for (int i = 0; i < scheduler->active; i++) {
+            paged_sequence_free(scheduler->kv, scheduler->seqs[i]);
+        }
+        if (scheduler->cross) {
+            for (int i = 0; i < scheduler->transformer->decoder->num_layers; i++) {
+                kv_cache_free(scheduler->cross[i]);
+            }
+            free(scheduler->cross);
+        }
+        paged_kv_cache_free(scheduler->kv);
+        free(scheduler->queue);
+        free(scheduler->running);
+        free(scheduler->seqs);
+        free(scheduler);
+    }
+}
+
+bool scheduler_set_vocab_head(InferenceScheduler* scheduler, const VocabHead* head) {
+    if (!scheduler) return false;
+    if (head && head->model_dim != scheduler->transformer->model_dim) {
+        fprintf(stderr, "Vocabulary head expects model_dim %d, transformer has %d\n",
+                head->model_dim, scheduler->transformer->model_dim);
+        return false;
+    }
+    scheduler->vocab_head = head;
+    return true;
+}
+
+bool scheduler_submit(InferenceScheduler* scheduler, InferenceRequest* request) {
+    if (!scheduler || !request || request->state != REQUEST_QUEUED) {
+        return false;
+    }
+    if (request->encoder_input->shape[2] != scheduler->transformer->model_dim) {
+        fprintf(stderr, "Request model dimension does not match the transformer\n");
+        return false;
+    }
+
+    // 队列满时扩容, 环形缓冲区按顺序搬到新数组开头
+    if (scheduler->queue_count == scheduler->queue_capacity) {
+        int capacity = scheduler->queue_capacity ? scheduler->queue_capacity * 2 : 16;
+        InferenceRequest** queue = (InferenceRequest**)malloc(capacity * sizeof(InferenceRequest*));
+        if (!queue) return false;
+        for (int i = 0; i < scheduler->queue_count; i++) {
+            queue[i] = scheduler->queue[(scheduler->queue_head + i) % scheduler->queue_capacity];
+        }
+        free(scheduler->queue);
+        scheduler->queue = queue;
+        scheduler->queue_head = 0;
+        scheduler->queue_capacity = capacity;
+    }
+
+    int tail = (scheduler->queue_head + scheduler->queue_count) % scheduler->queue_capacity;
+    scheduler->queue[tail] = request;
+    scheduler->queue_count++;
+    request->id = scheduler->next_id++;
+    request->submit_time = now_seconds();
+    if (scheduler->queue_count > scheduler->stats.max_queue_depth) {
+        scheduler->stats.max_queue_depth = scheduler->queue_count;
+    }
+    return true;
+}
+
+bool scheduler_has_work(const InferenceScheduler* scheduler) {
+    return scheduler && (scheduler->queue_count > 0 || scheduler->active > 0);
+}
+
+static InferenceRequest* queue_pop(InferenceScheduler* scheduler) {
+    InferenceRequest* request = scheduler->queue[scheduler->queue_head];
+    scheduler->queue_head = (scheduler->queue_head + 1) % scheduler->queue_capacity;
+    scheduler->queue_count--;
+    return request;
+}
+
+// 运行中请求还可能占用的KV块数, 接纳新请求时从空闲块中扣除, 保证已接纳的请求不会因块池耗尽而中断
+static int outstanding_blocks(const InferenceScheduler* scheduler) {
+    int blocks = 0;
+    for (int i = 0; i < scheduler->active; i++) {
+        int remaining = scheduler->running[i]->reserved_blocks - scheduler->seqs[i]->num_blocks;
+        blocks += remaining > 0 ? remaining : 0;
+    }
+    return blocks;
+}
+
+// 按提交顺序接纳请求, 直到batch已满或剩余的KV块不够队首请求使用, 返回接纳的个数
+static int admit_requests(InferenceScheduler* scheduler, double now) {
+    int admitted = 0;
+    int available = paged_kv_cache_num_free(scheduler->kv) - outstanding_blocks(scheduler);
+    int block_size = scheduler->kv->block_size;
+
+    while (scheduler->queue_count > 0 && scheduler->active < scheduler->max_batch) {
+        InferenceRequest* request = scheduler->queue[scheduler->queue_head];
+        int need = (request->max_new_tokens + block_size - 1) / block_size;
+        if (request->enc_len > scheduler->max_enc_len || need > scheduler->kv->num_blocks) {
+            fprintf(stderr, "Request %d can never be scheduled\n", request->id);
+            queue_pop(scheduler);
+            request->state = REQUEST_FAILED;
+            request->finish_time = now;
+            scheduler->stats.failed++;
+            continue;
+        }
+        if (need > available) {
+            break;
+        }
+
+        PagedSequence* seq = paged_sequence_create();
+        if (!seq) break;
+        queue_pop(scheduler);
+        request->seq = seq;
+        request->reserved_blocks = need;
+        request->state = REQUEST_RUNNING;
+        request->start_time = now;
+        scheduler->running[scheduler->active] = request;
+        scheduler->seqs[scheduler->active] = seq;
+        scheduler->active++;
+        scheduler->stats.admitted++;
+        available -= need;
+        admitted++;
+    }
+    return admitted;
+}
+
+// 各行编码器长度不同时用键长度屏蔽补齐位置, 不需要掩码张量
+// masked表示是否需要掩码(长度都相同时为false); 返回false表示分配失败
+static bool key_padding_mask(InferenceRequest* const* requests, int rows, int max_len,
+                             AttentionMask* mask, bool* masked) {
+    *masked = false;
+    bool ragged = false;
+    for (int i = 0; i < rows; i++) {
+        ragged = ragged || requests[i]->enc_len != max_len;
+    }
+    if (!ragged) return true;
+
+    int* lengths = (int*)tensor_arena_alloc(tensor_arena_active(), rows * sizeof(int));
+    if (!lengths) return false;
+    for (int i = 0; i < rows; i++) {
+        lengths[i] = requests[i]->enc_len;
+    }
+    *mask = (AttentionMask){.seq_length = max_len, .key_lengths = lengths, .num_lengths = rows};
+    *masked = true;
+    return true;
+}
+
+static int max_enc_len(InferenceRequest* const* requests, int rows) {
+    int len = 0;
+    for (int i = 0; i < rows; i++) {
+        if (requests[i]->enc_len > len) len = requests[i]->enc_len;
+    }
+    return len;
+}
+
+// 为batch位置[first, first + count)上新接纳的请求跑一次编码器(打包成变长batch, 不补齐),
+// 并把每层交叉注意力的K/V投影到这些位置对应的缓存行
+static bool encode_arrivals(InferenceScheduler* scheduler, int first, int count) {
+    Transformer* transformer = scheduler->transformer;
+    InferenceRequest* const* arrivals = scheduler->running + first;
+    int model_dim = transformer->model_dim;
+    bool success = false;
+
+    TensorArena* arena = tensor_arena_active();
+    int* lens = (int*)tensor_arena_alloc(arena, count * sizeof(int));
+    RaggedBatch* batch = NULL;
+    Tensor* input = NULL;
+    Tensor* packed_output = NULL;
+    Tensor* encoder_output = NULL;
+    if (!lens) goto cleanup;
+    for (int i = 0; i < count; i++) {
+        lens[i] = arrivals[i]->enc_len;
+    }
+    batch = ragged_batch_create(lens, count);
+    if (!batch) goto cleanup;
+
+    int packed_shape[] = {1, batch->total_tokens, model_dim};
+    int padded_shape[] = {count, batch->max_seq_len, model_dim};
+    input = tensor_create_scratch_uninit(packed_shape, 3);
+    packed_output = tensor_create_scratch_uninit(packed_shape, 3);
+    encoder_output = tensor_create_scratch_uninit(padded_shape, 3);
+    if (!input || !packed_output || !encoder_output) goto cleanup;
+
+    for (int i = 0; i < count; i++) {
+        memcpy(input->data + (size_t)batch->cu_seqlens[i] * model_dim, arrivals[i]->encoder_input->data,
+               (size_t)lens[i] * model_dim * sizeof(float));
+    }
+    if (!encoder_forward_ragged(transformer->encoder, input, packed_output, batch) ||
+        !ragged_batch_unpack(batch, packed_output, encoder_output)) {
+        goto cleanup;
+    }
+
+    // 补齐位置(全0)的K/V也会写入缓存, 解码时由键掩码屏蔽
+    for (int i = 0; i < transformer->decoder->num_layers; i++) {
+        KVCache rows;
+        if (!kv_cache_view_batch(scheduler->cross[i], first, count, &rows)) goto cleanup;
+        bool projected = cross_attention_precompute(transformer->decoder->layers[i]->cross_attn,
+                                                    encoder_output, &rows);
+        tensor_free(rows.k);
+        tensor_free(rows.v);
+        if (!projected) goto cleanup;
+    }
+    success = true;
+
+cleanup:
+    tensor_free(input);
+    tensor_free(packed_output);
+    tensor_free(encoder_output);
+    ragged_batch_free(batch);
+    return success;
+}
+
+// 编码失败时撤销本步接纳的请求: 它们的交叉注意力K/V没有写入, 不能参与解码
+// 归还序列的KV块, 请求标记为失败, batch恢复到接纳之前
+static void fail_arrivals(InferenceScheduler* scheduler, int first, double now) {
+    for (int i = first; i < scheduler->active; i++) {
+        InferenceRequest* request = scheduler->running[i];
+        paged_sequence_free(scheduler->kv, scheduler->seqs[i]);
+        request->seq = NULL;
+        request->state = REQUEST_FAILED;
+        request->finish_time = now;
+        scheduler->stats.failed++;
+        scheduler->running[i] = NULL;
+        scheduler->seqs[i] = NULL;
+    }
+    scheduler->active = first;
+}
+
+// batch中所有请求解码一个位置, 输出写入output[active, 1, model_dim]
+static bool decode_batch(InferenceScheduler* scheduler, Tensor* output) {
+    Transformer* transformer = scheduler->transformer;
+    int num_layers = transformer->decoder->num_layers;
+    int rows = scheduler->active;
+    int model_dim = transformer->model_dim;
+    int enc_len = max_enc_len(scheduler->running, rows);
+    bool success = false;
+
+    int shape[] = {rows, 1, model_dim};
+    Tensor* input = tensor_create_scratch_uninit(shape, 3);
+    AttentionMask mask;
+    bool masked = false;
+    KVCache* cross = (KVCache*)tensor_arena_alloc(tensor_arena_active(), num_layers * sizeof(KVCache));
+    const KVCache** cross_views = (const KVCache**)tensor_arena_alloc(tensor_arena_active(),
+                                                                     num_layers * sizeof(KVCache*));
+    int num_views = 0;
+    if (!input || !cross || !cross_views ||
+        !key_padding_mask(scheduler->running, rows, enc_len, &mask, &masked)) goto cleanup;
+
+    for (int i = 0; i < rows; i++) {
+        memcpy(input->data + (size_t)i * model_dim, scheduler->running[i]->next_input,
+               model_dim * sizeof(float));
+    }
+    // 交叉注意力只看前enc_len个位置, 每行更短的部分由键掩码屏蔽
+    for (; num_views < num_layers; num_views++) {
+        if (!kv_cache_view_batch(scheduler->cross[num_views], 0, rows, &cross[num_views])) {
+            goto cleanup;
+        }
+        cross[num_views].length = enc_len;
+        cross_views[num_views] = &cross[num_views];
+    }
+
+    success = decoder_step_paged(transformer->decoder, input, scheduler->kv, scheduler->seqs,
+                                 NULL, cross_views, output, masked ? &mask : NULL);
+
+cleanup:
+    for (int i = 0; i < num_views; i++) {
+        tensor_free(cross[i].k);
+        tensor_free(cross[i].v);
+    }
+    tensor_free(input);
+    return success;
+}
+
+// 请求退出batch: 释放它的KV块, 把最后一个运行中的请求移到空出的位置以保持batch紧凑
+static void retire_request(InferenceScheduler* scheduler, int slot, double now) {
+    InferenceRequest* request = scheduler->running[slot];
+    paged_sequence_free(scheduler->kv, scheduler->seqs[slot]);
+    request->seq = NULL;
+    request->state = REQUEST_FINISHED;
+    request->finish_time = now;
+
+    scheduler->stats.finished++;
+    scheduler->queue_latency_sum += request->start_time - request->submit_time;
+    scheduler->first_token_latency_sum += request->first_token_time - request->submit_time;
+    scheduler->latency_sum += now - request->submit_time;
+
+    int last = --scheduler->active;
+    if (slot != last) {
+        scheduler->running[slot] = scheduler->running[last];
+        scheduler->seqs[slot] = scheduler->seqs[last];
+        for (int i = 0; i < scheduler->transformer->decoder->num_layers; i++) {
+            kv_cache_copy_batch(scheduler->cross[i], slot, last);
+        }
+    }
+    scheduler->running[last] = NULL;
+    scheduler->seqs[last] = NULL;
+}
+
+bool scheduler_step(InferenceScheduler* scheduler) {
+    if (!scheduler) return false;
+
+    Transformer* transformer = scheduler->transformer;
+    TensorArena* previous = tensor_arena_set_active(transformer->arena);
+    tensor_arena_use_plan(transformer->arena, NULL);
+    tensor_arena_reset(transformer->arena);
+    bool success = false;
+    Tensor* output = NULL;
+    Tensor* logits = NULL;
+
+    // 1. 新请求进入batch, 编码器只处理这些新到达的请求
+    int first = scheduler->active;
+    int arrivals = admit_requests(scheduler, now_seconds());
+    if (arrivals > 0 && !encode_arrivals(scheduler, first, arrivals)) {
+        fprintf(stderr, "Failed to encode %d new requests\n", arrivals);
+        fail_arrivals(scheduler, first, now_seconds());
+        goto cleanup;
+    }
+    if (scheduler->active == 0) {
+        success = true;
+        goto cleanup;
+    }
+
+    // 2. batch中所有请求(包括刚进入的)解码一个位置
+    int rows = scheduler->active;
+    int shape[] = {rows, 1, transformer->model_dim};
+    output = tensor_create_scratch_uninit(shape, 3);
+    if (!output || !decode_batch(scheduler, output)) {
+        goto cleanup;
+    }
+    scheduler->stats.steps++;
+    scheduler->stats.tokens += rows;
+
+    // 每个请求只有这一步的最新位置, 词表投影只算这些行
+    const float* results = output->data;
+    int result_dim = transformer->model_dim;
+    if (scheduler->vocab_head) {
+        int logits_shape[] = {rows, scheduler->vocab_head->vocab_size};
+        logits = tensor_create_scratch_uninit(logits_shape, 2);
+        if (!logits || !vocab_head_forward_last(scheduler->vocab_head, output, logits)) {
+            goto cleanup;
+        }
+        results = logits->data;
+        result_dim = scheduler->vocab_head->vocab_size;
+    }
+
+    // 3. 交给回调生成下一步输入; 从后往前处理, 退出时移过来的请求都已处理过
+    double now = now_seconds();
+    for (int i = rows - 1; i >= 0; i--) {
+        InferenceRequest* request = scheduler->running[i];
+        if (request->generated++ == 0) {
+            request->first_token_time = now;
+        }
+        bool more = scheduler->on_token(scheduler->user_data, request,
+                                        results + (size_t)i * result_dim, request->next_input);
+        if (!more || request->generated >= request->max_new_tokens) {
+            retire_request(scheduler, i, now);
+        }
+    }
+    success = true;
+
+cleanup:
+    tensor_free(logits);
+    tensor_free(output);
+    tensor_arena_set_active(previous);
+    return success;
+}
+
+bool scheduler_run(InferenceScheduler* scheduler) {
+    while (scheduler_has_work(scheduler)) {
+        int before = scheduler->active + scheduler->queue_count;
+        if (!scheduler_step(scheduler)) {
+            return false;
+        }
+        // 队首请求放不进空的batch时不会再有进展
+        if (scheduler->active == 0 && scheduler->active + scheduler->queue_count == before) {
+            fprintf(stderr, "Scheduler cannot admit the next request\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+void scheduler_get_stats(const InferenceScheduler* scheduler, SchedulerStats* stats) {
+    if (!scheduler || !stats) return;
+    *stats = scheduler->stats;
+    stats->queue_depth = scheduler->queue_count;
+    stats->active = scheduler->active;
+    stats->occupancy = stats->steps > 0 ?
+        (double)stats->tokens / ((double)stats->steps * scheduler->max_batch) : 0.0;
+    if (stats->finished > 0) {
+        stats->mean_queue_latency = scheduler->queue_latency_sum / stats->finished;
+        stats->mean_first_token_latency = scheduler->first_token_latency_sum / stats->finished;
+        stats->mean_latency = scheduler->latency_sum / stats->finished;
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "tensor_type.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// 从最后位置的logits采样下一个token, 依次做重复惩罚、温度、top-k、top-p, 再按概率抽取
+// 都不对整个词表排序: top-k用大小为k的最小堆部分选择, top-p在top-k的候选中按概率从大到小取前缀;
+// 没有top-k时top-p按概率质量做quickselect, 期望O(vocab_size)找到集合, 集合内不排序
+
+typedef struct {
+    float temperature;          // logits除以temperature, <= 0时贪心解码(取logit最大的token)
+    int top_k;                  // 只在logit最大的top_k个token中采样, <= 0表示不限制
+    float top_p;                // 只在概率从大到小累计达到top_p的最小集合中采样, >= 1表示不限制
+    float repetition_penalty;   // 已出现过的token: logit > 0时除以它, 否则乘以它; 1表示不惩罚
+} SamplingParams;
+
+extern const SamplingParams SAMPLING_PARAMS_DEFAULT;   // 温度1, 不截断也不惩罚
+
+// 每个序列一个随机数状态(xorshift64*), 同样的seed和stream得到同样的序列, 与batch的组成无关
+uint64_t sampling_rng_init(uint64_t seed, uint64_t stream);
+
+// 批量采样, 各序列并行
+// logits: [batch_size, vocab_size], 每行是一个序列最后位置的logits, 不会被修改
+// history[b]/history_len[b]: 第b个序列已经出现的token, 用于重复惩罚; history为NULL时不惩罚
+// rng: [batch_size] 各序列的随机数状态, 采样后前进
+// tokens: [batch_size] 采样结果
+bool sampling_sample(const SamplingParams* params, const Tensor* logits,
+                     const int* const* history, const int* history_len,
+                     uint64_t* rng, int* tokens);
+
+#endif // SAMPLER_H
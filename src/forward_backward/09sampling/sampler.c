@@ -0,0 +1,298 @@
+#include "sampler.h"
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+const SamplingParams SAMPLING_PARAMS_DEFAULT = {
+    .temperature = 1.0f,
+    .top_k = 0,
+    .top_p = 1.0f,
+    .repetition_penalty = 1.0f,
+};
+
+uint64_t sampling_rng_init(uint64_t seed, uint64_t stream) {
+    // splitmix64打散种子, xorshift的状态不能为0
+    uint64_t z = seed + (stream + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    return z ? z : 1;
+}
+
+// [0, 1)均匀分布
+static double sampling_rng_uniform(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return ((x * 0x2545F4914F6CDD1Dull) >> 11) * 0x1.0p-53;
+}
+
+typedef struct {
+    float value;
+    int token;
+} SamplingCandidate;
+
+// 堆中的顺序: 值小的在前, 值相同时序号大的在前, 这样序号小的token优先保留
+static bool sampling_worse(SamplingCandidate a, SamplingCandidate b) {
+    return a.value < b.value || (a.value == b.value && a.token > b.token);
+}
+
+static void sampling_sift_down(SamplingCandidate* heap, int n, int i) {
+    for (;;) {
+        int left = 2 * i + 1;
+        int right = left + 1;
+        int worst = i;
+        if (left < n && sampling_worse(heap[left], heap[worst])) worst = left;
+        if (right < n && sampling_worse(heap[right], heap[worst])) worst = right;
+        if (worst == i) return;
+        SamplingCandidate t = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = t;
+        i = worst;
+    }
+}
+
+// 部分选择: 用大小为k的最小堆选出值最大的k个, 按值从大到小写入cand[0, k)
+// 堆顶是当前第k大的值, 大多数元素只需比较一次就被跳过, O(vocab + k log k)量级
+static void sampling_select_top(const float* values, int vocab_size, int k, SamplingCandidate* cand) {
+    for (int t = 0; t < k; t++) {
+        cand[t] = (SamplingCandidate){values[t], t};
+    }
+    for (int i = k / 2 - 1; i >= 0; i--) {
+        sampling_sift_down(cand, k, i);
+    }
+    for (int t = k; t < vocab_size; t++) {
+        if (values[t] > cand[0].value) {
+            cand[0] = (SamplingCandidate){values[t], t};
+            sampling_sift_down(cand, k, 0);
+        }
+    }
+    // 堆排序: 每次把最小的移到末尾, 结果从大到小
+    for (int end = k - 1; end > 0; end--) {
+        SamplingCandidate t = cand[0];
+        cand[0] = cand[end];
+        cand[end] = t;
+        sampling_sift_down(cand, end, 0);
+    }
+}
+
+static float sampling_median3(float a, float b, float c) {
+    if (a > b) { float t = a; a = b; b = t; }
+    if (b > c) b = c;
+    return a > b ? a : b;
+}
+
+// top-p的候选集合: 重排cand[0, n)使概率最大的若干个在前面, 返回累计概率刚达到target的最少个数
+// 按概率质量做quickselect: 三路划分后, 大于枢轴的部分已经够target就只在其中继续,
+// 否则整体收入再到小于枢轴的部分里找; 不变量是cand[0, lo)之和(acc) < target <= cand[0, hi)之和
+static int sampling_select_mass(SamplingCandidate* cand, int n, double target) {
+    int lo = 0;
+    int hi = n;
+    double acc = 0.0;
+    while (hi - lo > 1) {
+        float pivot = sampling_median3(cand[lo].value, cand[lo + (hi - lo) / 2].value, cand[hi - 1].value);
+
+        // [lo, gt)大于枢轴, [gt, i)等于枢轴, [lt, hi)小于枢轴
+        int gt = lo, i = lo, lt = hi;
+        double mass_gt = 0.0, mass_eq = 0.0;
+        while (i < lt) {
+            SamplingCandidate c = cand[i];
+            if (c.value > pivot) {
+                cand[i++] = cand[gt];
+                cand[gt++] = c;
+                mass_gt += c.value;
+            } else if (c.value < pivot) {
+                cand[i] = cand[--lt];
+                cand[lt] = c;
+            } else {
+                i++;
+                mass_eq += c.value;
+            }
+        }
+
+        if (acc + mass_gt >= target) {
+            hi = gt;
+        } else if (acc + mass_gt + mass_eq >= target) {
+            acc += mass_gt;
+            for (int j = gt; j < lt; j++) {
+                acc += cand[j].value;
+                if (acc >= target) return j + 1;
+            }
+            return lt;
+        } else {
+            acc += mass_gt + mass_eq;
+            lo = lt;
+        }
+    }
+    return hi;
+}
+
+static int sampling_argmax(const float* values, int vocab_size) {
+    int best = 0;
+    for (int t = 1; t < vocab_size; t++) {
+        if (values[t] > values[best]) best = t;
+    }
+    return best;
+}
+
+// 一个序列的采样, work/cand是vocab_size大小的临时空间
+static int sampling_row(const SamplingParams* params, const SimdKernels* kernels,
+                        const float* logits, int vocab_size, const int* history, int history_len,
+                        float* work, SamplingCandidate* cand, uint64_t* rng) {
+    // 1. 重复惩罚: 在副本上修改出现过的token, 同一token出现多次只惩罚一次
+    const float* values = logits;
+    if (history && history_len > 0 && params->repetition_penalty != 1.0f) {
+        memcpy(work, logits, vocab_size * sizeof(float));
+        for (int i = 0; i < history_len; i++) {
+            int t = history[i];
+            if (t < 0 || t >= vocab_size || work[t] != logits[t]) continue;
+            work[t] = work[t] > 0.0f ? work[t] / params->repetition_penalty
+                                     : work[t] * params->repetition_penalty;
+        }
+        values = work;
+    }
+
+    if (params->temperature <= 0.0f || params->top_k == 1 || params->top_p <= 0.0f) {
+        return sampling_argmax(values, vocab_size);
+    }
+    float inv_temp = 1.0f / params->temperature;
+    bool limit_k = params->top_k > 0 && params->top_k < vocab_size;
+    bool limit_p = params->top_p < 1.0f;
+
+    // 2. 候选集合cand[0, n)及其未归一化的概率exp((logit - max) / temperature), total是它们的和
+    int n;
+    double total = 0.0;
+    if (limit_k) {
+        // 先按logit选出top_k个, 只对它们取指数
+        n = params->top_k;
+        sampling_select_top(values, vocab_size, n, cand);
+        float max = cand[0].value;
+        for (int i = 0; i < n; i++) {
+            cand[i].value = expf((cand[i].value - max) * inv_temp);
+            total += cand[i].value;
+        }
+
+        // top-p: 候选已经从大到小排列, 取累计概率达到top_p的最短前缀
+        if (limit_p) {
+            double target = params->top_p * total;
+            double cum = 0.0;
+            int m = 0;
+            while (m < n) {
+                cum += cand[m++].value;
+                if (cum >= target) break;
+            }
+            n = m;
+            total = cum;
+        }
+    } else {
+        // 整个词表的概率, 指数和是top-p的分母
+        kernels->scale(values, work, inv_temp, vocab_size);
+        float max = kernels->scale_mask_max_row(work, work, vocab_size, 1.0f, NULL, 0.0f);
+        total = kernels->exp_sum_row(work, vocab_size, max);
+        if (!limit_p) {
+            // 不截断时直接在整个词表上抽取
+            double u = sampling_rng_uniform(rng) * total;
+            double cum = 0.0;
+            for (int t = 0; t < vocab_size; t++) {
+                cum += work[t];
+                if (u < cum) return t;
+            }
+            return sampling_argmax(work, vocab_size);
+        }
+
+        // top-p: 按概率质量做quickselect, 得到的候选集合无序
+        for (int t = 0; t < vocab_size; t++) {
+            cand[t] = (SamplingCandidate){work[t], t};
+        }
+        n = sampling_select_mass(cand, vocab_size, params->top_p * total);
+        total = 0.0;
+        for (int i = 0; i < n; i++) total += cand[i].value;
+    }
+
+    // 3. 在剩下的候选中按概率抽取
+    double u = sampling_rng_uniform(rng) * total;
+    double cum = 0.0;
+    for (int i = 0; i < n; i++) {
+        cum += cand[i].value;
+        if (u < cum) return cand[i].token;
+    }
+    return cand[n - 1].token;
+}
+
+typedef struct {
+    const SamplingParams* params;
+    const SimdKernels* kernels;
+    const float* logits;
+    int vocab_size;
+    const int* const* history;
+    const int* history_len;
+    uint64_t* rng;
+    int* tokens;
+} SamplingCtx;
+
+// 每个线程一份临时空间(概率和候选), 只在词表变大时重新分配, 解码的每一步不再访问堆
+static _Thread_local float* sampling_work = NULL;
+static _Thread_local SamplingCandidate* sampling_cand = NULL;
+static _Thread_local int sampling_buffer_size = 0;
+
+static bool sampling_ensure_buffer(int vocab_size) {
+    if (vocab_size > sampling_buffer_size) {
+        float* work = (float*)malloc(vocab_size * sizeof(float));
+        SamplingCandidate* cand = (SamplingCandidate*)malloc(vocab_size * sizeof(SamplingCandidate));
+        if (!work || !cand) {
+            fprintf(stderr, "Failed to allocate sampling buffer\n");
+            free(work);
+            free(cand);
+            return false;
+        }
+        free(sampling_work);
+        free(sampling_cand);
+        sampling_work = work;
+        sampling_cand = cand;
+        sampling_buffer_size = vocab_size;
+    }
+    return true;
+}
+
+// 临时空间分配失败时这些序列的结果为-1
+static void sampling_range(void* arg, long begin, long end) {
+    const SamplingCtx* ctx = (const SamplingCtx*)arg;
+    bool ready = sampling_ensure_buffer(ctx->vocab_size);
+    for (long b = begin; b < end; b++) {
+        if (!ready) {
+            ctx->tokens[b] = -1;
+            continue;
+        }
+        const int* history = ctx->history ? ctx->history[b] : NULL;
+        int history_len = ctx->history ? ctx->history_len[b] : 0;
+        ctx->tokens[b] = sampling_row(ctx->params, ctx->kernels, ctx->logits + b * ctx->vocab_size,
+                                      ctx->vocab_size, history, history_len,
+                                      sampling_work, sampling_cand, &ctx->rng[b]);
+    }
+}
+
+bool sampling_sample(const SamplingParams* params, const Tensor* logits,
+                     const int* const* history, const int* history_len,
+                     uint64_t* rng, int* tokens) {
+    if (!logits || !rng || !tokens || logits->num_dims != 2 || logits->shape[1] <= 0 ||
+        !tensor_is_contiguous(logits) || (history && !history_len)) {
+        fprintf(stderr, "Sampling expects contiguous logits [batch_size, vocab_size]\n");
+        return false;
+    }
+    if (!params) params = &SAMPLING_PARAMS_DEFAULT;
+
+    int batch_size = logits->shape[0];
+    SamplingCtx ctx = {
+        params, simd_kernels(), logits->data, logits->shape[1], history, history_len, rng, tokens,
+    };
+    parallel_for(batch_size, 1, sampling_range, &ctx);
+    for (int b = 0; b < batch_size; b++) {
+        if (tokens[b] < 0) return false;
+    }
+    return true;
+}
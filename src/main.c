@@ -1,6 +1,6 @@
 #include "transformer.h"
 #include "tensor_type.h"
-#include "01attention_mask.h"
+#include "attention_mask.h"
 #include <stdio.h>
 
 int main() {
@@ -38,7 +38,7 @@ int main() {
     
     // // 创建transformer
     // Transformer* transformer = transformer_create(num_layers, num_heads, model_dim,
-    //                                            ff_dim, dropout_prob);
+    //                                            ff_dim, dropout_prob, NULL);
     // if (!transformer) {
     //     printf("Failed to create transformer\n");
     //     return -1;
@@ -0,0 +1,33 @@
+#ifndef MEMORY_PLAN_H
+#define MEMORY_PLAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// 静态内存规划: 已知一次前向中每个中间结果的大小和生命周期后,
+// 为它们在同一块缓冲区中分配偏移, 生命周期不重叠的中间结果共享内存
+
+typedef struct MemoryPlan MemoryPlan;
+
+struct MemoryPlan {
+    int num_allocs;         // 分配次数, 按前向中的分配顺序编号
+    size_t* sizes;          // 每次分配的大小(字节, 已按64字节取整)
+    size_t* offsets;        // 每次分配在缓冲区中的偏移
+    long* starts;           // 每次分配的生命周期[start, end), 使用规划时用来核对分配/释放顺序
+    long* ends;
+    size_t peak_bytes;      // 规划后需要的缓冲区大小
+    size_t total_bytes;     // 不做任何复用时所有中间结果之和
+    size_t stack_bytes;     // 按作用域栈式分配时的峰值, 用于比较
+};
+
+// 根据生命周期[start, end)构建规划, 时间是分配/释放事件的序号
+// 大的张量优先放置, 每个张量放在与它生命周期重叠的张量之间最低的空隙
+MemoryPlan* memory_plan_build(const size_t* sizes, const long* starts, const long* ends,
+                              int num_allocs, size_t stack_bytes);
+
+void memory_plan_free(MemoryPlan* plan);
+
+// 打印规划摘要: 峰值、不复用时的总量和栈式分配的峰值
+void memory_plan_print(const MemoryPlan* plan, const char* name);
+
+#endif // MEMORY_PLAN_H
@@ -0,0 +1,105 @@
+#ifndef TENSOR_ARENA_H
+#define TENSOR_ARENA_H
+
+#include "tensor_type.h"
+#include "memory_plan.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// 前向/反向计算中间结果用的线性分配器
+// 一次预留一整块内存, 分配只是移动偏移量, 每一步计算结束后整体重置
+// 所有分配按64字节对齐, 方便SIMD对齐访问并避免伪共享
+
+#define TENSOR_ARENA_ALIGNMENT 64
+
+typedef struct TensorArena TensorArena;
+
+// 追踪模式下记录的一次分配
+typedef struct {
+    void* ptr;
+    size_t size;        // 按64字节取整后的大小
+    size_t offset;      // 栈式分配时的偏移, 用于判断release回收了哪些分配
+    long start;         // 分配时刻
+    long end;           // 释放时刻, -1表示仍然存活
+} ArenaTraceEntry;
+
+struct TensorArena {
+    char* base;         // 预留区域起始地址
+    size_t capacity;    // 区域大小(字节)
+    size_t used;        // 当前栈顶(字节), 可以超过capacity, 超出部分在临时堆块中
+    size_t peak;        // 本次重置以来栈顶的最大值
+    bool owns_base;     // base由arena分配, 可以在重置时扩容
+
+    // 容量不足时临时从堆分配的块, 重置时释放
+    void** overflow_blocks;
+    int num_overflow;
+    int overflow_capacity;
+
+    // 追踪模式: 记录每次分配的大小和生命周期, 供内存规划使用
+    bool tracing;
+    ArenaTraceEntry* trace;
+    int trace_count;
+    int trace_capacity;
+    long trace_clock;
+
+    // 规划模式: 第i次分配直接使用plan中的第i个偏移
+    // 同时按追踪时的方式重演事件时钟和栈顶(trace数组记录已取出的分配),
+    // 每次分配和释放的时刻都要与规划一致, 否则规划中复用同一偏移的分配可能同时存活
+    const MemoryPlan* plan;
+    int plan_cursor;
+    size_t plan_used;   // 重演的栈顶, 规划模式下mark/release使用它
+    bool plan_broken;   // 分配序列与规划不一致, 本步余下的分配改为栈式
+};
+
+// 创建arena, capacity为0时在第一步计算中按需学习所需大小
+// 容量不足的分配临时落在堆上, 下一次重置时扩容到峰值
+TensorArena* tensor_arena_create(size_t capacity);
+
+// 使用调用者提供的内存区域, 区域不会扩容, 生命周期由调用者负责
+TensorArena* tensor_arena_create_from(void* region, size_t size);
+
+void tensor_arena_free(TensorArena* arena);
+
+// 重置: 释放本步所有中间结果
+// 如果上一步发生过溢出, 在这里一次性扩容到峰值, 之后的步骤不再访问堆
+void tensor_arena_reset(TensorArena* arena);
+
+// 分配bytes字节, 64字节对齐
+// 容量不足时临时从堆上分配, 只有内存耗尽时返回NULL
+void* tensor_arena_alloc(TensorArena* arena, size_t bytes);
+
+// 追踪一步完整的计算, 结束时根据记录的生命周期构建内存规划
+// 在reset之后调用begin, 计算结束后调用end, 返回的规划由调用者释放
+void tensor_arena_begin_trace(TensorArena* arena);
+MemoryPlan* tensor_arena_end_trace(TensorArena* arena);
+
+// 在reset之后启用规划, 之后每一步的分配按规划的偏移放置; plan为NULL时恢复栈式分配
+// 分配的大小超过规划, 或者分配/释放的顺序与追踪时不同, 本步余下的分配退回栈式并打印警告
+// 容量不足以容纳规划时会扩容, 无法扩容时返回false
+bool tensor_arena_use_plan(TensorArena* arena, const MemoryPlan* plan);
+
+// tensor_free对arena中的张量调用, 追踪模式下记录释放时刻
+void tensor_arena_note_free(TensorArena* arena, const void* ptr);
+
+// 记录/回退分配位置, 用于在一个子层结束后复用它的临时内存
+// arena为NULL时为空操作
+size_t tensor_arena_mark(const TensorArena* arena);
+void tensor_arena_release(TensorArena* arena, size_t mark);
+
+// 在arena中分配张量头部(Tensor结构、shape和行主序strides), 不含数据
+// 供tensor_view_create等内部使用, 失败时返回NULL
+Tensor* tensor_arena_header(TensorArena* arena, const int* shape, int num_dims);
+
+// 当前线程的活动arena, tensor_create_scratch从这里分配
+// 返回之前的活动arena, 便于嵌套时恢复
+TensorArena* tensor_arena_set_active(TensorArena* arena);
+TensorArena* tensor_arena_active(void);
+
+// 创建中间结果张量: 有活动arena时从arena分配, 否则退回tensor_create
+// 对arena中的张量调用tensor_free是空操作, 内存在重置时统一回收
+Tensor* tensor_create_scratch(const int* shape, int num_dims);
+
+// 同上但不清零, 用于会被完整覆盖的输出(GEMM结果、归一化结果等)
+Tensor* tensor_create_scratch_uninit(const int* shape, int num_dims);
+
+#endif // TENSOR_ARENA_H
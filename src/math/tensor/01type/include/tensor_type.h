@@ -6,10 +6,17 @@
 
 typedef struct Tensor Tensor;
 
+// 张量可以是拥有存储的普通张量, 也可以是共享另一个张量存储的视图
+// 视图通过strides和offset描述内存布局, 不拷贝数据, 生命周期不能超过原张量
 struct Tensor {
-    float* data;    // 数据指针
+    float* data;    // 数据指针, 指向第一个元素, 等于storage + offset
     int* shape;     // 维度数组
     int num_dims;   // 维度数量
+    long* strides;  // 每一维的步长(以元素计), tensor_create创建的张量为行主序连续步长
+    float* storage; // 底层存储, 视图与原张量共享
+    long offset;    // data相对storage的偏移(以元素计)
+    bool owns_data; // 是否负责释放storage, 视图为false
+    bool in_arena;  // 头部在TensorArena中, tensor_free不做任何事
 };
 
 size_t calculate_total_size(const int* shape, int num_dims);
@@ -17,4 +24,17 @@ bool check_same_shape(const Tensor* A, const Tensor* B);
 Tensor* tensor_create(int* shape, int num_dims);
 void tensor_free(Tensor* tensor);
 bool tensor_copy(Tensor* dst, const Tensor* src);
+
+// 在base的存储上创建视图, offset相对于base->data
+// strides为NULL时按shape使用行主序连续步长
+// 有活动的TensorArena时视图头部从arena分配
+Tensor* tensor_view_create(const Tensor* base, const int* shape, const long* strides, int num_dims, long offset);
+
+// 是否为行主序连续布局
+bool tensor_is_contiguous(const Tensor* tensor);
+
+// 前outer_dims维的扁平下标index对应的元素偏移(相对于data)
+// 例如outer_dims = num_dims - 1时得到第index行的起始偏移
+long tensor_outer_offset(const Tensor* tensor, long index, int outer_dims);
+
 #endif // TENSOR_TYPE_H
@@ -0,0 +1,121 @@
+#include "memory_plan.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    size_t offset;
+    size_t size;
+} PlacedBlock;
+
+static int compare_placed(const void* a, const void* b) {
+    size_t x = ((const PlacedBlock*)a)->offset;
+    size_t y = ((const PlacedBlock*)b)->offset;
+    return (x > y) - (x < y);
+}
+
+// 放置顺序: 大小降序, 大小相同时按分配顺序
+// 大小和下标放在一起排序, 比较函数不依赖全局状态, 多个线程可以同时构建规划
+typedef struct {
+    size_t size;
+    int index;
+} SizeOrder;
+
+static int compare_by_size(const void* a, const void* b) {
+    const SizeOrder* x = (const SizeOrder*)a;
+    const SizeOrder* y = (const SizeOrder*)b;
+    if (x->size != y->size) return (x->size < y->size) - (x->size > y->size);
+    return x->index - y->index;
+}
+
+MemoryPlan* memory_plan_build(const size_t* sizes, const long* starts, const long* ends,
+                              int num_allocs, size_t stack_bytes) {
+    MemoryPlan* plan = (MemoryPlan*)calloc(1, sizeof(MemoryPlan));
+    if (!plan) {
+        fprintf(stderr, "Failed to allocate memory plan\n");
+        return NULL;
+    }
+
+    plan->num_allocs = num_allocs;
+    plan->stack_bytes = stack_bytes;
+    plan->sizes = (size_t*)malloc((num_allocs + 1) * sizeof(size_t));
+    plan->offsets = (size_t*)malloc((num_allocs + 1) * sizeof(size_t));
+    plan->starts = (long*)malloc((num_allocs + 1) * sizeof(long));
+    plan->ends = (long*)malloc((num_allocs + 1) * sizeof(long));
+    SizeOrder* order = (SizeOrder*)malloc((num_allocs + 1) * sizeof(SizeOrder));
+    bool* placed = (bool*)calloc(num_allocs + 1, sizeof(bool));
+    PlacedBlock* conflicts = (PlacedBlock*)malloc((num_allocs + 1) * sizeof(PlacedBlock));
+    if (!plan->sizes || !plan->offsets || !plan->starts || !plan->ends ||
+        !order || !placed || !conflicts) {
+        fprintf(stderr, "Failed to allocate memory plan\n");
+        free(order);
+        free(placed);
+        free(conflicts);
+        memory_plan_free(plan);
+        return NULL;
+    }
+
+    for (int i = 0; i < num_allocs; i++) {
+        plan->sizes[i] = sizes[i];
+        plan->starts[i] = starts[i];
+        plan->ends[i] = ends[i];
+        plan->total_bytes += sizes[i];
+        order[i].size = sizes[i];
+        order[i].index = i;
+    }
+    qsort(order, num_allocs, sizeof(SizeOrder), compare_by_size);
+
+    // 贪心放置: 收集已放置且生命周期重叠的块, 按偏移排序后找第一个放得下的空隙
+    for (int n = 0; n < num_allocs; n++) {
+        int i = order[n].index;
+        int num_conflicts = 0;
+        for (int j = 0; j < num_allocs; j++) {
+            if (placed[j] && starts[j] < ends[i] && starts[i] < ends[j]) {
+                conflicts[num_conflicts].offset = plan->offsets[j];
+                conflicts[num_conflicts].size = plan->sizes[j];
+                num_conflicts++;
+            }
+        }
+        qsort(conflicts, num_conflicts, sizeof(PlacedBlock), compare_placed);
+
+        size_t offset = 0;
+        for (int c = 0; c < num_conflicts; c++) {
+            if (conflicts[c].offset >= offset + sizes[i]) {
+                break;
+            }
+            if (conflicts[c].offset + conflicts[c].size > offset) {
+                offset = conflicts[c].offset + conflicts[c].size;
+            }
+        }
+
+        plan->offsets[i] = offset;
+        placed[i] = true;
+        if (offset + sizes[i] > plan->peak_bytes) {
+            plan->peak_bytes = offset + sizes[i];
+        }
+    }
+
+    free(order);
+    free(placed);
+    free(conflicts);
+    return plan;
+}
+
+void memory_plan_free(MemoryPlan* plan) {
+    if (plan) {
+        free(plan->sizes);
+        free(plan->offsets);
+        free(plan->starts);
+        free(plan->ends);
+        free(plan);
+    }
+}
+
+void memory_plan_print(const MemoryPlan* plan, const char* name) {
+    if (!plan) return;
+    printf("Memory plan %s: %d buffers, peak %.2f MB (no reuse %.2f MB, stack %.2f MB)\n",
+           name ? name : "",
+           plan->num_allocs,
+           plan->peak_bytes / (1024.0 * 1024.0),
+           plan->total_bytes / (1024.0 * 1024.0),
+           plan->stack_bytes / (1024.0 * 1024.0));
+}
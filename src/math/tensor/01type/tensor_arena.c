@@ -0,0 +1,413 @@
+#include "tensor_arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// 每个线程一个活动arena, 前向计算在调用线程上创建中间结果
+static _Thread_local TensorArena* g_active_arena = NULL;
+
+// 扩容时按页对齐
+#define TENSOR_ARENA_GROW_ALIGN 4096
+
+static size_t round_up(size_t value, size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+// base到第一个64字节对齐地址的距离, 调用者提供的区域不一定对齐
+static size_t base_padding(const TensorArena* arena) {
+    uintptr_t base = (uintptr_t)arena->base;
+    return (size_t)(round_up(base, TENSOR_ARENA_ALIGNMENT) - base);
+}
+
+// 对齐后可用的容量
+static size_t usable_capacity(const TensorArena* arena) {
+    if (!arena->base) return 0;
+    size_t padding = base_padding(arena);
+    return arena->capacity > padding ? arena->capacity - padding : 0;
+}
+
+static bool arena_grow(TensorArena* arena, size_t size) {
+    size_t capacity = round_up(size, TENSOR_ARENA_GROW_ALIGN);
+    char* base = (char*)aligned_alloc(TENSOR_ARENA_ALIGNMENT, capacity);
+    if (!base) {
+        fprintf(stderr, "Failed to grow tensor arena to %zu bytes\n", capacity);
+        return false;
+    }
+    free(arena->base);
+    arena->base = base;
+    arena->capacity = capacity;
+    return true;
+}
+
+TensorArena* tensor_arena_create(size_t capacity) {
+    TensorArena* arena = (TensorArena*)calloc(1, sizeof(TensorArena));
+    if (!arena) {
+        fprintf(stderr, "Failed to allocate tensor arena\n");
+        return NULL;
+    }
+
+    arena->owns_base = true;
+    if (capacity > 0 && !arena_grow(arena, capacity)) {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+TensorArena* tensor_arena_create_from(void* region, size_t size) {
+    if (!region || size == 0) {
+        fprintf(stderr, "Invalid arena region\n");
+        return NULL;
+    }
+
+    TensorArena* arena = (TensorArena*)calloc(1, sizeof(TensorArena));
+    if (!arena) {
+        fprintf(stderr, "Failed to allocate tensor arena\n");
+        return NULL;
+    }
+    arena->base = (char*)region;
+    arena->capacity = size;
+    arena->owns_base = false;
+    return arena;
+}
+
+static void free_overflow_blocks(TensorArena* arena) {
+    for (int i = 0; i < arena->num_overflow; i++) {
+        free(arena->overflow_blocks[i]);
+    }
+    arena->num_overflow = 0;
+}
+
+void tensor_arena_free(TensorArena* arena) {
+    if (arena) {
+        if (g_active_arena == arena) {
+            g_active_arena = NULL;
+        }
+        free_overflow_blocks(arena);
+        free(arena->overflow_blocks);
+        free(arena->trace);
+        if (arena->owns_base) {
+            free(arena->base);
+        }
+        free(arena);
+    }
+}
+
+void tensor_arena_reset(TensorArena* arena) {
+    if (!arena) return;
+
+    free_overflow_blocks(arena);
+
+    // 上一步的峰值超过容量: 扩容一次, 稳定状态下不再发生堆分配
+    if (arena->owns_base && arena->peak > usable_capacity(arena)) {
+        arena_grow(arena, arena->peak);
+    }
+
+    arena->used = 0;
+    arena->peak = arena->plan ? arena->plan->peak_bytes : 0;
+    arena->plan_cursor = 0;
+    arena->plan_used = 0;
+    arena->plan_broken = false;
+    if (arena->plan) {
+        arena->trace_count = 0;
+        arena->trace_clock = 0;
+    }
+}
+
+// 规划还在生效: 已取出的分配都与规划一致, 且规划中还有未取出的分配
+// 规划用完之后不再核对, 之后的分配都在规划区域之外
+static bool plan_checking(const TensorArena* arena) {
+    return arena->plan && !arena->plan_broken && arena->plan_cursor < arena->plan->num_allocs;
+}
+
+static bool trace_reserve(TensorArena* arena, int count) {
+    if (count <= arena->trace_capacity) return true;
+    int capacity = arena->trace_capacity ? arena->trace_capacity : 256;
+    while (capacity < count) capacity *= 2;
+    ArenaTraceEntry* trace = (ArenaTraceEntry*)realloc(arena->trace, capacity * sizeof(ArenaTraceEntry));
+    if (!trace) return false;
+    arena->trace = trace;
+    arena->trace_capacity = capacity;
+    return true;
+}
+
+static void trace_record(TensorArena* arena, void* ptr, size_t size, size_t offset) {
+    if (!trace_reserve(arena, arena->trace_count + 1)) {
+        fprintf(stderr, "Failed to grow arena trace, disabling tracing\n");
+        arena->tracing = false;
+        return;
+    }
+    ArenaTraceEntry* entry = &arena->trace[arena->trace_count++];
+    entry->ptr = ptr;
+    entry->size = size;
+    entry->offset = offset;
+    entry->start = arena->trace_clock++;
+    entry->end = -1;
+}
+
+// 超出容量的部分单独从堆上分配, 重置时统一释放
+static void* overflow_alloc(TensorArena* arena, size_t size) {
+    if (arena->num_overflow == arena->overflow_capacity) {
+        int capacity = arena->overflow_capacity ? arena->overflow_capacity * 2 : 16;
+        void** blocks = (void**)realloc(arena->overflow_blocks, capacity * sizeof(void*));
+        if (!blocks) return NULL;
+        arena->overflow_blocks = blocks;
+        arena->overflow_capacity = capacity;
+    }
+    void* block = aligned_alloc(TENSOR_ARENA_ALIGNMENT, size);
+    if (block) {
+        arena->overflow_blocks[arena->num_overflow++] = block;
+    }
+    return block;
+}
+
+void* tensor_arena_alloc(TensorArena* arena, size_t bytes) {
+    if (!arena) return NULL;
+
+    size_t size = round_up(bytes > 0 ? bytes : 1, TENSOR_ARENA_ALIGNMENT);
+    char* aligned_base = arena->base ? arena->base + base_padding(arena) : NULL;
+
+    // 规划模式: 按分配顺序直接取规划好的偏移
+    // 大小不超过规划且分配时刻与追踪时相同才使用, 之前的释放时刻已经逐个核对过
+    if (plan_checking(arena)) {
+        const MemoryPlan* plan = arena->plan;
+        int i = arena->plan_cursor;
+        if (size <= plan->sizes[i] && arena->trace_clock == plan->starts[i]) {
+            ArenaTraceEntry* entry = &arena->trace[i];
+            entry->ptr = aligned_base + plan->offsets[i];
+            entry->size = plan->sizes[i];
+            entry->offset = arena->plan_used;
+            entry->start = arena->trace_clock++;
+            entry->end = -1;
+            arena->trace_count = i + 1;
+            arena->plan_used += plan->sizes[i];
+            arena->plan_cursor++;
+            return entry->ptr;
+        }
+        fprintf(stderr, "Allocation sequence differs from memory plan, falling back to stack allocation\n");
+        arena->plan_broken = true;
+    }
+    // 规划之外的分配(例如反向传播)放在规划区域之后
+    if (arena->plan && arena->used < arena->plan->peak_bytes) {
+        arena->used = arena->plan->peak_bytes;
+    }
+
+    size_t offset = arena->used;
+    void* ptr;
+    if (aligned_base && offset + size <= usable_capacity(arena)) {
+        ptr = aligned_base + offset;
+    } else {
+        ptr = overflow_alloc(arena, size);
+        if (!ptr) {
+            fprintf(stderr, "Failed to allocate %zu bytes of scratch memory\n", size);
+            return NULL;
+        }
+    }
+
+    arena->used = offset + size;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    if (arena->tracing) {
+        trace_record(arena, ptr, size, offset);
+    }
+    return ptr;
+}
+
+size_t tensor_arena_mark(const TensorArena* arena) {
+    if (!arena) return 0;
+    return plan_checking(arena) ? arena->plan_used : arena->used;
+}
+
+// 结束第i个分配的生命周期; 规划模式下结束时刻必须与规划一致
+static void trace_end(TensorArena* arena, int i) {
+    ArenaTraceEntry* entry = &arena->trace[i];
+    entry->end = arena->trace_clock;
+    if (!arena->tracing && !arena->plan_broken && arena->plan->ends[i] != entry->end) {
+        fprintf(stderr, "Allocation lifetimes differ from memory plan, falling back to stack allocation\n");
+        arena->plan_broken = true;
+    }
+}
+
+// 栈顶以上仍存活的分配都在这里结束生命周期
+static void trace_release(TensorArena* arena, size_t mark) {
+    bool released = false;
+    for (int i = arena->trace_count - 1; i >= 0; i--) {
+        ArenaTraceEntry* entry = &arena->trace[i];
+        if (entry->end < 0 && entry->offset >= mark) {
+            trace_end(arena, i);
+            released = true;
+        }
+    }
+    if (released) arena->trace_clock++;
+}
+
+void tensor_arena_release(TensorArena* arena, size_t mark) {
+    if (!arena) return;
+
+    // 规划模式下mark是重演的栈顶, 规划区域之外还没有分配
+    if (plan_checking(arena)) {
+        if (mark <= arena->plan_used) {
+            trace_release(arena, mark);
+            arena->plan_used = mark;
+        }
+        return;
+    }
+
+    if (mark > arena->used) return;
+    if (arena->tracing) {
+        trace_release(arena, mark);
+    }
+    arena->used = mark;
+}
+
+void tensor_arena_note_free(TensorArena* arena, const void* ptr) {
+    if (!arena || !ptr || !(arena->tracing || plan_checking(arena))) return;
+    for (int i = arena->trace_count - 1; i >= 0; i--) {
+        ArenaTraceEntry* entry = &arena->trace[i];
+        if (entry->ptr == ptr && entry->end < 0) {
+            trace_end(arena, i);
+            arena->trace_clock++;
+            return;
+        }
+    }
+}
+
+void tensor_arena_begin_trace(TensorArena* arena) {
+    if (!arena) return;
+    arena->tracing = true;
+    arena->trace_count = 0;
+    arena->trace_clock = 0;
+    arena->plan = NULL;
+}
+
+MemoryPlan* tensor_arena_end_trace(TensorArena* arena) {
+    if (!arena || !arena->tracing) return NULL;
+    arena->tracing = false;
+
+    int n = arena->trace_count;
+    size_t* sizes = (size_t*)malloc((n + 1) * sizeof(size_t));
+    long* starts = (long*)malloc((n + 1) * sizeof(long));
+    long* ends = (long*)malloc((n + 1) * sizeof(long));
+    MemoryPlan* plan = NULL;
+    if (sizes && starts && ends) {
+        for (int i = 0; i < n; i++) {
+            const ArenaTraceEntry* entry = &arena->trace[i];
+            sizes[i] = entry->size;
+            starts[i] = entry->start;
+            // 到追踪结束仍存活的中间结果活到最后
+            ends[i] = entry->end >= 0 ? entry->end : arena->trace_clock;
+        }
+        plan = memory_plan_build(sizes, starts, ends, n, arena->peak);
+    } else {
+        fprintf(stderr, "Failed to allocate memory for plan construction\n");
+    }
+
+    free(sizes);
+    free(starts);
+    free(ends);
+    return plan;
+}
+
+bool tensor_arena_use_plan(TensorArena* arena, const MemoryPlan* plan) {
+    if (!arena) return false;
+
+    if (plan && usable_capacity(arena) < plan->peak_bytes) {
+        if (!arena->owns_base || !arena_grow(arena, plan->peak_bytes)) {
+            fprintf(stderr, "Arena cannot hold memory plan of %zu bytes\n", plan->peak_bytes);
+            return false;
+        }
+    }
+    // 核对生命周期用的记录, 只在遇到更大的规划时扩容
+    if (plan && !trace_reserve(arena, plan->num_allocs)) {
+        fprintf(stderr, "Failed to allocate memory plan bookkeeping\n");
+        return false;
+    }
+
+    arena->plan = plan;
+    arena->plan_cursor = 0;
+    arena->plan_used = 0;
+    arena->plan_broken = false;
+    if (plan) {
+        arena->trace_count = 0;
+        arena->trace_clock = 0;
+    }
+    if (plan && arena->peak < plan->peak_bytes) {
+        arena->peak = plan->peak_bytes;
+    }
+    return true;
+}
+
+TensorArena* tensor_arena_set_active(TensorArena* arena) {
+    TensorArena* previous = g_active_arena;
+    g_active_arena = arena;
+    return previous;
+}
+
+TensorArena* tensor_arena_active(void) {
+    return g_active_arena;
+}
+
+Tensor* tensor_arena_header(TensorArena* arena, const int* shape, int num_dims) {
+    // Tensor结构、shape和strides放在同一块里
+    size_t bytes = sizeof(Tensor) + num_dims * sizeof(long) + num_dims * sizeof(int);
+    char* block = (char*)tensor_arena_alloc(arena, bytes);
+    if (!block) {
+        return NULL;
+    }
+
+    Tensor* tensor = (Tensor*)block;
+    tensor->strides = (long*)(block + sizeof(Tensor));
+    tensor->shape = (int*)(block + sizeof(Tensor) + num_dims * sizeof(long));
+    memcpy(tensor->shape, shape, num_dims * sizeof(int));
+    tensor->num_dims = num_dims;
+
+    long stride = 1;
+    for (int i = num_dims - 1; i >= 0; i--) {
+        tensor->strides[i] = stride;
+        stride *= shape[i];
+    }
+
+    tensor->data = NULL;
+    tensor->storage = NULL;
+    tensor->offset = 0;
+    tensor->owns_data = false;
+    tensor->in_arena = true;
+    return tensor;
+}
+
+static Tensor* scratch_create(const int* shape, int num_dims, bool zero) {
+    TensorArena* arena = g_active_arena;
+    if (!arena) {
+        return tensor_create((int*)shape, num_dims);
+    }
+    if (!shape || num_dims <= 0) {
+        fprintf(stderr, "Invalid shape or dimensions\n");
+        return NULL;
+    }
+
+    // 头部和数据分两次分配, 规划时两者的生命周期相同
+    size_t data_bytes = calculate_total_size(shape, num_dims) * sizeof(float);
+    Tensor* tensor = tensor_arena_header(arena, shape, num_dims);
+    float* data = tensor ? (float*)tensor_arena_alloc(arena, data_bytes) : NULL;
+    if (!data) {
+        return NULL;
+    }
+
+    if (zero) {
+        memset(data, 0, data_bytes);
+    }
+    tensor->storage = data;
+    tensor->data = data;
+    tensor->owns_data = true;
+    return tensor;
+}
+
+Tensor* tensor_create_scratch(const int* shape, int num_dims) {
+    return scratch_create(shape, num_dims, true);
+}
+
+Tensor* tensor_create_scratch_uninit(const int* shape, int num_dims) {
+    return scratch_create(shape, num_dims, false);
+}
@@ -1,6 +1,57 @@
 #include "tensor_trio.h"
+#include "thread_pool.h"
 #include <stdio.h>
 
+typedef struct {
+    Tensor* mask;
+    const Tensor* k;
+    int num_heads;
+    int q_seq_len;
+    int k_seq_len;
+    int pad_token_id;
+    TriangularType type;
+    float fill_value;
+    float other_value;
+} MaskFillCtx;
+
+// 每个任务处理mask的一行 [b, h, i, :]
+static void pad_mask_rows(void* arg, long begin, long end) {
+    const MaskFillCtx* ctx = (const MaskFillCtx*)arg;
+    for (long row = begin; row < end; row++) {
+        int b = (int)(row / ((long)ctx->num_heads * ctx->q_seq_len));
+        float* dst = ctx->mask->data + row * ctx->k_seq_len;
+        for (int j = 0; j < ctx->k_seq_len; j++) {
+            // 如果k中的token是padding token,则设置为0,否则设置为1
+            dst[j] = (ctx->k->data[b * ctx->k_seq_len + j] == ctx->pad_token_id) ? 0.0f : 1.0f;
+        }
+    }
+}
+
+static void triangular_rows(void* arg, long begin, long end) {
+    const MaskFillCtx* ctx = (const MaskFillCtx*)arg;
+    for (long i = begin; i < end; i++) {
+        float* dst = ctx->mask->data + i * ctx->k_seq_len;
+        for (int j = 0; j < ctx->k_seq_len; j++) {
+            bool is_in_triangle = false;
+            switch (ctx->type) {
+                case LOWER_TRIANGULAR:
+                    is_in_triangle = (j <= i);
+                    break;
+                case UPPER_TRIANGULAR:
+                    is_in_triangle = (j >= i);
+                    break;
+                case STRICTLY_LOWER:
+                    is_in_triangle = (j < i);
+                    break;
+                case STRICTLY_UPPER:
+                    is_in_triangle = (j > i);
+                    break;
+            }
+            dst[j] = is_in_triangle ? ctx->fill_value : ctx->other_value;
+        }
+    }
+}
+
 // 创建padding掩码 - 用于处理序列中的padding token
 // mask: [batch_size, num_heads, q_seq_len, k_seq_len]
 // k: [batch_size, k_seq_len, model_dim] - 只需要考虑k中的padding
@@ -22,19 +73,13 @@ bool tensor_create_pad_mask(Tensor* mask, int batch_size, int q_seq_len, Tensor*
         return false;
     }
     
-    // 初始化掩码,只考虑k中的padding token
-    #pragma omp parallel for collapse(4) if(batch_size * num_heads * q_seq_len * k_seq_len > 1000)
-    for (int b = 0; b < batch_size; b++) {
-        for (int h = 0; h < num_heads; h++) {
-            for (int i = 0; i < q_seq_len; i++) {
-                for (int j = 0; j < k_seq_len; j++) {
-                    // 如果k中的token是padding token,则设置为0,否则设置为1
-                    float mask_value = (k->data[b * k_seq_len + j] == pad_token_id) ? 0.0f : 1.0f;
-                    mask->data[((b * num_heads + h) * q_seq_len + i) * k_seq_len + j] = mask_value;
-                }
-            }
-        }
-    }
+    // 初始化掩码,只考虑k中的padding token, 按行并行
+    MaskFillCtx ctx = {
+        .mask = mask, .k = k,
+        .num_heads = num_heads, .q_seq_len = q_seq_len, .k_seq_len = k_seq_len,
+        .pad_token_id = pad_token_id
+    };
+    parallel_for((long)batch_size * num_heads * q_seq_len, 16, pad_mask_rows, &ctx);
     return true;
 }
     
@@ -52,27 +97,11 @@ bool tensor_create_triangular_mask(
     const int rows = tensor->shape[0];
     const int cols = tensor->shape[1];
 
-    #pragma omp parallel for collapse(2) if(rows * cols > 1000)
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            bool is_in_triangle = false;
-            switch (type) {
-                case LOWER_TRIANGULAR:
-                    is_in_triangle = (j <= i);
-                    break;
-                case UPPER_TRIANGULAR:
-                    is_in_triangle = (j >= i);
-                    break;
-                case STRICTLY_LOWER:
-                    is_in_triangle = (j < i);
-                    break;
-                case STRICTLY_UPPER:
-                    is_in_triangle = (j > i);
-                    break;
-            }
-            tensor->data[i * cols + j] = is_in_triangle ? fill_value : other_value;
-        }
-    }
+    MaskFillCtx ctx = {
+        .mask = tensor, .k_seq_len = cols,
+        .type = type, .fill_value = fill_value, .other_value = other_value
+    };
+    parallel_for(rows, 16, triangular_rows, &ctx);
 
     return true;
 }
@@ -1,5 +1,8 @@
 #include "tensor_type.h"
+#include "tensor_arena.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 
 size_t calculate_total_size(const int* shape, int num_dims) {
@@ -23,61 +26,167 @@ bool check_same_shape(const Tensor* A, const Tensor* B) {
     return true;
 }
 
-// 创建空张量
-Tensor* tensor_create(int* shape, int num_dims) {
-    if (!shape || num_dims <= 0) {
-        fprintf(stderr, "Invalid shape or dimensions\n");
-        return false;
+// 行主序连续步长
+static void contiguous_strides(const int* shape, int num_dims, long* strides) {
+    long stride = 1;
+    for (int i = num_dims - 1; i >= 0; i--) {
+        strides[i] = stride;
+        stride *= shape[i];
     }
+}
 
+// 分配张量头部(shape和strides), 不分配数据
+static Tensor* tensor_alloc_header(const int* shape, int num_dims) {
     Tensor* tensor = (Tensor*)malloc(sizeof(Tensor));
     if (!tensor) {
-        return false;
+        return NULL;
     }
 
     // 分配并复制shape数组
     tensor->shape = (int*)malloc(num_dims * sizeof(int));
-    if (!tensor->shape) {
+    tensor->strides = (long*)malloc(num_dims * sizeof(long));
+    if (!tensor->shape || !tensor->strides) {
+        free(tensor->shape);
+        free(tensor->strides);
         free(tensor);
-        return false;
+        return NULL;
     }
     memcpy(tensor->shape, shape, num_dims * sizeof(int));
     tensor->num_dims = num_dims;
+    contiguous_strides(shape, num_dims, tensor->strides);
+
+    tensor->data = NULL;
+    tensor->storage = NULL;
+    tensor->offset = 0;
+    tensor->owns_data = false;
+    tensor->in_arena = false;
+    return tensor;
+}
+
+// 创建空张量
+Tensor* tensor_create(int* shape, int num_dims) {
+    if (!shape || num_dims <= 0) {
+        fprintf(stderr, "Invalid shape or dimensions\n");
+        return NULL;
+    }
+
+    Tensor* tensor = tensor_alloc_header(shape, num_dims);
+    if (!tensor) {
+        return NULL;
+    }
 
     // 计算并分配数据空间
     size_t total_size = calculate_total_size(shape, num_dims);
-    tensor->data = (float*)calloc(total_size, sizeof(float));
-    if (!tensor->data) {
+    tensor->storage = (float*)calloc(total_size, sizeof(float));
+    if (!tensor->storage) {
         free(tensor->shape);
+        free(tensor->strides);
         free(tensor);
-        return false;
+        return NULL;
     }
+    tensor->data = tensor->storage;
+    tensor->owns_data = true;
 
     return tensor;
 }
 
-// 释放张量
+// 在已有存储上创建视图
+Tensor* tensor_view_create(const Tensor* base, const int* shape, const long* strides, int num_dims, long offset) {
+    if (!base || !shape || num_dims <= 0) {
+        fprintf(stderr, "Invalid view arguments\n");
+        return NULL;
+    }
+
+    // 视图是临时对象, 优先放进活动arena
+    Tensor* view = tensor_arena_header(tensor_arena_active(), shape, num_dims);
+    if (!view) {
+        view = tensor_alloc_header(shape, num_dims);
+    }
+    if (!view) {
+        return NULL;
+    }
+    if (strides) {
+        memcpy(view->strides, strides, num_dims * sizeof(long));
+    }
+
+    view->storage = base->storage;
+    view->offset = base->offset + offset;
+    view->data = base->storage + view->offset;
+    view->owns_data = false;
+    return view;
+}
+
+// 释放张量, 视图只释放头部
 void tensor_free(Tensor* tensor) {
+    // arena中的张量在arena重置时统一回收, 这里只在追踪模式下记录释放时刻
+    if (tensor && tensor->in_arena) {
+        TensorArena* arena = tensor_arena_active();
+        if (tensor->owns_data) {
+            tensor_arena_note_free(arena, tensor->storage);
+        }
+        tensor_arena_note_free(arena, tensor);
+        return;
+    }
     if (tensor) {
-        free(tensor->data);
+        if (tensor->owns_data) {
+            free(tensor->storage);
+        }
         free(tensor->shape);
+        free(tensor->strides);
         free(tensor);
     }
 }
 
-// 复制张量
+bool tensor_is_contiguous(const Tensor* tensor) {
+    long stride = 1;
+    for (int i = tensor->num_dims - 1; i >= 0; i--) {
+        // 长度为1的维度步长没有意义
+        if (tensor->shape[i] != 1 && tensor->strides[i] != stride) {
+            return false;
+        }
+        stride *= tensor->shape[i];
+    }
+    return true;
+}
+
+long tensor_outer_offset(const Tensor* tensor, long index, int outer_dims) {
+    long offset = 0;
+    for (int i = outer_dims - 1; i >= 0; i--) {
+        offset += (index % tensor->shape[i]) * tensor->strides[i];
+        index /= tensor->shape[i];
+    }
+    return offset;
+}
+
+// 复制张量, 两边都是连续布局时整体拷贝, 否则按最后一维逐行拷贝
 bool tensor_copy(Tensor* dst, const Tensor* src) {
     // 检查输入参数
     if (!dst || !src) {
         return false;
     }
 
-
     // 计算总大小
     size_t total_size = calculate_total_size(src->shape, src->num_dims);
 
-    // 复制数据
-    memcpy(dst->data, src->data, total_size * sizeof(float));
+    if (tensor_is_contiguous(dst) && tensor_is_contiguous(src)) {
+        memcpy(dst->data, src->data, total_size * sizeof(float));
+        return true;
+    }
+
+    if (!check_same_shape(dst, src)) {
+        fprintf(stderr, "Strided copy requires matching shapes\n");
+        return false;
+    }
 
+    int last = src->num_dims - 1;
+    int row_len = src->shape[last];
+    long rows = (long)(total_size / (row_len > 0 ? row_len : 1));
+    for (long row = 0; row < rows; row++) {
+        const float* s = src->data + tensor_outer_offset(src, row, last);
+        float* d = dst->data + tensor_outer_offset(dst, row, last);
+        for (int j = 0; j < row_len; j++) {
+            d[j * dst->strides[last]] = s[j * src->strides[last]];
+        }
+    }
     return true;
 }
@@ -4,14 +4,25 @@
 #include <stdbool.h>
 #include "tensor_type.h"
 
+// 与嵌入查找融合的位置编码
+typedef struct {
+    const Tensor* table;        // [max_positions, embedding_dim]
+    int seq_length;             // 补齐的batch: cu_seqlens为NULL时第i个token的位置是i % seq_length
+    const int* cu_seqlens;      // 打包的变长batch: 非NULL时第i个token的位置是它在所在序列中的序号
+    int num_seqs;
+} EmbeddingPositions;
+
+// 嵌入查找, 按token并行收集行: output[i] = scale * embedding_matrix[tokens[i]] + table[position(i)]
+// embedding_matrix: [vocab_size, embedding_dim], 所有batch共用同一张表
+// tokens有num_tokens个token id, output是num_tokens行连续的embedding_dim维向量
+// positions为NULL时不加位置编码; token id或位置超出表的范围时返回false
 bool perform_embedding_lookup(
     const Tensor* embedding_matrix,
     const Tensor* tokens,
-    Tensor* output,
-    int batch_size,
-    int seq_length,
-    int embedding_dim
+    long num_tokens,
+    float scale,
+    const EmbeddingPositions* positions,
+    Tensor* output
 );
 
 #endif // LOOKUP_H
-
@@ -6,7 +6,6 @@
 
 bool compute_positional_encodings(
     Tensor* encodings,
-    int batch_size,
     int max_seq_length,
     int encoding_dim
 );
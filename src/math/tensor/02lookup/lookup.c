@@ -1,35 +1,129 @@
 #include "lookup.h"
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
 #include <stdio.h>
 #include <string.h>
 
-// 新增的嵌入查找函数，便于将来GPU加速
+typedef struct {
+    const Tensor* embedding_matrix;
+    const Tensor* tokens;
+    Tensor* output;
+    int embedding_dim;
+    float scale;
+    const EmbeddingPositions* positions;
+    const SimdKernels* kernels;
+} LookupCtx;
+
+// 第i个token所在的序列, 二分查找cu_seqlens
+static int lookup_ragged_seq(const EmbeddingPositions* positions, long i) {
+    int lo = 0;
+    int hi = positions->num_seqs - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (positions->cu_seqlens[mid] <= i) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// 按token并行收集embedding行, 缩放和位置编码在写回时一起完成, token id和位置已经在调用前检查过
+static void lookup_rows(void* arg, long begin, long end) {
+    const LookupCtx* ctx = (const LookupCtx*)arg;
+    const EmbeddingPositions* positions = ctx->positions;
+    int dim = ctx->embedding_dim;
+
+    int seq = 0;
+    long position = 0;
+    if (positions && positions->cu_seqlens) {
+        seq = lookup_ragged_seq(positions, begin);
+        position = begin - positions->cu_seqlens[seq];
+    } else if (positions) {
+        position = begin % positions->seq_length;
+    }
+
+    for (long i = begin; i < end; i++) {
+        int token = (int)ctx->tokens->data[i];
+        float* dst = ctx->output->data + i * dim;
+        const float* src = ctx->embedding_matrix->data + (long)token * dim;
+        if (!positions) {
+            if (ctx->scale == 1.0f) {
+                memcpy(dst, src, dim * sizeof(float));
+            } else {
+                ctx->kernels->scale(src, dst, ctx->scale, dim);
+            }
+            continue;
+        }
+
+        ctx->kernels->scale_add(src, ctx->scale, positions->table->data + position * dim, dst, dim);
+        position++;
+        if (positions->cu_seqlens) {
+            // 跳到下一个token所在的序列, 空序列直接跳过
+            while (seq + 1 < positions->num_seqs && i + 1 >= positions->cu_seqlens[seq + 1]) {
+                seq++;
+                position = i + 1 - positions->cu_seqlens[seq];
+            }
+        } else if (position == positions->seq_length) {
+            position = 0;
+        }
+    }
+}
+
+// 嵌入查找, 便于将来GPU加速
 bool perform_embedding_lookup(
     const Tensor* embedding_matrix,
     const Tensor* tokens,
-    Tensor* output,
-    int batch_size, 
-    int seq_length,
-    int embedding_dim
+    long num_tokens,
+    float scale,
+    const EmbeddingPositions* positions,
+    Tensor* output
 ) {
-    // 这部分将来可以替换为GPU实现
-    for (int b = 0; b < batch_size; b++) {
-        for (int s = 0; s < seq_length; s++) {
-            int token = (int)tokens->data[b * seq_length + s];
-            
-            // 检查token是否超出范围
-            if (token < 0 || token >= embedding_matrix->shape[0]) {
-                fprintf(stderr, "Token id %d exceeds vocabulary size %d\n", 
-                    token, embedding_matrix->shape[0]);
+    if (embedding_matrix->num_dims != 2) {
+        fprintf(stderr, "Embedding matrix must be [vocab_size, embedding_dim]\n");
+        return false;
+    }
+    int vocab_size = embedding_matrix->shape[0];
+    int embedding_dim = embedding_matrix->shape[1];
+    if (num_tokens == 0) return true;
+
+    // 先检查所有token和位置是否超出范围, 再并行收集
+    for (long i = 0; i < num_tokens; i++) {
+        int token = (int)tokens->data[i];
+        if (token < 0 || token >= vocab_size) {
+            fprintf(stderr, "Token id %d exceeds vocabulary size %d\n", token, vocab_size);
+            return false;
+        }
+    }
+    if (positions) {
+        const Tensor* table = positions->table;
+        if (table->num_dims != 2 || table->shape[1] != embedding_dim) {
+            fprintf(stderr, "Position table must be [max_positions, %d]\n", embedding_dim);
+            return false;
+        }
+        int longest = positions->seq_length;
+        if (positions->cu_seqlens) {
+            longest = 0;
+            for (int s = 0; s < positions->num_seqs; s++) {
+                int len = positions->cu_seqlens[s + 1] - positions->cu_seqlens[s];
+                if (len > longest) longest = len;
+            }
+            if (positions->num_seqs <= 0 || positions->cu_seqlens[positions->num_seqs] != num_tokens) {
+                fprintf(stderr, "Ragged positions do not cover %ld tokens\n", num_tokens);
                 return false;
             }
-            
-            // 计算源和目标的偏移量
-            float* dst = output->data + (b * seq_length + s) * embedding_dim;
-            float* src = embedding_matrix->data + token * embedding_dim;
-            
-            // 复制embedding向量
-            memcpy(dst, src, embedding_dim * sizeof(float));
+        } else if (longest <= 0) {
+            fprintf(stderr, "Invalid sequence length %d\n", longest);
+            return false;
+        }
+        if (longest > table->shape[0]) {
+            fprintf(stderr, "Sequence length %d exceeds position table size %d\n", longest, table->shape[0]);
+            return false;
         }
     }
+
+    LookupCtx ctx = {embedding_matrix, tokens, output, embedding_dim, scale, positions, simd_kernels()};
+    parallel_for(num_tokens, 64, lookup_rows, &ctx);
     return true;
-}
\ No newline at end of file
+}
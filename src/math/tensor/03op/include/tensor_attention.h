@@ -0,0 +1,90 @@
+#ifndef TENSOR_ATTENTION_H
+#define TENSOR_ATTENTION_H
+
+#include "tensor_type.h"
+#include <stdint.h>
+
+// 分块大小: 每次处理BLOCK_Q个查询行和BLOCK_K个键
+#define FLASH_BLOCK_Q 64
+#define FLASH_BLOCK_K 64
+
+// 被屏蔽位置的分数, 与apply_attention_mask使用的值相同
+#define FLASH_MASK_VALUE (-1e9f)
+
+// 分块注意力: output = softmax(scale * Q @ K^T + mask) @ V
+// 按K/V块遍历, 每个查询行维护运行中的最大值和指数和(online softmax),
+// 缩放和掩码在块内完成, 结果直接累加到输出, 不生成[seq_len_q, seq_len_k]的分数矩阵
+// q: [batch_size, num_heads, seq_len_q, head_dim]
+// k, v: [kv_batch, num_heads, seq_len_k, head_dim], batch_size必须是kv_batch的倍数,
+//       查询的第b个batch使用第b / (batch_size / kv_batch)个K/V (例如同一个源序列的多个beam共享交叉注意力的K/V)
+// mask: [seq_len_q, seq_len_k], [batch_size或kv_batch, seq_len_q, seq_len_k]
+//       或[batch_size或kv_batch, num_heads, seq_len_q, seq_len_k], 大小为1的前导维广播;
+//       seq_len_q维可以是1(所有查询共用, 只屏蔽padding键); 0表示屏蔽; 可以为NULL
+// output: [batch_size, num_heads, seq_len_q, head_dim]
+// 所有张量的最后一维步长必须为1, 其余维度可以是任意步长的视图(例如拆分注意力头得到的视图)
+bool tensor_flash_attention(
+    const Tensor* q,
+    const Tensor* k,
+    const Tensor* v,
+    const Tensor* mask,
+    float scale,
+    Tensor* output
+);
+
+// 注意力的屏蔽条件, 给出的各项同时生效, 隐式条件不需要[seq_len_q, seq_len_k]的掩码缓冲区
+// 被键长度或因果条件完全屏蔽的键块直接跳过; 某一行所有键都被这两项屏蔽时输出0
+typedef struct {
+    const Tensor* dense;        // 与tensor_flash_attention的mask相同 或 NULL
+    bool causal;                // 按下标因果屏蔽, 查询与键右对齐: 第i个查询看到前i + seq_len_k - seq_len_q + 1个键
+    const int* key_lengths;     // [num_lengths], 第b个查询batch只看前key_lengths[b]个键(padding在末尾); 或 NULL
+    int num_lengths;            // batch_size 或 kv_batch(每个K/V batch一个长度, 同组的查询batch共用)
+    const uint64_t* bits;       // 位图[bits_batch, bits_rows, bits_words], 第j个键对应第j位, 1表示允许; 或 NULL
+    int bits_batch;             // 1, batch_size 或 kv_batch, 没有head维
+    int bits_rows;              // 1(所有查询共用一行) 或 seq_len_q
+    int bits_words;             // 每行的64位字数, 至少ceil(seq_len_k / 64)
+} FlashMask;
+
+// 与tensor_flash_attention相同, 屏蔽条件由spec给出(NULL表示不屏蔽)
+bool tensor_flash_attention_masked(
+    const Tensor* q,
+    const Tensor* k,
+    const Tensor* v,
+    const FlashMask* spec,
+    float scale,
+    Tensor* output
+);
+
+// 分页K/V上的注意力: 每个序列的键分散在共享块池的若干块中, 按块表依次读取
+// 每个块就是online softmax的一个K/V块, 不需要把序列的K/V拼接成连续张量
+// q: [batch_size, num_heads, seq_len_q, head_dim], 每个查询都能看到所在序列的全部seq_lens[b]个键
+// k_blocks, v_blocks: [num_blocks, num_heads, block_size, head_dim]
+// block_tables[b]: 序列b按位置顺序使用的块号, 至少ceil(seq_lens[b] / block_size)个
+// output: [batch_size, num_heads, seq_len_q, head_dim]
+bool tensor_paged_attention(
+    const Tensor* q,
+    const Tensor* k_blocks,
+    const Tensor* v_blocks,
+    const int* const* block_tables,
+    const int* seq_lens,
+    float scale,
+    Tensor* output
+);
+
+// 打包的变长序列注意力: 一批长度不同的序列首尾相接, 不补齐
+// 第s个序列的查询是[cu_seqlens_q[s], cu_seqlens_q[s + 1])行, 只看到同一序列的[cu_seqlens_k[s], cu_seqlens_k[s + 1])个键
+// q, output: [1, num_heads, total_q, head_dim]; k, v: [1, num_heads, total_k, head_dim]
+// cu_seqlens_q/k: [num_seqs + 1]的累计偏移, 第一个为0, 最后一个为total_q/total_k
+// causal为true时查询与键右对齐做因果屏蔽(自注意力时即第i个位置只看前i + 1个键), 被屏蔽的键块整块跳过
+bool tensor_varlen_attention(
+    const Tensor* q,
+    const Tensor* k,
+    const Tensor* v,
+    const int* cu_seqlens_q,
+    const int* cu_seqlens_k,
+    int num_seqs,
+    bool causal,
+    float scale,
+    Tensor* output
+);
+
+#endif // TENSOR_ATTENTION_H
@@ -0,0 +1,119 @@
+#ifndef TENSOR_GEMM_H
+#define TENSOR_GEMM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// 分块参数: MC/KC/NC为缓存分块大小, MR/NR为寄存器微块大小
+// MC必须是MR的倍数, NC必须是NR的倍数
+#define GEMM_MR 6
+#define GEMM_NR 16
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 2048
+
+// 行主序单精度矩阵乘法: C = alpha * op(A) * op(B) + beta * C
+// op(A): [M, K], trans_a为true时A按[K, M]存储
+// op(B): [K, N], trans_b为true时B按[N, K]存储
+// lda/ldb/ldc: 各矩阵的行步长(元素个数)
+// beta为0时不读取C, C不能与A或B重叠
+void gemm_f32(
+    bool trans_a, bool trans_b,
+    int M, int N, int K,
+    float alpha,
+    const float* A, int lda,
+    const float* B, int ldb,
+    float beta,
+    float* C, int ldc
+);
+
+// 门控激活时K的上限: MC块至少要有MR行
+#define GEMM_GATED_MAX_K (GEMM_MC * GEMM_KC / GEMM_MR)
+
+// 按注意力头拆分写回时最多的输出个数(Q/K/V)
+#define GEMM_MAX_SPLIT 3
+
+// 写回时的激活函数
+typedef enum {
+    GEMM_ACT_NONE,
+    GEMM_ACT_RELU,
+    GEMM_ACT_GELU,          // tanh近似
+
+    // 门控激活(GLU): B的N列是交错存放的gate和up, 写回act(gate) * up, C只有N / 2列
+    // 列顺序见gemm_gated_column; 只支持alpha = 1, beta = 0, 不能与dropout、残差或拆分写回同时使用
+    GEMM_ACT_SWIGLU,        // silu(gate) * up
+    GEMM_ACT_GEGLU,         // gelu(gate) * up, tanh近似
+} GemmActivation;
+
+// 门控激活时B的列顺序: 每GEMM_NR列一组, 前一半是gate, 后一半是对应的up,
+// 最后不足一组时是w列gate加w列up; 这样一个寄存器微块里同时有配对的gate和up
+// 返回n_out列输出中第j列的gate(up为false)或up在B中的列号, B共2 * n_out列
+int gemm_gated_column(int n_out, int j, bool up);
+
+// GEMM写回阶段的附加操作, 在结果离开寄存器时完成, 不需要额外遍历C
+// 最后一个K块写回时依次执行: C = dropout(act(alpha * A * B + beta * C + bias)) + residual
+// 门控激活需要完整的点积, K不分块, 相应缩小MC/NC块使打包缓冲区大小不变, K最多为GEMM_GATED_MAX_K
+typedef struct {
+    const float* bias;      // [N], 非NULL时在最后一个K块写回时加到每一行
+    GemmActivation activation;
+
+    // dropout_prob > 0时激活之后做dropout, 保留的元素乘以1 / (1 - dropout_prob)
+    // 第row行第col列是否保留只由(dropout_seed, row * N + col)决定, 与分块方式和线程数无关,
+    // 与dropout_forward是同一个Philox序列, 反向传播需要的掩码可以用dropout_mask_generate重新生成
+    float dropout_prob;
+    uint64_t dropout_seed;
+
+    const float* residual;  // 非NULL时最后加上residual[row * ldr + col], 不能与C重叠(残差就是C时用beta = 1); 拆分写回时不支持
+    int ldr;
+
+    // split_parts > 0时按注意力头拆分写回, 忽略C/ldc
+    // 每split_dim列是一个输出, 行号r = b * seq_len + s, 该输出内的列号c = h * head_dim + d
+    // 写入split_out[part] + b * strides[0] + h * strides[1] + s * strides[2] + d
+    // 各输出的步长可以不同, 例如Q写入连续的临时张量, K/V写入KV缓存的切片
+    int split_parts;
+    float* split_out[GEMM_MAX_SPLIT];
+    long split_strides[GEMM_MAX_SPLIT][3];
+    int split_dim;
+    int split_seq_len;
+    int split_head_dim;
+} GemmEpilogue;
+
+// 带写回操作的GEMM, epilogue为NULL时与gemm_f32相同
+void gemm_f32_ex(
+    bool trans_a, bool trans_b,
+    int M, int N, int K,
+    float alpha,
+    const float* A, int lda,
+    const float* B, int ldb,
+    float beta,
+    float* C, int ldc,
+    const GemmEpilogue* epilogue
+);
+
+// 分组GEMM的一组: C = A * B, 行主序, 不转置
+typedef struct {
+    int M, N, K;
+    const float* A; int lda;
+    const float* B; int ldb;
+    float* C; int ldc;
+    const GemmEpilogue* epilogue;   // 只能有偏置和激活(包括门控激活), 或NULL
+} GemmGroup;
+
+// 分组GEMM: 各组的M、N、权重都可以不同(例如MoE中每个专家分到的token数不同)
+// 所有组的行块一起交给线程池, 每个行块在一个线程内串行计算; 只有一组非空时与gemm_f32_ex相同
+bool gemm_f32_grouped(int num_groups, const GemmGroup* groups);
+
+// 批量矩阵乘法, stride_a/stride_b/stride_c为相邻batch之间的元素偏移
+// stride_b为0时所有batch共享同一个B(例如共享权重)
+void gemm_f32_batched(
+    int batch,
+    bool trans_a, bool trans_b,
+    int M, int N, int K,
+    float alpha,
+    const float* A, int lda, long stride_a,
+    const float* B, int ldb, long stride_b,
+    float beta,
+    float* C, int ldc, long stride_c
+);
+
+#endif // TENSOR_GEMM_H
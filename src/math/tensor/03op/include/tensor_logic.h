@@ -3,6 +3,7 @@
 
 #include "tensor_type.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 // 掩码应用操作
 bool tensor_apply_mask(
@@ -12,13 +13,48 @@ bool tensor_apply_mask(
     float mask_value          // 掩码值（用于替换被掩码的位置）
 );
 
-// 在训练时执行dropout操作
-// prob: dropout概率(0-1之间)
-// training: 是否处于训练模式
+// dropout的随机数来自Philox4x32-10计数器随机数: 第i个元素是否保留只由(seed, i)决定,
+// 与分块方式和线程数无关; 融合在GEMM写回中的dropout使用同样的序列, 所以可以事后重新生成掩码
+
+// 保留掩码, 每16个元素一个uint16_t: 第i个元素保留时bits[i / 16]的第i % 16位为1
+// 嵌入在层结构中, 初始全为0, 训练时记录前向的掩码供反向传播使用
+typedef struct {
+    uint16_t* bits;
+    long capacity;      // bits能容纳的元素个数
+    long n;             // 最近一次记录的元素个数
+    float prob;         // 最近一次的dropout概率, 0表示没有dropout(反向时梯度直接传递)
+    uint64_t seed;
+} DropoutMask;
+
+// 随机数不小于该值的元素保留
+uint32_t dropout_threshold(float prob);
+
+// 在训练时执行dropout操作: 保留的元素乘以1 / (1 - prob)
+// prob <= 0(推理时由调用者传入0)时不生成随机数, input与output相同时直接返回
 bool dropout_forward(Tensor* input, Tensor* output, float prob);
 
-// dropout的反向传播
-bool dropout_backward(Tensor* grad_output, Tensor* grad_input, float prob);
+// 同上, mask非NULL时记录保留掩码
+bool dropout_forward_masked(const Tensor* input, Tensor* output, float prob, DropoutMask* mask);
+
+// 重新生成种子seed的前n个元素的掩码, 用于GEMM写回中融合的dropout
+bool dropout_mask_generate(DropoutMask* mask, long n, float prob, uint64_t seed);
+
+// 释放掩码内存, 之后可以继续使用
+void dropout_mask_release(DropoutMask* mask);
+
+// 设置dropout种子基数并把调用计数清零, 默认基数为0
+// 之后第n次dropout_next_seed的结果只由(基数, n)决定, 固定基数即可复现训练中的所有掩码
+void dropout_set_seed(uint64_t seed);
+
+// 用当前时间作为种子基数(每次运行不同), 返回使用的基数以便记录下来复现
+uint64_t dropout_seed_from_time(void);
+
+// 融合在GEMM写回中的dropout使用的种子, 每次调用返回不同的值, 可以多线程调用
+// 多个线程同时取种子时, 谁拿到哪个计数取决于调度, 需要复现时从一个线程按固定顺序调用
+uint64_t dropout_next_seed(void);
+
+// dropout的反向传播: grad_input = grad_output * mask / (1 - prob), 两者可以相同
+bool dropout_backward(const Tensor* grad_output, Tensor* grad_input, const DropoutMask* mask);
 
 // 张量逐元素与操作
 bool tensor_and(Tensor* a, Tensor* b, Tensor* output);
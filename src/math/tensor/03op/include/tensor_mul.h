@@ -2,6 +2,7 @@
 #define TENSOR_MUL_H
 
 #include "tensor_type.h"
+#include "tensor_gemm.h"
 
 bool tensor_matmul_2d(const Tensor* A, const Tensor* B, Tensor* C);  // 2D矩阵乘法 [M, K] × [K, N]
 bool tensor_matmul_3d(const Tensor* A, const Tensor* B, Tensor* C);  // 3D张量乘法 [batch, M, K] × [batch, K, N]
@@ -19,10 +20,41 @@ bool tensor_mul_4d_2d(
 // output: [batch_size, seq_len, model_dim]
 bool tensor_mul_3_2(const Tensor* input, const Tensor* weight, Tensor* output);
 
+// 线性投影, 偏置在GEMM写回时加上
+// input: [batch_size, seq_len, dim_in]
+// weight: [dim_in, dim_out]
+// bias: [dim_out] 或 NULL
+// output: [batch_size, seq_len, dim_out]
+bool tensor_linear_3d(const Tensor* input, const Tensor* weight, const Tensor* bias, Tensor* output);
+
+// 线性投影, 激活、dropout和残差加法也在GEMM写回时完成:
+// output = dropout(act(input * weight + bias)) + residual
+// residual: [batch_size, seq_len, dim_out] 或 NULL; 与output相同时不能再有激活和dropout
+// options: 只使用activation/dropout_prob/dropout_seed, NULL时与tensor_linear_3d相同
+// 门控激活时weight/bias是按gemm_gated_column交错的[dim_in, 2 * dim_out]/[2 * dim_out],
+// output是act(gate) * up, 不能有残差和dropout
+bool tensor_linear_3d_ex(const Tensor* input, const Tensor* weight, const Tensor* bias,
+                         const Tensor* residual, const GemmEpilogue* options, Tensor* output);
+
+// 融合投影并按注意力头拆分: 一次GEMM算出num_outputs个投影(例如Q/K/V),
+// 偏置和头拆分都在写回时完成, 结果直接是[batch_size, num_heads, seq_len, head_dim]
+// input: [batch_size, seq_len, dim_in]
+// weight: [dim_in, num_outputs * dim], 各投影的权重按列拼接
+// bias: [num_outputs * dim] 或 NULL
+// outputs: num_outputs个[batch_size, num_heads, seq_len, head_dim]张量, 最后一维步长为1,
+//          其余维度可以是视图(例如KV缓存中当前位置的切片)
+bool tensor_linear_split_heads(
+    const Tensor* input,
+    const Tensor* weight,
+    const Tensor* bias,
+    Tensor* const* outputs,
+    int num_outputs
+);
+
 // 4D张量乘法,K的最后两个维度要转置
-// input1: [batch_size, num_heads, seq_len, head_dim]
-// input2: [batch_size, num_heads, seq_len, head_dim]
-// output: [batch_size, num_heads, seq_len, seq_len]
+// input1: [batch_size, num_heads, seq_len_q, head_dim]
+// input2: [batch_size, num_heads, seq_len_k, head_dim]
+// output: [batch_size, num_heads, seq_len_q, seq_len_k]
 bool tensor_mul_4d_transpose(
     const Tensor* input1,
     const Tensor* input2,
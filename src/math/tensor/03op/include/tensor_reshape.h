@@ -4,7 +4,28 @@
 #include "tensor_type.h"
 
 
+// 物理拷贝版本: 输出是新的连续张量
 bool tensor_reshape_3d_to_4d(const Tensor* input, int num_heads, Tensor* output);
 bool tensor_reshape_4d_to_3d(const Tensor* input, Tensor* output);
 
+// 以下函数返回共享input存储的视图, 不拷贝数据, 用tensor_free释放
+// 失败时返回NULL
+
+// 改变形状, 要求input是连续的
+Tensor* tensor_view_reshape(const Tensor* input, const int* shape, int num_dims);
+
+// 维度重排, perm[i]是输出第i维对应的输入维度
+Tensor* tensor_view_permute(const Tensor* input, const int* perm);
+
+// 在dim维上截取[start, start + length)
+Tensor* tensor_view_slice(const Tensor* input, int dim, int start, int length);
+
+// 拆分注意力头: [batch_size, seq_len, model_dim] -> [batch_size, num_heads, seq_len, head_dim]
+Tensor* tensor_view_split_heads(const Tensor* input, int num_heads);
+
+// 合并注意力头: [batch_size, num_heads, seq_len, head_dim] -> [batch_size, seq_len, model_dim]
+// 只有当各个头在内存中按[batch, seq, head, head_dim]排列时才能不拷贝
+// (例如由tensor_view_split_heads得到的视图)
+Tensor* tensor_view_merge_heads(const Tensor* input);
+
 #endif // TENSOR_RESHAPE_H
@@ -20,4 +20,21 @@ bool layer_norm_forward_3d(const Tensor* input, Tensor* output,
                          const Tensor* gamma, const Tensor* beta,
                          float eps);
 
+// 残差加法与层归一化融合: output = layernorm(input + residual), 每行只读一次input和residual
+// residual为NULL时只做归一化; sum非NULL时写出input + residual(pre-norm的残差流需要)
+// mean/rstd非NULL时写入每行的均值和1 / sqrt(var + eps), [batch_size * seq_len], 供反向传播使用
+// input、sum和output可以是同一个张量; 所有操作数必须连续, 步长不连续的视图返回false
+bool residual_layer_norm_forward_3d(const Tensor* input, const Tensor* residual,
+                                    Tensor* sum, Tensor* output,
+                                    const Tensor* gamma, const Tensor* beta, float eps,
+                                    float* mean, float* rstd);
+
+// RMSNorm: output = gamma * x / sqrt(mean(x^2) + eps), 不减均值, 没有beta
+bool rms_norm_forward_3d(const Tensor* input, Tensor* output, const Tensor* gamma, float eps);
+
+// 残差加法与RMSNorm融合, 参数含义与residual_layer_norm_forward_3d相同
+bool residual_rms_norm_forward_3d(const Tensor* input, const Tensor* residual,
+                                  Tensor* sum, Tensor* output,
+                                  const Tensor* gamma, float eps, float* rstd);
+
 #endif
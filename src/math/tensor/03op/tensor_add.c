@@ -1,6 +1,29 @@
 #include "tensor_add.h"
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
 #include <stdio.h>
 
+typedef struct {
+    const float* a;
+    const float* b;
+    float* out;
+    int row_len;    // 加偏置时为model_dim
+} AddCtx;
+
+static void add_range(void* arg, long begin, long end) {
+    const AddCtx* ctx = (const AddCtx*)arg;
+    simd_kernels()->add(ctx->a + begin, ctx->b + begin, ctx->out + begin, end - begin);
+}
+
+static void add_bias_rows(void* arg, long begin, long end) {
+    const AddCtx* ctx = (const AddCtx*)arg;
+    const SimdKernels* kernels = simd_kernels();
+    for (long row = begin; row < end; row++) {
+        long offset = row * ctx->row_len;
+        kernels->add(ctx->a + offset, ctx->b, ctx->out + offset, ctx->row_len);
+    }
+}
+
 // 张量加法操作
 bool tensor_add(const Tensor* A, const Tensor* B, Tensor* output) {
     // 检查输入是否有效
@@ -17,9 +40,8 @@ bool tensor_add(const Tensor* A, const Tensor* B, Tensor* output) {
 
     // 执行加法运算
     size_t total_size = calculate_total_size(A->shape, A->num_dims);
-    for (size_t i = 0; i < total_size; i++) {
-        output->data[i] = A->data[i] + B->data[i];
-    }
+    AddCtx ctx = {A->data, B->data, output->data, 0};
+    parallel_for((long)total_size, 16384, add_range, &ctx);
 
     return true;
 }
@@ -38,20 +60,9 @@ bool tensor_add_bias_3d(
     int seq_len = input->shape[1];
     int model_dim = input->shape[2];
 
-    // 将输入复制到输出
-    memcpy(output->data, input->data, batch_size * seq_len * model_dim * sizeof(float));
-
-    // 为每个位置添加偏置
-    // optimize later for gpu and blas
-    for (int b = 0; b < batch_size; b++) {
-        for (int s = 0; s < seq_len; s++) {
-            for (int d = 0; d < model_dim; d++) {
-                // output[b,s,d] += bias[d]
-                int idx = (b * seq_len * model_dim) + (s * model_dim) + d;
-                output->data[idx] += bias->data[d];
-            }
-        }
-    }
+    // 为每个位置添加偏置, 输入与输出可以是同一个张量
+    AddCtx ctx = {input->data, bias->data, output->data, model_dim};
+    parallel_for((long)batch_size * seq_len, 16, add_bias_rows, &ctx);
 
     return true;
 }
\ No newline at end of file
@@ -0,0 +1,617 @@
+#include "tensor_attention.h"
+#include "tensor_gemm.h"
+#include "thread_pool.h"
+#include "tensor_arena.h"
+#include "cpu_dispatch.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+// 每个线程的块缓冲区: 分数/概率块[BLOCK_Q, BLOCK_K], 输出累加器[BLOCK_Q, head_dim],
+// 每行的运行最大值和指数和; 按需增长, 稳定状态下不再分配
+static _Thread_local float* flash_buffer = NULL;
+static _Thread_local size_t flash_buffer_size = 0;
+
+static float* flash_ensure_buffer(size_t floats) {
+    if (floats > flash_buffer_size) {
+        float* buffer = (float*)aligned_alloc(64, (floats * sizeof(float) + 63) / 64 * 64);
+        if (!buffer) {
+            fprintf(stderr, "Failed to allocate attention tile buffer\n");
+            return NULL;
+        }
+        free(flash_buffer);
+        flash_buffer = buffer;
+        flash_buffer_size = floats;
+    }
+    return flash_buffer;
+}
+
+typedef struct {
+    const Tensor* q;
+    const Tensor* k;
+    const Tensor* v;
+    const Tensor* mask;
+    const FlashMask* spec;  // 隐式掩码(因果、键长度、位图), 稠密部分即mask
+    Tensor* output;
+    float scale;
+    int num_heads;
+    int seq_len_q, seq_len_k, head_dim;
+    int q_blocks;
+    int kv_group;       // 每个K/V batch对应的查询batch数, 例如共享同一个源序列的beam数
+    bool mask_per_kv;   // 掩码的batch维对应K/V的batch
+    long mask_batch_stride, mask_head_stride;   // 广播的维度步长为0
+    long mask_row_stride;
+    int bits_batch_div;     // 位图的batch下标 = b / bits_batch_div, 广播时为0
+    int lengths_div;        // 键长度的下标 = b / lengths_div
+    long bits_batch_stride, bits_row_stride;    // 以64位字为单位
+} FlashCtx;
+
+// 一组查询行在遍历K/V块过程中的online softmax状态
+typedef struct {
+    const float* q;     // [rows, head_dim], 行步长ldq
+    int ldq;
+    int rows;
+    int head_dim;
+    float scale;
+    bool started;
+    float* scores;      // [BLOCK_Q, BLOCK_K]
+    float* acc;         // [BLOCK_Q, head_dim]
+    float* row_max;     // [BLOCK_Q]
+    float* row_sum;     // [BLOCK_Q]
+} FlashState;
+
+static void flash_state_init(FlashState* st, float* buffer, const float* q, int ldq,
+                             int rows, int head_dim, float scale) {
+    st->q = q;
+    st->ldq = ldq;
+    st->rows = rows;
+    st->head_dim = head_dim;
+    st->scale = scale;
+    st->started = false;
+    st->scores = buffer;
+    st->acc = st->scores + FLASH_BLOCK_Q * FLASH_BLOCK_K;
+    st->row_max = st->acc + (long)FLASH_BLOCK_Q * head_dim;
+    st->row_sum = st->row_max + FLASH_BLOCK_Q;
+    for (int i = 0; i < rows; i++) {
+        st->row_max[i] = -INFINITY;
+        st->row_sum[i] = 0.0f;
+    }
+}
+
+// 不做因果屏蔽时的causal_diag
+#define FLASH_NO_CAUSAL INT_MAX
+
+// 一个K/V块内的屏蔽条件, 各项同时生效
+typedef struct {
+    const float* dense;     // 该块对应的[rows, cols]浮点掩码 或 NULL
+    long dense_row_stride;
+    const uint64_t* bits;   // 位图中该块第一行所在行的起点 或 NULL
+    long bits_row_stride;
+    int bit_col;            // 该块第一个键在位图行中的列号
+    int causal_diag;        // 块内第i行只能看到第j <= i + causal_diag列
+} TileMask;
+
+// 累加一个K/V块(cols <= BLOCK_K个键), tm为NULL时不屏蔽
+static void flash_tile(FlashState* st, const float* k, int ldk, const float* v, int ldv, int cols,
+                       const TileMask* tm) {
+    int rows = st->rows;
+    int head_dim = st->head_dim;
+    float* scores = st->scores;
+
+    // S = scale * Q_blk @ K_blk^T, 缩放在GEMM写回时完成
+    gemm_f32(false, true, rows, cols, head_dim, st->scale,
+             st->q, st->ldq, k, ldk,
+             0.0f, scores, FLASH_BLOCK_K);
+
+    const SimdKernels* kernels = simd_kernels();
+    for (int i = 0; i < rows; i++) {
+        float* s = scores + i * FLASH_BLOCK_K;
+        float* a = st->acc + (long)i * head_dim;
+
+        // 因果条件下只有前n列有效, 之后的位置概率为0, 不计算exp
+        int n = cols;
+        if (tm && tm->causal_diag != FLASH_NO_CAUSAL && i + tm->causal_diag + 1 < cols) {
+            n = i + tm->causal_diag + 1 > 0 ? i + tm->causal_diag + 1 : 0;
+        }
+        if (n == 0) {
+            // 整行都在对角线之后, 本块贡献为0; 始终没有有效键的行最后输出0
+            for (int j = 0; j < cols; j++) s[j] = 0.0f;
+            if (!st->started) {
+                for (int d = 0; d < head_dim; d++) a[d] = 0.0f;
+            }
+            continue;
+        }
+
+        float block_max = kernels->scale_mask_max_row(s, s, n, 1.0f,
+                                                      tm && tm->dense ? tm->dense + i * tm->dense_row_stride : NULL,
+                                                      FLASH_MASK_VALUE);
+        if (tm && tm->bits) {
+            const uint64_t* row = tm->bits + i * tm->bits_row_stride;
+            bool cleared = false;
+            for (int j = 0; j < n; j++) {
+                int c = tm->bit_col + j;
+                if (!((row[c >> 6] >> (c & 63)) & 1)) {
+                    s[j] = FLASH_MASK_VALUE;
+                    cleared = true;
+                }
+            }
+            if (cleared) {
+                block_max = s[0];
+                for (int j = 1; j < n; j++) {
+                    if (s[j] > block_max) block_max = s[j];
+                }
+            }
+        }
+
+        // online softmax: 新的最大值出现时, 按exp(旧最大值 - 新最大值)修正之前的和与输出
+        float new_max = block_max > st->row_max[i] ? block_max : st->row_max[i];
+        float correction = expf(st->row_max[i] - new_max);
+        float sum = kernels->exp_sum_row(s, n, new_max);
+        for (int j = n; j < cols; j++) s[j] = 0.0f;
+        st->row_sum[i] = st->row_sum[i] * correction + sum;
+        st->row_max[i] = new_max;
+
+        if (!st->started) {
+            for (int d = 0; d < head_dim; d++) a[d] = 0.0f;
+        } else if (correction != 1.0f) {
+            kernels->scale(a, a, correction, (size_t)head_dim);
+        }
+    }
+    st->started = true;
+
+    // O += P_blk @ V_blk
+    gemm_f32(false, false, rows, head_dim, cols, 1.0f,
+             scores, FLASH_BLOCK_K, v, ldv,
+             1.0f, st->acc, head_dim);
+}
+
+// 按指数和归一化并写出结果
+static void flash_state_finish(const FlashState* st, float* out, long ldo) {
+    for (int i = 0; i < st->rows; i++) {
+        float* o = out + i * ldo;
+        if (!st->started || st->row_sum[i] == 0.0f) {
+            for (int d = 0; d < st->head_dim; d++) o[d] = 0.0f;
+            continue;
+        }
+        simd_kernels()->scale(st->acc + (long)i * st->head_dim, o, 1.0f / st->row_sum[i],
+                              (size_t)st->head_dim);
+    }
+}
+
+// 每个线程的块缓冲区大小
+static size_t flash_buffer_floats(int head_dim) {
+    return (size_t)FLASH_BLOCK_Q * (FLASH_BLOCK_K + head_dim + 2);
+}
+
+// 一个(batch, head, 查询块)的注意力
+static void flash_block(const FlashCtx* ctx, float* buffer, int b, int h, int q_begin) {
+    int rows = ctx->seq_len_q - q_begin < FLASH_BLOCK_Q ? ctx->seq_len_q - q_begin : FLASH_BLOCK_Q;
+    long bh = (long)b * ctx->num_heads + h;
+    long kv_bh = (long)(b / ctx->kv_group) * ctx->num_heads + h;
+
+    const float* q = ctx->q->data + tensor_outer_offset(ctx->q, bh, 2) + (long)q_begin * ctx->q->strides[2];
+    const float* k = ctx->k->data + tensor_outer_offset(ctx->k, kv_bh, 2);
+    const float* v = ctx->v->data + tensor_outer_offset(ctx->v, kv_bh, 2);
+    float* out = ctx->output->data + tensor_outer_offset(ctx->output, bh, 2) + (long)q_begin * ctx->output->strides[2];
+    int ldk = (int)ctx->k->strides[2];
+    int ldv = (int)ctx->v->strides[2];
+
+    const float* mask = NULL;
+    if (ctx->mask) {
+        int mask_b = ctx->mask_per_kv ? b / ctx->kv_group : b;
+        mask = ctx->mask->data + mask_b * ctx->mask_batch_stride + h * ctx->mask_head_stride +
+               (long)q_begin * ctx->mask_row_stride;
+    }
+
+    // 键长度和因果条件直接缩短要遍历的键, 完全被屏蔽的键块不计算
+    const FlashMask* spec = ctx->spec;
+    int k_end = ctx->seq_len_k;
+    int diag = FLASH_NO_CAUSAL;
+    const uint64_t* bits = NULL;
+    if (spec) {
+        int key_length = spec->key_lengths ? spec->key_lengths[b / ctx->lengths_div] : k_end;
+        if (key_length < k_end) {
+            k_end = key_length > 0 ? key_length : 0;
+        }
+        if (spec->causal) {
+            diag = q_begin + ctx->seq_len_k - ctx->seq_len_q;
+            if (diag + rows < k_end) k_end = diag + rows > 0 ? diag + rows : 0;
+        }
+        if (spec->bits) {
+            bits = spec->bits + (b / ctx->bits_batch_div) * ctx->bits_batch_stride +
+                   (long)q_begin * ctx->bits_row_stride;
+        }
+    }
+
+    FlashState st;
+    flash_state_init(&st, buffer, q, (int)ctx->q->strides[2], rows, ctx->head_dim, ctx->scale);
+    for (int k_begin = 0; k_begin < k_end; k_begin += FLASH_BLOCK_K) {
+        int cols = k_end - k_begin < FLASH_BLOCK_K ? k_end - k_begin : FLASH_BLOCK_K;
+        TileMask tm = {
+            .dense = mask ? mask + k_begin : NULL, .dense_row_stride = ctx->mask_row_stride,
+            .bits = bits, .bits_row_stride = ctx->bits_row_stride, .bit_col = k_begin,
+            .causal_diag = diag != FLASH_NO_CAUSAL && diag - k_begin < cols - 1 ?
+                           diag - k_begin : FLASH_NO_CAUSAL,
+        };
+        bool masked = tm.dense || tm.bits || tm.causal_diag != FLASH_NO_CAUSAL;
+        flash_tile(&st, k + (long)k_begin * ldk, ldk, v + (long)k_begin * ldv, ldv, cols,
+                   masked ? &tm : NULL);
+    }
+    flash_state_finish(&st, out, ctx->output->strides[2]);
+}
+
+static void flash_range(void* arg, long begin, long end) {
+    const FlashCtx* ctx = (const FlashCtx*)arg;
+    float* buffer = flash_ensure_buffer(flash_buffer_floats(ctx->head_dim));
+    if (!buffer) return;
+
+    for (long item = begin; item < end; item++) {
+        long bh = item / ctx->q_blocks;
+        int block = (int)(item % ctx->q_blocks);
+        flash_block(ctx, buffer, (int)(bh / ctx->num_heads), (int)(bh % ctx->num_heads),
+                    block * FLASH_BLOCK_Q);
+    }
+}
+
+// 掩码前导维的步长, 维度不存在或大小为1时广播(步长0)
+// 查询维大小为1时所有查询共用一行, 例如只屏蔽padding键的[B, 1, seq_len_k]
+static bool mask_strides(const Tensor* mask, int batch_size, int kv_batch, int num_heads,
+                         int seq_len_q, int seq_len_k, FlashCtx* ctx) {
+    int n = mask->num_dims;
+    if (n < 2 || n > 4 ||
+        (mask->shape[n - 2] != seq_len_q && mask->shape[n - 2] != 1) ||
+        mask->shape[n - 1] != seq_len_k || mask->strides[n - 1] != 1) {
+        fprintf(stderr, "Attention mask must end in [seq_len_q or 1, seq_len_k] with unit stride\n");
+        return false;
+    }
+    ctx->mask_row_stride = mask->shape[n - 2] == 1 ? 0 : mask->strides[n - 2];
+    ctx->mask_batch_stride = 0;
+    ctx->mask_head_stride = 0;
+    if (n >= 3) {
+        if (mask->shape[0] != 1 && mask->shape[0] != batch_size && mask->shape[0] != kv_batch) {
+            fprintf(stderr, "Attention mask batch dimension does not match\n");
+            return false;
+        }
+        ctx->mask_batch_stride = mask->shape[0] == 1 ? 0 : mask->strides[0];
+        ctx->mask_per_kv = mask->shape[0] != batch_size;
+    }
+    if (n == 4) {
+        if (mask->shape[1] != 1 && mask->shape[1] != num_heads) {
+            fprintf(stderr, "Attention mask head dimension does not match\n");
+            return false;
+        }
+        ctx->mask_head_stride = mask->shape[1] == 1 ? 0 : mask->strides[1];
+    }
+    return true;
+}
+
+// 位图的batch维和查询维的广播方式
+static bool bits_strides(const FlashMask* spec, int batch_size, int kv_batch, int seq_len_q,
+                         int seq_len_k, FlashCtx* ctx) {
+    if ((spec->bits_batch != 1 && spec->bits_batch != batch_size && spec->bits_batch != kv_batch) ||
+        (spec->bits_rows != 1 && spec->bits_rows != seq_len_q) ||
+        (long)spec->bits_words * 64 < seq_len_k) {
+        fprintf(stderr, "Attention bit mask does not match the scores\n");
+        return false;
+    }
+    if (spec->bits_batch == 1) {
+        ctx->bits_batch_div = batch_size;
+    } else {
+        ctx->bits_batch_div = spec->bits_batch == batch_size ? 1 : batch_size / kv_batch;
+    }
+    ctx->bits_row_stride = spec->bits_rows == 1 ? 0 : spec->bits_words;
+    ctx->bits_batch_stride = (long)spec->bits_rows * spec->bits_words;
+    return true;
+}
+
+bool tensor_flash_attention(
+    const Tensor* q,
+    const Tensor* k,
+    const Tensor* v,
+    const Tensor* mask,
+    float scale,
+    Tensor* output
+) {
+    FlashMask spec = {.dense = mask};
+    return tensor_flash_attention_masked(q, k, v, mask ? &spec : NULL, scale, output);
+}
+
+bool tensor_flash_attention_masked(
+    const Tensor* q,
+    const Tensor* k,
+    const Tensor* v,
+    const FlashMask* spec,
+    float scale,
+    Tensor* output
+) {
+    if (!q || !k || !v || !output ||
+        q->num_dims != 4 || k->num_dims != 4 || v->num_dims != 4 || output->num_dims != 4) {
+        fprintf(stderr, "Attention operands must be 4-dimensional\n");
+        return false;
+    }
+
+    int batch_size = q->shape[0];
+    int num_heads = q->shape[1];
+    int seq_len_q = q->shape[2];
+    int head_dim = q->shape[3];
+    int seq_len_k = k->shape[2];
+    int kv_batch = k->shape[0];
+    if (kv_batch <= 0 || batch_size % kv_batch != 0 || v->shape[0] != kv_batch ||
+        k->shape[1] != num_heads || v->shape[1] != num_heads ||
+        output->shape[0] != batch_size || output->shape[1] != num_heads) {
+        fprintf(stderr, "Attention batch/head dimensions do not match\n");
+        return false;
+    }
+    if (k->shape[3] != head_dim || v->shape[2] != seq_len_k || v->shape[3] != head_dim ||
+        output->shape[2] != seq_len_q || output->shape[3] != head_dim) {
+        fprintf(stderr, "Incompatible dimensions for attention\n");
+        return false;
+    }
+    if (q->strides[3] != 1 || k->strides[3] != 1 || v->strides[3] != 1 || output->strides[3] != 1) {
+        fprintf(stderr, "Attention operands need unit stride in the last dimension\n");
+        return false;
+    }
+
+    const Tensor* mask = spec ? spec->dense : NULL;
+    bool implicit = spec && (spec->causal || spec->key_lengths || spec->bits);
+    FlashCtx ctx = {
+        .q = q, .k = k, .v = v, .mask = mask, .spec = implicit ? spec : NULL, .output = output,
+        .scale = scale,
+        .num_heads = num_heads,
+        .seq_len_q = seq_len_q, .seq_len_k = seq_len_k, .head_dim = head_dim,
+        .q_blocks = (seq_len_q + FLASH_BLOCK_Q - 1) / FLASH_BLOCK_Q,
+        .kv_group = batch_size / kv_batch,
+    };
+    if (mask && !mask_strides(mask, batch_size, kv_batch, num_heads, seq_len_q, seq_len_k, &ctx)) {
+        return false;
+    }
+    if (implicit && spec->bits && !bits_strides(spec, batch_size, kv_batch, seq_len_q, seq_len_k, &ctx)) {
+        return false;
+    }
+    if (implicit && spec->key_lengths) {
+        if (spec->num_lengths != batch_size && spec->num_lengths != kv_batch) {
+            fprintf(stderr, "Attention key lengths do not match the batch\n");
+            return false;
+        }
+        ctx.lengths_div = spec->num_lengths == batch_size ? 1 : ctx.kv_group;
+    }
+    if (seq_len_q == 0 || seq_len_k == 0) {
+        return true;
+    }
+
+    // 每个(batch, head, 查询块)独立计算, 块内的小GEMM在线程内串行执行
+    parallel_for((long)batch_size * num_heads * ctx.q_blocks, 1, flash_range, &ctx);
+    return true;
+}
+
+typedef struct {
+    const Tensor* q;
+    const Tensor* k_blocks;
+    const Tensor* v_blocks;
+    const int* const* block_tables;
+    const int* seq_lens;
+    Tensor* output;
+    float scale;
+    int num_heads, seq_len_q, head_dim, block_size;
+    int q_blocks;
+} PagedCtx;
+
+static void paged_range(void* arg, long begin, long end) {
+    const PagedCtx* ctx = (const PagedCtx*)arg;
+    float* buffer = flash_ensure_buffer(flash_buffer_floats(ctx->head_dim));
+    if (!buffer) return;
+
+    int ldk = (int)ctx->k_blocks->strides[2];
+    int ldv = (int)ctx->v_blocks->strides[2];
+    for (long item = begin; item < end; item++) {
+        long bh = item / ctx->q_blocks;
+        int q_begin = (int)(item % ctx->q_blocks) * FLASH_BLOCK_Q;
+        int b = (int)(bh / ctx->num_heads);
+        int h = (int)(bh % ctx->num_heads);
+        int rows = ctx->seq_len_q - q_begin < FLASH_BLOCK_Q ? ctx->seq_len_q - q_begin : FLASH_BLOCK_Q;
+        const float* q = ctx->q->data + tensor_outer_offset(ctx->q, bh, 2) + (long)q_begin * ctx->q->strides[2];
+        float* out = ctx->output->data + tensor_outer_offset(ctx->output, bh, 2) +
+                     (long)q_begin * ctx->output->strides[2];
+
+        FlashState st;
+        flash_state_init(&st, buffer, q, (int)ctx->q->strides[2], rows, ctx->head_dim, ctx->scale);
+        const int* table = ctx->block_tables[b];
+        int seq_len = ctx->seq_lens[b];
+        for (int pos = 0; pos < seq_len; pos += ctx->block_size) {
+            long block = (long)table[pos / ctx->block_size] * ctx->num_heads + h;
+            const float* k = ctx->k_blocks->data + tensor_outer_offset(ctx->k_blocks, block, 2);
+            const float* v = ctx->v_blocks->data + tensor_outer_offset(ctx->v_blocks, block, 2);
+            int in_block = seq_len - pos < ctx->block_size ? seq_len - pos : ctx->block_size;
+            // 块比BLOCK_K大时再切分
+            for (int j = 0; j < in_block; j += FLASH_BLOCK_K) {
+                int cols = in_block - j < FLASH_BLOCK_K ? in_block - j : FLASH_BLOCK_K;
+                flash_tile(&st, k + (long)j * ldk, ldk, v + (long)j * ldv, ldv, cols, NULL);
+            }
+        }
+        flash_state_finish(&st, out, ctx->output->strides[2]);
+    }
+}
+
+bool tensor_paged_attention(
+    const Tensor* q,
+    const Tensor* k_blocks,
+    const Tensor* v_blocks,
+    const int* const* block_tables,
+    const int* seq_lens,
+    float scale,
+    Tensor* output
+) {
+    if (!q || !k_blocks || !v_blocks || !block_tables || !seq_lens || !output ||
+        q->num_dims != 4 || k_blocks->num_dims != 4 || v_blocks->num_dims != 4 || output->num_dims != 4) {
+        fprintf(stderr, "Paged attention operands must be 4-dimensional\n");
+        return false;
+    }
+
+    int batch_size = q->shape[0];
+    int num_heads = q->shape[1];
+    int seq_len_q = q->shape[2];
+    int head_dim = q->shape[3];
+    for (int i = 0; i < 4; i++) {
+        if (k_blocks->shape[i] != v_blocks->shape[i] || output->shape[i] != q->shape[i]) {
+            fprintf(stderr, "Incompatible dimensions for paged attention\n");
+            return false;
+        }
+    }
+    if (k_blocks->shape[1] != num_heads || k_blocks->shape[3] != head_dim) {
+        fprintf(stderr, "Block pool does not match query heads\n");
+        return false;
+    }
+    if (q->strides[3] != 1 || k_blocks->strides[3] != 1 || v_blocks->strides[3] != 1 ||
+        output->strides[3] != 1) {
+        fprintf(stderr, "Attention operands need unit stride in the last dimension\n");
+        return false;
+    }
+
+    PagedCtx ctx = {
+        .q = q, .k_blocks = k_blocks, .v_blocks = v_blocks,
+        .block_tables = block_tables, .seq_lens = seq_lens,
+        .output = output,
+        .scale = scale,
+        .num_heads = num_heads, .seq_len_q = seq_len_q, .head_dim = head_dim,
+        .block_size = k_blocks->shape[2],
+        .q_blocks = (seq_len_q + FLASH_BLOCK_Q - 1) / FLASH_BLOCK_Q,
+    };
+    if (seq_len_q == 0) {
+        return true;
+    }
+    parallel_for((long)batch_size * num_heads * ctx.q_blocks, 1, paged_range, &ctx);
+    return true;
+}
+
+typedef struct {
+    const Tensor* q;
+    const Tensor* k;
+    const Tensor* v;
+    Tensor* output;
+    const int* cu_seqlens_q;
+    const int* cu_seqlens_k;
+    const int* block_starts;    // [num_seqs + 1], 每个序列第一个查询块的全局编号
+    int num_seqs, num_heads, head_dim;
+    bool causal;
+    float scale;
+} VarlenCtx;
+
+// 查询块blk所在的序列: block_starts中最后一个<= blk的位置
+static int varlen_seq_of_block(const VarlenCtx* ctx, int blk) {
+    int lo = 0, hi = ctx->num_seqs - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (ctx->block_starts[mid] <= blk) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+static void varlen_range(void* arg, long begin, long end) {
+    const VarlenCtx* ctx = (const VarlenCtx*)arg;
+    float* buffer = flash_ensure_buffer(flash_buffer_floats(ctx->head_dim));
+    if (!buffer) return;
+
+    int ldq = (int)ctx->q->strides[2];
+    int ldk = (int)ctx->k->strides[2];
+    int ldv = (int)ctx->v->strides[2];
+    for (long item = begin; item < end; item++) {
+        int blk = (int)(item / ctx->num_heads);
+        int h = (int)(item % ctx->num_heads);
+        int s = varlen_seq_of_block(ctx, blk);
+        int len_q = ctx->cu_seqlens_q[s + 1] - ctx->cu_seqlens_q[s];
+        int len_k = ctx->cu_seqlens_k[s + 1] - ctx->cu_seqlens_k[s];
+        int q_begin = (blk - ctx->block_starts[s]) * FLASH_BLOCK_Q;
+        int rows = len_q - q_begin < FLASH_BLOCK_Q ? len_q - q_begin : FLASH_BLOCK_Q;
+
+        long q_row = ctx->cu_seqlens_q[s] + q_begin;
+        const float* q = ctx->q->data + h * ctx->q->strides[1] + q_row * ldq;
+        const float* k = ctx->k->data + h * ctx->k->strides[1] + (long)ctx->cu_seqlens_k[s] * ldk;
+        const float* v = ctx->v->data + h * ctx->v->strides[1] + (long)ctx->cu_seqlens_k[s] * ldv;
+        float* out = ctx->output->data + h * ctx->output->strides[1] + q_row * ctx->output->strides[2];
+
+        // 因果时查询与键右对齐: 序列内第i个查询看到前i + len_k - len_q + 1个键, 之后的块整块跳过
+        int diag = q_begin + len_k - len_q;
+        int k_end = len_k;
+        if (ctx->causal && diag + rows < k_end) {
+            k_end = diag + rows > 0 ? diag + rows : 0;
+        }
+
+        FlashState st;
+        flash_state_init(&st, buffer, q, ldq, rows, ctx->head_dim, ctx->scale);
+        for (int k_begin = 0; k_begin < k_end; k_begin += FLASH_BLOCK_K) {
+            int cols = k_end - k_begin < FLASH_BLOCK_K ? k_end - k_begin : FLASH_BLOCK_K;
+            TileMask tm = {.causal_diag = diag - k_begin};
+            bool masked = ctx->causal && diag - k_begin < cols - 1;
+            flash_tile(&st, k + (long)k_begin * ldk, ldk, v + (long)k_begin * ldv, ldv, cols,
+                       masked ? &tm : NULL);
+        }
+        flash_state_finish(&st, out, ctx->output->strides[2]);
+    }
+}
+
+bool tensor_varlen_attention(
+    const Tensor* q,
+    const Tensor* k,
+    const Tensor* v,
+    const int* cu_seqlens_q,
+    const int* cu_seqlens_k,
+    int num_seqs,
+    bool causal,
+    float scale,
+    Tensor* output
+) {
+    if (!q || !k || !v || !output || !cu_seqlens_q || !cu_seqlens_k || num_seqs <= 0 ||
+        q->num_dims != 4 || k->num_dims != 4 || v->num_dims != 4 || output->num_dims != 4 ||
+        q->shape[0] != 1 || k->shape[0] != 1 || v->shape[0] != 1 || output->shape[0] != 1) {
+        fprintf(stderr, "Packed attention operands must be [1, num_heads, total_tokens, head_dim]\n");
+        return false;
+    }
+
+    int num_heads = q->shape[1];
+    int head_dim = q->shape[3];
+    if (k->shape[1] != num_heads || v->shape[1] != num_heads || output->shape[1] != num_heads ||
+        k->shape[3] != head_dim || v->shape[3] != head_dim || output->shape[3] != head_dim ||
+        v->shape[2] != k->shape[2] || output->shape[2] != q->shape[2] ||
+        cu_seqlens_q[num_seqs] != q->shape[2] || cu_seqlens_k[num_seqs] != k->shape[2]) {
+        fprintf(stderr, "Packed attention dimensions do not match the sequence offsets\n");
+        return false;
+    }
+    if (q->strides[3] != 1 || k->strides[3] != 1 || v->strides[3] != 1 || output->strides[3] != 1) {
+        fprintf(stderr, "Attention operands need unit stride in the last dimension\n");
+        return false;
+    }
+
+    // 每个序列的查询块编号, 有活动arena时放在arena中
+    TensorArena* arena = tensor_arena_active();
+    size_t mark = tensor_arena_mark(arena);
+    size_t bytes = (num_seqs + 1) * sizeof(int);
+    int* block_starts = arena ? (int*)tensor_arena_alloc(arena, bytes) : (int*)malloc(bytes);
+    if (!block_starts) {
+        return false;
+    }
+    block_starts[0] = 0;
+    for (int s = 0; s < num_seqs; s++) {
+        int len_q = cu_seqlens_q[s + 1] - cu_seqlens_q[s];
+        block_starts[s + 1] = block_starts[s] + (len_q + FLASH_BLOCK_Q - 1) / FLASH_BLOCK_Q;
+    }
+
+    VarlenCtx ctx = {
+        .q = q, .k = k, .v = v, .output = output,
+        .cu_seqlens_q = cu_seqlens_q, .cu_seqlens_k = cu_seqlens_k,
+        .block_starts = block_starts,
+        .num_seqs = num_seqs, .num_heads = num_heads, .head_dim = head_dim,
+        .causal = causal, .scale = scale,
+    };
+    // 每个(查询块, head)独立计算, 不同长度的序列各自只遍历自己的键
+    parallel_for((long)block_starts[num_seqs] * num_heads, 1, varlen_range, &ctx);
+
+    if (arena) {
+        tensor_arena_release(arena, mark);
+    } else {
+        free(block_starts);
+    }
+    return true;
+}
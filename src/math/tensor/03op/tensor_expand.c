@@ -1,6 +1,21 @@
 #include "tensor_expand.h"
+#include "thread_pool.h"
 #include <string.h>
 
+typedef struct {
+    const float* input;
+    float* output;
+    int input_size;
+} BroadcastCtx;
+
+// 每个(b, h)复制一份完整的输入矩阵
+static void broadcast_copies(void* arg, long begin, long end) {
+    const BroadcastCtx* ctx = (const BroadcastCtx*)arg;
+    for (long i = begin; i < end; i++) {
+        memcpy(ctx->output + i * ctx->input_size, ctx->input, ctx->input_size * sizeof(float));
+    }
+}
+
 bool tensor_broadcast_2d_to_4d(
     const Tensor* input,
     int batch_size,
@@ -22,18 +37,9 @@ bool tensor_broadcast_2d_to_4d(
         return false;
     }
 
-    // 计算步长
-    const int head_stride = M * N;
-    const int batch_stride = num_heads * head_stride;
-
     // 执行广播
-    #pragma omp parallel for collapse(2) if (batch_size * num_heads > 4)
-    for (int b = 0; b < batch_size; b++) {
-        for (int h = 0; h < num_heads; h++) {
-            float* target = output->data + b * batch_stride + h * head_stride;
-            memcpy(target, input->data, input_size * sizeof(float));
-        }
-    }
+    BroadcastCtx ctx = {input->data, output->data, input_size};
+    parallel_for((long)batch_size * num_heads, 1, broadcast_copies, &ctx);
 
     return true;
 }
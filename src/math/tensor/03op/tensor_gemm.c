@@ -0,0 +1,499 @@
+#include "tensor_gemm.h"
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
+#include "tensor_logic.h"
+#include "tensor_arena.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+// 打包缓冲区, 每个线程一份, 第一次使用时分配
+// A块: [MC/MR个panel][KC][MR], B块: [NC/NR个panel][KC][NR]
+static _Thread_local float* packed_a = NULL;
+static _Thread_local float* packed_b = NULL;
+
+static bool gemm_ensure_buffers(void) {
+    if (!packed_a) {
+        packed_a = (float*)aligned_alloc(64, GEMM_MC * GEMM_KC * sizeof(float));
+    }
+    if (!packed_b) {
+        packed_b = (float*)aligned_alloc(64, GEMM_KC * GEMM_NC * sizeof(float));
+    }
+    if (!packed_a || !packed_b) {
+        fprintf(stderr, "Failed to allocate GEMM packing buffers\n");
+        return false;
+    }
+    return true;
+}
+
+// 将op(A)的[mc, kc]子块打包为MR行一组的panel, 不足MR的部分补0
+static void pack_a(
+    bool trans_a, int mc, int kc,
+    const float* A, int lda,
+    float* dst
+) {
+    for (int i = 0; i < mc; i += GEMM_MR) {
+        int rows = (mc - i < GEMM_MR) ? mc - i : GEMM_MR;
+        for (int p = 0; p < kc; p++) {
+            int r = 0;
+            if (trans_a) {
+                const float* src = A + (long)p * lda + i;
+                for (; r < rows; r++) dst[r] = src[r];
+            } else {
+                const float* src = A + (long)i * lda + p;
+                for (; r < rows; r++) dst[r] = src[(long)r * lda];
+            }
+            for (; r < GEMM_MR; r++) dst[r] = 0.0f;
+            dst += GEMM_MR;
+        }
+    }
+}
+
+// 将op(B)的[kc, nc]子块打包为NR列一组的panel, 不足NR的部分补0
+static void pack_b(
+    bool trans_b, int kc, int nc,
+    const float* B, int ldb,
+    float* dst
+) {
+    for (int j = 0; j < nc; j += GEMM_NR) {
+        int cols = (nc - j < GEMM_NR) ? nc - j : GEMM_NR;
+        for (int p = 0; p < kc; p++) {
+            int c = 0;
+            if (trans_b) {
+                const float* src = B + (long)j * ldb + p;
+                for (; c < cols; c++) dst[c] = src[(long)c * ldb];
+            } else {
+                const float* src = B + (long)p * ldb + j;
+                for (; c < cols; c++) dst[c] = src[c];
+            }
+            for (; c < GEMM_NR; c++) dst[c] = 0.0f;
+            dst += GEMM_NR;
+        }
+    }
+}
+
+// 写回目标: 普通的行主序C, 或按注意力头拆分的多个输出
+typedef struct {
+    float* C;
+    int ldc;
+    int N;
+    const GemmEpilogue* epilogue;
+    const SimdKernels* kernels;
+    uint32_t keep_threshold;    // dropout: Philox随机数不小于它的元素保留
+    float keep_scale;
+} GemmOutput;
+
+// 第row行第col列结果在拆分输出中的地址
+static float* split_address(const GemmEpilogue* ep, int row, int col) {
+    int part = col / ep->split_dim;
+    int c = col - part * ep->split_dim;
+    int h = c / ep->split_head_dim;
+    int d = c - h * ep->split_head_dim;
+    int b = row / ep->split_seq_len;
+    int s = row - b * ep->split_seq_len;
+    const long* strides = ep->split_strides[part];
+    return ep->split_out[part] + b * strides[0] + h * strides[1] + s * strides[2] + d;
+}
+
+// 将一行中[col, col + cols)的结果写回, 第一个K块时处理beta, 之后的K块累加
+// 最后一个K块时加上偏置
+static void store_row(float* dst, int cols, const float* acc, float alpha, float beta, const float* bias) {
+    if (beta == 0.0f) {
+        for (int j = 0; j < cols; j++) dst[j] = alpha * acc[j];
+    } else if (beta == 1.0f) {
+        for (int j = 0; j < cols; j++) dst[j] += alpha * acc[j];
+    } else {
+        for (int j = 0; j < cols; j++) dst[j] = beta * dst[j] + alpha * acc[j];
+    }
+    if (bias) {
+        for (int j = 0; j < cols; j++) dst[j] += bias[j];
+    }
+}
+
+// 通用写回路径中最后一个K块之后的激活、dropout和残差, 这一段刚刚写入, 仍在L1中
+static void epilogue_row(const GemmOutput* out, float* dst, int row, int col, int cols) {
+    const GemmEpilogue* ep = out->epilogue;
+    if (ep->activation == GEMM_ACT_RELU) {
+        out->kernels->relu(dst, dst, cols);
+    } else if (ep->activation == GEMM_ACT_GELU) {
+        out->kernels->gelu(dst, dst, cols);
+    }
+    if (ep->dropout_prob > 0.0f) {
+        // 与dropout_forward相同的掩码, 一段最多GEMM_NR列, 跨越至多两个16元素组
+        uint64_t index = (uint64_t)row * out->N + col;
+        long group = (long)(index / 16);
+        int offset = (int)(index % 16);
+        uint16_t bits[2];
+        out->kernels->dropout_mask(ep->dropout_seed, group, (offset + cols + 15) / 16,
+                                   out->keep_threshold, bits);
+        for (int j = 0; j < cols; j++) {
+            bool keep = (bits[(offset + j) >> 4] >> ((offset + j) & 15)) & 1;
+            dst[j] = keep ? dst[j] * out->keep_scale : 0.0f;
+        }
+    }
+    if (ep->residual) {
+        const float* res = ep->residual + (long)row * ep->ldr + col;
+        out->kernels->add(dst, res, dst, cols);
+    }
+}
+
+int gemm_gated_column(int n_out, int j, bool up) {
+    const int half = GEMM_NR / 2;
+    int group = j / half;
+    int width = (n_out - group * half < half) ? n_out - group * half : half;
+    return group * GEMM_NR + (up ? width : 0) + (j - group * half);
+}
+
+// 将微块结果写回, row/col是微块在整个C中的起始位置
+static void gemm_store_tile(
+    const GemmOutput* out,
+    int row, int col, int rows, int cols,
+    const float* acc, float alpha, float beta, bool last_k
+) {
+    const GemmEpilogue* ep = out->epilogue;
+    const float* bias = (ep && ep->bias && last_k) ? ep->bias + col : NULL;
+    bool post = ep && last_k && (ep->activation != GEMM_ACT_NONE ||
+                                 ep->dropout_prob > 0.0f || ep->residual);
+    bool split = ep && ep->split_parts > 0;
+
+    // 门控激活: 微块的cols列是配对的gate/up, 写回C中从col / 2开始的cols / 2列
+    if (ep && ep->activation >= GEMM_ACT_SWIGLU) {
+        out->kernels->gemm_store(out->C + (long)row * out->ldc + col / 2, out->ldc, acc, rows, cols,
+                                 false, bias, ep->activation, NULL, 0);
+        return;
+    }
+
+    // 常见情况(alpha = 1, beta为0或1, 不拆分, 没有dropout): 偏置、激活和残差由内核
+    // 在微块结果写入C时一起完成
+    if (!split && alpha == 1.0f && (beta == 0.0f || beta == 1.0f) &&
+        !(post && ep->dropout_prob > 0.0f)) {
+        int activation = post ? ep->activation : GEMM_ACT_NONE;
+        const float* residual = (post && ep->residual) ? ep->residual + (long)row * ep->ldr + col : NULL;
+        out->kernels->gemm_store(out->C + (long)row * out->ldc + col, out->ldc, acc, rows, cols,
+                                 beta == 1.0f, bias, activation, residual, post ? ep->ldr : 0);
+        return;
+    }
+
+    if (!split) {
+        for (int i = 0; i < rows; i++) {
+            float* dst = out->C + (long)(row + i) * out->ldc + col;
+            store_row(dst, cols, acc + i * GEMM_NR, alpha, beta, bias);
+            if (post) {
+                epilogue_row(out, dst, row + i, col, cols);
+            }
+        }
+        return;
+    }
+
+    // 拆分写回: 同一个头内的列在目标中连续, 按头的边界切成几段
+    for (int i = 0; i < rows; i++) {
+        int j = 0;
+        while (j < cols) {
+            int c = (col + j) % ep->split_head_dim;
+            int run = ep->split_head_dim - c;
+            if (run > cols - j) run = cols - j;
+            float* dst = split_address(ep, row + i, col + j);
+            store_row(dst, run, acc + i * GEMM_NR + j, alpha, beta, bias ? bias + j : NULL);
+            if (post) {
+                epilogue_row(out, dst, row + i, col + j, run);
+            }
+            j += run;
+        }
+    }
+}
+
+// 宏块: 已打包的A[mc, kc]与B中[panel_begin, panel_end)这些NR panel相乘并写回
+// 寄存器微块由当前指令集的内核表提供
+static void gemm_macro_kernel(
+    const SimdKernels* kernels,
+    int mc, int nc, int kc,
+    int panel_begin, int panel_end,
+    float alpha, float beta, bool last_k,
+    const float* pa, const float* pb,
+    const GemmOutput* out, int ic, int jc
+) {
+    float acc[GEMM_MR * GEMM_NR];
+    for (int panel = panel_begin; panel < panel_end; panel++) {
+        int j = panel * GEMM_NR;
+        int cols = (nc - j < GEMM_NR) ? nc - j : GEMM_NR;
+        const float* b_panel = pb + (long)j * kc;
+        for (int i = 0; i < mc; i += GEMM_MR) {
+            int rows = (mc - i < GEMM_MR) ? mc - i : GEMM_MR;
+            const float* a_panel = pa + (long)i * kc;
+            kernels->gemm_micro(kc, a_panel, b_panel, acc);
+            gemm_store_tile(out, ic + i, jc + j, rows, cols, acc, alpha, beta, last_k);
+        }
+    }
+}
+
+// 一个(jc, pc)块内的并行参数, B块已经由调用线程打包好并在所有线程间共享
+typedef struct {
+    const SimdKernels* kernels;
+    bool trans_a;
+    int M, mc_max, nc, kc, pc, jc;
+    float alpha, beta;
+    bool last_k;
+    const float* A;
+    int lda;
+    const float* pb;
+    GemmOutput out;
+} GemmBlockCtx;
+
+// 二维分块: 行是MC块, 列是NR panel; 每个线程把自己的A块打包到线程私有缓冲区
+static void gemm_block_tile(void* arg, int row_begin, int row_end, int col_begin, int col_end) {
+    const GemmBlockCtx* ctx = (const GemmBlockCtx*)arg;
+    if (!gemm_ensure_buffers()) return;
+
+    for (int block = row_begin; block < row_end; block++) {
+        int ic = block * ctx->mc_max;
+        int mc = (ctx->M - ic < ctx->mc_max) ? ctx->M - ic : ctx->mc_max;
+        const float* a_block = ctx->trans_a ? ctx->A + (long)ctx->pc * ctx->lda + ic
+                                            : ctx->A + (long)ic * ctx->lda + ctx->pc;
+        pack_a(ctx->trans_a, mc, ctx->kc, a_block, ctx->lda, packed_a);
+
+        gemm_macro_kernel(ctx->kernels, mc, ctx->nc, ctx->kc, col_begin, col_end,
+                          ctx->alpha, ctx->beta, ctx->last_k, packed_a, ctx->pb,
+                          &ctx->out, ic, ctx->jc);
+    }
+}
+
+void gemm_f32(
+    bool trans_a, bool trans_b,
+    int M, int N, int K,
+    float alpha,
+    const float* A, int lda,
+    const float* B, int ldb,
+    float beta,
+    float* C, int ldc
+) {
+    gemm_f32_ex(trans_a, trans_b, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc, NULL);
+}
+
+void gemm_f32_ex(
+    bool trans_a, bool trans_b,
+    int M, int N, int K,
+    float alpha,
+    const float* A, int lda,
+    const float* B, int ldb,
+    float beta,
+    float* C, int ldc,
+    const GemmEpilogue* epilogue
+) {
+    if (M <= 0 || N <= 0) return;
+    if (epilogue && epilogue->residual && epilogue->split_parts > 0) {
+        fprintf(stderr, "GEMM residual epilogue is not supported with head-split output\n");
+        return;
+    }
+    bool gated = epilogue && epilogue->activation >= GEMM_ACT_SWIGLU;
+    if (gated && (alpha != 1.0f || beta != 0.0f || K <= 0 || K > GEMM_GATED_MAX_K || N % 2 != 0 ||
+                  epilogue->dropout_prob > 0.0f || epilogue->residual || epilogue->split_parts > 0)) {
+        fprintf(stderr, "Unsupported gated GEMM epilogue (K = %d, N = %d)\n", K, N);
+        return;
+    }
+    const SimdKernels* kernels = simd_kernels();
+    GemmOutput out = {C, ldc, N, epilogue, kernels, 0, 1.0f};
+    if (epilogue && epilogue->dropout_prob > 0.0f) {
+        float p = epilogue->dropout_prob;
+        out.keep_threshold = dropout_threshold(p);
+        out.keep_scale = p >= 1.0f ? 0.0f : 1.0f / (1.0f - p);
+    }
+
+    // K为0时结果只剩beta * C (+ bias)
+    if (K <= 0 || alpha == 0.0f) {
+        float zero[GEMM_MR * GEMM_NR] = {0};
+        for (int i = 0; i < M; i += GEMM_MR) {
+            int rows = (M - i < GEMM_MR) ? M - i : GEMM_MR;
+            for (int j = 0; j < N; j += GEMM_NR) {
+                int cols = (N - j < GEMM_NR) ? N - j : GEMM_NR;
+                gemm_store_tile(&out, i, j, rows, cols, zero, 0.0f, beta, true);
+            }
+        }
+        return;
+    }
+
+    if (!gemm_ensure_buffers()) return;
+
+    // 缓存分块大小; 门控激活时整个K一块, MC/NC按比例缩小, 打包的A/B块大小不超过缓冲区
+    int mc_max = GEMM_MC, kc_max = GEMM_KC, nc_max = GEMM_NC;
+    if (gated && K > GEMM_KC) {
+        kc_max = K;
+        mc_max = GEMM_MC * GEMM_KC / K / GEMM_MR * GEMM_MR;
+        nc_max = GEMM_NC * GEMM_KC / K / GEMM_NR * GEMM_NR;
+    }
+
+    int num_threads = thread_pool_num_threads();
+    int row_blocks = (M + mc_max - 1) / mc_max;
+
+    // 经典的五层循环: jc(NC) -> pc(KC) -> ic(MC) -> jr(NR) -> ir(MR)
+    // B块打包一次后在所有MC块之间复用, A块留在L2中供所有NR panel复用
+    // ic和jr两层交给线程池做二维并行
+    for (int jc = 0; jc < N; jc += nc_max) {
+        int nc = (N - jc < nc_max) ? N - jc : nc_max;
+        int panels = (nc + GEMM_NR - 1) / GEMM_NR;
+
+        // MC块不够分给所有线程时, 再沿N方向切分panel
+        int col_splits = (num_threads * 2 + row_blocks - 1) / row_blocks;
+        int tile_panels = (panels + col_splits - 1) / col_splits;
+
+        for (int pc = 0; pc < K; pc += kc_max) {
+            int kc = (K - pc < kc_max) ? K - pc : kc_max;
+
+            const float* b_block = trans_b ? B + (long)jc * ldb + pc
+                                           : B + (long)pc * ldb + jc;
+            pack_b(trans_b, kc, nc, b_block, ldb, packed_b);
+
+            GemmBlockCtx ctx = {
+                .kernels = kernels,
+                .trans_a = trans_a,
+                .M = M, .mc_max = mc_max, .nc = nc, .kc = kc, .pc = pc, .jc = jc,
+                .alpha = alpha,
+                .beta = (pc == 0) ? beta : 1.0f,
+                .last_k = (pc + kc >= K),
+                .A = A, .lda = lda,
+                .pb = packed_b,
+                .out = out,
+            };
+            parallel_for_2d(row_blocks, panels, 1, tile_panels, gemm_block_tile, &ctx);
+        }
+    }
+}
+
+// 分组GEMM的任务表: 第i个任务是groups[task_group[i]]中从task_row[i]开始的一个行块
+typedef struct {
+    const GemmGroup* groups;
+    const int* task_group;
+    const int* task_row;
+    int rows_per_task;
+} GemmGroupedCtx;
+
+static void gemm_grouped_range(void* arg, long begin, long end) {
+    const GemmGroupedCtx* ctx = (const GemmGroupedCtx*)arg;
+    for (long t = begin; t < end; t++) {
+        const GemmGroup* g = &ctx->groups[ctx->task_group[t]];
+        int row = ctx->task_row[t];
+        int rows = (g->M - row < ctx->rows_per_task) ? g->M - row : ctx->rows_per_task;
+        gemm_f32_ex(false, false, rows, g->N, g->K, 1.0f,
+                    g->A + (long)row * g->lda, g->lda, g->B, g->ldb,
+                    0.0f, g->C + (long)row * g->ldc, g->ldc, g->epilogue);
+    }
+}
+
+bool gemm_f32_grouped(int num_groups, const GemmGroup* groups) {
+    long total_rows = 0;
+    int nonempty = 0, last = -1;
+    for (int i = 0; i < num_groups; i++) {
+        const GemmEpilogue* ep = groups[i].epilogue;
+        if (ep && (ep->residual || ep->dropout_prob > 0.0f || ep->split_parts > 0)) {
+            fprintf(stderr, "Grouped GEMM supports only bias and activation epilogues\n");
+            return false;
+        }
+        if (groups[i].M > 0) {
+            total_rows += groups[i].M;
+            nonempty++;
+            last = i;
+        }
+    }
+
+    // 任务表从活动arena分配, 没有arena时才用堆
+    // 行块不小于总行数/(2*线程数), 任务数不超过num_groups + 2*threads:
+    // 按这个上界分配, arena的分配序列与各组行数无关, 不会打乱内存规划
+    int threads = thread_pool_num_threads();
+    long max_tasks = num_groups + 2L * threads;
+    TensorArena* arena = tensor_arena_active();
+    size_t mark = tensor_arena_mark(arena);
+    int* task_group = NULL;
+    int* task_row = NULL;
+    if (arena) {
+        task_group = (int*)tensor_arena_alloc(arena, max_tasks * sizeof(int));
+        task_row = (int*)tensor_arena_alloc(arena, max_tasks * sizeof(int));
+        if (!task_group || !task_row) {
+            tensor_arena_release(arena, mark);
+            return false;
+        }
+    }
+
+    bool success = true;
+    if (nonempty == 0) goto cleanup;
+
+    // 只有一组有数据时让这一组的GEMM自己在线程池上做二维并行
+    if (nonempty == 1) {
+        const GemmGroup* g = &groups[last];
+        gemm_f32_ex(false, false, g->M, g->N, g->K, 1.0f, g->A, g->lda, g->B, g->ldb,
+                    0.0f, g->C, g->ldc, g->epilogue);
+        goto cleanup;
+    }
+
+    // 每个任务要重新打包整个B, 行块不能太小: 每个线程大约分到两个任务, 至少GEMM_MC行
+    long target = (total_rows + 2L * threads - 1) / (2L * threads);
+    int rows_per_task = (int)((target + GEMM_MC - 1) / GEMM_MC * GEMM_MC);
+    long num_tasks = 0;
+    for (int i = 0; i < num_groups; i++) {
+        num_tasks += (groups[i].M + rows_per_task - 1) / rows_per_task;
+    }
+
+    if (!arena) {
+        task_group = (int*)malloc(num_tasks * sizeof(int));
+        task_row = (int*)malloc(num_tasks * sizeof(int));
+        if (!task_group || !task_row) {
+            success = false;
+            goto cleanup;
+        }
+    }
+    long t = 0;
+    for (int i = 0; i < num_groups; i++) {
+        for (int row = 0; row < groups[i].M; row += rows_per_task) {
+            task_group[t] = i;
+            task_row[t] = row;
+            t++;
+        }
+    }
+
+    GemmGroupedCtx ctx = {groups, task_group, task_row, rows_per_task};
+    parallel_for(num_tasks, 1, gemm_grouped_range, &ctx);
+
+cleanup:
+    if (arena) {
+        tensor_arena_release(arena, mark);
+    } else {
+        free(task_group);
+        free(task_row);
+    }
+    return success;
+}
+
+typedef struct {
+    bool trans_a, trans_b;
+    int M, N, K;
+    float alpha, beta;
+    const float* A; int lda; long stride_a;
+    const float* B; int ldb; long stride_b;
+    float* C; int ldc; long stride_c;
+} GemmBatchCtx;
+
+static void gemm_batch_range(void* arg, long begin, long end) {
+    const GemmBatchCtx* ctx = (const GemmBatchCtx*)arg;
+    for (long b = begin; b < end; b++) {
+        gemm_f32(ctx->trans_a, ctx->trans_b, ctx->M, ctx->N, ctx->K, ctx->alpha,
+                 ctx->A + b * ctx->stride_a, ctx->lda,
+                 ctx->B + b * ctx->stride_b, ctx->ldb,
+                 ctx->beta,
+                 ctx->C + b * ctx->stride_c, ctx->ldc);
+    }
+}
+
+void gemm_f32_batched(
+    int batch,
+    bool trans_a, bool trans_b,
+    int M, int N, int K,
+    float alpha,
+    const float* A, int lda, long stride_a,
+    const float* B, int ldb, long stride_b,
+    float beta,
+    float* C, int ldc, long stride_c
+) {
+    // 注意力中的batch * heads个小矩阵: 按batch并行, 每个线程内串行执行GEMM
+    GemmBatchCtx ctx = {
+        trans_a, trans_b, M, N, K, alpha, beta,
+        A, lda, stride_a, B, ldb, stride_b, C, ldc, stride_c
+    };
+    parallel_for(batch, 1, gemm_batch_range, &ctx);
+}
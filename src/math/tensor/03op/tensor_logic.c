@@ -1,7 +1,11 @@
 #include "tensor_logic.h"
+#include "thread_pool.h"
+#include "cpu_dispatch.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
 bool tensor_apply_mask(
     const Tensor* input,
     const Tensor* mask,
@@ -12,8 +16,10 @@ bool tensor_apply_mask(
     if (!input || !mask || !output) return false;
     if (calculate_total_size(input->shape, input->num_dims) != calculate_total_size(output->shape, output->num_dims)) return false;
 
-    // 复制输入到输出
-    memcpy(output->data, input->data, calculate_total_size(input->shape, input->num_dims) * sizeof(float));
+    // 复制输入到输出, 原地屏蔽时不需要
+    if (output->data != input->data) {
+        memcpy(output->data, input->data, calculate_total_size(input->shape, input->num_dims) * sizeof(float));
+    }
 
     // 应用掩码
     for (int i = 0; i < calculate_total_size(output->shape, output->num_dims); i++) {
@@ -25,42 +31,181 @@ bool tensor_apply_mask(
     return true;
 }
 
-bool dropout_forward(Tensor* input, Tensor* output, float prob) {
+uint32_t dropout_threshold(float prob) {
+    double t = (double)prob * 4294967296.0;
+    return t >= 4294967295.0 ? UINT32_MAX : (uint32_t)t;
+}
+
+// 每次生成的组数(每组16个元素): 掩码在L1中生成后立即使用
+#define DROPOUT_CHUNK_GROUPS 256
+
+// 按16个元素一组并行, 组的边界与掩码对齐, 各线程写不同的掩码
+typedef struct {
+    const SimdKernels* kernels;
+    const float* in;        // NULL时只生成掩码
+    float* out;
+    uint16_t* mask;         // 完整掩码; NULL时用栈上的临时掩码
+    bool generate;          // false时使用mask中已有的掩码(反向传播)
+    long n;
+    uint64_t seed;
+    uint32_t threshold;
+    float scale;
+} DropoutCtx;
+
+static void dropout_range(void* arg, long begin, long end) {
+    const DropoutCtx* ctx = (const DropoutCtx*)arg;
+    uint16_t local[DROPOUT_CHUNK_GROUPS];
+    for (long g = begin; g < end; g += DROPOUT_CHUNK_GROUPS) {
+        long groups = end - g < DROPOUT_CHUNK_GROUPS ? end - g : DROPOUT_CHUNK_GROUPS;
+        uint16_t* bits = ctx->mask ? ctx->mask + g : local;
+        if (ctx->generate) {
+            ctx->kernels->dropout_mask(ctx->seed, g, groups, ctx->threshold, bits);
+        }
+        if (ctx->in) {
+            long first = g * 16;
+            long count = ctx->n - first < groups * 16 ? ctx->n - first : groups * 16;
+            ctx->kernels->dropout_apply(ctx->in + first, bits, ctx->out + first, count, ctx->scale);
+        }
+    }
+}
+
+static void dropout_run(DropoutCtx* ctx) {
+    ctx->kernels = simd_kernels();
+    parallel_for((ctx->n + 15) / 16, DROPOUT_CHUNK_GROUPS, dropout_range, ctx);
+}
+
+// 掩码容量不足时重新分配
+static bool dropout_mask_reserve(DropoutMask* mask, long n) {
+    if (mask->capacity >= n) return true;
+    uint16_t* bits = (uint16_t*)realloc(mask->bits, (size_t)((n + 15) / 16) * sizeof(uint16_t));
+    if (!bits) return false;
+    mask->bits = bits;
+    mask->capacity = (n + 15) / 16 * 16;
+    return true;
+}
+
+bool dropout_mask_generate(DropoutMask* mask, long n, float prob, uint64_t seed) {
+    if (!mask || n < 0) return false;
+    mask->n = n;
+    mask->prob = prob > 0.0f ? prob : 0.0f;
+    mask->seed = seed;
+    if (mask->prob == 0.0f) return true;
+    if (!dropout_mask_reserve(mask, n)) return false;
+
+    DropoutCtx ctx = {
+        .mask = mask->bits, .generate = true, .n = n,
+        .seed = seed, .threshold = dropout_threshold(prob),
+    };
+    dropout_run(&ctx);
+    return true;
+}
+
+void dropout_mask_release(DropoutMask* mask) {
+    if (mask) {
+        free(mask->bits);
+        memset(mask, 0, sizeof(DropoutMask));
+    }
+}
+
+bool dropout_forward_masked(const Tensor* input, Tensor* output, float prob, DropoutMask* mask) {
     if (!input || !output) return false;
-    
-    size_t total_elements = calculate_total_size(input->shape, input->num_dims);
-    
-    // 训练阶段
-    srand(time(NULL));
-    float scale = 1.0f / (1.0f - prob); // 缩放因子
-
-    for (int i = 0; i < total_elements; i++) {
-        float random = (float)rand() / RAND_MAX;
-        if (random > prob) {
-            output->data[i] = input->data[i] * scale;
-        } else {
-            output->data[i] = 0;
+    long n = (long)calculate_total_size(input->shape, input->num_dims);
+
+    // 推理或不做dropout: 原地时没有任何开销
+    if (prob <= 0.0f) {
+        if (mask) {
+            mask->n = n;
+            mask->prob = 0.0f;
         }
+        if (output->data != input->data) {
+            memcpy(output->data, input->data, n * sizeof(float));
+        }
+        return true;
+    }
+
+    uint64_t seed = dropout_next_seed();
+    if (mask) {
+        if (!dropout_mask_reserve(mask, n)) return false;
+        mask->n = n;
+        mask->prob = prob;
+        mask->seed = seed;
     }
-    
+    DropoutCtx ctx = {
+        .in = input->data, .out = output->data, .mask = mask ? mask->bits : NULL,
+        .generate = true, .n = n, .seed = seed, .threshold = dropout_threshold(prob),
+        .scale = prob >= 1.0f ? 0.0f : 1.0f / (1.0f - prob),
+    };
+    dropout_run(&ctx);
     return true;
 }
 
-bool dropout_backward(Tensor* grad_output, Tensor* grad_input, float prob) {
-    if (!grad_output || !grad_input) return false;
-    
-    size_t total_elements = calculate_total_size(grad_output->shape, grad_output->num_dims);
-    
-    float scale = 1.0f / (1.0f - prob);
-    
-    for (int i = 0; i < total_elements; i++) {
-        // 如果前向传播时该位置被dropout(为0),则梯度也为0
-        grad_input->data[i] = grad_input->data[i] == 0 ? 0 : grad_output->data[i] * scale;
+bool dropout_forward(Tensor* input, Tensor* output, float prob) {
+    return dropout_forward_masked(input, output, prob, NULL);
+}
+
+// 种子基数和调用计数: 同样的基数、同样的调用顺序得到同样的掩码
+static atomic_uint_fast64_t g_dropout_base = 0;
+static atomic_uint_fast64_t g_dropout_counter = 0;
+
+void dropout_set_seed(uint64_t seed) {
+    atomic_store(&g_dropout_base, seed);
+    atomic_store(&g_dropout_counter, 0);
+}
+
+uint64_t dropout_seed_from_time(void) {
+    uint64_t seed = (uint64_t)time(NULL);
+    dropout_set_seed(seed);
+    return seed;
+}
+
+uint64_t dropout_next_seed(void) {
+    uint64_t n = atomic_fetch_add(&g_dropout_counter, 1);
+    // splitmix64: 相邻的计数得到互不相关的Philox密钥
+    uint64_t z = atomic_load(&g_dropout_base) + (n + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+bool dropout_backward(const Tensor* grad_output, Tensor* grad_input, const DropoutMask* mask) {
+    if (!grad_output || !grad_input || !mask) return false;
+    long n = (long)calculate_total_size(grad_output->shape, grad_output->num_dims);
+    if (n != mask->n) {
+        fprintf(stderr, "Dropout mask covers %ld elements, gradient has %ld\n", mask->n, n);
+        return false;
+    }
+
+    // 前向没有dropout时梯度直接传递
+    if (mask->prob <= 0.0f) {
+        if (grad_input->data != grad_output->data) {
+            memcpy(grad_input->data, grad_output->data, n * sizeof(float));
+        }
+        return true;
     }
-    
+
+    // 保留的位置乘以前向的缩放, 其余为0
+    DropoutCtx ctx = {
+        .in = grad_output->data, .out = grad_input->data, .mask = mask->bits,
+        .generate = false, .n = n,
+        .scale = mask->prob >= 1.0f ? 0.0f : 1.0f / (1.0f - mask->prob),
+    };
+    dropout_run(&ctx);
     return true;
 }
 
+typedef struct {
+    const float* a;
+    const float* b;
+    float* output;
+} LogicCtx;
+
+static void and_range(void* arg, long begin, long end) {
+    const LogicCtx* ctx = (const LogicCtx*)arg;
+    for (long i = begin; i < end; i++) {
+        ctx->output[i] = (ctx->a[i] != 0.0f && ctx->b[i] != 0.0f) ? 1.0f : 0.0f;
+    }
+}
+
 bool tensor_and(Tensor* a, Tensor* b, Tensor* output) {
     if (!a || !b || !output) {
         fprintf(stderr, "输入张量不能为空\n");
@@ -83,10 +228,8 @@ bool tensor_and(Tensor* a, Tensor* b, Tensor* output) {
 
     // 执行逐元素与操作
     size_t total_size = calculate_total_size(a->shape, a->num_dims);
-    #pragma omp parallel for if(total_size > 1000)
-    for (size_t i = 0; i < total_size; i++) {
-        output->data[i] = (a->data[i] != 0.0f && b->data[i] != 0.0f) ? 1.0f : 0.0f;
-    }
+    LogicCtx ctx = {a->data, b->data, output->data};
+    parallel_for((long)total_size, 16384, and_range, &ctx);
 
     return true;
 }
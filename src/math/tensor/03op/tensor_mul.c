@@ -1,12 +1,148 @@
 #include "tensor_mul.h"
-
-#include "tensor_mul.h"
+#include "tensor_gemm.h"
+#include "thread_pool.h"
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <math.h>
 #include <stdio.h>
 
+// 判断张量最后两维在内存中的布局, 供GEMM直接读取而不拷贝
+// 最后一维步长为1: 行主序, ld为倒数第二维步长
+// 倒数第二维步长为1: 列主序(例如转置视图), 相当于转置后的行主序矩阵
+static bool matrix_layout(const Tensor* t, bool* col_major, int* ld) {
+    int n = t->num_dims;
+    int rows = t->shape[n - 2];
+    int cols = t->shape[n - 1];
+    long row_stride = t->strides[n - 2];
+    long col_stride = t->strides[n - 1];
+
+    if (col_stride == 1 || cols == 1) {
+        *col_major = false;
+        *ld = (rows == 1) ? cols : (int)row_stride;
+        return true;
+    }
+    if (row_stride == 1 || rows == 1) {
+        *col_major = true;
+        *ld = (int)col_stride;
+        return true;
+    }
+    fprintf(stderr, "Matrix operand needs unit stride in one of its last two dimensions\n");
+    return false;
+}
+
+// 前导维度能否合并成行: 输入[..., rows, cols]视为[prod(...) * rows, cols]
+static bool rows_collapsible(const Tensor* t) {
+    int n = t->num_dims;
+    if (t->strides[n - 1] != 1 && t->shape[n - 1] != 1) {
+        return false;
+    }
+    for (int i = 0; i < n - 2; i++) {
+        if (t->shape[i] != 1 && t->strides[i] != t->strides[i + 1] * t->shape[i + 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    const Tensor* A;
+    const Tensor* B;
+    Tensor* C;
+    int batch_dims;
+    bool shared_b;  // B是所有batch共享的2D矩阵
+    bool trans_a, trans_b;
+    int M, N, K;
+    int lda, ldb, ldc;
+    float alpha;
+} StridedMatmulCtx;
+
+static void strided_matmul_range(void* arg, long begin, long end) {
+    const StridedMatmulCtx* ctx = (const StridedMatmulCtx*)arg;
+    for (long b = begin; b < end; b++) {
+        gemm_f32(ctx->trans_a, ctx->trans_b, ctx->M, ctx->N, ctx->K, ctx->alpha,
+                 ctx->A->data + tensor_outer_offset(ctx->A, b, ctx->batch_dims), ctx->lda,
+                 ctx->shared_b ? ctx->B->data
+                               : ctx->B->data + tensor_outer_offset(ctx->B, b, ctx->batch_dims), ctx->ldb,
+                 0.0f,
+                 ctx->C->data + tensor_outer_offset(ctx->C, b, ctx->batch_dims), ctx->ldc);
+    }
+}
+
+// 批量矩阵乘法 C = alpha * A @ op(B), 三个操作数可以是任意步长的视图
+// 前导batch维按各自的步长寻址, 最后两维交给GEMM的trans/ld参数处理
+// B为2D时在所有batch间共享
+static bool strided_matmul(const Tensor* A, const Tensor* B, bool transpose_b, float alpha, Tensor* C) {
+    int n = A->num_dims;
+    bool a_col, b_col, c_col;
+    int lda, ldb, ldc;
+    if (!matrix_layout(A, &a_col, &lda) ||
+        !matrix_layout(B, &b_col, &ldb) ||
+        !matrix_layout(C, &c_col, &ldc)) {
+        return false;
+    }
+    if (c_col && C->shape[n - 2] != 1) {
+        fprintf(stderr, "Output matrix must be row-major\n");
+        return false;
+    }
+
+    long batch = 1;
+    for (int i = 0; i < n - 2; i++) {
+        batch *= A->shape[i];
+    }
+
+    StridedMatmulCtx ctx = {
+        .A = A, .B = B, .C = C,
+        .batch_dims = n - 2,
+        .shared_b = (B->num_dims == 2),
+        .trans_a = a_col,
+        .trans_b = b_col != transpose_b,
+        .M = C->shape[n - 2],
+        .N = C->shape[n - 1],
+        .K = A->shape[n - 1],
+        .lda = lda, .ldb = ldb, .ldc = ldc,
+        .alpha = alpha,
+    };
+
+    // 单个矩阵时GEMM内部并行, 多个小矩阵时按batch并行
+    if (batch == 1) {
+        strided_matmul_range(&ctx, 0, 1);
+    } else {
+        parallel_for(batch, 1, strided_matmul_range, &ctx);
+    }
+    return true;
+}
+
+// 共享权重的乘法: input[..., dim_in] @ op(weight) -> output[..., dim_out]
+// 行能合并时做一次大GEMM, 否则按batch逐个计算
+static bool shared_weight_matmul(const Tensor* input, const Tensor* weight, Tensor* output) {
+    int n = input->num_dims;
+    if (!rows_collapsible(input) || !rows_collapsible(output)) {
+        return strided_matmul(input, weight, false, 1.0f, output);
+    }
+
+    bool w_col;
+    int ldw;
+    if (!matrix_layout(weight, &w_col, &ldw)) {
+        return false;
+    }
+
+    long rows = 1;
+    for (int i = 0; i < n - 1; i++) {
+        rows *= input->shape[i];
+    }
+    int dim_in = input->shape[n - 1];
+    int dim_out = output->shape[n - 1];
+    int lda = (rows == 1) ? dim_in : (int)input->strides[n - 2];
+    int ldc = (rows == 1) ? dim_out : (int)output->strides[n - 2];
+
+    gemm_f32(false, w_col, (int)rows, dim_out, dim_in, 1.0f,
+             input->data, lda,
+             weight->data, ldw,
+             0.0f, output->data, ldc);
+    return true;
+}
+
 // 2D矩阵乘法: [M, K] × [K, N] -> [M, N]
 bool tensor_matmul_2d(const Tensor* left, const Tensor* right, Tensor* output) {
     // 检查维度数量
@@ -19,9 +155,6 @@ bool tensor_matmul_2d(const Tensor* left, const Tensor* right, Tensor* output) {
     const int* left_shape = left->shape;
     const int* right_shape = right->shape;
     const int* out_shape = output->shape;
-    const float* left_data = left->data;
-    const float* right_data = right->data;
-    float* out_data = output->data;
 
     int rows = left_shape[0];
     int inner_dim = left_shape[1];
@@ -42,17 +175,7 @@ bool tensor_matmul_2d(const Tensor* left, const Tensor* right, Tensor* output) {
     }
 
     // 执行矩阵乘法
-    for (int row = 0; row < rows; row++) {
-        for (int col = 0; col < cols; col++) {
-            float sum = 0.0f;
-            for (int k = 0; k < inner_dim; k++) {
-                sum += left_data[row * inner_dim + k] * right_data[k * cols + col];
-            }
-            out_data[row * cols + col] = sum;
-        }
-    }
-
-    return true;
+    return strided_matmul(left, right, false, 1.0f, output);
 }
 
 // 3D张量乘法: [batch_size, M, K] × [batch_size, K, N] -> [batch_size, M, N]
@@ -67,9 +190,6 @@ bool tensor_matmul_3d(const Tensor* left, const Tensor* right, Tensor* output) {
     const int* left_shape = left->shape;
     const int* right_shape = right->shape;
     const int* out_shape = output->shape;
-    const float* left_data = left->data;
-    const float* right_data = right->data;
-    float* out_data = output->data;
 
     int batch_size = left_shape[0];
     int rows = left_shape[1];
@@ -92,25 +212,7 @@ bool tensor_matmul_3d(const Tensor* left, const Tensor* right, Tensor* output) {
     }
 
     // 执行批量矩阵乘法
-    for (int batch = 0; batch < batch_size; batch++) {
-        // 计算当前批次的基础偏移量
-        int left_offset = batch * rows * inner_dim;
-        int right_offset = batch * inner_dim * cols;
-        int out_offset = batch * rows * cols;
-
-        // 矩阵乘法
-        for (int row = 0; row < rows; row++) {
-            for (int col = 0; col < cols; col++) {
-                float sum = 0.0f;
-                for (int k = 0; k < inner_dim; k++) {
-                    sum += left_data[left_offset + row * inner_dim + k] * 
-                          right_data[right_offset + k * cols + col];
-                }
-                out_data[out_offset + row * cols + col] = sum;
-            }
-        }
-    }
-    return true;
+    return strided_matmul(left, right, false, 1.0f, output);
 }
 
 // 4D张量乘法: [batch1, batch2, M, K] × [batch1, batch2, K, N] -> [batch1, batch2, M, N]
@@ -125,9 +227,6 @@ bool tensor_matmul_4d(const Tensor* left, const Tensor* right, Tensor* output) {
     const int* left_shape = left->shape;
     const int* right_shape = right->shape;
     const int* out_shape = output->shape;
-    const float* left_data = left->data;
-    const float* right_data = right->data;
-    float* out_data = output->data;
 
     int outer_batch = left_shape[0];
     int inner_batch = left_shape[1];
@@ -153,28 +252,8 @@ bool tensor_matmul_4d(const Tensor* left, const Tensor* right, Tensor* output) {
         return false;
     }
 
-    // 执行批量矩阵乘法
-    for (int batch1 = 0; batch1 < outer_batch; batch1++) {
-        for (int batch2 = 0; batch2 < inner_batch; batch2++) {
-            // 计算当前批次的基础偏移量
-            int left_offset = (batch1 * inner_batch + batch2) * rows * inner_dim;
-            int right_offset = (batch1 * inner_batch + batch2) * inner_dim * cols;
-            int out_offset = (batch1 * inner_batch + batch2) * rows * cols;
-
-            // 矩阵乘法
-            for (int row = 0; row < rows; row++) {
-                for (int col = 0; col < cols; col++) {
-                    float sum = 0.0f;
-                    for (int k = 0; k < inner_dim; k++) {
-                        sum += left_data[left_offset + row * inner_dim + k] * 
-                              right_data[right_offset + k * cols + col];
-                    }
-                    out_data[out_offset + row * cols + col] = sum;
-                }
-            }
-        }
-    }
-    return true;
+    // 执行批量矩阵乘法, 操作数可以是拆分注意力头得到的视图
+    return strided_matmul(left, right, false, 1.0f, output);
 }
 
 // 4D张量与2D权重相乘
@@ -214,27 +293,8 @@ bool tensor_mul_4d_2d(
         return false;
     }
 
-    // 对每个batch和序列位置进行矩阵乘法
-    for (int b1 = 0; b1 < batch1; b1++) {
-        for (int b2 = 0; b2 < batch2; b2++) {
-            for (int s = 0; s < seq_len; s++) {
-                // 计算当前位置的基础偏移量
-                int input_offset = ((b1 * batch2 + b2) * seq_len + s) * dim1;
-                int output_offset = ((b1 * batch2 + b2) * seq_len + s) * dim2;
-
-                // 执行矩阵乘法 [dim1] x [dim1, dim2]
-                for (int j = 0; j < dim2; j++) {
-                    float sum = 0.0f;
-                    for (int k = 0; k < dim1; k++) {
-                        sum += input->data[input_offset + k] * 
-                              weight->data[k * dim2 + j];
-                    }
-                    output->data[output_offset + j] = sum;
-                }
-            }
-        }
-    }
-    return true;
+    // 权重在所有位置共享, 把前三维展开成行: [batch1 * batch2 * seq_len, dim1] x [dim1, dim2]
+    return shared_weight_matmul(input, weight, output);
 }
 
 // 将3D输入与非方阵2D权重相乘, on Q,K,V running separately
@@ -267,28 +327,14 @@ bool tensor_mul_3_2(
     }
 
     // 进行批量矩阵乘法: [batch_size, seq_len, dim_in] @ [dim_in, dim_out]
-    for (int b = 0; b < batch_size; b++) {
-        int input_offset = b * seq_len * dim_in;
-        int output_offset = b * seq_len * dim_out;
-        for (int i = 0; i < seq_len; i++) {
-            for (int j = 0; j < dim_out; j++) {
-                float sum = 0.0f;
-                for (int k = 0; k < dim_in; k++) {
-                    // input[b,i,k] * weight[k,j] -> output[b,i,j]
-                    sum += input->data[input_offset + (i * dim_in) + k] * 
-                          weight->data[k * dim_out + j];
-                }
-                output->data[output_offset + (i * dim_out) + j] = sum;
-            }
-        }
-    }
-    return true;
+    // 权重共享, 等价于 [batch_size * seq_len, dim_in] @ [dim_in, dim_out]
+    return shared_weight_matmul(input, weight, output);
 }
 
 // 4D张量乘法,K的最后两个维度要转置
-// input1: [batch_size, num_heads, seq_len, head_dim]
-// input2: [batch_size, num_heads, seq_len, head_dim], transposed last two dimensions and then multiply
-// output: [batch_size, num_heads, seq_len, seq_len]
+// input1: [batch_size, num_heads, seq_len_q, head_dim]
+// input2: [batch_size, num_heads, seq_len_k, head_dim], transposed last two dimensions and then multiply
+// output: [batch_size, num_heads, seq_len_q, seq_len_k]
 bool tensor_mul_4d_transpose(
     const Tensor* input1,
     const Tensor* input2, 
@@ -297,27 +343,171 @@ bool tensor_mul_4d_transpose(
 ) {
     int batch_size = input1->shape[0];
     int num_heads = input1->shape[1];
-    int seq_len = input1->shape[2];
+    int seq_len_q = input1->shape[2];
     int head_dim = input1->shape[3];
+    int seq_len_k = input2->shape[2];
+
+    if (input2->shape[0] != batch_size ||
+        input2->shape[1] != num_heads ||
+        input2->shape[3] != head_dim ||
+        output->shape[2] != seq_len_q ||
+        output->shape[3] != seq_len_k) {
+        fprintf(stderr, "Incompatible dimensions for transposed 4D multiplication\n");
+        return false;
+    }
+
+    // 对每个batch和head计算注意力分数: scale * Q @ K^T
+    // K按[seq_len_k, head_dim]存储, 即op(B) = B^T, 缩放在写回时完成
+    return strided_matmul(input1, input2, true, scale, output);
+}
+
+// 合并前导维后的行数和行步长, 不能合并时返回false
+static bool collapsed_rows(const Tensor* t, long* rows, int* ld) {
+    if (!rows_collapsible(t)) {
+        fprintf(stderr, "Input rows must be collapsible into a single matrix\n");
+        return false;
+    }
+    int n = t->num_dims;
+    *rows = 1;
+    for (int i = 0; i < n - 1; i++) {
+        *rows *= t->shape[i];
+    }
+    *ld = (*rows == 1) ? t->shape[n - 1] : (int)t->strides[n - 2];
+    return true;
+}
+
+bool tensor_linear_3d(const Tensor* input, const Tensor* weight, const Tensor* bias, Tensor* output) {
+    return tensor_linear_3d_ex(input, weight, bias, NULL, NULL, output);
+}
+
+bool tensor_linear_3d_ex(const Tensor* input, const Tensor* weight, const Tensor* bias,
+                         const Tensor* residual, const GemmEpilogue* options, Tensor* output) {
+    if (input->num_dims != 3 || weight->num_dims != 2 || output->num_dims != 3) {
+        fprintf(stderr, "输入维度错误：需要3D输入、2D权重和3D输出\n");
+        return false;
+    }
+    int dim_in = input->shape[2];
+    int dim_out = weight->shape[1];
+    // 门控激活时权重是交错的gate/up, 输出只有一半的列
+    bool gated = options && options->activation >= GEMM_ACT_SWIGLU;
+    int out_dim = gated ? dim_out / 2 : dim_out;
+    if (weight->shape[0] != dim_in ||
+        output->shape[0] != input->shape[0] ||
+        output->shape[1] != input->shape[1] ||
+        output->shape[2] != out_dim ||
+        (gated && dim_out % 2 != 0) ||
+        (bias && bias->shape[bias->num_dims - 1] != dim_out) ||
+        (residual && (residual->num_dims != 3 || residual->shape[0] != output->shape[0] ||
+                      residual->shape[1] != output->shape[1] || residual->shape[2] != out_dim))) {
+        fprintf(stderr, "维度不匹配\n");
+        return false;
+    }
+    if (gated && (residual || options->dropout_prob > 0.0f || dim_in > GEMM_GATED_MAX_K)) {
+        fprintf(stderr, "Gated projection supports no residual or dropout and at most %d inputs\n",
+                GEMM_GATED_MAX_K);
+        return false;
+    }
+
+    long rows;
+    int lda, ldc, ldw;
+    bool w_col;
+    if (!collapsed_rows(input, &rows, &lda) ||
+        !collapsed_rows(output, &rows, &ldc) ||
+        !matrix_layout(weight, &w_col, &ldw)) {
+        return false;
+    }
 
-    // 对每个batch和head计算注意力分数
-    for (int b = 0; b < batch_size; b++) {
-        for (int h = 0; h < num_heads; h++) {
-            for (int i = 0; i < seq_len; i++) {
-                for (int j = 0; j < seq_len; j++) {
-                    float score = 0.0f;
-                    for (int k = 0; k < head_dim; k++) {
-                        // input1[b,h,i,k] * input2[b,h,j,k]
-                        int idx1 = ((b * num_heads + h) * seq_len + i) * head_dim + k;
-                        int idx2 = ((b * num_heads + h) * seq_len + j) * head_dim + k;
-                        score += input1->data[idx1] * input2->data[idx2];
-                    }
-                    // 将结果存储在输出中
-                    int out_idx = ((b * num_heads + h) * seq_len + i) * seq_len + j;
-                    output->data[out_idx] = score * scale;
-                }
-            }
+    GemmEpilogue epilogue = {0};
+    if (options) {
+        epilogue.activation = options->activation;
+        epilogue.dropout_prob = options->dropout_prob;
+        epilogue.dropout_seed = options->dropout_seed;
+    }
+    epilogue.bias = bias ? bias->data : NULL;
+
+    // 残差就是输出本身时用beta = 1累加, 激活和dropout之后才加残差, 这时不能再有激活和dropout
+    float beta = 0.0f;
+    if (residual && residual->data == output->data) {
+        if (epilogue.activation != GEMM_ACT_NONE || epilogue.dropout_prob > 0.0f) {
+            fprintf(stderr, "In-place residual cannot be combined with activation or dropout\n");
+            return false;
+        }
+        beta = 1.0f;
+    } else if (residual) {
+        long res_rows;
+        if (!collapsed_rows(residual, &res_rows, &epilogue.ldr)) {
+            return false;
+        }
+        epilogue.residual = residual->data;
+    }
+
+    gemm_f32_ex(false, w_col, (int)rows, dim_out, dim_in, 1.0f,
+                input->data, lda, weight->data, ldw,
+                beta, output->data, ldc, &epilogue);
+    return true;
+}
+
+bool tensor_linear_split_heads(
+    const Tensor* input,
+    const Tensor* weight,
+    const Tensor* bias,
+    Tensor* const* outputs,
+    int num_outputs
+) {
+    if (num_outputs <= 0 || num_outputs > GEMM_MAX_SPLIT ||
+        input->num_dims != 3 || weight->num_dims != 2) {
+        fprintf(stderr, "Invalid arguments for fused head projection\n");
+        return false;
+    }
+
+    int batch_size = input->shape[0];
+    int seq_len = input->shape[1];
+    int dim_in = input->shape[2];
+    int total_dim = weight->shape[1];
+    int dim = total_dim / num_outputs;
+    const Tensor* first = outputs[0];
+    if (weight->shape[0] != dim_in || dim * num_outputs != total_dim ||
+        (bias && bias->shape[bias->num_dims - 1] != total_dim) ||
+        first->num_dims != 4) {
+        fprintf(stderr, "维度不匹配\n");
+        return false;
+    }
+
+    int num_heads = first->shape[1];
+    int head_dim = first->shape[3];
+    GemmEpilogue epilogue = {
+        .bias = bias ? bias->data : NULL,
+        .split_parts = num_outputs,
+        .split_dim = dim,
+        .split_seq_len = seq_len,
+        .split_head_dim = head_dim,
+    };
+    for (int i = 0; i < num_outputs; i++) {
+        const Tensor* out = outputs[i];
+        if (out->num_dims != 4 || out->strides[3] != 1 ||
+            out->shape[0] != batch_size || out->shape[1] != num_heads ||
+            out->shape[2] != seq_len || out->shape[3] != head_dim ||
+            num_heads * head_dim != dim) {
+            fprintf(stderr, "Head-split outputs must be [batch_size, num_heads, seq_len, head_dim] with unit last stride\n");
+            return false;
+        }
+        epilogue.split_out[i] = out->data;
+        for (int j = 0; j < 3; j++) {
+            epilogue.split_strides[i][j] = out->strides[j];
         }
     }
+
+    long rows;
+    int lda, ldw;
+    bool w_col;
+    if (!collapsed_rows(input, &rows, &lda) ||
+        !matrix_layout(weight, &w_col, &ldw)) {
+        return false;
+    }
+
+    // [batch_size * seq_len, dim_in] @ [dim_in, num_outputs * dim], 写回时散到各个头
+    gemm_f32_ex(false, w_col, (int)rows, total_dim, dim_in, 1.0f,
+                input->data, lda, weight->data, ldw,
+                0.0f, NULL, 0, &epilogue);
     return true;
 }
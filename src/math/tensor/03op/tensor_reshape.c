@@ -1,4 +1,49 @@
 #include "tensor_reshape.h"
+#include "thread_pool.h"
+#include <string.h>
+#include <stdio.h>
+
+// 视图操作支持的最大维度
+#define TENSOR_VIEW_MAX_DIMS 8
+
+// 头拆分/合并的并行参数, 每个(b, s)位置是一个任务单元
+typedef struct {
+    const float* src;
+    float* dst;
+    int seq_len;
+    int num_heads;
+    int head_dim;
+} HeadReshapeCtx;
+
+// [b, s, h * head_dim + d] -> [b, h, s, d], 每个头的head_dim个元素是连续的
+static void split_heads_rows(void* arg, long begin, long end) {
+    const HeadReshapeCtx* ctx = (const HeadReshapeCtx*)arg;
+    int model_dim = ctx->num_heads * ctx->head_dim;
+    for (long row = begin; row < end; row++) {
+        long b = row / ctx->seq_len;
+        long s = row % ctx->seq_len;
+        for (int h = 0; h < ctx->num_heads; h++) {
+            const float* src = ctx->src + row * model_dim + h * ctx->head_dim;
+            float* dst = ctx->dst + ((b * ctx->num_heads + h) * ctx->seq_len + s) * ctx->head_dim;
+            memcpy(dst, src, ctx->head_dim * sizeof(float));
+        }
+    }
+}
+
+// [b, h, s, d] -> [b, s, h * head_dim + d]
+static void merge_heads_rows(void* arg, long begin, long end) {
+    const HeadReshapeCtx* ctx = (const HeadReshapeCtx*)arg;
+    int model_dim = ctx->num_heads * ctx->head_dim;
+    for (long row = begin; row < end; row++) {
+        long b = row / ctx->seq_len;
+        long s = row % ctx->seq_len;
+        for (int h = 0; h < ctx->num_heads; h++) {
+            const float* src = ctx->src + ((b * ctx->num_heads + h) * ctx->seq_len + s) * ctx->head_dim;
+            float* dst = ctx->dst + row * model_dim + h * ctx->head_dim;
+            memcpy(dst, src, ctx->head_dim * sizeof(float));
+        }
+    }
+}
 
 // 将3D张量重塑为4D张量
 // input: [batch_size, seq_len, model_dim]
@@ -26,26 +71,9 @@ bool tensor_reshape_3d_to_4d(
         return false;
     }
 
-    // 重新排列数据
-    for (int b = 0; b < batch_size; b++) {
-        for (int s = 0; s < seq_len; s++) {
-            for (int h = 0; h < num_heads; h++) {
-                for (int d = 0; d < head_dim; d++) {
-                    // 源索引: [b, s, h * head_dim + d]
-                    int src_idx = (b * seq_len * model_dim) + 
-                                (s * model_dim) + 
-                                (h * head_dim + d);
-                    
-                    // 目标索引: [b, h, s, d]
-                    int dst_idx = (b * num_heads * seq_len * head_dim) +
-                                (h * seq_len * head_dim) +
-                                (s * head_dim) + d;
-                    
-                    output->data[dst_idx] = input->data[src_idx];
-                }
-            }
-        }
-    }
+    // 重新排列数据, 按(b, s)位置并行
+    HeadReshapeCtx ctx = {input->data, output->data, seq_len, num_heads, head_dim};
+    parallel_for((long)batch_size * seq_len, 8, split_heads_rows, &ctx);
 
     return true;
 }
@@ -66,28 +94,95 @@ bool tensor_reshape_4d_to_3d(
     int num_heads = input->shape[1];
     int seq_len = input->shape[2];
     int head_dim = input->shape[3];
-    int model_dim = num_heads * head_dim;
-
-    // 重新排列数据
-    for (int b = 0; b < batch_size; b++) {
-        for (int s = 0; s < seq_len; s++) {
-            for (int h = 0; h < num_heads; h++) {
-                for (int d = 0; d < head_dim; d++) {
-                    // 源索引: [b, h, s, d]
-                    int src_idx = (b * num_heads * seq_len * head_dim) +
-                                (h * seq_len * head_dim) +
-                                (s * head_dim) + d;
-                    
-                    // 目标索引: [b, s, h * head_dim + d]
-                    int dst_idx = (b * seq_len * model_dim) +
-                                (s * model_dim) +
-                                (h * head_dim + d);
-                    
-                    output->data[dst_idx] = input->data[src_idx];
-                }
-            }
+
+    // 重新排列数据, 按(b, s)位置并行
+    HeadReshapeCtx ctx = {input->data, output->data, seq_len, num_heads, head_dim};
+    parallel_for((long)batch_size * seq_len, 8, merge_heads_rows, &ctx);
+
+    return true;
+}
+Tensor* tensor_view_reshape(const Tensor* input, const int* shape, int num_dims) {
+    if (!tensor_is_contiguous(input) ||
+        calculate_total_size(shape, num_dims) != calculate_total_size(input->shape, input->num_dims)) {
+        fprintf(stderr, "Reshape view requires a contiguous tensor with the same number of elements\n");
+        return NULL;
+    }
+    return tensor_view_create(input, shape, NULL, num_dims, 0);
+}
+
+Tensor* tensor_view_permute(const Tensor* input, const int* perm) {
+    int shape[TENSOR_VIEW_MAX_DIMS];
+    long strides[TENSOR_VIEW_MAX_DIMS];
+    int num_dims = input->num_dims;
+    if (num_dims > TENSOR_VIEW_MAX_DIMS) {
+        fprintf(stderr, "Too many dimensions for permute\n");
+        return NULL;
+    }
+
+    unsigned used = 0;
+    for (int i = 0; i < num_dims; i++) {
+        if (perm[i] < 0 || perm[i] >= num_dims || (used & (1u << perm[i]))) {
+            fprintf(stderr, "Invalid permutation\n");
+            return NULL;
         }
+        used |= 1u << perm[i];
+        shape[i] = input->shape[perm[i]];
+        strides[i] = input->strides[perm[i]];
     }
+    return tensor_view_create(input, shape, strides, num_dims, 0);
+}
 
-    return true;
-}
\ No newline at end of file
+Tensor* tensor_view_slice(const Tensor* input, int dim, int start, int length) {
+    if (dim < 0 || dim >= input->num_dims ||
+        start < 0 || length <= 0 || start + length > input->shape[dim]) {
+        fprintf(stderr, "Invalid slice range\n");
+        return NULL;
+    }
+
+    int shape[TENSOR_VIEW_MAX_DIMS];
+    if (input->num_dims > TENSOR_VIEW_MAX_DIMS) {
+        fprintf(stderr, "Too many dimensions for slice\n");
+        return NULL;
+    }
+    memcpy(shape, input->shape, input->num_dims * sizeof(int));
+    shape[dim] = length;
+    return tensor_view_create(input, shape, input->strides, input->num_dims,
+                              (long)start * input->strides[dim]);
+}
+
+Tensor* tensor_view_split_heads(const Tensor* input, int num_heads) {
+    if (input->num_dims != 3 || input->shape[2] % num_heads != 0) {
+        fprintf(stderr, "Cannot split %d heads from this tensor\n", num_heads);
+        return NULL;
+    }
+
+    // 最后一维拆成[num_heads, head_dim], 再交换seq和head两维
+    int head_dim = input->shape[2] / num_heads;
+    int shape[] = {input->shape[0], num_heads, input->shape[1], head_dim};
+    long strides[] = {
+        input->strides[0],
+        input->strides[2] * head_dim,
+        input->strides[1],
+        input->strides[2]
+    };
+    return tensor_view_create(input, shape, strides, 4, 0);
+}
+
+Tensor* tensor_view_merge_heads(const Tensor* input) {
+    if (input->num_dims != 4) {
+        fprintf(stderr, "Merge heads expects a 4D tensor\n");
+        return NULL;
+    }
+
+    // 相邻的头必须正好首尾相接
+    int num_heads = input->shape[1];
+    int head_dim = input->shape[3];
+    if (num_heads > 1 && input->strides[1] != input->strides[3] * head_dim) {
+        fprintf(stderr, "Heads are not interleaved in memory, merge needs a copy\n");
+        return NULL;
+    }
+
+    int shape[] = {input->shape[0], input->shape[2], num_heads * head_dim};
+    long strides[] = {input->strides[0], input->strides[2], input->strides[3]};
+    return tensor_view_create(input, shape, strides, 3, 0);
+}
@@ -1,6 +1,34 @@
 #include "tensor_std.h"
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
 #include <math.h>
 #include <stdlib.h>
+#include <stdio.h>
+
+// 按行([batch_size * seq_len]中的一行)并行的公共参数
+typedef struct {
+    const Tensor* input;
+    Tensor* output;
+    const Tensor* means;
+    const Tensor* variances;
+    const Tensor* gamma;
+    const Tensor* beta;
+    Tensor* stats;      // compute_*_3d的结果
+    int hidden_dim;
+    float eps;
+} RowNormCtx;
+
+static void means_rows(void* arg, long begin, long end) {
+    const RowNormCtx* ctx = (const RowNormCtx*)arg;
+    for (long row = begin; row < end; row++) {
+        const float* x = ctx->input->data + row * ctx->hidden_dim;
+        float sum = 0.0f;
+        for (int h = 0; h < ctx->hidden_dim; h++) {
+            sum += x[h];
+        }
+        ctx->stats->data[row] = sum / ctx->hidden_dim;
+    }
+}
 
 bool compute_means_3d(const Tensor* input, Tensor* means) {
     if (!input || !means) return false;
@@ -9,21 +37,23 @@ bool compute_means_3d(const Tensor* input, Tensor* means) {
     int seq_len = input->shape[1];
     int hidden_dim = input->shape[2];
     
-    #pragma omp parallel for collapse(2)
-    for (int b = 0; b < batch_size; b++) {
-        for (int s = 0; s < seq_len; s++) {
-            float sum = 0.0f;
-            int offset = (b * seq_len + s) * hidden_dim;
-            
-            #pragma omp simd reduction(+:sum)
-            for (int h = 0; h < hidden_dim; h++) {
-                sum += input->data[offset + h];
-            }
-            
-            means->data[b * seq_len + s] = sum / hidden_dim;
+    RowNormCtx ctx = {.input = input, .stats = means, .hidden_dim = hidden_dim};
+    parallel_for((long)batch_size * seq_len, 16, means_rows, &ctx);
+    return true;
+}
+
+static void variances_rows(void* arg, long begin, long end) {
+    const RowNormCtx* ctx = (const RowNormCtx*)arg;
+    for (long row = begin; row < end; row++) {
+        const float* x = ctx->input->data + row * ctx->hidden_dim;
+        float mean = ctx->means->data[row];
+        float sum_sq = 0.0f;
+        for (int h = 0; h < ctx->hidden_dim; h++) {
+            float diff = x[h] - mean;
+            sum_sq += diff * diff;
         }
+        ctx->stats->data[row] = sum_sq / ctx->hidden_dim;
     }
-    return true;
 }
 
 bool compute_variances_3d(const Tensor* input, const Tensor* means, Tensor* variances) {
@@ -33,23 +63,22 @@ bool compute_variances_3d(const Tensor* input, const Tensor* means, Tensor* vari
     int seq_len = input->shape[1];
     int hidden_dim = input->shape[2];
     
-    #pragma omp parallel for collapse(2)
-    for (int b = 0; b < batch_size; b++) {
-        for (int s = 0; s < seq_len; s++) {
-            float sum_sq = 0.0f;
-            int offset = (b * seq_len + s) * hidden_dim;
-            float mean = means->data[b * seq_len + s];
-            
-            #pragma omp simd reduction(+:sum_sq)
-            for (int h = 0; h < hidden_dim; h++) {
-                float diff = input->data[offset + h] - mean;
-                sum_sq += diff * diff;
-            }
-            
-            variances->data[b * seq_len + s] = sum_sq / hidden_dim;
+    RowNormCtx ctx = {.input = input, .means = means, .stats = variances, .hidden_dim = hidden_dim};
+    parallel_for((long)batch_size * seq_len, 16, variances_rows, &ctx);
+    return true;
+}
+
+static void normalize_rows(void* arg, long begin, long end) {
+    const RowNormCtx* ctx = (const RowNormCtx*)arg;
+    for (long row = begin; row < end; row++) {
+        long offset = row * ctx->hidden_dim;
+        float mean = ctx->means->data[row];
+        float std = sqrtf(ctx->variances->data[row] + ctx->eps);
+        for (int h = 0; h < ctx->hidden_dim; h++) {
+            float normalized = (ctx->input->data[offset + h] - mean) / std;
+            ctx->output->data[offset + h] = ctx->gamma->data[h] * normalized + ctx->beta->data[h];
         }
     }
-    return true;
 }
 
 bool normalize_and_scale_3d(const Tensor* input, Tensor* output,
@@ -62,59 +91,111 @@ bool normalize_and_scale_3d(const Tensor* input, Tensor* output,
     int seq_len = input->shape[1];
     int hidden_dim = input->shape[2];
     
-    #pragma omp parallel for collapse(2)
-    for (int b = 0; b < batch_size; b++) {
-        for (int s = 0; s < seq_len; s++) {
-            int offset = (b * seq_len + s) * hidden_dim;
-            float mean = means->data[b * seq_len + s];
-            float std = sqrt(variances->data[b * seq_len + s] + eps);
-            
-            #pragma omp simd
-            for (int h = 0; h < hidden_dim; h++) {
-                float normalized = (input->data[offset + h] - mean) / std;
-                output->data[offset + h] = gamma->data[h] * normalized + beta->data[h];
-            }
+    RowNormCtx ctx = {
+        .input = input, .output = output,
+        .means = means, .variances = variances,
+        .gamma = gamma, .beta = beta,
+        .hidden_dim = hidden_dim, .eps = eps
+    };
+    parallel_for((long)batch_size * seq_len, 16, normalize_rows, &ctx);
+    return true;
+}
+
+typedef struct {
+    const Tensor* input;
+    const Tensor* residual;
+    Tensor* sum;
+    Tensor* output;
+    const Tensor* gamma;
+    const Tensor* beta;
+    float* mean;
+    float* rstd;
+    int hidden_dim;
+    float eps;
+    bool rms;           // RMSNorm: 不减均值, 没有beta
+} ResidualNormCtx;
+
+static void residual_norm_rows(void* arg, long begin, long end) {
+    const ResidualNormCtx* ctx = (const ResidualNormCtx*)arg;
+    const SimdKernels* kernels = simd_kernels();
+    for (long row = begin; row < end; row++) {
+        long offset = row * ctx->hidden_dim;
+        if (ctx->rms) {
+            kernels->rms_norm_row(ctx->input->data + offset,
+                                  ctx->residual ? ctx->residual->data + offset : NULL,
+                                  ctx->sum ? ctx->sum->data + offset : NULL,
+                                  ctx->output->data + offset,
+                                  ctx->gamma->data, ctx->hidden_dim, ctx->eps,
+                                  ctx->rstd ? ctx->rstd + row : NULL);
+            continue;
         }
+        kernels->layer_norm_row(ctx->input->data + offset,
+                                ctx->residual ? ctx->residual->data + offset : NULL,
+                                ctx->sum ? ctx->sum->data + offset : NULL,
+                                ctx->output->data + offset,
+                                ctx->gamma->data, ctx->beta->data, ctx->hidden_dim, ctx->eps,
+                                ctx->mean ? ctx->mean + row : NULL,
+                                ctx->rstd ? ctx->rstd + row : NULL);
     }
-    return true;
 }
 
+// 逐行归一化, 均值和方差在行内一次遍历得到, 不需要中间张量
 bool layer_norm_forward_3d(const Tensor* input, Tensor* output,
                          const Tensor* gamma, const Tensor* beta,
                          float eps) {
-    if (!input || !output || !gamma || !beta) return false;
-                         
-    // 创建临时张量
-    int means_shape[] = {input->shape[0], input->shape[1]};
-    Tensor* means = tensor_create(means_shape, 2);
-    Tensor* variances = tensor_create(means_shape, 2);
-    
-    if (!means || !variances) {
-        if (means) tensor_free(means);
-        if (variances) tensor_free(variances);
-        return false;
-    }
-    
-    // 计算均值
-    if (!compute_means_3d(input, means)) {
-        tensor_free(means);
-        tensor_free(variances);
+    return residual_layer_norm_forward_3d(input, NULL, NULL, output, gamma, beta, eps, NULL, NULL);
+}
+
+// LayerNorm和RMSNorm共用的参数检查和行并行
+// 行指针按data + row * hidden_dim计算, 所有操作数都必须是连续的(转置、切片视图需要先复制)
+static bool residual_norm_run(ResidualNormCtx* ctx) {
+    const Tensor* input = ctx->input;
+    if (!tensor_is_contiguous(input) || !tensor_is_contiguous(ctx->output) ||
+        (ctx->residual && !tensor_is_contiguous(ctx->residual)) ||
+        (ctx->sum && !tensor_is_contiguous(ctx->sum)) ||
+        !tensor_is_contiguous(ctx->gamma) || (ctx->beta && !tensor_is_contiguous(ctx->beta))) {
+        fprintf(stderr, "Residual norm expects contiguous operands\n");
         return false;
     }
-    
-    // 计算方差
-    if (!compute_variances_3d(input, means, variances)) {
-        tensor_free(means);
-        tensor_free(variances);
+    int rows = input->shape[0] * input->shape[1];
+    int hidden_dim = input->shape[2];
+    size_t total = (size_t)rows * hidden_dim;
+    if (calculate_total_size(ctx->output->shape, ctx->output->num_dims) != total ||
+        (ctx->residual && calculate_total_size(ctx->residual->shape, ctx->residual->num_dims) != total) ||
+        (ctx->sum && calculate_total_size(ctx->sum->shape, ctx->sum->num_dims) != total)) {
+        fprintf(stderr, "Residual norm operands have different sizes\n");
         return false;
     }
-    
-    // 归一化和缩放
-    bool success = normalize_and_scale_3d(input, output, means, variances, gamma, beta, eps);
-    
-    // 释放临时缓冲区
-    tensor_free(means);
-    tensor_free(variances);
-    
-    return success;
-}
\ No newline at end of file
+    ctx->hidden_dim = hidden_dim;
+    parallel_for(rows, 16, residual_norm_rows, ctx);
+    return true;
+}
+
+bool residual_layer_norm_forward_3d(const Tensor* input, const Tensor* residual,
+                                    Tensor* sum, Tensor* output,
+                                    const Tensor* gamma, const Tensor* beta, float eps,
+                                    float* mean, float* rstd) {
+    if (!input || !output || !gamma || !beta) return false;
+
+    ResidualNormCtx ctx = {
+        .input = input, .residual = residual, .sum = sum, .output = output,
+        .gamma = gamma, .beta = beta, .mean = mean, .rstd = rstd, .eps = eps
+    };
+    return residual_norm_run(&ctx);
+}
+
+bool rms_norm_forward_3d(const Tensor* input, Tensor* output, const Tensor* gamma, float eps) {
+    return residual_rms_norm_forward_3d(input, NULL, NULL, output, gamma, eps, NULL);
+}
+
+bool residual_rms_norm_forward_3d(const Tensor* input, const Tensor* residual,
+                                  Tensor* sum, Tensor* output,
+                                  const Tensor* gamma, float eps, float* rstd) {
+    if (!input || !output || !gamma) return false;
+
+    ResidualNormCtx ctx = {
+        .input = input, .residual = residual, .sum = sum, .output = output,
+        .gamma = gamma, .rstd = rstd, .eps = eps, .rms = true
+    };
+    return residual_norm_run(&ctx);
+}
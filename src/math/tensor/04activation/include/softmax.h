@@ -2,13 +2,24 @@
 #define SOFTMAX_H
 
 #include "tensor_type.h"
+#include "tensor_attention.h"
 
 // 在指定维度上执行softmax
 // axis: 执行softmax的维度
 // bool tensor_softmax(const Tensor* input, int axis, Tensor* output);
 
 // 针对4D注意力分数的特殊softmax实现
-// input: [batch_size, num_heads, seq_len, seq_len]
+// input: [batch_size, num_heads, seq_len_q, seq_len_k], 沿最后一维归一化
+// 输入输出可以是视图, 但每一行必须连续
 bool attention_scores_softmax(const Tensor* input, Tensor* output);
 
+// 融合缩放、掩码和softmax: output = softmax(scale * input + mask), 每行只读一次输入
+// input: [batch_size, num_heads, seq_len_q, seq_len_k], seq_len_q和seq_len_k可以不同
+// spec: 与tensor_flash_attention_masked相同的屏蔽条件(位图的batch维为batch_size或1), NULL表示不屏蔽
+// 键长度的个数必须整除batch_size: 第b个batch使用key_lengths[b / (batch_size / num_lengths)]
+// 因果条件和键长度之外的位置直接写0, 不计算exp; 这两项屏蔽了整行时该行全为0
+// 输入输出可以是同一个张量或视图, 但每一行必须连续
+bool attention_scores_softmax_masked(const Tensor* input, float scale, const FlashMask* spec,
+                                     Tensor* output);
+
 #endif // SOFTMAX_H
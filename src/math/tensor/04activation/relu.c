@@ -1,9 +1,20 @@
 #include "relu.h"
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
 #include <stdio.h>
 
+typedef struct {
+    const float* input;
+    float* output;
+} ReluCtx;
+
+static void relu_range(void* arg, long begin, long end) {
+    const ReluCtx* ctx = (const ReluCtx*)arg;
+    simd_kernels()->relu(ctx->input + begin, ctx->output + begin, end - begin);
+}
+
 void relu_forward(Tensor* input, Tensor* output) {
     size_t size = calculate_total_size(input->shape, input->num_dims);
-    for (int i = 0; i < size; i++) {
-        output->data[i] = input->data[i] > 0 ? input->data[i] : 0;
-    }
+    ReluCtx ctx = {input->data, output->data};
+    parallel_for((long)size, 16384, relu_range, &ctx);
 }
\ No newline at end of file
@@ -1,39 +1,182 @@
 #include "softmax.h"
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
 #include <math.h>
 #include <float.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    const Tensor* input;
+    Tensor* output;
+    int row_len;
+} SoftmaxCtx;
+
+// 行的起始位置按前三维的步长计算, 输入输出可以是视图
+static void softmax_rows(void* arg, long begin, long end) {
+    const SoftmaxCtx* ctx = (const SoftmaxCtx*)arg;
+    const SimdKernels* kernels = simd_kernels();
+    for (long row = begin; row < end; row++) {
+        kernels->softmax_row(ctx->input->data + tensor_outer_offset(ctx->input, row, 3),
+                             ctx->output->data + tensor_outer_offset(ctx->output, row, 3),
+                             ctx->row_len);
+    }
+}
 
 bool attention_scores_softmax(const Tensor* input, Tensor* output) {
     int batch_size = input->shape[0];
     int num_heads = input->shape[1];
-    int seq_len = input->shape[2];
-    // 最后一维也是seq_len
+    int seq_len_q = input->shape[2];
+    int seq_len_k = input->shape[3];
+
+    // 每一行在内存中必须连续
+    if ((input->strides[3] != 1 || output->strides[3] != 1) && seq_len_k > 1) {
+        fprintf(stderr, "Softmax rows must be contiguous\n");
+        return false;
+    }
     
-    // 对每个batch和head分别计算softmax
-    for (int b = 0; b < batch_size; b++) {
-        for (int h = 0; h < num_heads; h++) {
-            for (int i = 0; i < seq_len; i++) {
-                // 1. 找到最大值
-                float max_val = -FLT_MAX;
-                for (int j = 0; j < seq_len; j++) {
-                    int idx = ((b * num_heads + h) * seq_len + i) * seq_len + j;
-                    max_val = fmaxf(max_val, input->data[idx]);
-                }
-                
-                // 2. 计算exp并求和
-                float sum = 0.0f;
-                for (int j = 0; j < seq_len; j++) {
-                    int idx = ((b * num_heads + h) * seq_len + i) * seq_len + j;
-                    output->data[idx] = expf(input->data[idx] - max_val);
-                    sum += output->data[idx];
+    // 对每个batch和head的每一行分别计算softmax, 行之间并行
+    SoftmaxCtx ctx = {input, output, seq_len_k};
+    parallel_for((long)batch_size * num_heads * seq_len_q, 8, softmax_rows, &ctx);
+    return true;
+}
+
+typedef struct {
+    const Tensor* input;
+    Tensor* output;
+    const FlashMask* spec;
+    float scale;
+    int num_heads, seq_len_q, seq_len_k;
+    long mask_batch_stride, mask_head_stride, mask_row_stride;  // 广播的维度步长为0
+    long bits_batch_stride, bits_row_stride;                    // 以64位字为单位
+    int lengths_div;                                            // 键长度的下标 = b / lengths_div
+} MaskedSoftmaxCtx;
+
+// 一行: 先按因果条件和键长度确定有效长度, 有效部分缩放、屏蔽并求最大值, 再取指数、求和、归一化
+static void masked_softmax_rows(void* arg, long begin, long end) {
+    const MaskedSoftmaxCtx* ctx = (const MaskedSoftmaxCtx*)arg;
+    const FlashMask* spec = ctx->spec;
+    const SimdKernels* kernels = simd_kernels();
+    int seq_len_k = ctx->seq_len_k;
+
+    for (long row = begin; row < end; row++) {
+        int i = (int)(row % ctx->seq_len_q);
+        int h = (int)(row / ctx->seq_len_q % ctx->num_heads);
+        int b = (int)(row / ((long)ctx->seq_len_q * ctx->num_heads));
+        const float* in = ctx->input->data + tensor_outer_offset(ctx->input, row, 3);
+        float* out = ctx->output->data + tensor_outer_offset(ctx->output, row, 3);
+
+        int valid = seq_len_k;
+        const float* mask = NULL;
+        const uint64_t* bits = NULL;
+        if (spec) {
+            if (spec->causal && i + seq_len_k - ctx->seq_len_q + 1 < valid) {
+                valid = i + seq_len_k - ctx->seq_len_q + 1;
+            }
+            if (spec->key_lengths && spec->key_lengths[b / ctx->lengths_div] < valid) {
+                valid = spec->key_lengths[b / ctx->lengths_div];
+            }
+            if (valid < 0) valid = 0;
+            if (spec->dense) {
+                mask = spec->dense->data + b * ctx->mask_batch_stride + h * ctx->mask_head_stride +
+                       i * ctx->mask_row_stride;
+            }
+            if (spec->bits) {
+                bits = spec->bits + b * ctx->bits_batch_stride + i * ctx->bits_row_stride;
+            }
+        }
+
+        if (valid > 0) {
+            float max_val = kernels->scale_mask_max_row(in, out, valid, ctx->scale, mask, FLASH_MASK_VALUE);
+            if (bits) {
+                bool cleared = false;
+                for (int j = 0; j < valid; j++) {
+                    if (!((bits[j >> 6] >> (j & 63)) & 1)) {
+                        out[j] = FLASH_MASK_VALUE;
+                        cleared = true;
+                    }
                 }
-                
-                // 3. 归一化
-                for (int j = 0; j < seq_len; j++) {
-                    int idx = ((b * num_heads + h) * seq_len + i) * seq_len + j;
-                    output->data[idx] /= sum;
+                if (cleared) {
+                    max_val = out[0];
+                    for (int j = 1; j < valid; j++) max_val = fmaxf(max_val, out[j]);
                 }
             }
+            float sum = kernels->exp_sum_row(out, valid, max_val);
+            kernels->scale(out, out, 1.0f / sum, (size_t)valid);
+        }
+        if (valid < seq_len_k) {
+            memset(out + valid, 0, (size_t)(seq_len_k - valid) * sizeof(float));
         }
     }
+}
+
+// 稠密掩码的前导维步长, 与注意力内核的规则相同: 大小为1的维度广播
+static bool masked_softmax_mask_strides(const Tensor* mask, int batch_size, int num_heads,
+                                        int seq_len_q, int seq_len_k, MaskedSoftmaxCtx* ctx) {
+    int n = mask->num_dims;
+    if (n < 2 || n > 4 ||
+        (mask->shape[n - 2] != seq_len_q && mask->shape[n - 2] != 1) ||
+        mask->shape[n - 1] != seq_len_k || mask->strides[n - 1] != 1 ||
+        (n >= 3 && mask->shape[0] != 1 && mask->shape[0] != batch_size) ||
+        (n == 4 && mask->shape[1] != 1 && mask->shape[1] != num_heads)) {
+        fprintf(stderr, "Softmax mask does not match the scores\n");
+        return false;
+    }
+    ctx->mask_row_stride = mask->shape[n - 2] == 1 ? 0 : mask->strides[n - 2];
+    ctx->mask_batch_stride = n >= 3 && mask->shape[0] != 1 ? mask->strides[0] : 0;
+    ctx->mask_head_stride = n == 4 && mask->shape[1] != 1 ? mask->strides[1] : 0;
+    return true;
+}
+
+bool attention_scores_softmax_masked(const Tensor* input, float scale, const FlashMask* spec,
+                                     Tensor* output) {
+    if (!input || !output || input->num_dims != 4 || output->num_dims != 4) {
+        fprintf(stderr, "Softmax scores must be 4-dimensional\n");
+        return false;
+    }
+    int batch_size = input->shape[0];
+    int num_heads = input->shape[1];
+    int seq_len_q = input->shape[2];
+    int seq_len_k = input->shape[3];
+    for (int d = 0; d < 4; d++) {
+        if (output->shape[d] != input->shape[d]) {
+            fprintf(stderr, "Softmax input and output shapes do not match\n");
+            return false;
+        }
+    }
+    if ((input->strides[3] != 1 || output->strides[3] != 1) && seq_len_k > 1) {
+        fprintf(stderr, "Softmax rows must be contiguous\n");
+        return false;
+    }
+
+    MaskedSoftmaxCtx ctx = {
+        .input = input, .output = output, .spec = spec, .scale = scale,
+        .num_heads = num_heads, .seq_len_q = seq_len_q, .seq_len_k = seq_len_k,
+    };
+    if (spec && spec->dense &&
+        !masked_softmax_mask_strides(spec->dense, batch_size, num_heads, seq_len_q, seq_len_k, &ctx)) {
+        return false;
+    }
+    if (spec && spec->bits) {
+        if ((spec->bits_batch != 1 && spec->bits_batch != batch_size) ||
+            (spec->bits_rows != 1 && spec->bits_rows != seq_len_q) ||
+            (long)spec->bits_words * 64 < seq_len_k) {
+            fprintf(stderr, "Softmax bit mask does not match the scores\n");
+            return false;
+        }
+        ctx.bits_batch_stride = spec->bits_batch == 1 ? 0 : (long)spec->bits_rows * spec->bits_words;
+        ctx.bits_row_stride = spec->bits_rows == 1 ? 0 : spec->bits_words;
+    }
+
+    // 键长度每个查询batch一个, 或者每组一个(同一个源序列的多个beam连续排列)
+    if (spec && spec->key_lengths) {
+        if (spec->num_lengths <= 0 || batch_size % spec->num_lengths != 0) {
+            fprintf(stderr, "Softmax key lengths do not match the batch\n");
+            return false;
+        }
+        ctx.lengths_div = batch_size / spec->num_lengths;
+    }
+
+    parallel_for((long)batch_size * num_heads * seq_len_q, 8, masked_softmax_rows, &ctx);
     return true;
 }
@@ -90,7 +90,7 @@ bool linear_forward(Linear* linear, const Tensor* input, Tensor* output) {
     }
 
     // 检查最后一个维度是否匹配权重的输入特征数
-    if (input->shape[input->num_dims - 1] != linear->weight->shape[1]) {
+    if (input->shape[input->num_dims - 1] != linear->weight->shape[0]) {
         fprintf(stderr, "Input features dimension mismatch\n");
         return false;
     }
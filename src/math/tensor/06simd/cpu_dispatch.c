@@ -0,0 +1,93 @@
+#include "cpu_dispatch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const SimdKernels* active_kernels = NULL;
+static CpuIsa active_isa = CPU_ISA_SCALAR;
+
+CpuIsa cpu_detect_isa(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return CPU_ISA_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return CPU_ISA_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return CPU_ISA_SSE4;
+    }
+#endif
+    return CPU_ISA_SCALAR;
+}
+
+const char* cpu_isa_name(CpuIsa isa) {
+    switch (isa) {
+        case CPU_ISA_SSE4:   return "sse4";
+        case CPU_ISA_AVX2:   return "avx2";
+        case CPU_ISA_AVX512: return "avx512";
+        default:             return "scalar";
+    }
+}
+
+static const SimdKernels* kernels_for_isa(CpuIsa isa) {
+    switch (isa) {
+        case CPU_ISA_AVX512: return simd_kernels_avx512();
+        case CPU_ISA_AVX2:   return simd_kernels_avx2();
+        case CPU_ISA_SSE4:   return simd_kernels_sse4();
+        default:             return simd_kernels_scalar();
+    }
+}
+
+bool cpu_force_isa(CpuIsa isa) {
+    const SimdKernels* kernels = kernels_for_isa(isa);
+    if (isa > cpu_detect_isa() || !kernels) {
+        fprintf(stderr, "ISA %s is not supported on this CPU\n", cpu_isa_name(isa));
+        return false;
+    }
+    active_isa = isa;
+    active_kernels = kernels;
+    return true;
+}
+
+// 启动时选择: 默认用CPU支持的最高等级, TRANSFORMER_ISA可以降级
+static void cpu_dispatch_init(void) {
+    CpuIsa isa = cpu_detect_isa();
+
+    const char* forced = getenv("TRANSFORMER_ISA");
+    if (forced) {
+        for (int i = CPU_ISA_SCALAR; i <= CPU_ISA_AVX512; i++) {
+            if (strcmp(forced, cpu_isa_name((CpuIsa)i)) == 0) {
+                if ((CpuIsa)i <= isa) {
+                    isa = (CpuIsa)i;
+                } else {
+                    fprintf(stderr, "TRANSFORMER_ISA=%s not supported, using %s\n",
+                            forced, cpu_isa_name(isa));
+                }
+                break;
+            }
+        }
+    }
+
+    // 平台不提供该等级的实现时逐级回退
+    while (isa > CPU_ISA_SCALAR && !kernels_for_isa(isa)) {
+        isa = (CpuIsa)(isa - 1);
+    }
+    active_isa = isa;
+    active_kernels = kernels_for_isa(isa);
+}
+
+CpuIsa cpu_active_isa(void) {
+    if (!active_kernels) {
+        cpu_dispatch_init();
+    }
+    return active_isa;
+}
+
+const SimdKernels* simd_kernels(void) {
+    if (!active_kernels) {
+        cpu_dispatch_init();
+    }
+    return active_kernels;
+}
@@ -0,0 +1,30 @@
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+#include <stdbool.h>
+#include "simd_kernels.h"
+
+// 指令集等级, 数值越大能力越强
+typedef enum {
+    CPU_ISA_SCALAR = 0,   // 通用C实现
+    CPU_ISA_SSE4 = 1,     // SSE4.1
+    CPU_ISA_AVX2 = 2,     // AVX2 + FMA
+    CPU_ISA_AVX512 = 3    // AVX-512F
+} CpuIsa;
+
+// 检测当前CPU支持的最高指令集(cpuid)
+CpuIsa cpu_detect_isa(void);
+
+// 当前选中的指令集, 第一次调用时初始化
+// 环境变量TRANSFORMER_ISA=scalar|sse4|avx2|avx512 可以在启动时强制指定
+CpuIsa cpu_active_isa(void);
+
+// 强制使用某个指令集(用于A/B性能测试), CPU不支持时返回false且不做修改
+bool cpu_force_isa(CpuIsa isa);
+
+const char* cpu_isa_name(CpuIsa isa);
+
+// 当前指令集对应的内核表
+const SimdKernels* simd_kernels(void);
+
+#endif // CPU_DISPATCH_H
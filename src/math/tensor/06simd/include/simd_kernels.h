@@ -0,0 +1,89 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct SimdKernels SimdKernels;
+
+// GELU近似中的常数: z = x * (GELU_K0 + GELU_K1 * x^2), gelu(x) = x * sigmoid(z)
+#define GELU_K0 1.5957691216057308f     // 2 * sqrt(2 / pi)
+#define GELU_K1 0.0713548162726009f     // 2 * sqrt(2 / pi) * 0.044715
+
+// Philox4x32-10计数器随机数的常数: 每轮 (c0, c1, c2, c3) -> (hi(M1 * c2) ^ c1 ^ k0, lo(M1 * c2),
+// hi(M0 * c0) ^ c3 ^ k1, lo(M0 * c0)), 之后k0 += W0, k1 += W1
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+// 按指令集区分的内核函数表, 由cpu_dispatch根据cpuid选择
+struct SimdKernels {
+    const char* name;
+
+    // GEMM寄存器微块: acc[GEMM_MR][GEMM_NR] = a[kc][GEMM_MR] * b[kc][GEMM_NR]
+    void (*gemm_micro)(int kc, const float* a, const float* b, float* acc);
+
+    // GEMM微块写回, 偏置、激活和残差在结果写入C之前完成, 不需要再遍历C:
+    // dst[i][j] = act(acc[i][j] + (accumulate ? dst[i][j] : 0) + bias[j]) + residual[i * ldr + j]
+    // acc是gemm_micro的结果, 只写回前rows行前cols列; bias/residual可以为NULL; activation取GemmActivation的值
+    // 门控激活时每行前cols / 2列是gate, 后cols / 2列是up, 写回cols / 2列act(gate + bias) * (up + bias),
+    // 这时不使用accumulate和residual
+    void (*gemm_store)(float* dst, long ldc, const float* acc, int rows, int cols, bool accumulate,
+                       const float* bias, int activation, const float* residual, long ldr);
+
+    // 一行softmax: out = exp(in - max) / sum, in与out可以相同
+    void (*softmax_row)(const float* in, float* out, int n);
+
+    // 融合softmax的各步, in与out/x可以相同
+    // 缩放并屏蔽: out = mask[j] == 0 ? masked_value : scale * in[j], mask为NULL时只缩放; 返回out的最大值
+    float (*scale_mask_max_row)(const float* in, float* out, int n, float scale,
+                                const float* mask, float masked_value);
+    // 原地取指数并求和: x = exp(x - max), 返回和; x - max低于约-87时结果为0
+    float (*exp_sum_row)(float* x, int n, float max);
+
+    // 残差加法与layernorm融合的一行: s = x + residual(residual为NULL时s = x),
+    // out = gamma * (s - mean) / sqrt(var + eps) + beta, 均值和方差用Welford方法一次遍历得到
+    // sum非NULL时写出s; mean/rstd非NULL时写入均值和1 / sqrt(var + eps); x、sum和out可以相同
+    void (*layer_norm_row)(const float* x, const float* residual, float* sum, float* out,
+                           const float* gamma, const float* beta, int n, float eps,
+                           float* mean, float* rstd);
+
+    // 残差加法与RMSNorm融合的一行: s = x + residual(residual为NULL时s = x),
+    // out = gamma * s / sqrt(mean(s^2) + eps); sum/rstd可以为NULL, x、sum和out可以相同
+    void (*rms_norm_row)(const float* x, const float* residual, float* sum, float* out,
+                         const float* gamma, int n, float eps, float* rstd);
+
+    // 逐元素加法: out = a + b, 也用于逐行加偏置
+    void (*add)(const float* a, const float* b, float* out, size_t n);
+
+    // 逐元素ReLU: out = max(in, 0)
+    void (*relu)(const float* in, float* out, size_t n);
+
+    // 逐元素GELU的tanh近似: out = x * sigmoid(2 * sqrt(2 / pi) * (x + 0.044715 * x^3)), in与out可以相同
+    void (*gelu)(const float* in, float* out, size_t n);
+
+    // 逐元素乘标量: out = alpha * in
+    void (*scale)(const float* in, float* out, float alpha, size_t n);
+
+    // 缩放后相加: out = alpha * x + y
+    void (*scale_add)(const float* x, float alpha, const float* y, float* out, size_t n);
+
+    // dropout保留掩码, 每16个元素一组, 第g组的保留位写入mask[g - first_group]
+    // 组内第4 * w + l个元素使用Philox计数器(4 * g + l, 0)、密钥seed的第w个输出, 不小于threshold时保留
+    // 一组正好是GEMM微块的一行, 各指令集结果相同
+    void (*dropout_mask)(uint64_t seed, long first_group, long groups, uint32_t threshold, uint16_t* mask);
+
+    // 按掩码应用dropout: out[i] = (mask[i / 16] >> (i % 16)) & 1 ? in[i] * scale : 0, 前向和反向共用
+    void (*dropout_apply)(const float* in, const uint16_t* mask, float* out, size_t n, float scale);
+};
+
+// 各指令集的内核表, 当前平台不支持时返回NULL
+const SimdKernels* simd_kernels_scalar(void);
+const SimdKernels* simd_kernels_sse4(void);
+const SimdKernels* simd_kernels_avx2(void);
+const SimdKernels* simd_kernels_avx512(void);
+
+#endif // SIMD_KERNELS_H
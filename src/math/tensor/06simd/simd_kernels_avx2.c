@@ -0,0 +1,471 @@
+#include "simd_kernels.h"
+#include "tensor_gemm.h"
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC target("avx2,fma")
+#include <immintrin.h>
+#include <math.h>
+#include <float.h>
+#include <stdbool.h>
+
+// AVX2 + FMA实现: 256位寄存器
+
+static inline float avx2_hsum(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    __m128 shuf = _mm_movehdup_ps(lo);
+    __m128 sums = _mm_add_ps(lo, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+static inline float avx2_hmax(__m256 v) {
+    __m128 lo = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_max_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(2, 3, 0, 1)));
+    lo = _mm_max_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(lo);
+}
+
+// 多项式近似exp(Cephes expf), 相对误差约1e-7
+// 输入截断到[-87.3, 88.3], 保证2^n在规格化浮点范围内; 低于下限的输入(例如被屏蔽的分数)结果为0
+static inline __m256 avx2_exp(__m256 x) {
+    __m256 underflow = _mm256_cmp_ps(x, _mm256_set1_ps(-87.3365447504019f), _CMP_LT_OQ);
+    x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+    x = _mm256_max_ps(x, _mm256_set1_ps(-87.3365447504019f));
+
+    __m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f));
+    fx = _mm256_floor_ps(fx);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+
+    __m256 y = _mm256_set1_ps(1.9875691500E-4f);
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507E-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073E-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894E-2f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459E-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201E-1f));
+    y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+
+    __m256i n = _mm256_cvttps_epi32(fx);
+    n = _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23);
+    return _mm256_andnot_ps(underflow, _mm256_mul_ps(y, _mm256_castsi256_ps(n)));
+}
+
+// x * sigmoid(x * (K0 + K1 * x^2)), 见GELU_K0
+static inline __m256 avx2_gelu_ps(__m256 x) {
+    __m256 z = _mm256_mul_ps(x, _mm256_fmadd_ps(_mm256_set1_ps(GELU_K1), _mm256_mul_ps(x, x),
+                                                _mm256_set1_ps(GELU_K0)));
+    __m256 e = avx2_exp(_mm256_sub_ps(_mm256_setzero_ps(), z));
+    return _mm256_div_ps(x, _mm256_add_ps(_mm256_set1_ps(1.0f), e));
+}
+
+// x * sigmoid(x)
+static inline __m256 avx2_silu_ps(__m256 x) {
+    __m256 e = avx2_exp(_mm256_sub_ps(_mm256_setzero_ps(), x));
+    return _mm256_div_ps(x, _mm256_add_ps(_mm256_set1_ps(1.0f), e));
+}
+
+static inline __m256 avx2_activate(__m256 v, int activation) {
+    if (activation == GEMM_ACT_RELU) return _mm256_max_ps(v, _mm256_setzero_ps());
+    if (activation == GEMM_ACT_GELU || activation == GEMM_ACT_GEGLU) return avx2_gelu_ps(v);
+    if (activation == GEMM_ACT_SWIGLU) return avx2_silu_ps(v);
+    return v;
+}
+
+// 6x16微块: 12个累加寄存器, 每步2次加载B, 6次广播A, 12次FMA
+static void avx2_gemm_micro(int kc, const float* a, const float* b, float* acc) {
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+    for (int p = 0; p < kc; p++) {
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 ai;
+        ai = _mm256_broadcast_ss(a + 0);
+        c00 = _mm256_fmadd_ps(ai, b0, c00); c01 = _mm256_fmadd_ps(ai, b1, c01);
+        ai = _mm256_broadcast_ss(a + 1);
+        c10 = _mm256_fmadd_ps(ai, b0, c10); c11 = _mm256_fmadd_ps(ai, b1, c11);
+        ai = _mm256_broadcast_ss(a + 2);
+        c20 = _mm256_fmadd_ps(ai, b0, c20); c21 = _mm256_fmadd_ps(ai, b1, c21);
+        ai = _mm256_broadcast_ss(a + 3);
+        c30 = _mm256_fmadd_ps(ai, b0, c30); c31 = _mm256_fmadd_ps(ai, b1, c31);
+        ai = _mm256_broadcast_ss(a + 4);
+        c40 = _mm256_fmadd_ps(ai, b0, c40); c41 = _mm256_fmadd_ps(ai, b1, c41);
+        ai = _mm256_broadcast_ss(a + 5);
+        c50 = _mm256_fmadd_ps(ai, b0, c50); c51 = _mm256_fmadd_ps(ai, b1, c51);
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+
+    _mm256_storeu_ps(acc + 0 * GEMM_NR, c00); _mm256_storeu_ps(acc + 0 * GEMM_NR + 8, c01);
+    _mm256_storeu_ps(acc + 1 * GEMM_NR, c10); _mm256_storeu_ps(acc + 1 * GEMM_NR + 8, c11);
+    _mm256_storeu_ps(acc + 2 * GEMM_NR, c20); _mm256_storeu_ps(acc + 2 * GEMM_NR + 8, c21);
+    _mm256_storeu_ps(acc + 3 * GEMM_NR, c30); _mm256_storeu_ps(acc + 3 * GEMM_NR + 8, c31);
+    _mm256_storeu_ps(acc + 4 * GEMM_NR, c40); _mm256_storeu_ps(acc + 4 * GEMM_NR + 8, c41);
+    _mm256_storeu_ps(acc + 5 * GEMM_NR, c50); _mm256_storeu_ps(acc + 5 * GEMM_NR + 8, c51);
+}
+
+// 门控激活: 每行w列gate和w列up, 正好各一个ymm, 不足8列时用掩码
+static void avx2_gemm_store_gated(float* dst, long ldc, const float* acc, int rows, int w,
+                                  const float* bias, int activation) {
+    __m256i m = _mm256_cmpgt_epi32(_mm256_set1_epi32(w), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256 bg = bias ? _mm256_maskload_ps(bias, m) : _mm256_setzero_ps();
+    __m256 bu = bias ? _mm256_maskload_ps(bias + w, m) : _mm256_setzero_ps();
+    for (int i = 0; i < rows; i++) {
+        const float* a = acc + i * GEMM_NR;
+        __m256 gate = _mm256_add_ps(_mm256_loadu_ps(a), bg);
+        __m256 up = _mm256_add_ps(_mm256_loadu_ps(a + w), bu);
+        __m256 v = _mm256_mul_ps(avx2_activate(gate, activation), up);
+        if (w == 8) {
+            _mm256_storeu_ps(dst + i * ldc, v);
+        } else {
+            _mm256_maskstore_ps(dst + i * ldc, m, v);
+        }
+    }
+}
+
+// 每行两个8列的半行, 不足8列的部分用掩码加载/存储
+static void avx2_gemm_store(float* dst, long ldc, const float* acc, int rows, int cols, bool accumulate,
+                            const float* bias, int activation, const float* residual, long ldr) {
+    if (activation >= GEMM_ACT_SWIGLU) {
+        avx2_gemm_store_gated(dst, ldc, acc, rows, cols / 2, bias, activation);
+        return;
+    }
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (int h = 0; h < cols; h += 8) {
+        int n = cols - h < 8 ? cols - h : 8;
+        __m256i m = _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lane);
+        __m256 vb = bias ? _mm256_maskload_ps(bias + h, m) : _mm256_setzero_ps();
+        for (int i = 0; i < rows; i++) {
+            float* d = dst + i * ldc + h;
+            __m256 v = _mm256_add_ps(_mm256_loadu_ps(acc + i * GEMM_NR + h), vb);
+            if (accumulate) v = _mm256_add_ps(v, _mm256_maskload_ps(d, m));
+            v = avx2_activate(v, activation);
+            if (residual) v = _mm256_add_ps(v, _mm256_maskload_ps(residual + i * ldr + h, m));
+            if (n == 8) {
+                _mm256_storeu_ps(d, v);
+            } else {
+                _mm256_maskstore_ps(d, m, v);
+            }
+        }
+    }
+}
+
+static void avx2_softmax_row(const float* in, float* out, int n) {
+    int j = 0;
+    __m256 vmax = _mm256_set1_ps(-FLT_MAX);
+    for (; j + 8 <= n; j += 8) {
+        vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(in + j));
+    }
+    float max_val = avx2_hmax(vmax);
+    for (; j < n; j++) {
+        max_val = fmaxf(max_val, in[j]);
+    }
+
+    __m256 vm = _mm256_set1_ps(max_val);
+    __m256 vsum = _mm256_setzero_ps();
+    for (j = 0; j + 8 <= n; j += 8) {
+        __m256 e = avx2_exp(_mm256_sub_ps(_mm256_loadu_ps(in + j), vm));
+        _mm256_storeu_ps(out + j, e);
+        vsum = _mm256_add_ps(vsum, e);
+    }
+    float sum = avx2_hsum(vsum);
+    for (; j < n; j++) {
+        out[j] = expf(in[j] - max_val);
+        sum += out[j];
+    }
+
+    float inv_sum = 1.0f / sum;
+    __m256 vinv = _mm256_set1_ps(inv_sum);
+    for (j = 0; j + 8 <= n; j += 8) {
+        _mm256_storeu_ps(out + j, _mm256_mul_ps(_mm256_loadu_ps(out + j), vinv));
+    }
+    for (; j < n; j++) {
+        out[j] *= inv_sum;
+    }
+}
+
+static float avx2_scale_mask_max_row(const float* in, float* out, int n, float scale,
+                                     const float* mask, float masked_value) {
+    __m256 vs = _mm256_set1_ps(scale);
+    __m256 vmasked = _mm256_set1_ps(masked_value);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 vmax = _mm256_set1_ps(-FLT_MAX);
+    int j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m256 x = _mm256_mul_ps(_mm256_loadu_ps(in + j), vs);
+        if (mask) {
+            __m256 off = _mm256_cmp_ps(_mm256_loadu_ps(mask + j), zero, _CMP_EQ_OQ);
+            x = _mm256_blendv_ps(x, vmasked, off);
+        }
+        _mm256_storeu_ps(out + j, x);
+        vmax = _mm256_max_ps(vmax, x);
+    }
+    float max_val = avx2_hmax(vmax);
+    for (; j < n; j++) {
+        out[j] = mask && mask[j] == 0.0f ? masked_value : scale * in[j];
+        max_val = fmaxf(max_val, out[j]);
+    }
+    return max_val;
+}
+
+static float avx2_exp_sum_row(float* x, int n, float max) {
+    __m256 vm = _mm256_set1_ps(max);
+    __m256 vsum = _mm256_setzero_ps();
+    int j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m256 e = avx2_exp(_mm256_sub_ps(_mm256_loadu_ps(x + j), vm));
+        _mm256_storeu_ps(x + j, e);
+        vsum = _mm256_add_ps(vsum, e);
+    }
+    float sum = avx2_hsum(vsum);
+    for (; j < n; j++) {
+        x[j] = expf(x[j] - max);
+        sum += x[j];
+    }
+    return sum;
+}
+
+// 每个通道各自做Welford更新, 一次遍历得到均值和方差
+static void avx2_layer_norm_row(const float* x, const float* residual, float* sum, float* out,
+                                const float* gamma, const float* beta, int n, float eps,
+                                float* mean_out, float* rstd_out) {
+    __m256 vmean = _mm256_setzero_ps();
+    __m256 vm2 = _mm256_setzero_ps();
+    int h = 0, count = 0;
+    for (; h + 8 <= n; h += 8) {
+        __m256 v = _mm256_loadu_ps(x + h);
+        if (residual) v = _mm256_add_ps(v, _mm256_loadu_ps(residual + h));
+        if (sum) _mm256_storeu_ps(sum + h, v);
+        count++;
+        __m256 delta = _mm256_sub_ps(v, vmean);
+        vmean = _mm256_fmadd_ps(delta, _mm256_set1_ps(1.0f / count), vmean);
+        vm2 = _mm256_fmadd_ps(delta, _mm256_sub_ps(v, vmean), vm2);
+    }
+    float lane_mean[8], lane_m2[8];
+    _mm256_storeu_ps(lane_mean, vmean);
+    _mm256_storeu_ps(lane_m2, vm2);
+    // 各通道的计数相同, 按Chan的公式合并, 尾部元素再逐个并入
+    float mean = 0.0f, m2 = 0.0f;
+    if (count > 0) {
+        for (int l = 0; l < 8; l++) mean += lane_mean[l];
+        mean /= 8;
+        for (int l = 0; l < 8; l++) {
+            float d = lane_mean[l] - mean;
+            m2 += lane_m2[l] + count * d * d;
+        }
+    }
+    int total = 8 * count;
+    for (; h < n; h++) {
+        float v = residual ? x[h] + residual[h] : x[h];
+        if (sum) sum[h] = v;
+        total++;
+        float delta = v - mean;
+        mean += delta / total;
+        m2 += delta * (v - mean);
+    }
+    float rstd = 1.0f / sqrtf(m2 / n + eps);
+    if (mean_out) *mean_out = mean;
+    if (rstd_out) *rstd_out = rstd;
+
+    // 归一化: 写出了和时直接读和, 否则重新相加
+    const float* s = sum ? sum : x;
+    bool add = residual && !sum;
+
+    __m256 vmu = _mm256_set1_ps(mean);
+    __m256 vrstd = _mm256_set1_ps(rstd);
+    for (h = 0; h + 8 <= n; h += 8) {
+        __m256 v = _mm256_loadu_ps(s + h);
+        if (add) v = _mm256_add_ps(v, _mm256_loadu_ps(residual + h));
+        __m256 y = _mm256_mul_ps(_mm256_sub_ps(v, vmu), vrstd);
+        _mm256_storeu_ps(out + h, _mm256_fmadd_ps(_mm256_loadu_ps(gamma + h), y, _mm256_loadu_ps(beta + h)));
+    }
+    for (; h < n; h++) {
+        float v = add ? s[h] + residual[h] : s[h];
+        out[h] = gamma[h] * (v - mean) * rstd + beta[h];
+    }
+}
+
+static void avx2_rms_norm_row(const float* x, const float* residual, float* sum, float* out,
+                              const float* gamma, int n, float eps, float* rstd_out) {
+    __m256 vsq = _mm256_setzero_ps();
+    int h = 0;
+    for (; h + 8 <= n; h += 8) {
+        __m256 v = _mm256_loadu_ps(x + h);
+        if (residual) v = _mm256_add_ps(v, _mm256_loadu_ps(residual + h));
+        if (sum) _mm256_storeu_ps(sum + h, v);
+        vsq = _mm256_fmadd_ps(v, v, vsq);
+    }
+    float sum_sq = avx2_hsum(vsq);
+    for (; h < n; h++) {
+        float v = residual ? x[h] + residual[h] : x[h];
+        if (sum) sum[h] = v;
+        sum_sq += v * v;
+    }
+    float rstd = 1.0f / sqrtf(sum_sq / n + eps);
+    if (rstd_out) *rstd_out = rstd;
+
+    const float* s = sum ? sum : x;
+    bool add = residual && !sum;
+    __m256 vrstd = _mm256_set1_ps(rstd);
+    for (h = 0; h + 8 <= n; h += 8) {
+        __m256 v = _mm256_loadu_ps(s + h);
+        if (add) v = _mm256_add_ps(v, _mm256_loadu_ps(residual + h));
+        _mm256_storeu_ps(out + h, _mm256_mul_ps(_mm256_loadu_ps(gamma + h), _mm256_mul_ps(v, vrstd)));
+    }
+    for (; h < n; h++) {
+        float v = add ? s[h] + residual[h] : s[h];
+        out[h] = gamma[h] * v * rstd;
+    }
+}
+
+static void avx2_add(const float* a, const float* b, float* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    for (; i < n; i++) out[i] = a[i] + b[i];
+}
+
+static void avx2_relu(const float* in, float* out, size_t n) {
+    size_t i = 0;
+    __m256 zero = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_max_ps(_mm256_loadu_ps(in + i), zero));
+    }
+    for (; i < n; i++) out[i] = in[i] > 0.0f ? in[i] : 0.0f;
+}
+
+static void avx2_gelu(const float* in, float* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, avx2_gelu_ps(_mm256_loadu_ps(in + i)));
+    }
+    for (; i < n; i++) {
+        float x = in[i];
+        out[i] = x / (1.0f + expf(-x * (GELU_K0 + GELU_K1 * x * x)));
+    }
+}
+
+static void avx2_scale(const float* in, float* out, float alpha, size_t n) {
+    size_t i = 0;
+    __m256 va = _mm256_set1_ps(alpha);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), va));
+    }
+    for (; i < n; i++) out[i] = alpha * in[i];
+}
+
+static void avx2_scale_add(const float* x, float alpha, const float* y, float* out, size_t n) {
+    size_t i = 0;
+    __m256 va = _mm256_set1_ps(alpha);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_loadu_ps(x + i), va, _mm256_loadu_ps(y + i)));
+    }
+    for (; i < n; i++) out[i] = fmaf(alpha, x[i], y[i]);
+}
+
+// 8个通道的32x32位乘法, 返回高32位, 低32位写入lo
+static inline __m256i avx2_mulhilo(__m256i a, __m256i m, __m256i* lo) {
+    __m256i even = _mm256_mul_epu32(a, m);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+    *lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+    return _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+}
+
+// 每次两组8个计数器, 最后不足两组时多算的一组丢弃
+static void avx2_dropout_mask(uint64_t seed, long first_group, long groups, uint32_t threshold,
+                              uint16_t* mask) {
+    const __m256i m0 = _mm256_set1_epi32((int)PHILOX_M0);
+    const __m256i m1 = _mm256_set1_epi32((int)PHILOX_M1);
+    const __m256i t = _mm256_set1_epi32((int)threshold);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+    for (long g = 0; g < groups; g += 2) {
+        uint64_t base = (uint64_t)(first_group + g) * 4;
+        // 8个计数器的低32位可能跨过2^32, 进位的通道高32位加1(无符号比较用符号位翻转)
+        __m256i start = _mm256_set1_epi32((int)(uint32_t)base);
+        __m256i lo = _mm256_add_epi32(start, lanes);
+        __m256i carry = _mm256_cmpgt_epi32(_mm256_xor_si256(start, sign), _mm256_xor_si256(lo, sign));
+        __m256i c[4] = {
+            lo,
+            _mm256_sub_epi32(_mm256_set1_epi32((int)(uint32_t)(base >> 32)), carry),
+            _mm256_setzero_si256(),
+            _mm256_setzero_si256(),
+        };
+        uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+        for (int r = 0; r < PHILOX_ROUNDS; r++) {
+            __m256i lo0, lo1;
+            __m256i hi0 = avx2_mulhilo(c[0], m0, &lo0);
+            __m256i hi1 = avx2_mulhilo(c[2], m1, &lo1);
+            c[0] = _mm256_xor_si256(_mm256_xor_si256(hi1, c[1]), _mm256_set1_epi32((int)k0));
+            c[1] = lo1;
+            c[2] = _mm256_xor_si256(_mm256_xor_si256(hi0, c[3]), _mm256_set1_epi32((int)k1));
+            c[3] = lo0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        // 第w个输出的8位: 低4位属于第一组的第4 * w到4 * w + 3个元素, 高4位属于第二组
+        int first = 0, second = 0;
+        for (int w = 0; w < 4; w++) {
+            __m256i keep = _mm256_cmpeq_epi32(_mm256_max_epu32(c[w], t), c[w]);
+            int bits = _mm256_movemask_ps(_mm256_castsi256_ps(keep));
+            first |= (bits & 0xF) << (4 * w);
+            second |= (bits >> 4) << (4 * w);
+        }
+        mask[g] = (uint16_t)first;
+        if (g + 1 < groups) mask[g + 1] = (uint16_t)second;
+    }
+}
+
+static void avx2_dropout_apply(const float* in, const uint16_t* mask, float* out, size_t n, float scale) {
+    const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256 s = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int byte = (mask[i >> 4] >> (i & 15)) & 0xFF;
+        __m256i keep = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(byte), lane_bits), lane_bits);
+        _mm256_storeu_ps(out + i, _mm256_and_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), s),
+                                                _mm256_castsi256_ps(keep)));
+    }
+    for (; i < n; i++) {
+        out[i] = (mask[i >> 4] >> (i & 15)) & 1 ? in[i] * scale : 0.0f;
+    }
+}
+
+static const SimdKernels avx2_kernels = {
+    .name = "avx2",
+    .gemm_micro = avx2_gemm_micro,
+    .gemm_store = avx2_gemm_store,
+    .softmax_row = avx2_softmax_row,
+    .scale_mask_max_row = avx2_scale_mask_max_row,
+    .exp_sum_row = avx2_exp_sum_row,
+    .layer_norm_row = avx2_layer_norm_row,
+    .rms_norm_row = avx2_rms_norm_row,
+    .add = avx2_add,
+    .relu = avx2_relu,
+    .gelu = avx2_gelu,
+    .scale = avx2_scale,
+    .scale_add = avx2_scale_add,
+    .dropout_mask = avx2_dropout_mask,
+    .dropout_apply = avx2_dropout_apply,
+};
+
+const SimdKernels* simd_kernels_avx2(void) {
+    return &avx2_kernels;
+}
+
+#else
+
+const SimdKernels* simd_kernels_avx2(void) {
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,407 @@
+#include "simd_kernels.h"
+#include "tensor_gemm.h"
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC target("avx512f")
+#include <immintrin.h>
+#include <math.h>
+#include <float.h>
+#include <stdbool.h>
+
+// AVX-512F实现: 512位寄存器, 尾部用掩码加载/存储, 不需要标量收尾
+
+static inline __mmask16 avx512_tail_mask(size_t remaining) {
+    return remaining >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << remaining) - 1);
+}
+
+// 多项式近似exp, 与AVX2版本相同的系数, 低于下限的输入结果为0
+static inline __m512 avx512_exp(__m512 x) {
+    __mmask16 valid = _mm512_cmp_ps_mask(x, _mm512_set1_ps(-87.3365447504019f), _CMP_GE_OQ);
+    x = _mm512_min_ps(x, _mm512_set1_ps(88.3762626647949f));
+    x = _mm512_max_ps(x, _mm512_set1_ps(-87.3365447504019f));
+
+    __m512 fx = _mm512_fmadd_ps(x, _mm512_set1_ps(1.44269504088896341f), _mm512_set1_ps(0.5f));
+    fx = _mm512_roundscale_ps(fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(0.693359375f), x);
+    x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(-2.12194440e-4f), x);
+
+    __m512 y = _mm512_set1_ps(1.9875691500E-4f);
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.3981999507E-3f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(8.3334519073E-3f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(4.1665795894E-2f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.6666665459E-1f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(5.0000001201E-1f));
+    y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x), _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+
+    __m512i n = _mm512_cvttps_epi32(fx);
+    n = _mm512_slli_epi32(_mm512_add_epi32(n, _mm512_set1_epi32(127)), 23);
+    return _mm512_maskz_mul_ps(valid, y, _mm512_castsi512_ps(n));
+}
+
+// x * sigmoid(x * (K0 + K1 * x^2)), 见GELU_K0
+static inline __m512 avx512_gelu_ps(__m512 x) {
+    __m512 z = _mm512_mul_ps(x, _mm512_fmadd_ps(_mm512_set1_ps(GELU_K1), _mm512_mul_ps(x, x),
+                                                _mm512_set1_ps(GELU_K0)));
+    __m512 e = avx512_exp(_mm512_sub_ps(_mm512_setzero_ps(), z));
+    return _mm512_div_ps(x, _mm512_add_ps(_mm512_set1_ps(1.0f), e));
+}
+
+// x * sigmoid(x)
+static inline __m512 avx512_silu_ps(__m512 x) {
+    __m512 e = avx512_exp(_mm512_sub_ps(_mm512_setzero_ps(), x));
+    return _mm512_div_ps(x, _mm512_add_ps(_mm512_set1_ps(1.0f), e));
+}
+
+static inline __m512 avx512_activate(__m512 v, int activation) {
+    if (activation == GEMM_ACT_RELU) return _mm512_max_ps(v, _mm512_setzero_ps());
+    if (activation == GEMM_ACT_GELU || activation == GEMM_ACT_GEGLU) return avx512_gelu_ps(v);
+    if (activation == GEMM_ACT_SWIGLU) return avx512_silu_ps(v);
+    return v;
+}
+
+// 6x16微块: 一行正好一个zmm, K方向展开2次用两组累加器隐藏FMA延迟
+static void avx512_gemm_micro(int kc, const float* a, const float* b, float* acc) {
+    __m512 c0 = _mm512_setzero_ps(), d0 = _mm512_setzero_ps();
+    __m512 c1 = _mm512_setzero_ps(), d1 = _mm512_setzero_ps();
+    __m512 c2 = _mm512_setzero_ps(), d2 = _mm512_setzero_ps();
+    __m512 c3 = _mm512_setzero_ps(), d3 = _mm512_setzero_ps();
+    __m512 c4 = _mm512_setzero_ps(), d4 = _mm512_setzero_ps();
+    __m512 c5 = _mm512_setzero_ps(), d5 = _mm512_setzero_ps();
+
+    int p = 0;
+    for (; p + 2 <= kc; p += 2) {
+        __m512 b0 = _mm512_load_ps(b);
+        __m512 b1 = _mm512_load_ps(b + GEMM_NR);
+        const float* a1 = a + GEMM_MR;
+        c0 = _mm512_fmadd_ps(_mm512_set1_ps(a[0]), b0, c0);
+        c1 = _mm512_fmadd_ps(_mm512_set1_ps(a[1]), b0, c1);
+        c2 = _mm512_fmadd_ps(_mm512_set1_ps(a[2]), b0, c2);
+        c3 = _mm512_fmadd_ps(_mm512_set1_ps(a[3]), b0, c3);
+        c4 = _mm512_fmadd_ps(_mm512_set1_ps(a[4]), b0, c4);
+        c5 = _mm512_fmadd_ps(_mm512_set1_ps(a[5]), b0, c5);
+        d0 = _mm512_fmadd_ps(_mm512_set1_ps(a1[0]), b1, d0);
+        d1 = _mm512_fmadd_ps(_mm512_set1_ps(a1[1]), b1, d1);
+        d2 = _mm512_fmadd_ps(_mm512_set1_ps(a1[2]), b1, d2);
+        d3 = _mm512_fmadd_ps(_mm512_set1_ps(a1[3]), b1, d3);
+        d4 = _mm512_fmadd_ps(_mm512_set1_ps(a1[4]), b1, d4);
+        d5 = _mm512_fmadd_ps(_mm512_set1_ps(a1[5]), b1, d5);
+        a += 2 * GEMM_MR;
+        b += 2 * GEMM_NR;
+    }
+    if (p < kc) {
+        __m512 b0 = _mm512_load_ps(b);
+        c0 = _mm512_fmadd_ps(_mm512_set1_ps(a[0]), b0, c0);
+        c1 = _mm512_fmadd_ps(_mm512_set1_ps(a[1]), b0, c1);
+        c2 = _mm512_fmadd_ps(_mm512_set1_ps(a[2]), b0, c2);
+        c3 = _mm512_fmadd_ps(_mm512_set1_ps(a[3]), b0, c3);
+        c4 = _mm512_fmadd_ps(_mm512_set1_ps(a[4]), b0, c4);
+        c5 = _mm512_fmadd_ps(_mm512_set1_ps(a[5]), b0, c5);
+    }
+
+    _mm512_storeu_ps(acc + 0 * GEMM_NR, _mm512_add_ps(c0, d0));
+    _mm512_storeu_ps(acc + 1 * GEMM_NR, _mm512_add_ps(c1, d1));
+    _mm512_storeu_ps(acc + 2 * GEMM_NR, _mm512_add_ps(c2, d2));
+    _mm512_storeu_ps(acc + 3 * GEMM_NR, _mm512_add_ps(c3, d3));
+    _mm512_storeu_ps(acc + 4 * GEMM_NR, _mm512_add_ps(c4, d4));
+    _mm512_storeu_ps(acc + 5 * GEMM_NR, _mm512_add_ps(c5, d5));
+}
+
+// 一行正好一个zmm, 不足16列时用掩码
+// 门控激活时gate和up各占w <= 8列, 用掩码加载到两个zmm的低位
+static void avx512_gemm_store(float* dst, long ldc, const float* acc, int rows, int cols, bool accumulate,
+                              const float* bias, int activation, const float* residual, long ldr) {
+    if (activation >= GEMM_ACT_SWIGLU) {
+        int w = cols / 2;
+        __mmask16 hm = avx512_tail_mask(w);
+        __m512 bg = bias ? _mm512_maskz_loadu_ps(hm, bias) : _mm512_setzero_ps();
+        __m512 bu = bias ? _mm512_maskz_loadu_ps(hm, bias + w) : _mm512_setzero_ps();
+        for (int i = 0; i < rows; i++) {
+            const float* a = acc + i * GEMM_NR;
+            __m512 gate = _mm512_add_ps(_mm512_maskz_loadu_ps(hm, a), bg);
+            __m512 up = _mm512_add_ps(_mm512_maskz_loadu_ps(hm, a + w), bu);
+            _mm512_mask_storeu_ps(dst + i * ldc, hm, _mm512_mul_ps(avx512_activate(gate, activation), up));
+        }
+        return;
+    }
+    __mmask16 m = avx512_tail_mask(cols);
+    __m512 vb = bias ? _mm512_maskz_loadu_ps(m, bias) : _mm512_setzero_ps();
+    for (int i = 0; i < rows; i++) {
+        float* d = dst + i * ldc;
+        __m512 v = _mm512_add_ps(_mm512_loadu_ps(acc + i * GEMM_NR), vb);
+        if (accumulate) v = _mm512_add_ps(v, _mm512_maskz_loadu_ps(m, d));
+        v = avx512_activate(v, activation);
+        if (residual) v = _mm512_add_ps(v, _mm512_maskz_loadu_ps(m, residual + i * ldr));
+        _mm512_mask_storeu_ps(d, m, v);
+    }
+}
+
+static void avx512_softmax_row(const float* in, float* out, int n) {
+    __m512 vmax = _mm512_set1_ps(-FLT_MAX);
+    for (int j = 0; j < n; j += 16) {
+        __mmask16 m = avx512_tail_mask((size_t)(n - j));
+        vmax = _mm512_mask_max_ps(vmax, m, vmax, _mm512_maskz_loadu_ps(m, in + j));
+    }
+    __m512 vm = _mm512_set1_ps(_mm512_reduce_max_ps(vmax));
+
+    __m512 vsum = _mm512_setzero_ps();
+    for (int j = 0; j < n; j += 16) {
+        __mmask16 m = avx512_tail_mask((size_t)(n - j));
+        __m512 e = avx512_exp(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, in + j), vm));
+        _mm512_mask_storeu_ps(out + j, m, e);
+        vsum = _mm512_mask_add_ps(vsum, m, vsum, e);
+    }
+
+    __m512 vinv = _mm512_set1_ps(1.0f / _mm512_reduce_add_ps(vsum));
+    for (int j = 0; j < n; j += 16) {
+        __mmask16 m = avx512_tail_mask((size_t)(n - j));
+        _mm512_mask_storeu_ps(out + j, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, out + j), vinv));
+    }
+}
+
+static float avx512_scale_mask_max_row(const float* in, float* out, int n, float scale,
+                                       const float* mask, float masked_value) {
+    __m512 vs = _mm512_set1_ps(scale);
+    __m512 vmasked = _mm512_set1_ps(masked_value);
+    __m512 vmax = _mm512_set1_ps(-FLT_MAX);
+    for (int j = 0; j < n; j += 16) {
+        __mmask16 m = avx512_tail_mask((size_t)(n - j));
+        __m512 x = _mm512_mul_ps(_mm512_maskz_loadu_ps(m, in + j), vs);
+        if (mask) {
+            __mmask16 off = _mm512_mask_cmp_ps_mask(m, _mm512_maskz_loadu_ps(m, mask + j),
+                                                     _mm512_setzero_ps(), _CMP_EQ_OQ);
+            x = _mm512_mask_blend_ps(off, x, vmasked);
+        }
+        _mm512_mask_storeu_ps(out + j, m, x);
+        vmax = _mm512_mask_max_ps(vmax, m, vmax, x);
+    }
+    return _mm512_reduce_max_ps(vmax);
+}
+
+static float avx512_exp_sum_row(float* x, int n, float max) {
+    __m512 vm = _mm512_set1_ps(max);
+    __m512 vsum = _mm512_setzero_ps();
+    for (int j = 0; j < n; j += 16) {
+        __mmask16 m = avx512_tail_mask((size_t)(n - j));
+        __m512 e = avx512_exp(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, x + j), vm));
+        _mm512_mask_storeu_ps(x + j, m, e);
+        vsum = _mm512_mask_add_ps(vsum, m, vsum, e);
+    }
+    return _mm512_reduce_add_ps(vsum);
+}
+
+// 整向量部分每个通道各自做Welford更新, 一次遍历得到均值和方差
+static void avx512_layer_norm_row(const float* x, const float* residual, float* sum, float* out,
+                                  const float* gamma, const float* beta, int n, float eps,
+                                  float* mean_out, float* rstd_out) {
+    __m512 vmean = _mm512_setzero_ps();
+    __m512 vm2 = _mm512_setzero_ps();
+    int h = 0, count = 0;
+    for (; h + 16 <= n; h += 16) {
+        __m512 v = _mm512_loadu_ps(x + h);
+        if (residual) v = _mm512_add_ps(v, _mm512_loadu_ps(residual + h));
+        if (sum) _mm512_storeu_ps(sum + h, v);
+        count++;
+        __m512 delta = _mm512_sub_ps(v, vmean);
+        vmean = _mm512_fmadd_ps(delta, _mm512_set1_ps(1.0f / count), vmean);
+        vm2 = _mm512_fmadd_ps(delta, _mm512_sub_ps(v, vmean), vm2);
+    }
+    float lane_mean[16], lane_m2[16];
+    _mm512_storeu_ps(lane_mean, vmean);
+    _mm512_storeu_ps(lane_m2, vm2);
+    // 各通道的计数相同, 按Chan的公式合并, 尾部元素再逐个并入
+    float mean = 0.0f, m2 = 0.0f;
+    if (count > 0) {
+        for (int l = 0; l < 16; l++) mean += lane_mean[l];
+        mean /= 16;
+        for (int l = 0; l < 16; l++) {
+            float d = lane_mean[l] - mean;
+            m2 += lane_m2[l] + count * d * d;
+        }
+    }
+    int total = 16 * count;
+    for (; h < n; h++) {
+        float v = residual ? x[h] + residual[h] : x[h];
+        if (sum) sum[h] = v;
+        total++;
+        float delta = v - mean;
+        mean += delta / total;
+        m2 += delta * (v - mean);
+    }
+    float rstd = 1.0f / sqrtf(m2 / n + eps);
+    if (mean_out) *mean_out = mean;
+    if (rstd_out) *rstd_out = rstd;
+
+    // 归一化: 写出了和时直接读和, 否则重新相加
+    const float* s = sum ? sum : x;
+    bool add = residual && !sum;
+
+    __m512 vmu = _mm512_set1_ps(mean);
+    __m512 vrstd = _mm512_set1_ps(rstd);
+    for (h = 0; h < n; h += 16) {
+        __mmask16 m = avx512_tail_mask((size_t)(n - h));
+        __m512 v = _mm512_maskz_loadu_ps(m, s + h);
+        if (add) v = _mm512_add_ps(v, _mm512_maskz_loadu_ps(m, residual + h));
+        __m512 y = _mm512_mul_ps(_mm512_sub_ps(v, vmu), vrstd);
+        y = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, gamma + h), y, _mm512_maskz_loadu_ps(m, beta + h));
+        _mm512_mask_storeu_ps(out + h, m, y);
+    }
+}
+
+static void avx512_rms_norm_row(const float* x, const float* residual, float* sum, float* out,
+                                const float* gamma, int n, float eps, float* rstd_out) {
+    __m512 vsq = _mm512_setzero_ps();
+    for (int h = 0; h < n; h += 16) {
+        __mmask16 m = avx512_tail_mask((size_t)(n - h));
+        __m512 v = _mm512_maskz_loadu_ps(m, x + h);
+        if (residual) v = _mm512_add_ps(v, _mm512_maskz_loadu_ps(m, residual + h));
+        if (sum) _mm512_mask_storeu_ps(sum + h, m, v);
+        vsq = _mm512_fmadd_ps(v, v, vsq);
+    }
+    float rstd = 1.0f / sqrtf(_mm512_reduce_add_ps(vsq) / n + eps);
+    if (rstd_out) *rstd_out = rstd;
+
+    const float* s = sum ? sum : x;
+    bool add = residual && !sum;
+    __m512 vrstd = _mm512_set1_ps(rstd);
+    for (int h = 0; h < n; h += 16) {
+        __mmask16 m = avx512_tail_mask((size_t)(n - h));
+        __m512 v = _mm512_maskz_loadu_ps(m, s + h);
+        if (add) v = _mm512_add_ps(v, _mm512_maskz_loadu_ps(m, residual + h));
+        _mm512_mask_storeu_ps(out + h, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, gamma + h),
+                                                        _mm512_mul_ps(v, vrstd)));
+    }
+}
+
+static void avx512_add(const float* a, const float* b, float* out, size_t n) {
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = avx512_tail_mask(n - i);
+        _mm512_mask_storeu_ps(out + i, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, a + i),
+                                                        _mm512_maskz_loadu_ps(m, b + i)));
+    }
+}
+
+static void avx512_relu(const float* in, float* out, size_t n) {
+    __m512 zero = _mm512_setzero_ps();
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = avx512_tail_mask(n - i);
+        _mm512_mask_storeu_ps(out + i, m, _mm512_max_ps(_mm512_maskz_loadu_ps(m, in + i), zero));
+    }
+}
+
+static void avx512_gelu(const float* in, float* out, size_t n) {
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = avx512_tail_mask(n - i);
+        _mm512_mask_storeu_ps(out + i, m, avx512_gelu_ps(_mm512_maskz_loadu_ps(m, in + i)));
+    }
+}
+
+static void avx512_scale(const float* in, float* out, float alpha, size_t n) {
+    __m512 va = _mm512_set1_ps(alpha);
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = avx512_tail_mask(n - i);
+        _mm512_mask_storeu_ps(out + i, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, in + i), va));
+    }
+}
+
+static void avx512_scale_add(const float* x, float alpha, const float* y, float* out, size_t n) {
+    __m512 va = _mm512_set1_ps(alpha);
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = avx512_tail_mask(n - i);
+        _mm512_mask_storeu_ps(out + i, m, _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, x + i), va,
+                                                          _mm512_maskz_loadu_ps(m, y + i)));
+    }
+}
+
+// 16个通道的32x32位乘法, 返回高32位, 低32位写入lo
+static inline __m512i avx512_mulhilo(__m512i a, __m512i m, __m512i* lo) {
+    __m512i even = _mm512_mul_epu32(a, m);
+    __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), m);
+    *lo = _mm512_mask_blend_epi32(0xAAAA, even, _mm512_slli_epi64(odd, 32));
+    return _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(even, 32), odd);
+}
+
+// 每次四组16个计数器, 最后不足四组时多算的丢弃
+static void avx512_dropout_mask(uint64_t seed, long first_group, long groups, uint32_t threshold,
+                                uint16_t* mask) {
+    const __m512i m0 = _mm512_set1_epi32((int)PHILOX_M0);
+    const __m512i m1 = _mm512_set1_epi32((int)PHILOX_M1);
+    const __m512i t = _mm512_set1_epi32((int)threshold);
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    for (long g = 0; g < groups; g += 4) {
+        uint64_t base = (uint64_t)(first_group + g) * 4;
+        // 16个计数器的低32位可能跨过2^32, 各通道分别加上进位
+        __m512i lo = _mm512_add_epi32(_mm512_set1_epi32((int)(uint32_t)base), lanes);
+        __mmask16 carry = _mm512_cmplt_epu32_mask(lo, _mm512_set1_epi32((int)(uint32_t)base));
+        __m512i c[4] = {
+            lo,
+            _mm512_mask_add_epi32(_mm512_set1_epi32((int)(uint32_t)(base >> 32)), carry,
+                                  _mm512_set1_epi32((int)(uint32_t)(base >> 32)), _mm512_set1_epi32(1)),
+            _mm512_setzero_si512(),
+            _mm512_setzero_si512(),
+        };
+        uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+        for (int r = 0; r < PHILOX_ROUNDS; r++) {
+            __m512i lo0, lo1;
+            __m512i hi0 = avx512_mulhilo(c[0], m0, &lo0);
+            __m512i hi1 = avx512_mulhilo(c[2], m1, &lo1);
+            c[0] = _mm512_ternarylogic_epi32(hi1, c[1], _mm512_set1_epi32((int)k0), 0x96);
+            c[1] = lo1;
+            c[2] = _mm512_ternarylogic_epi32(hi0, c[3], _mm512_set1_epi32((int)k1), 0x96);
+            c[3] = lo0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        // 第w个输出的16位中第q个4位属于第g + q组的第4 * w到4 * w + 3个元素
+        uint16_t bits[4] = {0, 0, 0, 0};
+        for (int w = 0; w < 4; w++) {
+            unsigned keep = _mm512_cmpge_epu32_mask(c[w], t);
+            for (int q = 0; q < 4; q++) {
+                bits[q] |= (uint16_t)(((keep >> (4 * q)) & 0xF) << (4 * w));
+            }
+        }
+        for (int q = 0; q < 4 && g + q < groups; q++) {
+            mask[g + q] = bits[q];
+        }
+    }
+}
+
+static void avx512_dropout_apply(const float* in, const uint16_t* mask, float* out, size_t n, float scale) {
+    const __m512 s = _mm512_set1_ps(scale);
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 tail = avx512_tail_mask(n - i);
+        __m512 x = _mm512_maskz_loadu_ps(tail, in + i);
+        _mm512_mask_storeu_ps(out + i, tail, _mm512_maskz_mul_ps(mask[i >> 4] & tail, x, s));
+    }
+}
+
+static const SimdKernels avx512_kernels = {
+    .name = "avx512",
+    .gemm_micro = avx512_gemm_micro,
+    .gemm_store = avx512_gemm_store,
+    .softmax_row = avx512_softmax_row,
+    .scale_mask_max_row = avx512_scale_mask_max_row,
+    .exp_sum_row = avx512_exp_sum_row,
+    .layer_norm_row = avx512_layer_norm_row,
+    .rms_norm_row = avx512_rms_norm_row,
+    .add = avx512_add,
+    .relu = avx512_relu,
+    .gelu = avx512_gelu,
+    .scale = avx512_scale,
+    .scale_add = avx512_scale_add,
+    .dropout_mask = avx512_dropout_mask,
+    .dropout_apply = avx512_dropout_apply,
+};
+
+const SimdKernels* simd_kernels_avx512(void) {
+    return &avx512_kernels;
+}
+
+#else
+
+const SimdKernels* simd_kernels_avx512(void) {
+    return NULL;
+}
+
+#endif
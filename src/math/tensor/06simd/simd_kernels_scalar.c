@@ -0,0 +1,227 @@
+#include "simd_kernels.h"
+#include "tensor_gemm.h"
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <stdbool.h>
+
+// 通用C实现, 所有平台可用, 也是其他指令集的参考实现
+
+static void scalar_gemm_micro(int kc, const float* a, const float* b, float* acc) {
+    float c[GEMM_MR][GEMM_NR] = {{0.0f}};
+    for (int p = 0; p < kc; p++) {
+        for (int i = 0; i < GEMM_MR; i++) {
+            float ai = a[i];
+            for (int j = 0; j < GEMM_NR; j++) {
+                c[i][j] += ai * b[j];
+            }
+        }
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+    memcpy(acc, c, sizeof(c));
+}
+
+static float scalar_activate(float x, int activation) {
+    if (activation == GEMM_ACT_RELU) return x > 0.0f ? x : 0.0f;
+    if (activation == GEMM_ACT_GELU || activation == GEMM_ACT_GEGLU) {
+        return x / (1.0f + expf(-x * (GELU_K0 + GELU_K1 * x * x)));
+    }
+    if (activation == GEMM_ACT_SWIGLU) return x / (1.0f + expf(-x));
+    return x;
+}
+
+// 门控激活的一行: out[j] = act(acc[j] + bias[j]) * (acc[w + j] + bias[w + j]), j < w
+static void scalar_gated_row(float* out, const float* acc, const float* bias, int w, int activation) {
+    for (int j = 0; j < w; j++) {
+        float gate = acc[j] + (bias ? bias[j] : 0.0f);
+        float up = acc[w + j] + (bias ? bias[w + j] : 0.0f);
+        out[j] = scalar_activate(gate, activation) * up;
+    }
+}
+
+static void scalar_gemm_store(float* dst, long ldc, const float* acc, int rows, int cols, bool accumulate,
+                              const float* bias, int activation, const float* residual, long ldr) {
+    if (activation >= GEMM_ACT_SWIGLU) {
+        for (int i = 0; i < rows; i++) {
+            scalar_gated_row(dst + i * ldc, acc + i * GEMM_NR, bias, cols / 2, activation);
+        }
+        return;
+    }
+    for (int i = 0; i < rows; i++) {
+        float* d = dst + i * ldc;
+        const float* a = acc + i * GEMM_NR;
+        for (int j = 0; j < cols; j++) {
+            float v = a[j] + (bias ? bias[j] : 0.0f) + (accumulate ? d[j] : 0.0f);
+            v = scalar_activate(v, activation);
+            d[j] = residual ? v + residual[i * ldr + j] : v;
+        }
+    }
+}
+
+static void scalar_softmax_row(const float* in, float* out, int n) {
+    float max_val = -FLT_MAX;
+    for (int j = 0; j < n; j++) {
+        max_val = fmaxf(max_val, in[j]);
+    }
+    float sum = 0.0f;
+    for (int j = 0; j < n; j++) {
+        out[j] = expf(in[j] - max_val);
+        sum += out[j];
+    }
+    float inv_sum = 1.0f / sum;
+    for (int j = 0; j < n; j++) {
+        out[j] *= inv_sum;
+    }
+}
+
+static float scalar_scale_mask_max_row(const float* in, float* out, int n, float scale,
+                                       const float* mask, float masked_value) {
+    float max_val = -FLT_MAX;
+    for (int j = 0; j < n; j++) {
+        out[j] = mask && mask[j] == 0.0f ? masked_value : scale * in[j];
+        max_val = fmaxf(max_val, out[j]);
+    }
+    return max_val;
+}
+
+static float scalar_exp_sum_row(float* x, int n, float max) {
+    float sum = 0.0f;
+    for (int j = 0; j < n; j++) {
+        x[j] = expf(x[j] - max);
+        sum += x[j];
+    }
+    return sum;
+}
+
+// Welford: 逐个更新均值和偏差平方和, 一次遍历且没有E[x^2] - E[x]^2的相消误差
+static void scalar_layer_norm_row(const float* x, const float* residual, float* sum, float* out,
+                                  const float* gamma, const float* beta, int n, float eps,
+                                  float* mean_out, float* rstd_out) {
+    float mean = 0.0f, m2 = 0.0f;
+    for (int h = 0; h < n; h++) {
+        float v = residual ? x[h] + residual[h] : x[h];
+        if (sum) sum[h] = v;
+        float delta = v - mean;
+        mean += delta / (h + 1);
+        m2 += delta * (v - mean);
+    }
+    float rstd = 1.0f / sqrtf(m2 / n + eps);
+    if (mean_out) *mean_out = mean;
+    if (rstd_out) *rstd_out = rstd;
+
+    const float* s = sum ? sum : x;
+    bool add = residual && !sum;
+    for (int h = 0; h < n; h++) {
+        float v = add ? s[h] + residual[h] : s[h];
+        out[h] = gamma[h] * (v - mean) * rstd + beta[h];
+    }
+}
+
+static void scalar_rms_norm_row(const float* x, const float* residual, float* sum, float* out,
+                                const float* gamma, int n, float eps, float* rstd_out) {
+    float sum_sq = 0.0f;
+    for (int h = 0; h < n; h++) {
+        float v = residual ? x[h] + residual[h] : x[h];
+        if (sum) sum[h] = v;
+        sum_sq += v * v;
+    }
+    float rstd = 1.0f / sqrtf(sum_sq / n + eps);
+    if (rstd_out) *rstd_out = rstd;
+
+    const float* s = sum ? sum : x;
+    bool add = residual && !sum;
+    for (int h = 0; h < n; h++) {
+        float v = add ? s[h] + residual[h] : s[h];
+        out[h] = gamma[h] * v * rstd;
+    }
+}
+
+static void scalar_add(const float* a, const float* b, float* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = a[i] + b[i];
+    }
+}
+
+static void scalar_relu(const float* in, float* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = in[i] > 0.0f ? in[i] : 0.0f;
+    }
+}
+
+static void scalar_gelu(const float* in, float* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = scalar_activate(in[i], GEMM_ACT_GELU);
+    }
+}
+
+static void scalar_scale(const float* in, float* out, float alpha, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = alpha * in[i];
+    }
+}
+
+static void scalar_scale_add(const float* x, float alpha, const float* y, float* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = alpha * x[i] + y[i];
+    }
+}
+
+static void scalar_philox(uint32_t c[4], uint32_t k0, uint32_t k1) {
+    for (int r = 0; r < PHILOX_ROUNDS; r++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c[0];
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c[2];
+        uint32_t c0 = (uint32_t)(p1 >> 32) ^ c[1] ^ k0;
+        uint32_t c2 = (uint32_t)(p0 >> 32) ^ c[3] ^ k1;
+        c[0] = c0;
+        c[1] = (uint32_t)p1;
+        c[2] = c2;
+        c[3] = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+}
+
+static void scalar_dropout_mask(uint64_t seed, long first_group, long groups, uint32_t threshold,
+                                uint16_t* mask) {
+    for (long g = 0; g < groups; g++) {
+        uint16_t bits = 0;
+        for (int l = 0; l < 4; l++) {
+            uint64_t counter = (uint64_t)(first_group + g) * 4 + l;
+            uint32_t c[4] = {(uint32_t)counter, (uint32_t)(counter >> 32), 0, 0};
+            scalar_philox(c, (uint32_t)seed, (uint32_t)(seed >> 32));
+            for (int w = 0; w < 4; w++) {
+                if (c[w] >= threshold) bits |= (uint16_t)(1u << (4 * w + l));
+            }
+        }
+        mask[g] = bits;
+    }
+}
+
+static void scalar_dropout_apply(const float* in, const uint16_t* mask, float* out, size_t n, float scale) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (mask[i >> 4] >> (i & 15)) & 1 ? in[i] * scale : 0.0f;
+    }
+}
+
+static const SimdKernels scalar_kernels = {
+    .name = "scalar",
+    .gemm_micro = scalar_gemm_micro,
+    .gemm_store = scalar_gemm_store,
+    .softmax_row = scalar_softmax_row,
+    .scale_mask_max_row = scalar_scale_mask_max_row,
+    .exp_sum_row = scalar_exp_sum_row,
+    .layer_norm_row = scalar_layer_norm_row,
+    .rms_norm_row = scalar_rms_norm_row,
+    .add = scalar_add,
+    .relu = scalar_relu,
+    .gelu = scalar_gelu,
+    .scale = scalar_scale,
+    .scale_add = scalar_scale_add,
+    .dropout_mask = scalar_dropout_mask,
+    .dropout_apply = scalar_dropout_apply,
+};
+
+const SimdKernels* simd_kernels_scalar(void) {
+    return &scalar_kernels;
+}
@@ -0,0 +1,458 @@
+#include "simd_kernels.h"
+#include "tensor_gemm.h"
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC target("sse4.1")
+#include <immintrin.h>
+#include <math.h>
+#include <float.h>
+#include <stdbool.h>
+
+// SSE4.1实现: 128位寄存器, 没有FMA
+
+static inline float sse4_hsum(__m128 v) {
+    __m128 shuf = _mm_movehdup_ps(v);
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+static inline float sse4_hmax(__m128 v) {
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(v);
+}
+
+// 多项式近似exp, 与AVX2版本相同的系数, 没有FMA时用乘加代替; 低于下限的输入结果为0
+static inline __m128 sse4_exp(__m128 x) {
+    __m128 underflow = _mm_cmplt_ps(x, _mm_set1_ps(-87.3365447504019f));
+    x = _mm_min_ps(x, _mm_set1_ps(88.3762626647949f));
+    x = _mm_max_ps(x, _mm_set1_ps(-87.3365447504019f));
+
+    __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+    fx = _mm_floor_ps(fx);
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(0.693359375f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(-2.12194440e-4f)));
+
+    __m128 y = _mm_set1_ps(1.9875691500E-4f);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507E-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073E-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894E-2f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459E-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201E-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(x, x)), _mm_add_ps(x, _mm_set1_ps(1.0f)));
+
+    __m128i n = _mm_cvttps_epi32(fx);
+    n = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+    return _mm_andnot_ps(underflow, _mm_mul_ps(y, _mm_castsi128_ps(n)));
+}
+
+// x * sigmoid(x * (K0 + K1 * x^2)), 见GELU_K0
+static inline __m128 sse4_gelu_ps(__m128 x) {
+    __m128 z = _mm_mul_ps(x, _mm_add_ps(_mm_set1_ps(GELU_K0),
+                                        _mm_mul_ps(_mm_set1_ps(GELU_K1), _mm_mul_ps(x, x))));
+    __m128 e = sse4_exp(_mm_sub_ps(_mm_setzero_ps(), z));
+    return _mm_div_ps(x, _mm_add_ps(_mm_set1_ps(1.0f), e));
+}
+
+// x * sigmoid(x)
+static inline __m128 sse4_silu_ps(__m128 x) {
+    __m128 e = sse4_exp(_mm_sub_ps(_mm_setzero_ps(), x));
+    return _mm_div_ps(x, _mm_add_ps(_mm_set1_ps(1.0f), e));
+}
+
+static inline __m128 sse4_activate(__m128 v, int activation) {
+    if (activation == GEMM_ACT_RELU) return _mm_max_ps(v, _mm_setzero_ps());
+    if (activation == GEMM_ACT_GELU || activation == GEMM_ACT_GEGLU) return sse4_gelu_ps(v);
+    if (activation == GEMM_ACT_SWIGLU) return sse4_silu_ps(v);
+    return v;
+}
+
+static inline float sse4_activate_ss(float x, int activation) {
+    if (activation == GEMM_ACT_RELU) return x > 0.0f ? x : 0.0f;
+    if (activation == GEMM_ACT_GELU || activation == GEMM_ACT_GEGLU) {
+        return x / (1.0f + expf(-x * (GELU_K0 + GELU_K1 * x * x)));
+    }
+    if (activation == GEMM_ACT_SWIGLU) return x / (1.0f + expf(-x));
+    return x;
+}
+
+// 6x16微块分成两个6x8的半块计算, 每个半块12个累加寄存器
+static void sse4_gemm_micro(int kc, const float* a, const float* b, float* acc) {
+    for (int half = 0; half < GEMM_NR; half += 8) {
+        __m128 c[GEMM_MR][2];
+        for (int i = 0; i < GEMM_MR; i++) {
+            c[i][0] = _mm_setzero_ps();
+            c[i][1] = _mm_setzero_ps();
+        }
+        const float* pa = a;
+        const float* pb = b + half;
+        for (int p = 0; p < kc; p++) {
+            __m128 b0 = _mm_load_ps(pb);
+            __m128 b1 = _mm_load_ps(pb + 4);
+            for (int i = 0; i < GEMM_MR; i++) {
+                __m128 ai = _mm_set1_ps(pa[i]);
+                c[i][0] = _mm_add_ps(c[i][0], _mm_mul_ps(ai, b0));
+                c[i][1] = _mm_add_ps(c[i][1], _mm_mul_ps(ai, b1));
+            }
+            pa += GEMM_MR;
+            pb += GEMM_NR;
+        }
+        for (int i = 0; i < GEMM_MR; i++) {
+            _mm_storeu_ps(acc + i * GEMM_NR + half, c[i][0]);
+            _mm_storeu_ps(acc + i * GEMM_NR + half + 4, c[i][1]);
+        }
+    }
+}
+
+// 门控激活: 每行w列gate和w列up, 每4列一个向量
+static void sse4_gemm_store_gated(float* dst, long ldc, const float* acc, int rows, int w,
+                                  const float* bias, int activation) {
+    int vec_cols = w & ~3;
+    for (int i = 0; i < rows; i++) {
+        float* d = dst + i * ldc;
+        const float* a = acc + i * GEMM_NR;
+        for (int j = 0; j < vec_cols; j += 4) {
+            __m128 gate = _mm_loadu_ps(a + j);
+            __m128 up = _mm_loadu_ps(a + w + j);
+            if (bias) {
+                gate = _mm_add_ps(gate, _mm_loadu_ps(bias + j));
+                up = _mm_add_ps(up, _mm_loadu_ps(bias + w + j));
+            }
+            _mm_storeu_ps(d + j, _mm_mul_ps(sse4_activate(gate, activation), up));
+        }
+        for (int j = vec_cols; j < w; j++) {
+            float gate = a[j] + (bias ? bias[j] : 0.0f);
+            float up = a[w + j] + (bias ? bias[w + j] : 0.0f);
+            d[j] = sse4_activate_ss(gate, activation) * up;
+        }
+    }
+}
+
+// 每4列一个向量, 不足4列的部分逐个处理
+static void sse4_gemm_store(float* dst, long ldc, const float* acc, int rows, int cols, bool accumulate,
+                            const float* bias, int activation, const float* residual, long ldr) {
+    if (activation >= GEMM_ACT_SWIGLU) {
+        sse4_gemm_store_gated(dst, ldc, acc, rows, cols / 2, bias, activation);
+        return;
+    }
+    int vec_cols = cols & ~3;
+    for (int i = 0; i < rows; i++) {
+        float* d = dst + i * ldc;
+        const float* a = acc + i * GEMM_NR;
+        const float* r = residual ? residual + i * ldr : NULL;
+        for (int j = 0; j < vec_cols; j += 4) {
+            __m128 v = _mm_loadu_ps(a + j);
+            if (bias) v = _mm_add_ps(v, _mm_loadu_ps(bias + j));
+            if (accumulate) v = _mm_add_ps(v, _mm_loadu_ps(d + j));
+            v = sse4_activate(v, activation);
+            if (r) v = _mm_add_ps(v, _mm_loadu_ps(r + j));
+            _mm_storeu_ps(d + j, v);
+        }
+        for (int j = vec_cols; j < cols; j++) {
+            float v = a[j] + (bias ? bias[j] : 0.0f) + (accumulate ? d[j] : 0.0f);
+            v = sse4_activate_ss(v, activation);
+            d[j] = r ? v + r[j] : v;
+        }
+    }
+}
+
+static void sse4_softmax_row(const float* in, float* out, int n) {
+    int j = 0;
+    __m128 vmax = _mm_set1_ps(-FLT_MAX);
+    for (; j + 4 <= n; j += 4) {
+        vmax = _mm_max_ps(vmax, _mm_loadu_ps(in + j));
+    }
+    float max_val = sse4_hmax(vmax);
+    for (; j < n; j++) {
+        max_val = fmaxf(max_val, in[j]);
+    }
+
+    __m128 vm = _mm_set1_ps(max_val);
+    __m128 vsum = _mm_setzero_ps();
+    for (j = 0; j + 4 <= n; j += 4) {
+        __m128 e = sse4_exp(_mm_sub_ps(_mm_loadu_ps(in + j), vm));
+        _mm_storeu_ps(out + j, e);
+        vsum = _mm_add_ps(vsum, e);
+    }
+    float sum = sse4_hsum(vsum);
+    for (; j < n; j++) {
+        out[j] = expf(in[j] - max_val);
+        sum += out[j];
+    }
+
+    __m128 vinv = _mm_set1_ps(1.0f / sum);
+    for (j = 0; j + 4 <= n; j += 4) {
+        _mm_storeu_ps(out + j, _mm_mul_ps(_mm_loadu_ps(out + j), vinv));
+    }
+    for (; j < n; j++) {
+        out[j] /= sum;
+    }
+}
+
+static float sse4_scale_mask_max_row(const float* in, float* out, int n, float scale,
+                                     const float* mask, float masked_value) {
+    __m128 vs = _mm_set1_ps(scale);
+    __m128 vmasked = _mm_set1_ps(masked_value);
+    __m128 zero = _mm_setzero_ps();
+    __m128 vmax = _mm_set1_ps(-FLT_MAX);
+    int j = 0;
+    for (; j + 4 <= n; j += 4) {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(in + j), vs);
+        if (mask) {
+            x = _mm_blendv_ps(x, vmasked, _mm_cmpeq_ps(_mm_loadu_ps(mask + j), zero));
+        }
+        _mm_storeu_ps(out + j, x);
+        vmax = _mm_max_ps(vmax, x);
+    }
+    float max_val = sse4_hmax(vmax);
+    for (; j < n; j++) {
+        out[j] = mask && mask[j] == 0.0f ? masked_value : scale * in[j];
+        max_val = fmaxf(max_val, out[j]);
+    }
+    return max_val;
+}
+
+static float sse4_exp_sum_row(float* x, int n, float max) {
+    __m128 vm = _mm_set1_ps(max);
+    __m128 vsum = _mm_setzero_ps();
+    int j = 0;
+    for (; j + 4 <= n; j += 4) {
+        __m128 e = sse4_exp(_mm_sub_ps(_mm_loadu_ps(x + j), vm));
+        _mm_storeu_ps(x + j, e);
+        vsum = _mm_add_ps(vsum, e);
+    }
+    float sum = sse4_hsum(vsum);
+    for (; j < n; j++) {
+        x[j] = expf(x[j] - max);
+        sum += x[j];
+    }
+    return sum;
+}
+
+// 每个通道各自做Welford更新, 一次遍历得到均值和方差
+static void sse4_layer_norm_row(const float* x, const float* residual, float* sum, float* out,
+                                const float* gamma, const float* beta, int n, float eps,
+                                float* mean_out, float* rstd_out) {
+    __m128 vmean = _mm_setzero_ps();
+    __m128 vm2 = _mm_setzero_ps();
+    int h = 0, count = 0;
+    for (; h + 4 <= n; h += 4) {
+        __m128 v = _mm_loadu_ps(x + h);
+        if (residual) v = _mm_add_ps(v, _mm_loadu_ps(residual + h));
+        if (sum) _mm_storeu_ps(sum + h, v);
+        count++;
+        __m128 delta = _mm_sub_ps(v, vmean);
+        vmean = _mm_add_ps(vmean, _mm_mul_ps(delta, _mm_set1_ps(1.0f / count)));
+        vm2 = _mm_add_ps(vm2, _mm_mul_ps(delta, _mm_sub_ps(v, vmean)));
+    }
+    float lane_mean[4], lane_m2[4];
+    _mm_storeu_ps(lane_mean, vmean);
+    _mm_storeu_ps(lane_m2, vm2);
+    // 各通道的计数相同, 按Chan的公式合并, 尾部元素再逐个并入
+    float mean = 0.0f, m2 = 0.0f;
+    if (count > 0) {
+        for (int l = 0; l < 4; l++) mean += lane_mean[l];
+        mean /= 4;
+        for (int l = 0; l < 4; l++) {
+            float d = lane_mean[l] - mean;
+            m2 += lane_m2[l] + count * d * d;
+        }
+    }
+    int total = 4 * count;
+    for (; h < n; h++) {
+        float v = residual ? x[h] + residual[h] : x[h];
+        if (sum) sum[h] = v;
+        total++;
+        float delta = v - mean;
+        mean += delta / total;
+        m2 += delta * (v - mean);
+    }
+    float rstd = 1.0f / sqrtf(m2 / n + eps);
+    if (mean_out) *mean_out = mean;
+    if (rstd_out) *rstd_out = rstd;
+
+    // 归一化: 写出了和时直接读和, 否则重新相加
+    const float* s = sum ? sum : x;
+    bool add = residual && !sum;
+
+    __m128 vmu = _mm_set1_ps(mean);
+    __m128 vrstd = _mm_set1_ps(rstd);
+    for (h = 0; h + 4 <= n; h += 4) {
+        __m128 v = _mm_loadu_ps(s + h);
+        if (add) v = _mm_add_ps(v, _mm_loadu_ps(residual + h));
+        __m128 y = _mm_mul_ps(_mm_sub_ps(v, vmu), vrstd);
+        _mm_storeu_ps(out + h, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(gamma + h), y), _mm_loadu_ps(beta + h)));
+    }
+    for (; h < n; h++) {
+        float v = add ? s[h] + residual[h] : s[h];
+        out[h] = gamma[h] * (v - mean) * rstd + beta[h];
+    }
+}
+
+static void sse4_rms_norm_row(const float* x, const float* residual, float* sum, float* out,
+                              const float* gamma, int n, float eps, float* rstd_out) {
+    __m128 vsq = _mm_setzero_ps();
+    int h = 0;
+    for (; h + 4 <= n; h += 4) {
+        __m128 v = _mm_loadu_ps(x + h);
+        if (residual) v = _mm_add_ps(v, _mm_loadu_ps(residual + h));
+        if (sum) _mm_storeu_ps(sum + h, v);
+        vsq = _mm_add_ps(vsq, _mm_mul_ps(v, v));
+    }
+    float sum_sq = sse4_hsum(vsq);
+    for (; h < n; h++) {
+        float v = residual ? x[h] + residual[h] : x[h];
+        if (sum) sum[h] = v;
+        sum_sq += v * v;
+    }
+    float rstd = 1.0f / sqrtf(sum_sq / n + eps);
+    if (rstd_out) *rstd_out = rstd;
+
+    const float* s = sum ? sum : x;
+    bool add = residual && !sum;
+    __m128 vrstd = _mm_set1_ps(rstd);
+    for (h = 0; h + 4 <= n; h += 4) {
+        __m128 v = _mm_loadu_ps(s + h);
+        if (add) v = _mm_add_ps(v, _mm_loadu_ps(residual + h));
+        _mm_storeu_ps(out + h, _mm_mul_ps(_mm_loadu_ps(gamma + h), _mm_mul_ps(v, vrstd)));
+    }
+    for (; h < n; h++) {
+        float v = add ? s[h] + residual[h] : s[h];
+        out[h] = gamma[h] * v * rstd;
+    }
+}
+
+static void sse4_add(const float* a, const float* b, float* out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    for (; i < n; i++) out[i] = a[i] + b[i];
+}
+
+static void sse4_relu(const float* in, float* out, size_t n) {
+    size_t i = 0;
+    __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(out + i, _mm_max_ps(_mm_loadu_ps(in + i), zero));
+    }
+    for (; i < n; i++) out[i] = in[i] > 0.0f ? in[i] : 0.0f;
+}
+
+static void sse4_gelu(const float* in, float* out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(out + i, sse4_gelu_ps(_mm_loadu_ps(in + i)));
+    }
+    for (; i < n; i++) {
+        out[i] = sse4_activate_ss(in[i], GEMM_ACT_GELU);
+    }
+}
+
+static void sse4_scale(const float* in, float* out, float alpha, size_t n) {
+    size_t i = 0;
+    __m128 va = _mm_set1_ps(alpha);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), va));
+    }
+    for (; i < n; i++) out[i] = alpha * in[i];
+}
+
+static void sse4_scale_add(const float* x, float alpha, const float* y, float* out, size_t n) {
+    size_t i = 0;
+    __m128 va = _mm_set1_ps(alpha);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + i), va), _mm_loadu_ps(y + i)));
+    }
+    for (; i < n; i++) out[i] = alpha * x[i] + y[i];
+}
+
+// 4个通道的32x32位乘法, 返回高32位, 低32位写入lo
+static inline __m128i sse4_mulhilo(__m128i a, __m128i m, __m128i* lo) {
+    __m128i even = _mm_mul_epu32(a, m);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), m);
+    *lo = _mm_blend_epi16(even, _mm_slli_epi64(odd, 32), 0xCC);
+    return _mm_blend_epi16(_mm_srli_epi64(even, 32), odd, 0xCC);
+}
+
+// 一组的4个计数器正好是一个寄存器
+static void sse4_dropout_mask(uint64_t seed, long first_group, long groups, uint32_t threshold,
+                              uint16_t* mask) {
+    const __m128i m0 = _mm_set1_epi32((int)PHILOX_M0);
+    const __m128i m1 = _mm_set1_epi32((int)PHILOX_M1);
+    const __m128i t = _mm_set1_epi32((int)threshold);
+    for (long g = 0; g < groups; g++) {
+        uint64_t base = (uint64_t)(first_group + g) * 4;
+        __m128i c[4] = {
+            _mm_add_epi32(_mm_set1_epi32((int)(uint32_t)base), _mm_setr_epi32(0, 1, 2, 3)),
+            _mm_set1_epi32((int)(uint32_t)(base >> 32)),
+            _mm_setzero_si128(),
+            _mm_setzero_si128(),
+        };
+        uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+        for (int r = 0; r < PHILOX_ROUNDS; r++) {
+            __m128i lo0, lo1;
+            __m128i hi0 = sse4_mulhilo(c[0], m0, &lo0);
+            __m128i hi1 = sse4_mulhilo(c[2], m1, &lo1);
+            c[0] = _mm_xor_si128(_mm_xor_si128(hi1, c[1]), _mm_set1_epi32((int)k0));
+            c[1] = lo1;
+            c[2] = _mm_xor_si128(_mm_xor_si128(hi0, c[3]), _mm_set1_epi32((int)k1));
+            c[3] = lo0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        int bits = 0;
+        for (int w = 0; w < 4; w++) {
+            __m128i keep = _mm_cmpeq_epi32(_mm_max_epu32(c[w], t), c[w]);
+            bits |= _mm_movemask_ps(_mm_castsi128_ps(keep)) << (4 * w);
+        }
+        mask[g] = (uint16_t)bits;
+    }
+}
+
+static void sse4_dropout_apply(const float* in, const uint16_t* mask, float* out, size_t n, float scale) {
+    const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+    const __m128 s = _mm_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int nibble = (mask[i >> 4] >> (i & 15)) & 0xF;
+        __m128i keep = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(nibble), lane_bits), lane_bits);
+        _mm_storeu_ps(out + i, _mm_and_ps(_mm_mul_ps(_mm_loadu_ps(in + i), s), _mm_castsi128_ps(keep)));
+    }
+    for (; i < n; i++) {
+        out[i] = (mask[i >> 4] >> (i & 15)) & 1 ? in[i] * scale : 0.0f;
+    }
+}
+
+static const SimdKernels sse4_kernels = {
+    .name = "sse4",
+    .gemm_micro = sse4_gemm_micro,
+    .gemm_store = sse4_gemm_store,
+    .softmax_row = sse4_softmax_row,
+    .scale_mask_max_row = sse4_scale_mask_max_row,
+    .exp_sum_row = sse4_exp_sum_row,
+    .layer_norm_row = sse4_layer_norm_row,
+    .rms_norm_row = sse4_rms_norm_row,
+    .add = sse4_add,
+    .relu = sse4_relu,
+    .gelu = sse4_gelu,
+    .scale = sse4_scale,
+    .scale_add = sse4_scale_add,
+    .dropout_mask = sse4_dropout_mask,
+    .dropout_apply = sse4_dropout_apply,
+};
+
+const SimdKernels* simd_kernels_sse4(void) {
+    return &sse4_kernels;
+}
+
+#else
+
+const SimdKernels* simd_kernels_sse4(void) {
+    return NULL;
+}
+
+#endif
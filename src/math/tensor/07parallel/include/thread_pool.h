@@ -0,0 +1,31 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdbool.h>
+
+// 一维区间任务: 处理[begin, end)
+typedef void (*ParallelRangeFn)(void* ctx, long begin, long end);
+
+// 二维分块任务: 处理行[row_begin, row_end) x 列[col_begin, col_end)
+typedef void (*ParallelTileFn)(void* ctx, int row_begin, int row_end, int col_begin, int col_end);
+
+// 初始化全局线程池
+// num_threads: 总线程数(包括调用线程), <=0时读取TRANSFORMER_NUM_THREADS, 否则使用全部在线核心
+// pin_threads: 是否把工作线程绑定到固定核心, 也可通过TRANSFORMER_PIN_THREADS=1开启
+// 第一次调用parallel_for时会自动以默认参数初始化
+bool thread_pool_init(int num_threads, bool pin_threads);
+
+// 停止并回收所有工作线程
+void thread_pool_shutdown(void);
+
+// 线程池的总线程数
+int thread_pool_num_threads(void);
+
+// 把[0, n)切成不小于grain的块并行执行, 在工作线程内嵌套调用时串行执行
+void parallel_for(long n, long grain, ParallelRangeFn fn, void* ctx);
+
+// 把rows x cols的二维区域切成tile_rows x tile_cols的块并行执行
+void parallel_for_2d(int rows, int cols, int tile_rows, int tile_cols,
+                     ParallelTileFn fn, void* ctx);
+
+#endif // THREAD_POOL_H
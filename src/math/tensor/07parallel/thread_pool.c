@@ -0,0 +1,359 @@
+#define _GNU_SOURCE
+#include "thread_pool.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// 一次parallel_for调用对应一个job, 被切成若干task分发到各线程的双端队列
+typedef struct ParallelJob {
+    ParallelRangeFn range_fn;
+    ParallelTileFn tile_fn;
+    void* ctx;
+    long n;             // 一维: 总长度
+    long chunk;         // 一维: 每个task的长度
+    int rows, cols;     // 二维: 区域大小
+    int tile_rows, tile_cols;
+    int tiles_per_row;
+    atomic_long remaining;  // 尚未完成的task数
+} ParallelJob;
+
+typedef struct {
+    ParallelJob* job;
+    long index;
+} PoolTask;
+
+// 每个线程一个双端队列: 自己从bottom取, 其他线程从top偷
+typedef struct {
+    pthread_mutex_t lock;
+    PoolTask* tasks;
+    long capacity;
+    long top;
+    long bottom;
+} WorkDeque;
+
+typedef struct {
+    int num_threads;            // 总线程数, 下标0是提交任务的调用线程
+    bool pin_threads;
+    bool running;
+    pthread_t* workers;         // num_threads - 1个后台线程
+    WorkDeque* deques;          // num_threads个队列
+
+    pthread_mutex_t lock;       // 保护generation和shutdown
+    pthread_cond_t wake;
+    unsigned long generation;   // 每提交一个job加一, 唤醒工作线程
+    bool shutdown;
+
+    pthread_mutex_t done_lock;
+    pthread_cond_t done;
+
+    pthread_mutex_t submit_lock;  // 同一时刻只执行一个job
+} ThreadPool;
+
+static ThreadPool g_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done_lock = PTHREAD_MUTEX_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .submit_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static pthread_once_t g_pool_once = PTHREAD_ONCE_INIT;
+
+// 当前线程正在执行池内任务时为true, 嵌套的parallel_for直接串行执行
+static _Thread_local bool tls_in_pool = false;
+
+static bool deque_push(WorkDeque* dq, PoolTask task) {
+    if (dq->bottom == dq->capacity) {
+        long new_capacity = dq->capacity ? dq->capacity * 2 : 64;
+        PoolTask* tasks = (PoolTask*)realloc(dq->tasks, new_capacity * sizeof(PoolTask));
+        if (!tasks) return false;
+        dq->tasks = tasks;
+        dq->capacity = new_capacity;
+    }
+    dq->tasks[dq->bottom++] = task;
+    return true;
+}
+
+static bool deque_pop(WorkDeque* dq, PoolTask* task) {
+    bool found = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom > dq->top) {
+        *task = dq->tasks[--dq->bottom];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static bool deque_steal(WorkDeque* dq, PoolTask* task) {
+    bool found = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom > dq->top) {
+        *task = dq->tasks[dq->top++];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static void execute_task(PoolTask task) {
+    ParallelJob* job = task.job;
+    if (job->range_fn) {
+        long begin = task.index * job->chunk;
+        long end = begin + job->chunk < job->n ? begin + job->chunk : job->n;
+        job->range_fn(job->ctx, begin, end);
+    } else {
+        int tr = (int)(task.index / job->tiles_per_row);
+        int tc = (int)(task.index % job->tiles_per_row);
+        int row_begin = tr * job->tile_rows;
+        int col_begin = tc * job->tile_cols;
+        int row_end = row_begin + job->tile_rows < job->rows ? row_begin + job->tile_rows : job->rows;
+        int col_end = col_begin + job->tile_cols < job->cols ? col_begin + job->tile_cols : job->cols;
+        job->tile_fn(job->ctx, row_begin, row_end, col_begin, col_end);
+    }
+
+    // 最后一个task完成时通知提交线程
+    if (atomic_fetch_sub(&job->remaining, 1) == 1) {
+        pthread_mutex_lock(&g_pool.done_lock);
+        pthread_cond_broadcast(&g_pool.done);
+        pthread_mutex_unlock(&g_pool.done_lock);
+    }
+}
+
+// 先处理自己的队列, 空了以后依次从其他线程的队列顶部偷任务
+static void run_tasks(int self) {
+    PoolTask task;
+    bool was_in_pool = tls_in_pool;
+    tls_in_pool = true;
+    for (;;) {
+        if (deque_pop(&g_pool.deques[self], &task)) {
+            execute_task(task);
+            continue;
+        }
+        bool stolen = false;
+        for (int i = 1; i < g_pool.num_threads && !stolen; i++) {
+            int victim = (self + i) % g_pool.num_threads;
+            stolen = deque_steal(&g_pool.deques[victim], &task);
+        }
+        if (!stolen) break;
+        execute_task(task);
+    }
+    tls_in_pool = was_in_pool;
+}
+
+static void pin_current_thread(int index) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus <= 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % num_cpus, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "Failed to pin worker %d to a core\n", index);
+    }
+}
+
+static void* worker_main(void* arg) {
+    int self = (int)(intptr_t)arg;
+    if (g_pool.pin_threads) {
+        pin_current_thread(self);
+    }
+
+    unsigned long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&g_pool.lock);
+        while (!g_pool.shutdown && g_pool.generation == seen) {
+            pthread_cond_wait(&g_pool.wake, &g_pool.lock);
+        }
+        if (g_pool.shutdown) {
+            pthread_mutex_unlock(&g_pool.lock);
+            break;
+        }
+        seen = g_pool.generation;
+        pthread_mutex_unlock(&g_pool.lock);
+
+        run_tasks(self);
+    }
+    return NULL;
+}
+
+bool thread_pool_init(int num_threads, bool pin_threads) {
+    thread_pool_shutdown();
+
+    if (num_threads <= 0) {
+        const char* env = getenv("TRANSFORMER_NUM_THREADS");
+        num_threads = env ? atoi(env) : 0;
+    }
+    if (num_threads <= 0) {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = num_cpus > 0 ? (int)num_cpus : 1;
+    }
+    const char* pin_env = getenv("TRANSFORMER_PIN_THREADS");
+    if (pin_env && strcmp(pin_env, "1") == 0) {
+        pin_threads = true;
+    }
+
+    g_pool.deques = (WorkDeque*)calloc(num_threads, sizeof(WorkDeque));
+    g_pool.workers = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+    if (!g_pool.deques || !g_pool.workers) {
+        fprintf(stderr, "Failed to allocate thread pool\n");
+        free(g_pool.deques);
+        free(g_pool.workers);
+        g_pool.deques = NULL;
+        g_pool.workers = NULL;
+        return false;
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_mutex_init(&g_pool.deques[i].lock, NULL);
+    }
+
+    g_pool.num_threads = num_threads;
+    g_pool.pin_threads = pin_threads;
+    g_pool.shutdown = false;
+    g_pool.generation = 0;
+    g_pool.running = true;
+
+    int started = 1;
+    while (started < num_threads &&
+           pthread_create(&g_pool.workers[started], NULL, worker_main, (void*)(intptr_t)started) == 0) {
+        started++;
+    }
+    if (started < num_threads) {
+        fprintf(stderr, "Failed to start worker thread %d\n", started);
+        // 已经启动的线程保留, 只是线程数变少; 多出的队列不再使用, 先销毁它们的锁
+        // 还没有提交任务, 已启动的线程都在等待wake, 不会访问这些队列
+        for (int i = started; i < num_threads; i++) {
+            pthread_mutex_destroy(&g_pool.deques[i].lock);
+        }
+        g_pool.num_threads = started;
+    }
+    return true;
+}
+
+void thread_pool_shutdown(void) {
+    if (!g_pool.running) return;
+
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.shutdown = true;
+    pthread_cond_broadcast(&g_pool.wake);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    for (int i = 1; i < g_pool.num_threads; i++) {
+        pthread_join(g_pool.workers[i], NULL);
+    }
+    for (int i = 0; i < g_pool.num_threads; i++) {
+        pthread_mutex_destroy(&g_pool.deques[i].lock);
+        free(g_pool.deques[i].tasks);
+    }
+    free(g_pool.deques);
+    free(g_pool.workers);
+    g_pool.deques = NULL;
+    g_pool.workers = NULL;
+    g_pool.num_threads = 0;
+    g_pool.running = false;
+}
+
+static void thread_pool_default_init(void) {
+    if (!g_pool.running) {
+        thread_pool_init(0, false);
+    }
+}
+
+int thread_pool_num_threads(void) {
+    pthread_once(&g_pool_once, thread_pool_default_init);
+    return g_pool.num_threads > 0 ? g_pool.num_threads : 1;
+}
+
+// 把job的task按连续块分给各个队列, 唤醒工作线程, 调用线程也参与执行
+static void submit_job(ParallelJob* job, long num_tasks) {
+    pthread_mutex_lock(&g_pool.submit_lock);
+
+    int num_threads = g_pool.num_threads;
+    long per_thread = (num_tasks + num_threads - 1) / num_threads;
+    atomic_store(&job->remaining, num_tasks);
+
+    for (int t = 0; t < num_threads; t++) {
+        WorkDeque* dq = &g_pool.deques[t];
+        pthread_mutex_lock(&dq->lock);
+        dq->top = dq->bottom = 0;
+        // 逆序入队, 让owner从bottom弹出时按顺序访问内存
+        long begin = t * per_thread;
+        long end = begin + per_thread < num_tasks ? begin + per_thread : num_tasks;
+        for (long i = end - 1; i >= begin; i--) {
+            PoolTask task = {job, i};
+            if (!deque_push(dq, task)) {
+                // 无法入队时直接在提交线程执行
+                pthread_mutex_unlock(&dq->lock);
+                execute_task(task);
+                pthread_mutex_lock(&dq->lock);
+            }
+        }
+        pthread_mutex_unlock(&dq->lock);
+    }
+
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.generation++;
+    pthread_cond_broadcast(&g_pool.wake);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    run_tasks(0);
+
+    pthread_mutex_lock(&g_pool.done_lock);
+    while (atomic_load(&job->remaining) > 0) {
+        pthread_cond_wait(&g_pool.done, &g_pool.done_lock);
+    }
+    pthread_mutex_unlock(&g_pool.done_lock);
+
+    pthread_mutex_unlock(&g_pool.submit_lock);
+}
+
+void parallel_for(long n, long grain, ParallelRangeFn fn, void* ctx) {
+    if (n <= 0) return;
+    if (grain < 1) grain = 1;
+
+    int num_threads = thread_pool_num_threads();
+    if (num_threads == 1 || tls_in_pool || n <= grain) {
+        fn(ctx, 0, n);
+        return;
+    }
+
+    // 每个线程约4个task, 给偷取留出余地
+    long chunk = (n + num_threads * 4 - 1) / (num_threads * 4);
+    if (chunk < grain) chunk = grain;
+
+    ParallelJob job = {0};
+    job.range_fn = fn;
+    job.ctx = ctx;
+    job.n = n;
+    job.chunk = chunk;
+    submit_job(&job, (n + chunk - 1) / chunk);
+}
+
+void parallel_for_2d(int rows, int cols, int tile_rows, int tile_cols,
+                     ParallelTileFn fn, void* ctx) {
+    if (rows <= 0 || cols <= 0) return;
+    if (tile_rows < 1) tile_rows = 1;
+    if (tile_cols < 1) tile_cols = 1;
+
+    int tiles_per_row = (cols + tile_cols - 1) / tile_cols;
+    long num_tasks = (long)((rows + tile_rows - 1) / tile_rows) * tiles_per_row;
+
+    int num_threads = thread_pool_num_threads();
+    if (num_threads == 1 || tls_in_pool || num_tasks == 1) {
+        fn(ctx, 0, rows, 0, cols);
+        return;
+    }
+
+    ParallelJob job = {0};
+    job.tile_fn = fn;
+    job.ctx = ctx;
+    job.rows = rows;
+    job.cols = cols;
+    job.tile_rows = tile_rows;
+    job.tile_cols = tile_cols;
+    job.tiles_per_row = tiles_per_row;
+    submit_job(&job, num_tasks);
+}
@@ -3,6 +3,37 @@
 
 #include <stdbool.h>
 
+// 归一化层的类型
+typedef enum {
+    NORM_LAYER_NORM,    // gamma * (x - mean) / sqrt(var + eps) + beta
+    NORM_RMS_NORM       // gamma * x / sqrt(mean(x^2) + eps), 不减均值, 没有beta
+} NormType;
+
+// 前馈网络中间层的激活函数
+typedef enum {
+    FFN_ACT_RELU,
+    FFN_ACT_GELU,       // tanh近似
+    // 门控变体: hidden = act(x * W_gate) * (x * W_up), gate和up的权重拼接后一次GEMM算出
+    FFN_ACT_SWIGLU,     // act = silu
+    FFN_ACT_GEGLU       // act = gelu
+} FfnActivation;
+
+// 编码器/解码器层的结构, 创建模型时选定
+typedef struct {
+    NormType norm_type;
+    bool pre_norm;      // true: x + Sublayer(Norm(x)), 编码器和解码器最后各加一个归一化层
+                        // false: Norm(x + Sublayer(x)), 即原始Transformer的post-norm
+    FfnActivation ffn_activation;
+
+    // 混合专家前馈层, num_experts为0时使用稠密前馈网络
+    int num_experts;
+    int moe_top_k;              // 每个token使用的专家数
+    float moe_capacity_factor;  // 专家容量 = ceil(factor * tokens * top_k / num_experts), <= 0时不限制
+} LayerOptions;
+
+// 默认的层结构: post-norm LayerNorm
+extern const LayerOptions LAYER_OPTIONS_DEFAULT;
+
 typedef struct ModelConfig {
     int batch_size;      // 批处理大小
     int max_seq_length;  // 最大序列长度
@@ -12,6 +43,7 @@ typedef struct ModelConfig {
     int num_heads;       // 注意力头数量
     float dropout_prob;  // dropout概率
     bool is_training;    // 是否处于训练模式
+    LayerOptions layer_options;  // 层结构, 传给transformer_create
 } ModelConfig;
 
 // 全局配置实例
@@ -1,6 +1,15 @@
 #include "model_config.h"
 #include <stdbool.h>
 
+const LayerOptions LAYER_OPTIONS_DEFAULT = {
+    .norm_type = NORM_LAYER_NORM,
+    .pre_norm = false,
+    .ffn_activation = FFN_ACT_RELU,
+    .num_experts = 0,
+    .moe_top_k = 2,
+    .moe_capacity_factor = 1.25f,
+};
+
 // 定义全局配置实例
 ModelConfig g_model_config = {0};  // 初始化为0
 
@@ -21,4 +30,5 @@ void init_model_config(
     g_model_config.num_heads = num_heads;
     g_model_config.dropout_prob = dropout_prob;
     g_model_config.is_training = true;  // 默认为训练模式
+    g_model_config.layer_options = LAYER_OPTIONS_DEFAULT;
 }
\ No newline at end of file